@@ -3,11 +3,20 @@
 #define STB_IMAGE_IMPLEMENTATION
 
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <random>
 #include <stdexcept>
 #include <vector>
 
 #include <string>
 
+#include "vulkan-geometry-codec.h"
+#include "vulkan-mesh-analyzer.h"
 #include "vulkan-renderer.h"
 
 GLFWwindow *window = nullptr;
@@ -30,18 +39,840 @@ void clean()
     glfwTerminate();
 }
 
-int main()
+// Decode every file of textures/ with an increasing number of threads and print the throughput
+int benchmarkTextureDecoding()
 {
+    std::vector<std::string> filenames;
+    for (const auto &entry : std::filesystem::directory_iterator("textures"))
+    {
+        filenames.push_back(entry.path().filename().string());
+    }
+
+    size_t maxThreadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2)
+    {
+        ThreadPool threadPool(threadCount);
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        std::vector<std::future<TextureData>> decodedTextures;
+        for (const auto &filename : filenames)
+        {
+            decodedTextures.push_back(
+                threadPool.submit([filename]() { return VulkanRenderer::decodeTextureFile(filename); }));
+        }
+        double decodedBytes = 0.0;
+        for (auto &decodedTexture : decodedTextures)
+        {
+            decodedBytes += decodedTexture.get().imageSize;
+        }
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(endTime - startTime).count();
+        printf("%2zu threads: %zu textures in %7.2f ms, %7.1f MB/s decoded\n", threadCount, filenames.size(),
+               seconds * 1000.0, decodedBytes / (1024.0 * 1024.0) / seconds);
+    }
+    return EXIT_SUCCESS;
+}
+
+// Import a model as the renderer does, then print the meshlets its back face cones reject from cameras orbiting it
+int benchmarkMeshletCulling(const std::string &filename)
+{
+    Assimp::Importer importer;
+    const aiScene *scene =
+        importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+    if (!scene)
+    {
+        printf("Failed to load mesh model: %s\n", filename.c_str());
+        return EXIT_FAILURE;
+    }
+    ThreadPool threadPool;
+    SceneGraph sceneGraph;
+    std::vector<MeshData> meshes = VulkanMeshModel::loadNode(scene->mRootNode, scene, threadPool, sceneGraph);
+
+    glm::vec3 boundsMin(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+    std::vector<std::vector<Meshlet>> meshlets(meshes.size());
+    size_t meshletCount = 0;
+    size_t triangleCount = 0;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        MeshOptimizer::optimizeMesh(meshes[i]);
+        meshlets[i] = MeshletBuilder::buildMeshlets(meshes[i].vertices, meshes[i].indices.data(),
+                                                    meshes[i].indices.size());
+        boundsMin = glm::min(boundsMin, meshes[i].boundsMin);
+        boundsMax = glm::max(boundsMax, meshes[i].boundsMax);
+        meshletCount += meshlets[i].size();
+        triangleCount += meshes[i].indices.size() / 3;
+    }
+    printf("%s: %zu triangles in %zu meshlets\n", filename.c_str(), triangleCount, meshletCount);
+
+    // Around the vertical axis, then from above and below
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    float distance = glm::length(boundsMax - boundsMin) * 1.5f;
+    std::vector<std::pair<std::string, glm::vec3>> views;
+    for (int angle = 0; angle < 360; angle += 45)
+    {
+        float radians = glm::radians(static_cast<float>(angle));
+        views.push_back({"yaw " + std::to_string(angle), glm::vec3(std::sin(radians), 0.0f, std::cos(radians))});
+    }
+    views.push_back({"top", glm::vec3(0.0f, 1.0f, 0.0f)});
+    views.push_back({"bottom", glm::vec3(0.0f, -1.0f, 0.0f)});
+    for (const auto &view : views)
+    {
+        glm::vec3 cameraPosition = center + view.second * distance;
+        size_t culledMeshlets = 0;
+        size_t culledTriangles = 0;
+        for (const auto &meshMeshlets : meshlets)
+        {
+            for (const auto &meshlet : meshMeshlets)
+            {
+                if (MeshletBuilder::isBackfacing(meshlet, cameraPosition))
+                {
+                    culledMeshlets++;
+                    culledTriangles += meshlet.triangleCount;
+                }
+            }
+        }
+        printf("%-8s: %5zu meshlets culled (%5.1f%%), %7zu triangles (%5.1f%%)\n", view.first.c_str(),
+               culledMeshlets, 100.0 * culledMeshlets / std::max<size_t>(meshletCount, 1), culledTriangles,
+               100.0 * culledTriangles / std::max<size_t>(triangleCount, 1));
+    }
+    return EXIT_SUCCESS;
+}
+
+// Build a random hierarchy of nodeCount nodes, then time the world transform updates for typical edits against
+// recomputing every node
+int benchmarkSceneGraph(size_t nodeCount)
+{
+    // Fixed seed, so runs compare the same tree. Each node hangs below the previous one or one of its ancestors,
+    // going up one level on average: the depth wanders around the square root of the node count.
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> angles(-1.0f, 1.0f);
+    auto randomTransform = [&]() {
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(angles(random), angles(random), 1.0f));
+        return glm::rotate(transform, angles(random), glm::vec3(0.0f, 1.0f, 0.0f));
+    };
+    SceneGraph sceneGraph;
+    sceneGraph.reserve(nodeCount);
+    std::vector<uint32_t> path;
+    for (size_t i = 0; i < nodeCount; ++i)
+    {
+        while (path.size() > 1 && random() % 2 == 0)
+        {
+            path.pop_back();
+        }
+        path.push_back(sceneGraph.addNode(path.empty() ? SceneGraph::NO_PARENT : path.back(), randomTransform()));
+    }
+    printf("%zu nodes, last branch %zu deep\n", nodeCount, path.size());
+
+    const int repeatCount = 20;
+    auto measure = [&](const char *name, auto &&edit, auto &&update) {
+        double milliseconds = 0.0;
+        size_t updatedCount = 0;
+        for (int repeat = 0; repeat < repeatCount; ++repeat)
+        {
+            edit();
+            auto startTime = std::chrono::high_resolution_clock::now();
+            updatedCount = update();
+            auto endTime = std::chrono::high_resolution_clock::now();
+            milliseconds += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+        }
+        printf("%-22s: %9.4f ms, %8zu nodes recomputed\n", name, milliseconds / repeatCount, updatedCount);
+    };
+    auto updateAll = [&]() {
+        sceneGraph.updateAllWorldTransforms();
+        return sceneGraph.getNodeCount();
+    };
+    auto updateDirty = [&]() { return sceneGraph.updateWorldTransforms(); };
+    auto moveNode = [&](uint32_t node) { sceneGraph.setLocalTransform(node, randomTransform()); };
+    std::uniform_int_distribution<uint32_t> anyNode(0, static_cast<uint32_t>(nodeCount - 1));
+
+    measure("full recompute", []() {}, updateAll);
+    measure("1% of nodes moved", [&]() {
+        for (size_t i = 0; i < nodeCount / 100; ++i)
+        {
+            moveNode(anyNode(random));
+        }
+    }, updateDirty);
+    measure("one leaf moved", [&]() { moveNode(path.back()); }, updateDirty);
+    measure("root moved", [&]() { moveNode(0); }, updateDirty);
+    measure("nothing moved", []() {}, updateDirty);
+    return EXIT_SUCCESS;
+}
+
+// Write a grid of sizeMB megabytes of textured quads, split in a few objects and materials like exported files
+static void writeSyntheticObj(const std::string &filename, size_t sizeMB)
+{
+    // About 120 bytes of position, texture coordinates and face per grid vertex
+    size_t side = static_cast<size_t>(std::sqrt(sizeMB * 1024.0 * 1024.0 / 120.0)) + 2;
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    char line[128];
+    for (size_t y = 0; y < side; ++y)
+    {
+        for (size_t x = 0; x < side; ++x)
+        {
+            float height = std::sin(x * 0.05f) * std::cos(y * 0.05f);
+            file.write(line, snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", x * 0.1f, height, y * 0.1f));
+            file.write(line, snprintf(line, sizeof(line), "vt %.6f %.6f\n", float(x) / side, float(y) / side));
+        }
+    }
+    for (size_t y = 0; y + 1 < side; ++y)
+    {
+        if (y % (side / 4 + 1) == 0)
+        {
+            file << "o rows" << y << "\nusemtl material" << y % 3 << "\n";
+        }
+        for (size_t x = 0; x + 1 < side; ++x)
+        {
+            size_t corner = y * side + x + 1;
+            file.write(line, snprintf(line, sizeof(line), "f %zu/%zu %zu/%zu %zu/%zu %zu/%zu\n", corner, corner,
+                                      corner + 1, corner + 1, corner + side + 1, corner + side + 1, corner + side,
+                                      corner + side));
+        }
+    }
+}
+
+// Parse throughput of the native OBJ reader against Assimp, both producing our vertex and index arrays.
+// Runs on the given file, then on a synthetic one of syntheticSizeMB megabytes.
+int benchmarkObjImport(const std::string &filename, size_t syntheticSizeMB)
+{
+    std::string syntheticFilename = (std::filesystem::temp_directory_path() / "vulkan-bench-synthetic.obj").string();
+    writeSyntheticObj(syntheticFilename, syntheticSizeMB);
+
+    ThreadPool threadPool;
+    for (const auto &benchmarkFile : {filename, syntheticFilename})
+    {
+        double megabytes = std::filesystem::file_size(benchmarkFile) / (1024.0 * 1024.0);
+        printf("%s: %.1f MB\n", benchmarkFile.c_str(), megabytes);
+
+        // Best of a few runs, the first one also warms up the page cache
+        const int runCount = 3;
+        double assimpSeconds = std::numeric_limits<double>::max();
+        double nativeSeconds = std::numeric_limits<double>::max();
+        size_t assimpVertices = 0;
+        size_t nativeVertices = 0;
+        for (int run = 0; run < runCount; ++run)
+        {
+            auto startTime = std::chrono::high_resolution_clock::now();
+            Assimp::Importer importer;
+            const aiScene *scene = importer.ReadFile(
+                benchmarkFile, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+            if (!scene)
+            {
+                printf("Failed to load mesh model: %s\n", benchmarkFile.c_str());
+                return EXIT_FAILURE;
+            }
+            SceneGraph sceneGraph;
+            std::vector<MeshData> meshes = VulkanMeshModel::loadNode(scene->mRootNode, scene, threadPool, sceneGraph);
+            auto endTime = std::chrono::high_resolution_clock::now();
+            assimpSeconds = std::min(assimpSeconds, std::chrono::duration<double>(endTime - startTime).count());
+            assimpVertices = 0;
+            for (const auto &mesh : meshes)
+            {
+                assimpVertices += mesh.vertices.size();
+            }
+
+            startTime = std::chrono::high_resolution_clock::now();
+            ObjModel objModel = ObjLoader::load(benchmarkFile, threadPool);
+            endTime = std::chrono::high_resolution_clock::now();
+            nativeSeconds = std::min(nativeSeconds, std::chrono::duration<double>(endTime - startTime).count());
+            nativeVertices = 0;
+            for (const auto &mesh : objModel.meshes)
+            {
+                nativeVertices += mesh.vertices.size();
+            }
+        }
+        printf("  Assimp    : %8.2f ms, %7.1f MB/s, %zu vertices\n", assimpSeconds * 1000.0, megabytes / assimpSeconds,
+               assimpVertices);
+        printf("  ObjLoader : %8.2f ms, %7.1f MB/s, %zu vertices (%zu threads, %.1fx)\n", nativeSeconds * 1000.0,
+               megabytes / nativeSeconds, nativeVertices, threadPool.getThreadCount(), assimpSeconds / nativeSeconds);
+    }
+    std::filesystem::remove(syntheticFilename);
+    return EXIT_SUCCESS;
+}
+
+// Import and optimize a model as the renderer does before baking, then print the GeometryCodec compression ratio
+// and decode throughput of its vertices and indices
+int benchmarkGeometryCodec(const std::string &filename)
+{
+    Assimp::Importer importer;
+    const aiScene *scene =
+        importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+    if (!scene)
+    {
+        printf("Failed to load mesh model: %s\n", filename.c_str());
+        return EXIT_FAILURE;
+    }
+    ThreadPool threadPool;
+    SceneGraph sceneGraph;
+    std::vector<MeshData> meshes = VulkanMeshModel::loadNode(scene->mRootNode, scene, threadPool, sceneGraph);
+
+    std::vector<std::vector<uint8_t>> encodedVertices(meshes.size());
+    std::vector<std::vector<uint8_t>> encodedIndices(meshes.size());
+    double vertexBytes = 0.0;
+    double indexBytes = 0.0;
+    double encodedVertexBytes = 0.0;
+    double encodedIndexBytes = 0.0;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        MeshOptimizer::optimizeMesh(meshes[i]);
+    }
+    auto endTime = std::chrono::high_resolution_clock::now();
+    double optimizeSeconds = std::chrono::duration<double>(endTime - startTime).count();
+    startTime = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        encodedVertices[i] = GeometryCodec::encodeVertices(meshes[i].vertices.data(), meshes[i].vertices.size());
+        encodedIndices[i] = GeometryCodec::encodeIndices(meshes[i].indices.data(), meshes[i].indices.size());
+        vertexBytes += meshes[i].vertices.size() * sizeof(Vertex);
+        indexBytes += meshes[i].indices.size() * sizeof(uint32_t);
+        encodedVertexBytes += encodedVertices[i].size();
+        encodedIndexBytes += encodedIndices[i].size();
+    }
+    endTime = std::chrono::high_resolution_clock::now();
+    double encodeSeconds = std::chrono::duration<double>(endTime - startTime).count();
+    printf("%s: %zu meshes, optimized in %.2f ms, encoded in %.2f ms\n", filename.c_str(), meshes.size(),
+           optimizeSeconds * 1000.0, encodeSeconds * 1000.0);
+
+    // Decoded repeatedly into the same arrays, as into staging, best run kept
+    std::vector<MeshData> decodedMeshes(meshes.size());
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        decodedMeshes[i].vertices.resize(meshes[i].vertices.size());
+        decodedMeshes[i].indices.resize(meshes[i].indices.size());
+    }
+    const int runCount = 10;
+    double vertexSeconds = std::numeric_limits<double>::max();
+    double indexSeconds = std::numeric_limits<double>::max();
+    bool isDecoded = true;
+    for (int run = 0; run < runCount; ++run)
+    {
+        startTime = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < meshes.size(); ++i)
+        {
+            isDecoded = GeometryCodec::decodeVertices(decodedMeshes[i].vertices.data(), meshes[i].vertices.size(),
+                                                      encodedVertices[i].data(), encodedVertices[i].size()) &&
+                        isDecoded;
+        }
+        endTime = std::chrono::high_resolution_clock::now();
+        vertexSeconds = std::min(vertexSeconds, std::chrono::duration<double>(endTime - startTime).count());
+
+        startTime = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < meshes.size(); ++i)
+        {
+            isDecoded = GeometryCodec::decodeIndices(decodedMeshes[i].indices.data(), meshes[i].indices.size(),
+                                                     meshes[i].vertices.size(), encodedIndices[i].data(),
+                                                     encodedIndices[i].size()) &&
+                        isDecoded;
+        }
+        endTime = std::chrono::high_resolution_clock::now();
+        indexSeconds = std::min(indexSeconds, std::chrono::duration<double>(endTime - startTime).count());
+    }
+
+    if (!isDecoded)
+    {
+        printf("Failed to decode the encoded geometry\n");
+        return EXIT_FAILURE;
+    }
+
+    double megabyte = 1024.0 * 1024.0;
+    printf("  vertices: %8.2f MB -> %8.2f MB (%.2fx), decoded at %6.2f GB/s\n", vertexBytes / megabyte,
+           encodedVertexBytes / megabyte, vertexBytes / std::max(encodedVertexBytes, 1.0),
+           vertexBytes / vertexSeconds / (megabyte * 1024.0));
+    printf("  indices : %8.2f MB -> %8.2f MB (%.2fx), decoded at %6.2f GB/s\n", indexBytes / megabyte,
+           encodedIndexBytes / megabyte, indexBytes / std::max(encodedIndexBytes, 1.0),
+           indexBytes / indexSeconds / (megabyte * 1024.0));
+    return EXIT_SUCCESS;
+}
+
+// Time a frame of skinning for instanceCount copies of an animated model: palettes only, as the renderer does, against
+// skinning the vertices on the CPU
+int benchmarkSkinning(const std::string &filename, size_t instanceCount)
+{
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs |
+                                                           aiProcess_JoinIdenticalVertices |
+                                                           aiProcess_LimitBoneWeights);
+    if (!scene)
+    {
+        printf("Failed to load mesh model: %s\n", filename.c_str());
+        return EXIT_FAILURE;
+    }
+    SceneGraph sceneGraph;
+    std::vector<aiMesh *> sceneMeshes;
+    std::vector<uint32_t> meshNodes;
+    VulkanMeshModel::collectNodeMeshes(scene->mRootNode, scene, SceneGraph::NO_PARENT, sceneGraph, sceneMeshes,
+                                       meshNodes);
+    std::vector<MeshData> meshes(sceneMeshes.size());
+    std::vector<std::vector<VertexSkin>> meshSkins(sceneMeshes.size());
+    std::vector<Skin> skins(sceneMeshes.size());
+    size_t vertexCount = 0;
+    size_t jointCount = 0;
+    for (size_t i = 0; i < sceneMeshes.size(); ++i)
+    {
+        meshes[i] = VulkanMeshModel::loadMesh(sceneMeshes[i], scene);
+        VulkanMeshModel::loadMeshSkin(sceneMeshes[i], meshNodes[i], sceneGraph, meshSkins[i], skins[i]);
+        vertexCount += meshes[i].vertices.size();
+        jointCount += skins[i].jointNodes.size();
+    }
+    Skeleton skeleton(sceneGraph);
+    std::vector<AnimationClip> clips = VulkanMeshModel::loadAnimations(scene, sceneGraph);
+    const AnimationClip *clip = clips.empty() ? nullptr : &clips[0];
+    printf("%s: %zu meshes, %zu vertices, %zu joints, %zu nodes, %zu clips, %zu copies\n", filename.c_str(),
+           meshes.size(), vertexCount, jointCount, skeleton.getNodeCount(), clips.size(), instanceCount);
+
+    // What the renderer does every frame for each copy, each at its own time, against skinning the vertices on the
+    // CPU too, the skinned vertices then having to be uploaded instead of the palettes. Skinned vertices go to a
+    // scratch per thread, a whole frame of them would not fit in memory for large crowds.
+    ThreadPool threadPool;
+    struct SkinningScratch
+    {
+        std::vector<glm::mat4> nodeTransforms;
+        std::vector<Vertex> skinnedVertices;
+    };
+    std::vector<SkinningScratch> scratches(threadPool.getThreadCount() + 1);
+    for (auto &scratch : scratches)
+    {
+        scratch.nodeTransforms.resize(skeleton.getNodeCount());
+        scratch.skinnedVertices.resize(vertexCount);
+    }
+    std::vector<glm::mat4> palettes(instanceCount * jointCount);
+    const int repeatCount = 10;
+    auto measure = [&](const char *name, bool skinOnCpu, size_t threadCount) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        for (int repeat = 0; repeat < repeatCount; ++repeat)
+        {
+            auto skinCopy = [&](size_t copy, SkinningScratch &scratch) {
+                skeleton.evaluate(clip, repeat * 0.016f + copy * 0.1f, scratch.nodeTransforms.data());
+                glm::mat4 *palette = palettes.data() + copy * jointCount;
+                Vertex *output = scratch.skinnedVertices.data();
+                for (size_t i = 0; i < meshes.size(); ++i)
+                {
+                    Skeleton::computePalette(skins[i], scratch.nodeTransforms.data(), palette);
+                    if (skinOnCpu)
+                    {
+                        Skeleton::skinVertices(meshes[i].vertices.data(), meshSkins[i].data(),
+                                               meshes[i].vertices.size(), palette, output);
+                    }
+                    palette += skins[i].jointNodes.size();
+                    output += meshes[i].vertices.size();
+                }
+            };
+            if (threadCount == 1)
+            {
+                for (size_t copy = 0; copy < instanceCount; ++copy)
+                {
+                    skinCopy(copy, scratches[0]);
+                }
+                continue;
+            }
+            // A slice of copies per thread, each with its own scratch
+            threadPool.parallelFor(threadCount, [&](size_t slice) {
+                for (size_t copy = slice; copy < instanceCount; copy += threadCount)
+                {
+                    skinCopy(copy, scratches[slice]);
+                }
+            });
+        }
+        auto endTime = std::chrono::high_resolution_clock::now();
+        double milliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count() / repeatCount;
+        double uploadBytes = skinOnCpu ? instanceCount * vertexCount * sizeof(Vertex)
+                                       : instanceCount * jointCount * sizeof(glm::mat4);
+        printf("  %-34s: %9.3f ms per frame, %8.2f MB uploaded per frame\n", name, milliseconds,
+               uploadBytes / (1024.0 * 1024.0));
+    };
+    measure("palettes (GPU skinning), 1 thread", false, 1);
+    measure("palettes (GPU skinning), workers", false, threadPool.getThreadCount() + 1);
+    measure("CPU vertex skinning, 1 thread", true, 1);
+    measure("CPU vertex skinning, workers", true, threadPool.getThreadCount() + 1);
+    return EXIT_SUCCESS;
+}
+
+// Sub-allocation of a streamed scene's buffers and textures in DeviceMemoryAllocator sized blocks, on the CPU only:
+// resourceCount live resources, then as many replaced one at a time in random order
+int benchmarkSubAllocation(size_t resourceCount)
+{
+    struct Resource
+    {
+        size_t block;
+        uint32_t node;
+        uint64_t size;
+    };
+    const uint64_t blockSize = DeviceMemoryAllocator::BLOCK_SIZE;
+    std::vector<std::unique_ptr<TlsfAllocator>> blocks;
+    std::vector<Resource> resources;
+    size_t dedicatedCount = 0;
+    std::mt19937 random(1);
+    double allocateNanoseconds = 0.0;
+    double maxAllocateNanoseconds = 0.0;
+    size_t allocateCount = 0;
+
+    // Vertex and index buffers of a few KB to a few MB (256 bytes aligned), textures of up to 16 MB (64 KB aligned)
+    auto allocateResource = [&]() {
+        bool isTexture = random() % 3 == 0;
+        uint64_t size = isTexture ? (uint64_t(64) * 1024) << (random() % 9) : 4096 + random() % (4 * 1024 * 1024);
+        uint64_t alignment = isTexture ? 64 * 1024 : 256;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Resource resource{0, TlsfAllocator::NO_NODE, size};
+        if (size > blockSize / 2)
+        {
+            ++dedicatedCount;
+        }
+        else
+        {
+            uint64_t offset;
+            for (resource.block = 0; resource.block < blocks.size(); ++resource.block)
+            {
+                resource.node = blocks[resource.block]->allocate(size, alignment, &offset);
+                if (resource.node != TlsfAllocator::NO_NODE)
+                {
+                    break;
+                }
+            }
+            if (resource.node == TlsfAllocator::NO_NODE)
+            {
+                blocks.push_back(std::make_unique<TlsfAllocator>(blockSize));
+                resource.node = blocks.back()->allocate(size, alignment, &offset);
+            }
+        }
+        auto endTime = std::chrono::high_resolution_clock::now();
+        double nanoseconds = std::chrono::duration<double, std::nano>(endTime - startTime).count();
+        allocateNanoseconds += nanoseconds;
+        maxAllocateNanoseconds = std::max(maxAllocateNanoseconds, nanoseconds);
+        ++allocateCount;
+        resources.push_back(resource);
+    };
+    auto report = [&](const char *name) {
+        uint64_t freeBytes = 0;
+        uint64_t largestFreeBytes = 0;
+        for (const auto &block : blocks)
+        {
+            freeBytes += block->getFreeBytes();
+            largestFreeBytes += block->getLargestFreeRange();
+        }
+        uint64_t blockBytes = blocks.size() * blockSize;
+        printf("  %-8s: %zu resources in %zu device memories (%zu blocks, %zu dedicated), blocks %.1f%% used, "
+               "fragmentation %.1f%%, allocation %.0f ns average, %.0f ns max\n",
+               name, resources.size(), blocks.size() + dedicatedCount, blocks.size(), dedicatedCount,
+               blockBytes ? 100.0 * (blockBytes - freeBytes) / blockBytes : 0.0,
+               freeBytes ? 100.0 * (1.0 - static_cast<double>(largestFreeBytes) / freeBytes) : 0.0,
+               allocateCount ? allocateNanoseconds / allocateCount : 0.0, maxAllocateNanoseconds);
+    };
+
+    printf("%zu resources, one device memory each without sub-allocation\n", resourceCount);
+    for (size_t i = 0; i < resourceCount; ++i)
+    {
+        allocateResource();
+    }
+    report("loaded");
+    for (size_t i = 0; i < resourceCount; ++i)
+    {
+        size_t index = random() % resources.size();
+        Resource resource = resources[index];
+        resources[index] = resources.back();
+        resources.pop_back();
+        if (resource.node == TlsfAllocator::NO_NODE)
+        {
+            --dedicatedCount;
+        }
+        else
+        {
+            blocks[resource.block]->free(resource.node);
+        }
+        allocateResource();
+    }
+    report("churned");
+    return EXIT_SUCCESS;
+}
+
+// Name as a JSON string, quotes, backslashes and control characters escaped
+static std::string toJsonString(const std::string &value)
+{
+    std::string json = "\"";
+    for (char character : value)
+    {
+        if (character == '"' || character == '\\')
+        {
+            json += '\\';
+            json += character;
+        }
+        else if (static_cast<unsigned char>(character) < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+            json += escaped;
+        }
+        else
+        {
+            json += character;
+        }
+    }
+    return json + "\"";
+}
+
+// Statistics of a mesh, or of a whole model, as the members of a JSON object
+static void printMeshAnalysis(const MeshAnalysis &analysis, const char *indent)
+{
+    printf("%s\"vertexCount\": %zu,\n", indent, analysis.vertexCount);
+    printf("%s\"indexCount\": %zu,\n", indent, analysis.indexCount);
+    printf("%s\"vertexCache\": [", indent);
+    for (size_t i = 0; i < std::size(MeshAnalyzer::CACHE_SIZES); ++i)
+    {
+        printf("%s{\"cacheSize\": %u, \"acmr\": %.4f, \"atvr\": %.4f}", i > 0 ? ", " : "",
+               MeshAnalyzer::CACHE_SIZES[i], analysis.vertexCache[i].getACMR(), analysis.vertexCache[i].getATVR());
+    }
+    printf("],\n");
+    printf("%s\"overdraw\": {\"average\": %.4f, \"max\": %.4f},\n", indent, analysis.overdraw.getOverdraw(),
+           analysis.maxOverdraw);
+    printf("%s\"vertexFetchOverfetch\": %.4f,\n", indent, analysis.vertexFetch.getOverfetch());
+    printf("%s\"duplicateVertexRatio\": %.4f,\n", indent, analysis.getDuplicateVertexRatio());
+    printf("%s\"bytesPerTriangle\": {\"imported\": %.2f, \"packed\": %.2f}", indent,
+           analysis.getImportedBytesPerTriangle(), analysis.getPackedBytesPerTriangle());
+}
+
+// Import a model the way the renderer does and print, as JSON, how GPU friendly each of its meshes is.
+// Without a GPU: nothing but the import and MeshAnalyzer runs. optimize applies MeshOptimizer first, to compare
+// the source order with what the renderer bakes.
+int analyzeMeshModel(const std::string &filename, bool optimize)
+{
+    Assimp::Importer importer;
+    const aiScene *scene =
+        importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+    if (!scene)
+    {
+        fprintf(stderr, "Failed to load mesh model: %s\n", filename.c_str());
+        return EXIT_FAILURE;
+    }
+    ThreadPool threadPool;
+    SceneGraph sceneGraph;
+    std::vector<MeshData> meshes = VulkanMeshModel::loadNode(scene->mRootNode, scene, threadPool, sceneGraph);
+    // Joined vertices leave no duplicates to count: they are counted in the source, imported again without
+    // aiProcess_JoinIdenticalVertices, which keeps the meshes and their order
+    Assimp::Importer sourceImporter;
+    const aiScene *sourceScene = sourceImporter.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs);
+    SceneGraph sourceSceneGraph;
+    std::vector<MeshData> sourceMeshes;
+    if (sourceScene)
+    {
+        sourceMeshes = VulkanMeshModel::loadNode(sourceScene->mRootNode, sourceScene, threadPool, sourceSceneGraph);
+    }
+    if (sourceMeshes.size() != meshes.size())
+    {
+        fprintf(stderr, "Failed to load the source vertices of: %s\n", filename.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Meshes analyzed in parallel, printed in order
+    std::vector<std::future<MeshAnalysis>> analyses;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        analyses.push_back(threadPool.submit([&mesh = meshes[i], &sourceMesh = sourceMeshes[i], optimize]() {
+            if (optimize)
+            {
+                MeshOptimizer::optimizeMesh(mesh);
+            }
+            MeshAnalysis analysis = MeshAnalyzer::analyzeMesh(mesh.getView());
+            analysis.duplicateVertexCount =
+                MeshAnalyzer::countDuplicateVertices(sourceMesh.vertices.data(), sourceMesh.vertices.size());
+            analysis.sourceVertexCount = sourceMesh.vertices.size();
+            return analysis;
+        }));
+    }
+
+    // Model totals: counts and statistics summed, ratios recomputed from the sums
+    MeshAnalysis total;
+    printf("{\n  \"file\": %s,\n  \"optimized\": %s,\n  \"meshes\": [", toJsonString(filename).c_str(),
+           optimize ? "true" : "false");
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        MeshAnalysis analysis = analyses[i].get();
+        uint32_t node = meshes[i].nodeIndex;
+        printf("%s\n    {\n      \"node\": %s,\n      \"material\": %u,\n", i > 0 ? "," : "",
+               toJsonString(node < sceneGraph.getNodeCount() ? sceneGraph.getName(node) : "").c_str(),
+               meshes[i].materialIndex);
+        printMeshAnalysis(analysis, "      ");
+        printf("\n    }");
+
+        total.vertexCount += analysis.vertexCount;
+        total.indexCount += analysis.indexCount;
+        for (size_t cache = 0; cache < std::size(MeshAnalyzer::CACHE_SIZES); ++cache)
+        {
+            total.vertexCache[cache] += analysis.vertexCache[cache];
+        }
+        total.overdraw += analysis.overdraw;
+        total.maxOverdraw = std::max(total.maxOverdraw, analysis.maxOverdraw);
+        total.vertexFetch += analysis.vertexFetch;
+        total.duplicateVertexCount += analysis.duplicateVertexCount;
+        total.sourceVertexCount += analysis.sourceVertexCount;
+        total.packedBytes += analysis.packedBytes;
+    }
+    printf("\n  ],\n  \"total\": {\n");
+    printMeshAnalysis(total, "    ");
+    printf("\n  }\n}\n");
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    // CPU only tools, no window nor device needed
+    if (argc > 1 && std::string(argv[1]) == "--bench-decode")
+    {
+        return benchmarkTextureDecoding();
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-meshlets")
+    {
+        return benchmarkMeshletCulling(argc > 2 ? argv[2] : "models/Futuristic combat jet.obj");
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-obj")
+    {
+        return benchmarkObjImport(argc > 2 ? argv[2] : "models/Futuristic combat jet.obj",
+                                  argc > 3 ? std::max(1, std::stoi(argv[3])) : 128);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--analyze")
+    {
+        // --analyze [model] [--optimized]
+        bool optimize = argc > 2 && std::string(argv[argc - 1]) == "--optimized";
+        int fileArgument = optimize ? argc - 1 : argc;
+        return analyzeMeshModel(fileArgument > 2 ? argv[2] : "models/Futuristic combat jet.obj", optimize);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-codec")
+    {
+        return benchmarkGeometryCodec(argc > 2 ? argv[2] : "models/Futuristic combat jet.obj");
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-skinning")
+    {
+        return benchmarkSkinning(argc > 2 ? argv[2] : "models/Futuristic combat jet.obj",
+                                 argc > 3 ? std::max(1, std::stoi(argv[3])) : 1000);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-suballocation")
+    {
+        return benchmarkSubAllocation(argc > 2 ? std::max(1, std::stoi(argv[2])) : 10000);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-scene-graph")
+    {
+        return benchmarkSceneGraph(argc > 2 ? std::max(1, std::stoi(argv[2])) : 100000);
+    }
+
     initWindow();
     if (vulkanRenderer.init(window) == EXIT_FAILURE)
         return EXIT_FAILURE;
 
+    // A/B switches for the mesh reordering, the vertex format and the levels of detail, to compare frame times.
+    // --assimp-obj imports OBJ files through Assimp instead of the native reader, --no-mesh-compression bakes raw
+    // vertex and index arrays in the mesh cache.
+    // --import-ceiling (in MB) bounds the host memory of the import, the load report gives the peak RSS reached.
+    // --instances spreads copies of the model over a grid going away from the camera, --static stops the instances
+    // from turning and draws them from static batches, --impostors draws the distant ones as camera-facing quads
+    // (compare the frame times and triangle counts with and without).
+    // --hot-reload picks up edited models and textures without restarting.
+    // --stream loads the model in the background while frames keep being drawn, --upload-budget (in MB) bounding
+    // what each frame uploads: the max frame time of the report shows the hitches left.
+    // --skinned adds an animated model, skinned in a compute pass, with as many copies as --instances, each playing
+    // its first clip out of step with the others.
+    int instanceCount = 1;
+    std::string skinnedModelPath;
+    bool staticInstances = false;
+    bool impostorInstances = false;
+    bool streamModel = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--no-mesh-optimization")
+        {
+            vulkanRenderer.setMeshOptimization(false);
+        }
+        if (std::string(argv[i]) == "--assimp-obj")
+        {
+            vulkanRenderer.setNativeObjImport(false);
+        }
+        if (std::string(argv[i]) == "--no-mesh-compression")
+        {
+            vulkanRenderer.setMeshCacheCompression(false);
+        }
+        if (std::string(argv[i]) == "--import-ceiling" && i + 1 < argc)
+        {
+            vulkanRenderer.setImportMemoryCeiling(static_cast<size_t>(std::stod(argv[++i]) * 1024.0 * 1024.0));
+        }
+        if (std::string(argv[i]) == "--full-vertices")
+        {
+            vulkanRenderer.setMeshVertexFormat(VertexFormat::Full);
+        }
+        if (std::string(argv[i]) == "--no-meshlet-culling")
+        {
+            vulkanRenderer.setMeshletCulling(false);
+        }
+        if (std::string(argv[i]) == "--no-lod")
+        {
+            vulkanRenderer.setMeshLodSelection(false);
+        }
+        if (std::string(argv[i]) == "--lod-count" && i + 1 < argc)
+        {
+            vulkanRenderer.setMeshLodCount(std::stoi(argv[++i]));
+        }
+        if (std::string(argv[i]) == "--instances" && i + 1 < argc)
+        {
+            instanceCount = std::max(1, std::stoi(argv[++i]));
+        }
+        if (std::string(argv[i]) == "--static")
+        {
+            staticInstances = true;
+        }
+        if (std::string(argv[i]) == "--impostors")
+        {
+            impostorInstances = true;
+        }
+        if (std::string(argv[i]) == "--hot-reload")
+        {
+            vulkanRenderer.enableHotReload({"models", "textures"});
+        }
+        if (std::string(argv[i]) == "--stream")
+        {
+            streamModel = true;
+        }
+        if (std::string(argv[i]) == "--skinned" && i + 1 < argc)
+        {
+            skinnedModelPath = argv[++i];
+        }
+        if (std::string(argv[i]) == "--upload-budget" && i + 1 < argc)
+        {
+            vulkanRenderer.setUploadBudget(static_cast<vk::DeviceSize>(std::stod(argv[++i]) * 1024.0 * 1024.0));
+        }
+    }
+
     float angle = 0.0f;
     float deltaTime = 0.0f;
     float lastTime = 0.0f;
+    // Average and worst frame times, printed every few seconds
+    float reportTime = 0.0f;
+    int reportFrames = 0;
+    float maxFrameTime = 0.0f;
+
+    // Load model, instances are created once it is ready
+    const std::string modelPath = "models/Futuristic combat jet.obj";
+    int modelId = streamModel ? vulkanRenderer.createMeshModelAsync(modelPath)
+                              : vulkanRenderer.createMeshModel(modelPath);
+    std::vector<int> modelIds{modelId};
+    bool instancesCreated = false;
+    std::vector<int> skinnedModelIds;
+    if (!skinnedModelPath.empty())
+    {
+        skinnedModelIds.push_back(vulkanRenderer.createSkinnedModel(skinnedModelPath));
+        for (int i = 1; i < instanceCount; ++i)
+        {
+            skinnedModelIds.push_back(vulkanRenderer.createSkinnedModelInstance(skinnedModelIds[0]));
+        }
+    }
+    int gridSide = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(instanceCount))));
+    const float gridSpacing = 4.0f;
+    auto getGridMatrix = [&](size_t i, float rotation) {
+        // Rows centered on x = 0, the first one where the single model used to be
+        float x = (static_cast<float>(i % gridSide) - (gridSide - 1) * 0.5f) * gridSpacing;
+        float z = -1.0f - static_cast<float>(i / gridSide) * gridSpacing;
+        glm::mat4 rotationModelMatrix(1.0f);
 
-    // Load model
-    int modelId = vulkanRenderer.createMeshModel("models/Futuristic combat jet.obj");
+        rotationModelMatrix = glm::translate(rotationModelMatrix, glm::vec3(x, 0.0f, z));
+        return glm::rotate(rotationModelMatrix, glm::radians(rotation), glm::vec3(0.0f, 1.0f, 0.0f));
+    };
     while (!glfwWindowShouldClose(window))
     {
         glfwPollEvents();
@@ -52,17 +883,79 @@ int main()
         lastTime = now;
         angle += 10.0 * deltaTime;
 
+        reportFrames++;
+        maxFrameTime = std::max(maxFrameTime, deltaTime);
+        if (now - reportTime >= 5.0f)
+        {
+            const MeshletCullingStats &cullingStats = vulkanRenderer.getMeshletCullingStats();
+            printf("Frame time: %.3f ms (max %.3f ms), %zu triangles, meshlets: %zu, %zu frustum culled, "
+                   "%zu back face culled, %zu draws, %zu draw calls recorded in %.3f ms, %zu impostors\n",
+                   (now - reportTime) * 1000.0f / reportFrames, maxFrameTime * 1000.0f,
+                   vulkanRenderer.getDrawnTriangleCount(), cullingStats.meshletCount, cullingStats.frustumCulled,
+                   cullingStats.backfaceCulled, cullingStats.drawCount, vulkanRenderer.getDrawCallCount(),
+                   vulkanRenderer.getRecordMilliseconds(), vulkanRenderer.getDrawnImpostorCount());
+            if (!skinnedModelIds.empty())
+            {
+                printf("Skinning: %zu vertices, palettes in %.3f ms, compute pass %.3f ms on the GPU\n",
+                       vulkanRenderer.getSkinnedVertexCount(), vulkanRenderer.getPaletteMilliseconds(),
+                       vulkanRenderer.getSkinningGpuMilliseconds());
+            }
+            DeviceMemoryStats memoryStats = vulkanRenderer.getDeviceMemoryStats();
+            printf("Device memory: %zu buffers and images in %zu device memories (peak %zu, limit %u), %zu blocks "
+                   "%.1f MB %.1f%% used, %.1f MB dedicated, fragmentation %.1f%%, allocation %.2f us average, "
+                   "%.2f us max\n",
+                   memoryStats.allocationCount, memoryStats.deviceMemoryCount, memoryStats.peakDeviceMemoryCount,
+                   memoryStats.maxDeviceMemoryCount, memoryStats.blockCount, memoryStats.blockBytes / (1024.0 * 1024.0),
+                   memoryStats.blockBytes ? 100.0 * memoryStats.usedBlockBytes / memoryStats.blockBytes : 0.0,
+                   memoryStats.dedicatedBytes / (1024.0 * 1024.0), memoryStats.fragmentation * 100.0,
+                   memoryStats.averageAllocateMicroseconds, memoryStats.maxAllocateMicroseconds);
+            reportTime = now;
+            reportFrames = 0;
+            maxFrameTime = 0.0f;
+        }
+
+        if (!instancesCreated && vulkanRenderer.getMeshModelLoadState(modelId) == ModelLoadState::Ready)
+        {
+            // Baked before instancing, so that every instance shares the atlas
+            if (impostorInstances)
+            {
+                vulkanRenderer.createMeshModelImpostor(modelId);
+            }
+            for (int i = 1; i < instanceCount; ++i)
+            {
+                modelIds.push_back(vulkanRenderer.createMeshModelInstance(modelId));
+                if (staticInstances)
+                {
+                    // Placed once, each facing its own way
+                    vulkanRenderer.updateModel(modelIds.back(), getGridMatrix(i, i * 37.0f));
+                    vulkanRenderer.setMeshModelStatic(modelIds.back(), true);
+                }
+            }
+            instancesCreated = true;
+        }
+
         if (angle > 360.0f)
         {
             angle -= 360.0f;
         }
 
-        glm::mat4 rotationModelMatrix(1.0f);
-
-        rotationModelMatrix = glm::translate(rotationModelMatrix, glm::vec3(-0.0f, 0.0f, -1.0f));
-        rotationModelMatrix = glm::rotate(rotationModelMatrix, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+        // Static instances keep their place, only the first model turns
+        for (size_t i = 0; i < (staticInstances ? 1 : modelIds.size()); ++i)
+        {
+            vulkanRenderer.updateModel(modelIds[i], getGridMatrix(i, angle));
+        }
 
-        vulkanRenderer.updateModel(modelId, rotationModelMatrix);
+        // Skinned copies stand in a row in front of the grid
+        int clipIndex = !skinnedModelIds.empty() && vulkanRenderer.getSkinnedModelClipCount(skinnedModelIds[0]) > 0
+                            ? 0
+                            : -1;
+        for (size_t i = 0; i < skinnedModelIds.size(); ++i)
+        {
+            float x = (static_cast<float>(i) - (skinnedModelIds.size() - 1) * 0.5f) * gridSpacing;
+            vulkanRenderer.updateSkinnedModel(skinnedModelIds[i],
+                                              glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, 3.0f)));
+            vulkanRenderer.setSkinnedModelAnimation(skinnedModelIds[i], clipIndex, now + i * 0.1f);
+        }
 
         vulkanRenderer.draw();
     }
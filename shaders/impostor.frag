@@ -0,0 +1,17 @@
+#version 450
+
+layout(location = 0) in vec2 fragTex;
+layout(set = 1, binding = 0) uniform sampler2D atlasSampler;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    // Cells are cleared to transparent around the model, cut out so that depth testing still works
+    vec4 color = texture(atlasSampler, fragTex);
+    if (color.a < 0.5)
+    {
+        discard;
+    }
+    outColor = vec4(color.rgb, 1.0);
+}
@@ -0,0 +1,32 @@
+#version 450
+
+// Per instance, see ImpostorInstance: a quad facing the camera in place of a distant model
+layout(location = 0) in vec4 centerRadius;
+layout(location = 1) in vec4 right;
+layout(location = 2) in vec4 up;
+layout(location = 3) in vec4 cellRect;
+
+// Uniform Buffer Object
+layout(set = 0, binding = 0) uniform ViewProjection
+{
+    mat4 projection;
+    mat4 view;
+}
+viewProjection;
+
+// To fragment shader
+layout(location = 0) out vec2 fragTex;
+
+// Two triangles, no vertex buffer
+const vec2 corners[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, -1.0), vec2(1.0, 1.0),
+                               vec2(-1.0, 1.0));
+
+void main()
+{
+    vec2 corner = corners[gl_VertexIndex];
+    vec3 position = centerRadius.xyz + (corner.x * right.xyz + corner.y * up.xyz) * centerRadius.w;
+    gl_Position = viewProjection.projection * viewProjection.view * vec4(position, 1.0);
+
+    // The top of a cell is the model's up
+    fragTex = cellRect.xy + vec2(0.5 + 0.5 * corner.x, 0.5 - 0.5 * corner.y) * cellRect.zw;
+}
@@ -0,0 +1,39 @@
+#version 450
+
+// From vertex input stage: floats, or normalized 16 bits integers for packed vertices
+layout(location = 0) in vec3 pos;
+layout(location = 2) in vec2 tex;
+// Per instance: the model matrix of one occurrence of a shared geometry, in place of the push constant one
+layout(location = 3) in mat4 instanceModel;
+
+// Uniform Buffer Object
+layout(set = 0, binding = 0) uniform ViewProjection
+{
+    mat4 projection;
+    mat4 view;
+}
+viewProjection;
+
+// Push constant, same layout as shader.vert: the model matrix is not read
+layout(push_constant) uniform PushModel
+{
+    mat4 model;
+    // Dequantization of the mesh, identity for float vertices
+    vec4 positionScale;
+    vec4 positionOffset;
+    vec4 texScaleOffset;
+}
+pushModel;
+
+// To fragment shader
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTex;
+
+void main()
+{
+    vec3 position = pos * pushModel.positionScale.xyz + pushModel.positionOffset.xyz;
+    gl_Position = viewProjection.projection * viewProjection.view * instanceModel * vec4(position, 1.0);
+
+    fragColor = vec3(1.0);
+    fragTex = tex * pushModel.texScaleOffset.xy + pushModel.texScaleOffset.zw;
+}
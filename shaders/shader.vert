@@ -1,8 +1,7 @@
 #version 450
 
-// From vertex input stage
+// From vertex input stage: floats, or normalized 16 bits integers for packed vertices
 layout(location = 0) in vec3 pos;
-layout(location = 1) in vec3 col;
 layout(location = 2) in vec2 tex;
 
 // Uniform Buffer Object
@@ -17,6 +16,10 @@ viewProjection;
 layout(push_constant) uniform PushModel
 {
     mat4 model;
+    // Dequantization of the mesh, identity for float vertices
+    vec4 positionScale;
+    vec4 positionOffset;
+    vec4 texScaleOffset;
 }
 pushModel;
 
@@ -26,10 +29,11 @@ layout(location = 1) out vec2 fragTex;
 
 void main()
 {
+    vec3 position = pos * pushModel.positionScale.xyz + pushModel.positionOffset.xyz;
     gl_Position = viewProjection.projection * viewProjection.view *
 
-                  pushModel.model * vec4(pos, 1.0);
+                  pushModel.model * vec4(position, 1.0);
 
-    fragColor = col;
-    fragTex = tex;
+    fragColor = vec3(1.0);
+    fragTex = tex * pushModel.texScaleOffset.xy + pushModel.texScaleOffset.zw;
 }
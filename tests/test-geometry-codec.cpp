@@ -0,0 +1,215 @@
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#include "test-utilities.h"
+#include "vulkan-geometry-codec.h"
+#include "vulkan-mesh-optimizer.h"
+
+// Vertices come back bit exact
+static bool isVertexRoundTrip(const std::vector<Vertex> &vertices)
+{
+    std::vector<uint8_t> encoded = GeometryCodec::encodeVertices(vertices.data(), vertices.size());
+    std::vector<Vertex> decoded(vertices.size());
+    return GeometryCodec::decodeVertices(decoded.data(), decoded.size(), encoded.data(), encoded.size()) &&
+           (vertices.empty() || memcmp(vertices.data(), decoded.data(), vertices.size() * sizeof(Vertex)) == 0);
+}
+
+// Triangles come back in order, each possibly rotated, through both index widths
+static bool isIndexRoundTrip(const std::vector<uint32_t> &indices, size_t vertexCount)
+{
+    std::vector<uint8_t> encoded = GeometryCodec::encodeIndices(indices.data(), indices.size());
+    std::vector<uint32_t> decoded(indices.size());
+    if (!GeometryCodec::decodeIndices(decoded.data(), decoded.size(), vertexCount, encoded.data(), encoded.size()))
+    {
+        return false;
+    }
+    std::vector<uint16_t> narrowDecoded(indices.size());
+    bool isNarrow = vertexCount <= UINT16_MAX + 1;
+    if (isNarrow && !GeometryCodec::decodeIndices(narrowDecoded.data(), narrowDecoded.size(), vertexCount,
+                                                  encoded.data(), encoded.size()))
+    {
+        return false;
+    }
+    for (size_t triangle = 0; triangle < indices.size(); triangle += 3)
+    {
+        if (!isSameTriangle(&decoded[triangle], &indices[triangle]) ||
+            (isNarrow && !isSameTriangle(&narrowDecoded[triangle], &indices[triangle])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<Vertex> makeRandomVertices(size_t vertexCount, std::mt19937 &random)
+{
+    std::uniform_real_distribution<float> distribution(-100.0f, 100.0f);
+    std::vector<Vertex> vertices(vertexCount);
+    for (Vertex &vertex : vertices)
+    {
+        vertex.pos = glm::vec3(distribution(random), distribution(random), distribution(random));
+        vertex.col = glm::vec3(1.0f);
+        vertex.tex = glm::vec2(distribution(random), distribution(random));
+    }
+    return vertices;
+}
+
+static void testEmpty()
+{
+    CHECK(isVertexRoundTrip({}));
+    CHECK(isIndexRoundTrip({}, 0));
+
+    // Empty streams hold no geometry, not even for a count of zero
+    std::vector<uint8_t> encodedVertices = GeometryCodec::encodeVertices(nullptr, 0);
+    std::vector<uint8_t> encodedIndices = GeometryCodec::encodeIndices(nullptr, 0);
+    Vertex vertex;
+    uint32_t indices[3];
+    CHECK(!GeometryCodec::decodeVertices(&vertex, 1, encodedVertices.data(), encodedVertices.size()));
+    CHECK(!GeometryCodec::decodeIndices(indices, 3, 3, encodedIndices.data(), encodedIndices.size()));
+}
+
+// Counts around the 16 vertices groups and the VERTEX_BLOCK_SIZE blocks
+static void testVertexCounts()
+{
+    std::mt19937 random(1);
+    for (size_t vertexCount : {1, 2, 15, 17, 31, 255, 257, 1000})
+    {
+        CHECK(isVertexRoundTrip(makeRandomVertices(vertexCount, random)));
+    }
+    MeshData grid = makeGrid(37, 23);
+    CHECK(isVertexRoundTrip(grid.vertices));
+    MeshOptimizer::optimizeMesh(grid);
+    CHECK(isVertexRoundTrip(grid.vertices));
+}
+
+static void testIndices()
+{
+    // Shared edges, in the source order and in the optimized one
+    MeshData grid = makeGrid(37, 23);
+    CHECK(isIndexRoundTrip(grid.indices, grid.vertices.size()));
+    MeshOptimizer::optimizeMesh(grid);
+    CHECK(isIndexRoundTrip(grid.indices, grid.vertices.size()));
+
+    // No shared edges and large deltas, past the 16 bits range
+    std::mt19937 random(2);
+    std::uniform_int_distribution<uint32_t> distribution(0, 99999);
+    std::vector<uint32_t> indices(3000);
+    for (uint32_t &index : indices)
+    {
+        index = distribution(random);
+    }
+    CHECK(isIndexRoundTrip(indices, 100000));
+
+    // Degenerate triangles
+    CHECK(isIndexRoundTrip({0, 0, 0, 1, 1, 2, 2, 1, 1}, 3));
+
+    bool isThrown = false;
+    try
+    {
+        GeometryCodec::encodeIndices(indices.data(), 4);
+    }
+    catch (const std::runtime_error &)
+    {
+        isThrown = true;
+    }
+    CHECK(isThrown);
+}
+
+static void testTruncated()
+{
+    std::mt19937 random(3);
+    std::vector<Vertex> vertices = makeRandomVertices(300, random);
+    std::vector<uint8_t> encodedVertices = GeometryCodec::encodeVertices(vertices.data(), vertices.size());
+    MeshData grid = makeGrid(16, 16);
+    std::vector<uint8_t> encodedIndices = GeometryCodec::encodeIndices(grid.indices.data(), grid.indices.size());
+
+    // Every prefix of the streams, the last byte cut to nothing
+    std::vector<Vertex> decodedVertices(vertices.size());
+    for (size_t size = 0; size < encodedVertices.size(); ++size)
+    {
+        CHECK(!GeometryCodec::decodeVertices(decodedVertices.data(), decodedVertices.size(), encodedVertices.data(),
+                                             size));
+    }
+    std::vector<uint32_t> decodedIndices(grid.indices.size());
+    std::vector<uint16_t> narrowDecodedIndices(grid.indices.size());
+    for (size_t size = 0; size < encodedIndices.size(); ++size)
+    {
+        CHECK(!GeometryCodec::decodeIndices(decodedIndices.data(), decodedIndices.size(), grid.vertices.size(),
+                                            encodedIndices.data(), size));
+        CHECK(!GeometryCodec::decodeIndices(narrowDecodedIndices.data(), narrowDecodedIndices.size(),
+                                            grid.vertices.size(), encodedIndices.data(), size));
+    }
+
+    // Streams of the wrong count, by a 16 vertices group: the vertex count is not stored, only its groups are
+    CHECK(!GeometryCodec::decodeVertices(decodedVertices.data(), vertices.size() - 16, encodedVertices.data(),
+                                         encodedVertices.size()));
+    decodedVertices.resize(vertices.size() + 16);
+    CHECK(!GeometryCodec::decodeVertices(decodedVertices.data(), vertices.size() + 16, encodedVertices.data(),
+                                         encodedVertices.size()));
+    CHECK(!GeometryCodec::decodeIndices(decodedIndices.data(), grid.indices.size() - 3, grid.vertices.size(),
+                                        encodedIndices.data(), encodedIndices.size()));
+    // Trailing bytes
+    encodedVertices.push_back(0);
+    encodedIndices.push_back(0);
+    CHECK(!GeometryCodec::decodeVertices(decodedVertices.data(), vertices.size(), encodedVertices.data(),
+                                         encodedVertices.size()));
+    CHECK(!GeometryCodec::decodeIndices(decodedIndices.data(), decodedIndices.size(), grid.vertices.size(),
+                                        encodedIndices.data(), encodedIndices.size()));
+}
+
+static void testCorrupt()
+{
+    MeshData grid = makeGrid(16, 16);
+    std::vector<uint8_t> encodedIndices = GeometryCodec::encodeIndices(grid.indices.data(), grid.indices.size());
+    std::vector<uint32_t> decodedIndices(grid.indices.size());
+    std::vector<uint16_t> narrowDecodedIndices(grid.indices.size());
+
+    // Indices past the vertex count
+    CHECK(!GeometryCodec::decodeIndices(decodedIndices.data(), decodedIndices.size(), grid.vertices.size() - 1,
+                                        encodedIndices.data(), encodedIndices.size()));
+    CHECK(!GeometryCodec::decodeIndices(narrowDecodedIndices.data(), narrowDecodedIndices.size(),
+                                        grid.vertices.size() - 1, encodedIndices.data(), encodedIndices.size()));
+    std::vector<uint32_t> indices = {0, 1, 2, 2, 1, 70000};
+    std::vector<uint8_t> wideEncodedIndices = GeometryCodec::encodeIndices(indices.data(), indices.size());
+    CHECK(!GeometryCodec::decodeIndices(narrowDecodedIndices.data(), indices.size(), 3, wideEncodedIndices.data(),
+                                        wideEncodedIndices.size()));
+
+    // Flipped bytes either fail to decode or decode to valid indices, never past the arrays or the vertex count
+    std::mt19937 random(4);
+    for (size_t i = 0; i < encodedIndices.size(); ++i)
+    {
+        std::vector<uint8_t> corrupt = encodedIndices;
+        corrupt[i] ^= static_cast<uint8_t>(1 + random() % 255);
+        if (GeometryCodec::decodeIndices(decodedIndices.data(), decodedIndices.size(), grid.vertices.size(),
+                                         corrupt.data(), corrupt.size()))
+        {
+            for (uint32_t index : decodedIndices)
+            {
+                CHECK(index < grid.vertices.size());
+            }
+        }
+    }
+    std::vector<Vertex> vertices = makeRandomVertices(300, random);
+    std::vector<uint8_t> encodedVertices = GeometryCodec::encodeVertices(vertices.data(), vertices.size());
+    std::vector<Vertex> decodedVertices(vertices.size());
+    for (size_t i = 0; i < encodedVertices.size(); ++i)
+    {
+        std::vector<uint8_t> corrupt = encodedVertices;
+        corrupt[i] = 0xff;
+        GeometryCodec::decodeVertices(decodedVertices.data(), decodedVertices.size(), corrupt.data(), corrupt.size());
+    }
+    // A stream of another kind
+    CHECK(!GeometryCodec::decodeVertices(decodedVertices.data(), decodedVertices.size(), encodedIndices.data(),
+                                         encodedIndices.size()));
+}
+
+int main()
+{
+    testEmpty();
+    testVertexCounts();
+    testIndices();
+    testTruncated();
+    testCorrupt();
+    return getTestResult();
+}
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <random>
+
+#include "test-utilities.h"
+#include "vulkan-memory-allocator.h"
+
+struct Range
+{
+    uint32_t node;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Ranges in use are within the allocator and don't overlap, the free bytes are what they leave
+static bool isConsistent(const TlsfAllocator &allocator, std::vector<Range> ranges)
+{
+    std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) { return a.offset < b.offset; });
+    uint64_t usedBytes = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        if (ranges[i].offset + ranges[i].size > allocator.getSize() ||
+            (i > 0 && ranges[i - 1].offset + ranges[i - 1].size > ranges[i].offset))
+        {
+            return false;
+        }
+        usedBytes += ranges[i].size;
+    }
+    return allocator.getFreeBytes() == allocator.getSize() - usedBytes &&
+           allocator.getAllocationCount() == ranges.size() &&
+           allocator.getLargestFreeRange() <= allocator.getFreeBytes();
+}
+
+static void testEmpty()
+{
+    TlsfAllocator allocator(1 << 20);
+    CHECK(allocator.getFreeBytes() == 1 << 20 && allocator.getAllocationCount() == 0);
+    CHECK(allocator.getLargestFreeRange() == 1 << 20);
+    uint64_t offset;
+    CHECK(allocator.allocate(0, 1, &offset) == TlsfAllocator::NO_NODE);
+    CHECK(allocator.allocate((1 << 20) + 1, 1, &offset) == TlsfAllocator::NO_NODE);
+    // All of it, then nothing more
+    uint32_t node = allocator.allocate(1 << 20, 256, &offset);
+    CHECK(node != TlsfAllocator::NO_NODE && offset == 0 && allocator.getFreeBytes() == 0);
+    CHECK(allocator.allocate(1, 1, &offset) == TlsfAllocator::NO_NODE);
+    allocator.free(node);
+    CHECK(allocator.getFreeBytes() == 1 << 20 && allocator.getLargestFreeRange() == 1 << 20);
+}
+
+static void testFragmentation()
+{
+    const uint64_t size = 1 << 20;
+    const uint64_t rangeSize = size / 64;
+    TlsfAllocator allocator(size);
+    std::vector<Range> ranges;
+    for (int i = 0; i < 64; ++i)
+    {
+        Range range;
+        range.size = rangeSize;
+        range.node = allocator.allocate(rangeSize, 1, &range.offset);
+        CHECK(range.node != TlsfAllocator::NO_NODE);
+        ranges.push_back(range);
+    }
+    CHECK(isConsistent(allocator, ranges));
+    uint64_t offset;
+    CHECK(allocator.allocate(1, 1, &offset) == TlsfAllocator::NO_NODE);
+
+    // Every other range freed: half the bytes are free, but in pieces
+    std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) { return a.offset < b.offset; });
+    for (size_t i = 0; i < ranges.size(); i += 2)
+    {
+        allocator.free(ranges[i].node);
+    }
+    CHECK(allocator.getFreeBytes() == size / 2 && allocator.getLargestFreeRange() == rangeSize);
+    CHECK(allocator.allocate(rangeSize + 1, 1, &offset) == TlsfAllocator::NO_NODE);
+    // The others freed, the free neighbours merge back into a single range
+    for (size_t i = 1; i < ranges.size(); i += 2)
+    {
+        allocator.free(ranges[i].node);
+    }
+    CHECK(allocator.getFreeBytes() == size && allocator.getLargestFreeRange() == size);
+    CHECK(allocator.getAllocationCount() == 0);
+}
+
+static void testRandom()
+{
+    const uint64_t size = 1 << 24;
+    TlsfAllocator allocator(size);
+    std::mt19937 random(1);
+    std::vector<Range> ranges;
+    for (int step = 0; step < 20000; ++step)
+    {
+        // Allocations outnumber frees until about half of the allocator is used
+        if (ranges.empty() || (random() % 2 == 0 && allocator.getFreeBytes() > size / 2))
+        {
+            uint64_t alignment = uint64_t(1) << (random() % 13);
+            Range range;
+            range.size = 1 + random() % 65536;
+            range.node = allocator.allocate(range.size, alignment, &range.offset);
+            CHECK(range.node != TlsfAllocator::NO_NODE);
+            if (range.node != TlsfAllocator::NO_NODE)
+            {
+                CHECK(range.offset % alignment == 0);
+                ranges.push_back(range);
+            }
+        }
+        else
+        {
+            size_t i = random() % ranges.size();
+            allocator.free(ranges[i].node);
+            ranges[i] = ranges.back();
+            ranges.pop_back();
+        }
+        if (step % 1000 == 0)
+        {
+            CHECK(isConsistent(allocator, ranges));
+        }
+    }
+    CHECK(isConsistent(allocator, ranges));
+    for (const Range &range : ranges)
+    {
+        allocator.free(range.node);
+    }
+    CHECK(allocator.getFreeBytes() == size && allocator.getLargestFreeRange() == size);
+    CHECK(allocator.getAllocationCount() == 0);
+}
+
+int main()
+{
+    testEmpty();
+    testFragmentation();
+    testRandom();
+    return getTestResult();
+}
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <array>
+#include <random>
+
+#include "test-utilities.h"
+#include "vulkan-mesh-optimizer.h"
+
+// A triangle by the values of its corners, rotated to start from the smallest so that rotations compare equal
+using TriangleKey = std::array<std::array<float, 5>, 3>;
+
+static std::vector<TriangleKey> getTriangleKeys(const std::vector<Vertex> &vertices, const uint32_t *indices,
+                                                size_t indexCount)
+{
+    std::vector<TriangleKey> keys;
+    for (size_t triangle = 0; triangle < indexCount; triangle += 3)
+    {
+        TriangleKey key;
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            const Vertex &vertex = vertices[indices[triangle + corner]];
+            key[corner] = {vertex.pos.x, vertex.pos.y, vertex.pos.z, vertex.tex.x, vertex.tex.y};
+        }
+        std::rotate(key.begin(), std::min_element(key.begin(), key.end()), key.end());
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+static std::vector<TriangleKey> getSortedTriangleKeys(const MeshData &mesh)
+{
+    std::vector<TriangleKey> keys = getTriangleKeys(mesh.vertices, mesh.indices.data(), mesh.indices.size());
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+static void shuffleTriangles(std::vector<uint32_t> &indices, std::mt19937 &random)
+{
+    for (size_t triangle = indices.size() / 3; triangle > 1; --triangle)
+    {
+        size_t other = random() % triangle;
+        std::swap_ranges(&indices[(triangle - 1) * 3], &indices[triangle * 3], &indices[other * 3]);
+    }
+}
+
+static void testVertexCacheStats()
+{
+    // A single triangle misses every vertex, a second one sharing an edge misses one more
+    std::vector<uint32_t> indices = {0, 1, 2, 2, 1, 3};
+    VertexCacheStats stats = MeshOptimizer::analyzeVertexCache(indices.data(), 3, 4);
+    CHECK(stats.triangleCount == 1 && stats.vertexCount == 3 && stats.cacheMisses == 3);
+    stats = MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), 4);
+    CHECK(stats.triangleCount == 2 && stats.vertexCount == 4 && stats.cacheMisses == 4);
+    CHECK(stats.getACMR() == 2.0f && stats.getATVR() == 1.0f);
+    stats = MeshOptimizer::analyzeVertexCache(nullptr, 0, 0);
+    CHECK(stats.getACMR() == 0.0f && stats.getATVR() == 0.0f);
+}
+
+static void testOptimizeMesh()
+{
+    std::mt19937 random(1);
+    MeshData mesh = makeGrid(37, 23);
+    shuffleTriangles(mesh.indices, random);
+    // An unreferenced vertex, dropped by the vertex fetch step
+    mesh.vertices.push_back(Vertex{glm::vec3(-1.0f), glm::vec3(0.0f), glm::vec2(0.0f)});
+    std::vector<TriangleKey> sourceTriangles = getSortedTriangleKeys(mesh);
+    float sourceACMR = MeshOptimizer::analyzeVertexCache(mesh.indices.data(), mesh.indices.size(),
+                                                         mesh.vertices.size())
+                           .getACMR();
+
+    MeshOptimizer::optimizeMesh(mesh);
+    CHECK(getSortedTriangleKeys(mesh) == sourceTriangles);
+    CHECK(mesh.vertices.size() == 38 * 24);
+    VertexCacheStats stats =
+        MeshOptimizer::analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+    CHECK(stats.getACMR() < sourceACMR);
+    CHECK(stats.getACMR() < 1.0f);
+
+    // Vertices are in first use order
+    uint32_t next = 0;
+    for (uint32_t index : mesh.indices)
+    {
+        CHECK(index <= next);
+        next = std::max(next, index + 1);
+    }
+    CHECK(next == mesh.vertices.size());
+
+    MeshData empty;
+    MeshOptimizer::optimizeMesh(empty);
+    CHECK(empty.vertices.empty() && empty.indices.empty());
+}
+
+static void testSplitMesh()
+{
+    MeshData mesh = makeGrid(37, 23);
+    mesh.materialIndex = 3;
+    mesh.nodeIndex = 5;
+    MeshOptimizer::optimizeMesh(mesh);
+    std::vector<TriangleKey> sourceTriangles = getTriangleKeys(mesh.vertices, mesh.indices.data(), mesh.indices.size());
+
+    std::vector<MeshData> chunks = MeshOptimizer::splitMesh(mesh, 100);
+    CHECK(chunks.size() > 1);
+    // The triangles in order, each chunk within the vertex limit and bounds
+    std::vector<TriangleKey> chunkTriangles;
+    for (const MeshData &chunk : chunks)
+    {
+        CHECK(!chunk.vertices.empty() && chunk.vertices.size() <= 100);
+        CHECK(chunk.materialIndex == 3 && chunk.nodeIndex == 5);
+        for (const Vertex &vertex : chunk.vertices)
+        {
+            CHECK(glm::min(vertex.pos, chunk.boundsMin) == chunk.boundsMin &&
+                  glm::max(vertex.pos, chunk.boundsMax) == chunk.boundsMax);
+        }
+        std::vector<TriangleKey> keys = getTriangleKeys(chunk.vertices, chunk.indices.data(), chunk.indices.size());
+        chunkTriangles.insert(chunkTriangles.end(), keys.begin(), keys.end());
+    }
+    CHECK(chunkTriangles == sourceTriangles);
+
+    // A mesh within the limit is a single chunk
+    chunks = MeshOptimizer::splitMesh(mesh, mesh.vertices.size());
+    CHECK(chunks.size() == 1 && chunks[0].vertices.size() == mesh.vertices.size() &&
+          chunks[0].indices == mesh.indices);
+}
+
+static void testFindDuplicateMeshes()
+{
+    MeshData grid = makeGrid(8, 8);
+    // A translated copy, with another material
+    MeshData translated = grid;
+    glm::vec3 translation(10.0f, -20.0f, 30.5f);
+    for (Vertex &vertex : translated.vertices)
+    {
+        vertex.pos += translation;
+    }
+    translated.boundsMin += translation;
+    translated.boundsMax += translation;
+    translated.materialIndex = 1;
+    // Same sizes, other texture coordinates
+    MeshData retextured = grid;
+    retextured.vertices[7].tex.x += 0.5f;
+    // Same sizes, another shape
+    MeshData reshaped = translated;
+    reshaped.vertices[7].pos.y += 0.5f;
+    MeshData other = makeGrid(8, 4);
+
+    std::vector<MeshView> views = {grid.getView(), other.getView(), translated.getView(),
+                                   retextured.getView(), reshaped.getView(), grid.getView()};
+    std::vector<uint32_t> duplicates = MeshOptimizer::findDuplicateMeshes(views);
+    CHECK((duplicates == std::vector<uint32_t>{0, 1, 0, 3, 4, 0}));
+    CHECK(MeshOptimizer::findDuplicateMeshes({}).empty());
+}
+
+int main()
+{
+    testVertexCacheStats();
+    testOptimizeMesh();
+    testSplitMesh();
+    testFindDuplicateMeshes();
+    return getTestResult();
+}
@@ -0,0 +1,78 @@
+#include <algorithm>
+
+#include "test-utilities.h"
+#include "vulkan-mesh-optimizer.h"
+#include "vulkan-mesh-simplifier.h"
+
+static void testSimplify()
+{
+    MeshData mesh = makeGrid(32, 32);
+    size_t targetIndexCount = mesh.indices.size() / 4;
+    float error = -1.0f;
+    std::vector<uint32_t> indices = MeshSimplifier::simplify(mesh.vertices, mesh.indices.data(), mesh.indices.size(),
+                                                             targetIndexCount, &error);
+    CHECK(!indices.empty() && indices.size() <= targetIndexCount && indices.size() % 3 == 0);
+    // The bump is one unit high: collapses move the surface, but not that far
+    CHECK(error > 0.0f && error < 1.0f);
+    for (size_t triangle = 0; triangle < indices.size(); triangle += 3)
+    {
+        CHECK(indices[triangle] < mesh.vertices.size() && indices[triangle + 1] < mesh.vertices.size() &&
+              indices[triangle + 2] < mesh.vertices.size());
+        // No degenerate triangles are left
+        CHECK(indices[triangle] != indices[triangle + 1] && indices[triangle + 1] != indices[triangle + 2] &&
+              indices[triangle + 2] != indices[triangle]);
+    }
+
+    // Nothing to do
+    indices = MeshSimplifier::simplify(mesh.vertices, mesh.indices.data(), mesh.indices.size(), mesh.indices.size(),
+                                       &error);
+    CHECK(indices == mesh.indices && error == 0.0f);
+    // A lone triangle is all border, it can't be collapsed
+    std::vector<uint32_t> triangle = {0, 1, 2};
+    indices = MeshSimplifier::simplify(mesh.vertices, triangle.data(), triangle.size(), 0, &error);
+    CHECK(indices == triangle);
+}
+
+static void testGenerateLods()
+{
+    MeshData mesh = makeGrid(32, 32);
+    MeshOptimizer::optimizeMesh(mesh);
+    std::vector<uint32_t> fullIndices = mesh.indices;
+    MeshSimplifier::generateLods(mesh, MeshSimplifier::DEFAULT_LOD_COUNT);
+
+    CHECK(mesh.lods.size() > 1 && mesh.lods.size() <= MeshSimplifier::DEFAULT_LOD_COUNT);
+    // Level 0 is the full mesh, left as it was
+    CHECK(mesh.lods[0].indexOffset == 0 && mesh.lods[0].indexCount == fullIndices.size() &&
+          mesh.lods[0].error == 0.0f);
+    CHECK(std::equal(fullIndices.begin(), fullIndices.end(), mesh.indices.begin()));
+    // The other levels follow, each smaller than the previous one by at least MIN_LOD_SAVING, errors non decreasing
+    for (size_t level = 1; level < mesh.lods.size(); ++level)
+    {
+        const MeshLod &lod = mesh.lods[level];
+        const MeshLod &previous = mesh.lods[level - 1];
+        CHECK(lod.indexOffset == previous.indexOffset + previous.indexCount);
+        CHECK(lod.indexCount % 3 == 0 &&
+              lod.indexCount <= previous.indexCount * (1.0f - MeshSimplifier::MIN_LOD_SAVING));
+        CHECK(lod.error >= previous.error);
+    }
+    const MeshLod &last = mesh.lods.back();
+    CHECK(last.indexOffset + last.indexCount == mesh.indices.size());
+    for (uint32_t index : mesh.indices)
+    {
+        CHECK(index < mesh.vertices.size());
+    }
+
+    // Too small to simplify: the full level only
+    MeshData triangle;
+    triangle.vertices = std::vector<Vertex>(mesh.vertices.begin(), mesh.vertices.begin() + 3);
+    triangle.indices = {0, 1, 2};
+    MeshSimplifier::generateLods(triangle, MeshSimplifier::DEFAULT_LOD_COUNT);
+    CHECK(triangle.lods.size() == 1 && triangle.indices.size() == 3);
+}
+
+int main()
+{
+    testSimplify();
+    testGenerateLods();
+    return getTestResult();
+}
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+#include "test-utilities.h"
+#include "vulkan-obj-loader.h"
+
+// Files of a test in the temporary directory, named after the process so that concurrent runs don't collide
+static std::string getTemporaryPath(const std::string &name)
+{
+    return (std::filesystem::temp_directory_path() / ("test-obj-loader." + std::to_string(getpid()) + "." + name))
+        .string();
+}
+
+static void writeFile(const std::string &filename, const std::string &content)
+{
+    std::ofstream file(filename, std::ios::binary);
+    file << content;
+}
+
+static bool isLoadThrowing(const std::string &filename, ThreadPool &threadPool)
+{
+    try
+    {
+        ObjLoader::load(filename, threadPool);
+    }
+    catch (const std::runtime_error &)
+    {
+        return true;
+    }
+    return false;
+}
+
+static void testIsObjFile()
+{
+    CHECK(ObjLoader::isObjFile("models/jet.obj"));
+    CHECK(ObjLoader::isObjFile("JET.OBJ"));
+    CHECK(!ObjLoader::isObjFile("jet.fbx"));
+    CHECK(!ObjLoader::isObjFile("obj"));
+}
+
+static void testObjects(ThreadPool &threadPool)
+{
+    std::string filename = getTemporaryPath("objects.obj");
+    std::string libraryName = filename.substr(filename.find_last_of('/') + 1);
+    libraryName = libraryName.substr(0, libraryName.rfind('.')) + ".mtl";
+    writeFile(filename.substr(0, filename.rfind('.')) + ".mtl", "newmtl red\n"
+                                                                "map_Kd red.png\n");
+    writeFile(filename, "mtllib " + libraryName +
+                            "\n"
+                            "v 0 0 0\n"
+                            "v 1 0 0\n"
+                            "v 1 1 0\n"
+                            "v 0 1 0\n"
+                            "vt 0 0\n"
+                            "vt 1 0\n"
+                            "vt 1 1\n"
+                            "vt 0 1\n"
+                            "o quad\n"
+                            "f 1/1 2/2 3/3 4/4\n"
+                            "o triangle\n"
+                            "usemtl red\n"
+                            "f -4/-4 -3/-3 -2/-2\n"
+                            "o seam\n"
+                            "f 1/1 2/2 3/3\n"
+                            "f 1/3 3/3 4/4\n");
+    ObjModel model = ObjLoader::load(filename, threadPool);
+
+    CHECK(model.textureNames.size() == 2 && model.textureNames[0].empty() && model.textureNames[1] == "red.png");
+    CHECK(std::find(model.dependencies.begin(), model.dependencies.end(),
+                    filename.substr(0, filename.rfind('.')) + ".mtl") != model.dependencies.end());
+    // A root node, then a node per object
+    CHECK(model.sceneGraph.getNodeCount() == 4);
+    CHECK(model.sceneGraph.findNode("quad") == 1 && model.sceneGraph.findNode("triangle") == 2 &&
+          model.sceneGraph.findNode("seam") == 3);
+
+    CHECK(model.meshes.size() == 3);
+    if (model.meshes.size() == 3)
+    {
+        // The quad is triangulated, its texture coordinates flipped
+        const MeshData &quad = model.meshes[0];
+        CHECK(quad.materialIndex == 0 && quad.nodeIndex == 1);
+        CHECK(quad.vertices.size() == 4 && quad.indices.size() == 6);
+        for (const Vertex &vertex : quad.vertices)
+        {
+            CHECK(vertex.tex == glm::vec2(vertex.pos.x, 1.0f - vertex.pos.y));
+        }
+        CHECK(quad.boundsMin == glm::vec3(0.0f) && quad.boundsMax == glm::vec3(1.0f, 1.0f, 0.0f));
+
+        const MeshData &triangle = model.meshes[1];
+        CHECK(triangle.materialIndex == 1 && triangle.nodeIndex == 2);
+        CHECK(triangle.vertices.size() == 3 && triangle.indices.size() == 3);
+
+        // The material carries over to the next object. Vertices are shared by position and texture coordinates:
+        // the first corner is used twice, with two of them.
+        const MeshData &seam = model.meshes[2];
+        CHECK(seam.materialIndex == 1 && seam.nodeIndex == 3);
+        CHECK(seam.vertices.size() == 5 && seam.indices.size() == 6);
+    }
+    std::filesystem::remove(filename);
+    std::filesystem::remove(filename.substr(0, filename.rfind('.')) + ".mtl");
+}
+
+// A strip of quads long enough to be parsed in several chunks, each face pointing back at the last vertices
+static void testChunks(ThreadPool &threadPool)
+{
+    const size_t quadCount = 20000;
+    std::string content = "v 0 0 0\nv 0 1 0\n";
+    for (size_t quad = 1; quad <= quadCount; ++quad)
+    {
+        content += "v " + std::to_string(quad) + " 0 0\nv " + std::to_string(quad) + " 1 0\nf -4 -2 -1 -3\n";
+    }
+    CHECK(content.size() > ObjLoader::MIN_CHUNK_SIZE * 4);
+    std::string filename = getTemporaryPath("chunks.obj");
+    writeFile(filename, content);
+    ObjModel model = ObjLoader::load(filename, threadPool);
+
+    CHECK(model.meshes.size() == 1);
+    if (model.meshes.size() == 1)
+    {
+        const MeshData &mesh = model.meshes[0];
+        CHECK(mesh.vertices.size() == 2 * (quadCount + 1) && mesh.indices.size() == 6 * quadCount);
+        // Every triangle spans a single quad
+        for (size_t triangle = 0; triangle + 2 < mesh.indices.size(); triangle += 3)
+        {
+            float minX = mesh.vertices[mesh.indices[triangle]].pos.x;
+            float maxX = minX;
+            for (size_t corner = 1; corner < 3; ++corner)
+            {
+                minX = std::min(minX, mesh.vertices[mesh.indices[triangle + corner]].pos.x);
+                maxX = std::max(maxX, mesh.vertices[mesh.indices[triangle + corner]].pos.x);
+            }
+            CHECK(maxX - minX == 1.0f);
+        }
+        CHECK(mesh.boundsMax == glm::vec3(static_cast<float>(quadCount), 1.0f, 0.0f));
+    }
+    std::filesystem::remove(filename);
+}
+
+static void testMalformed(ThreadPool &threadPool)
+{
+    std::string filename = getTemporaryPath("malformed.obj");
+    CHECK(isLoadThrowing(filename, threadPool));
+    writeFile(filename, "v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 x\n");
+    CHECK(isLoadThrowing(filename, threadPool));
+    writeFile(filename, "v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 4\n");
+    CHECK(isLoadThrowing(filename, threadPool));
+    writeFile(filename, "v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 -4\n");
+    CHECK(isLoadThrowing(filename, threadPool));
+    writeFile(filename, "v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1/1 2/1 3/1\n");
+    CHECK(isLoadThrowing(filename, threadPool));
+
+    // Empty files are no error, they have no mesh
+    writeFile(filename, "");
+    CHECK(ObjLoader::load(filename, threadPool).meshes.empty());
+    std::filesystem::remove(filename);
+}
+
+int main()
+{
+    ThreadPool threadPool(4);
+    testIsObjFile();
+    testObjects(threadPool);
+    testChunks(threadPool);
+    testMalformed(threadPool);
+    return getTestResult();
+}
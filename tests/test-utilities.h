@@ -0,0 +1,74 @@
+#pragma once
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "vulkan-mesh.h"
+
+// Checks of the unit tests: a failed one is printed and counted, the test goes on with the next one.
+// A test's main returns getTestResult(), a failure for ctest when any check failed.
+static int testFailureCount = 0;
+
+#define CHECK(condition)                                                                                               \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(condition))                                                                                              \
+        {                                                                                                              \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);                                      \
+            ++testFailureCount;                                                                                        \
+        }                                                                                                              \
+    } while (false)
+
+static int getTestResult()
+{
+    if (testFailureCount)
+    {
+        printf("%d checks failed\n", testFailureCount);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Regular grid of width x height quads in the XZ plane, two triangles each, on a bump so that it doesn't simplify
+// for free. Texture coordinates span [0, 1], the color is constant.
+static MeshData makeGrid(uint32_t width, uint32_t height)
+{
+    MeshData mesh;
+    for (uint32_t z = 0; z <= height; ++z)
+    {
+        for (uint32_t x = 0; x <= width; ++x)
+        {
+            float u = static_cast<float>(x) / width;
+            float v = static_cast<float>(z) / height;
+            float y = std::sin(u * 3.14159265f) * std::sin(v * 3.14159265f);
+            mesh.vertices.push_back(Vertex{glm::vec3(x, y, z), glm::vec3(1.0f, 0.5f, 0.25f), glm::vec2(u, v)});
+        }
+    }
+    for (uint32_t z = 0; z < height; ++z)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            uint32_t corner = z * (width + 1) + x;
+            mesh.indices.insert(mesh.indices.end(), {corner, corner + width + 1, corner + 1});
+            mesh.indices.insert(mesh.indices.end(), {corner + 1, corner + width + 1, corner + width + 2});
+        }
+    }
+    mesh.boundsMin = glm::vec3(0.0f);
+    mesh.boundsMax = glm::vec3(width, 1.0f, height);
+    return mesh;
+}
+
+// Whether two triangles are the same up to a rotation, the winding kept
+template <typename A, typename B> static bool isSameTriangle(const A *first, const B *second)
+{
+    for (size_t rotation = 0; rotation < 3; ++rotation)
+    {
+        if (first[0] == second[rotation] && first[1] == second[(rotation + 1) % 3] &&
+            first[2] == second[(rotation + 2) % 3])
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,80 @@
+#include "vulkan-file-watcher.h"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+FileWatcher::~FileWatcher()
+{
+    close();
+}
+
+bool FileWatcher::addDirectory(const std::string &directory)
+{
+    if (inotifyFd < 0)
+    {
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0)
+        {
+            return false;
+        }
+    }
+    // Files closed after writing, and files renamed into place by atomic saves
+    int watchDescriptor = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watchDescriptor < 0)
+    {
+        return false;
+    }
+    directories[watchDescriptor] = directory;
+    return true;
+}
+
+void FileWatcher::close()
+{
+    if (inotifyFd >= 0)
+    {
+        ::close(inotifyFd);
+    }
+    inotifyFd = -1;
+    directories.clear();
+    pendingChanges.clear();
+}
+
+std::vector<FileChange> FileWatcher::poll()
+{
+    std::vector<FileChange> changes;
+    if (inotifyFd < 0)
+    {
+        return changes;
+    }
+    auto now = std::chrono::steady_clock::now();
+
+    // Drain the queued events, read fails with EAGAIN once there are none left
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *eventStart = buffer; eventStart < buffer + length;)
+        {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(eventStart);
+            eventStart += sizeof(inotify_event) + event->len;
+            auto directory = directories.find(event->wd);
+            if (event->len == 0 || (event->mask & IN_ISDIR) || directory == directories.end())
+            {
+                continue;
+            }
+            pendingChanges[directory->second + "/" + event->name] = now;
+        }
+    }
+
+    for (auto pending = pendingChanges.begin(); pending != pendingChanges.end();)
+    {
+        if (now - pending->second < SETTLE_TIME)
+        {
+            ++pending;
+            continue;
+        }
+        changes.push_back(FileChange{pending->first, pending->second});
+        pending = pendingChanges.erase(pending);
+    }
+    return changes;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct FileChange
+{
+    std::string path; // Watched directory + "/" + file name
+    std::chrono::steady_clock::time_point time; // Last write seen
+};
+
+// Reports files written in a set of directories, through inotify. Never blocks, poll() is meant to be called
+// every frame. Editors often save in several steps (truncate then write, or write a temporary file and rename it),
+// so a file is only reported once it stayed untouched for SETTLE_TIME.
+class FileWatcher
+{
+  public:
+    static constexpr std::chrono::milliseconds SETTLE_TIME{200};
+
+    FileWatcher() = default;
+    ~FileWatcher();
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    // Watch the files directly in directory, not in its subdirectories. Returns false if it can't be watched.
+    bool addDirectory(const std::string &directory);
+    void close();
+
+    bool isWatching() const
+    {
+        return !directories.empty();
+    }
+
+    // Files changed, and settled, since the last call
+    std::vector<FileChange> poll();
+
+  private:
+    int inotifyFd{-1};
+    std::unordered_map<int, std::string> directories; // By watch descriptor
+    // Changed files waiting to settle
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> pendingChanges;
+};
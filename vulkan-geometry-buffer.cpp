@@ -0,0 +1,249 @@
+#include "vulkan-geometry-buffer.h"
+
+#include <algorithm>
+#include <limits>
+
+void GeometryBuffer::create(DeviceMemoryAllocator &memoryAllocatorP, vk::Queue transferQueueP,
+                            vk::CommandPool transferCommandPoolP)
+{
+    memoryAllocator = &memoryAllocatorP;
+    device = memoryAllocatorP.getDevice();
+    transferQueue = transferQueueP;
+    transferCommandPool = transferCommandPoolP;
+
+    arenas[FULL_VERTICES].usage = vk::BufferUsageFlagBits::eVertexBuffer;
+    arenas[FULL_VERTICES].stride = sizeof(Vertex);
+    arenas[PACKED_VERTICES].usage = vk::BufferUsageFlagBits::eVertexBuffer;
+    arenas[PACKED_VERTICES].stride = sizeof(PackedVertex);
+    arenas[INDICES_16].usage = vk::BufferUsageFlagBits::eIndexBuffer;
+    arenas[INDICES_16].stride = sizeof(uint16_t);
+    arenas[INDICES_32].usage = vk::BufferUsageFlagBits::eIndexBuffer;
+    arenas[INDICES_32].stride = sizeof(uint32_t);
+    // Buffers themselves are only created on first use
+}
+
+void GeometryBuffer::destroy()
+{
+    releaseReplacedBuffers(true);
+    for (auto &arena : arenas)
+    {
+        if (arena.buffer)
+        {
+            device.destroyBuffer(arena.buffer, nullptr);
+            memoryAllocator->free(arena.memory);
+        }
+        arena.buffer = nullptr;
+        arena.capacity = 0;
+        arena.allocated = 0;
+        arena.freeBlocks.clear();
+    }
+}
+
+void GeometryBuffer::reserveVertices(VertexFormat vertexFormat, uint32_t count)
+{
+    reserve(arenas[getVertexArenaIndex(vertexFormat)], count);
+}
+
+void GeometryBuffer::reserveIndices(vk::IndexType indexType, uint32_t count)
+{
+    reserve(arenas[getIndexArenaIndex(indexType)], count);
+}
+
+GeometryRange GeometryBuffer::allocateVertices(VertexFormat vertexFormat, uint32_t count)
+{
+    return allocate(arenas[getVertexArenaIndex(vertexFormat)], count);
+}
+
+GeometryRange GeometryBuffer::allocateIndices(vk::IndexType indexType, uint32_t count)
+{
+    return allocate(arenas[getIndexArenaIndex(indexType)], count);
+}
+
+void GeometryBuffer::freeVertices(VertexFormat vertexFormat, const GeometryRange &range)
+{
+    free(arenas[getVertexArenaIndex(vertexFormat)], range);
+}
+
+void GeometryBuffer::freeIndices(vk::IndexType indexType, const GeometryRange &range)
+{
+    free(arenas[getIndexArenaIndex(indexType)], range);
+}
+
+vk::DeviceSize GeometryBuffer::getAllocatedBytes() const
+{
+    vk::DeviceSize bytes = 0;
+    for (const auto &arena : arenas)
+    {
+        bytes += arena.allocated * arena.stride;
+    }
+    return bytes;
+}
+
+vk::DeviceSize GeometryBuffer::getCapacityBytes() const
+{
+    vk::DeviceSize bytes = 0;
+    for (const auto &arena : arenas)
+    {
+        bytes += arena.capacity * arena.stride;
+    }
+    return bytes;
+}
+
+void GeometryBuffer::reserve(Arena &arena, uint32_t count)
+{
+    // Allocations are first fit: if the free block at the end of the arena can hold them all,
+    // every one of them succeeds without growing, whatever the holes before it
+    uint32_t tailFree = 0;
+    if (!arena.freeBlocks.empty())
+    {
+        auto last = std::prev(arena.freeBlocks.end());
+        if (last->first + last->second == arena.capacity)
+        {
+            tailFree = last->second;
+        }
+    }
+    if (tailFree < count)
+    {
+        grow(arena, arena.capacity + count - tailFree);
+    }
+}
+
+GeometryRange GeometryBuffer::allocate(Arena &arena, uint32_t count)
+{
+    GeometryRange range;
+    range.count = count;
+    if (count == 0)
+    {
+        return range;
+    }
+
+    auto block = std::find_if(arena.freeBlocks.begin(), arena.freeBlocks.end(),
+                              [count](const std::pair<const uint32_t, uint32_t> &freeBlock) {
+                                  return freeBlock.second >= count;
+                              });
+    if (block == arena.freeBlocks.end())
+    {
+        reserve(arena, count);
+        block = std::prev(arena.freeBlocks.end());
+    }
+
+    // Take the front of the block, the rest stays free
+    range.offset = block->first;
+    uint32_t remaining = block->second - count;
+    arena.freeBlocks.erase(block);
+    if (remaining > 0)
+    {
+        arena.freeBlocks[range.offset + count] = remaining;
+    }
+    arena.allocated += count;
+    return range;
+}
+
+void GeometryBuffer::free(Arena &arena, const GeometryRange &range)
+{
+    if (range.count == 0)
+    {
+        return;
+    }
+    arena.allocated -= range.count;
+    insertFreeBlock(arena, range.offset, range.count);
+}
+
+void GeometryBuffer::insertFreeBlock(Arena &arena, uint32_t offset, uint32_t count)
+{
+    // Merge with the free block right after...
+    auto next = arena.freeBlocks.find(offset + count);
+    if (next != arena.freeBlocks.end())
+    {
+        count += next->second;
+        arena.freeBlocks.erase(next);
+    }
+    // ...and with the one right before
+    auto previous = arena.freeBlocks.lower_bound(offset);
+    if (previous != arena.freeBlocks.begin())
+    {
+        --previous;
+        if (previous->first + previous->second == offset)
+        {
+            previous->second += count;
+            return;
+        }
+    }
+    arena.freeBlocks[offset] = count;
+}
+
+void GeometryBuffer::grow(Arena &arena, uint32_t minimumCapacity)
+{
+    uint32_t oldCapacity = arena.capacity;
+    uint32_t newCapacity = std::max(oldCapacity ? oldCapacity * 2 : INITIAL_CAPACITY, minimumCapacity);
+
+    vk::Buffer newBuffer;
+    MemoryAllocation newMemory;
+    createBuffer(*memoryAllocator, newCapacity * arena.stride,
+                 arena.usage | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal, &newBuffer, &newMemory);
+
+    if (arena.buffer)
+    {
+        // Frames in flight only read the old buffer, the copy can run alongside them. It waits for the transfers
+        // submitted before (uploads into the old buffer), and anything submitted after it reads the new buffer.
+        ReplacedBuffer replaced{arena.buffer, arena.memory};
+        replaced.copyCommandBuffer = beginCommandBuffer(device, transferCommandPool);
+        vk::MemoryBarrier barrier{};
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+        replaced.copyCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                                   vk::PipelineStageFlagBits::eTransfer, {}, 1, &barrier, 0, nullptr,
+                                                   0, nullptr);
+        vk::BufferCopy copyRegion{0, 0, oldCapacity * arena.stride};
+        replaced.copyCommandBuffer.copyBuffer(arena.buffer, newBuffer, copyRegion);
+        // Like UploadBatch, readable by the vertex input and compute shaders of later submissions
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+                                vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferWrite;
+        replaced.copyCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                                   vk::PipelineStageFlagBits::eVertexInput |
+                                                       vk::PipelineStageFlagBits::eComputeShader |
+                                                       vk::PipelineStageFlagBits::eTransfer,
+                                                   {}, 1, &barrier, 0, nullptr, 0, nullptr);
+        replaced.copyCommandBuffer.end();
+
+        vk::SubmitInfo submitInfo{};
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &replaced.copyCommandBuffer;
+        replaced.copyFence = device.createFence(vk::FenceCreateInfo{});
+        transferQueue.submit(1, &submitInfo, replaced.copyFence);
+        replacedBuffers.push_back(replaced);
+        growCopiedBytes += copyRegion.size;
+        printf("Geometry buffer arena grown from %u to %u elements\n", oldCapacity, newCapacity);
+    }
+    arena.buffer = newBuffer;
+    arena.memory = newMemory;
+    arena.capacity = newCapacity;
+
+    // New space at the end, merged with the free block ending at the old capacity if any
+    insertFreeBlock(arena, oldCapacity, newCapacity - oldCapacity);
+}
+
+void GeometryBuffer::releaseReplacedBuffers(bool wait)
+{
+    // Submitted in order, so completed in order too
+    size_t releasedCount = 0;
+    for (; releasedCount < replacedBuffers.size(); ++releasedCount)
+    {
+        ReplacedBuffer &replaced = replacedBuffers[releasedCount];
+        if (wait)
+        {
+            device.waitForFences(replaced.copyFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        }
+        else if (device.getFenceStatus(replaced.copyFence) != vk::Result::eSuccess)
+        {
+            break;
+        }
+        device.destroyFence(replaced.copyFence, nullptr);
+        device.freeCommandBuffers(transferCommandPool, 1, &replaced.copyCommandBuffer);
+        device.destroyBuffer(replaced.buffer, nullptr);
+        memoryAllocator->free(replaced.memory);
+    }
+    replacedBuffers.erase(replacedBuffers.begin(), replacedBuffers.begin() + releasedCount);
+}
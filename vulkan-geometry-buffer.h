@@ -0,0 +1,126 @@
+#pragma once
+#include <map>
+#include <vector>
+
+#include "vulkan-utilities.h"
+
+// Element range inside one of the GeometryBuffer arenas, in vertices or indices
+struct GeometryRange
+{
+    uint32_t offset{0};
+    uint32_t count{0};
+};
+
+// Renderer-wide device local vertex and index buffers, meshes being sub-allocated ranges in them.
+// There is one arena per vertex format and per index type, so a range offset is always a whole number of elements:
+// meshes are drawn with drawIndexed(indexCount, 1, firstIndex = index range offset, vertexOffset = vertex range
+// offset), and the buffers only need to be bound again when the vertex format or index type changes.
+// Freed ranges go back to a free list (coalesced with their neighbours) and are reused first fit.
+class GeometryBuffer
+{
+  public:
+    // Size of an arena when first used, in elements. Arenas then grow by doubling.
+    static constexpr uint32_t INITIAL_CAPACITY = 256 * 1024;
+
+    GeometryBuffer() = default;
+    GeometryBuffer(const GeometryBuffer &) = delete;
+    GeometryBuffer &operator=(const GeometryBuffer &) = delete;
+
+    void create(DeviceMemoryAllocator &memoryAllocatorP, vk::Queue transferQueueP,
+                vk::CommandPool transferCommandPoolP);
+    void destroy();
+
+    // Growing an arena replaces its buffer: the content is moved over by a copy submitted to the queue right away,
+    // without waiting, ordered before any later submission (uploads, frames). The old buffer is kept until the copy
+    // is complete, frames submitted earlier being complete then too. Reserve every range of a batch first, so that
+    // no buffer is replaced while uploads to it are staged.
+    void reserveVertices(VertexFormat vertexFormat, uint32_t count);
+    void reserveIndices(vk::IndexType indexType, uint32_t count);
+    // Destroy the buffers replaced by growing whose copy is complete, all of them waiting for it if wait is set
+    void releaseReplacedBuffers(bool wait);
+
+    GeometryRange allocateVertices(VertexFormat vertexFormat, uint32_t count);
+    GeometryRange allocateIndices(vk::IndexType indexType, uint32_t count);
+    void freeVertices(VertexFormat vertexFormat, const GeometryRange &range);
+    void freeIndices(vk::IndexType indexType, const GeometryRange &range);
+
+    vk::Buffer getVertexBuffer(VertexFormat vertexFormat) const
+    {
+        return arenas[getVertexArenaIndex(vertexFormat)].buffer;
+    }
+    vk::Buffer getIndexBuffer(vk::IndexType indexType) const
+    {
+        return arenas[getIndexArenaIndex(indexType)].buffer;
+    }
+    // Byte offset of a range start, for uploads
+    vk::DeviceSize getVertexByteOffset(VertexFormat vertexFormat, const GeometryRange &range) const
+    {
+        return range.offset * arenas[getVertexArenaIndex(vertexFormat)].stride;
+    }
+    vk::DeviceSize getIndexByteOffset(vk::IndexType indexType, const GeometryRange &range) const
+    {
+        return range.offset * arenas[getIndexArenaIndex(indexType)].stride;
+    }
+
+    // Bytes in allocated ranges, and bytes of device memory held by the arenas
+    vk::DeviceSize getAllocatedBytes() const;
+    vk::DeviceSize getCapacityBytes() const;
+    // Bytes moved by the GPU from replaced buffers so far, for upload budgets
+    vk::DeviceSize getGrowCopiedBytes() const
+    {
+        return growCopiedBytes;
+    }
+
+  private:
+    struct Arena
+    {
+        vk::Buffer buffer;
+        MemoryAllocation memory;
+        vk::BufferUsageFlags usage;
+        vk::DeviceSize stride{0};
+        uint32_t capacity{0};
+        uint32_t allocated{0};
+        std::map<uint32_t, uint32_t> freeBlocks; // Offset to count, never two adjacent blocks
+    };
+
+    enum ArenaIndex
+    {
+        FULL_VERTICES,
+        PACKED_VERTICES,
+        INDICES_16,
+        INDICES_32,
+        ARENA_COUNT
+    };
+
+    // Buffer replaced by grow(), read by its copy in flight
+    struct ReplacedBuffer
+    {
+        vk::Buffer buffer;
+        MemoryAllocation memory;
+        vk::CommandBuffer copyCommandBuffer;
+        vk::Fence copyFence;
+    };
+
+    DeviceMemoryAllocator *memoryAllocator{nullptr};
+    vk::Device device;
+    vk::Queue transferQueue;
+    vk::CommandPool transferCommandPool;
+    Arena arenas[ARENA_COUNT];
+    std::vector<ReplacedBuffer> replacedBuffers;
+    vk::DeviceSize growCopiedBytes{0};
+
+    static size_t getVertexArenaIndex(VertexFormat vertexFormat)
+    {
+        return vertexFormat == VertexFormat::Packed ? PACKED_VERTICES : FULL_VERTICES;
+    }
+    static size_t getIndexArenaIndex(vk::IndexType indexType)
+    {
+        return indexType == vk::IndexType::eUint16 ? INDICES_16 : INDICES_32;
+    }
+
+    void reserve(Arena &arena, uint32_t count);
+    GeometryRange allocate(Arena &arena, uint32_t count);
+    void free(Arena &arena, const GeometryRange &range);
+    void insertFreeBlock(Arena &arena, uint32_t offset, uint32_t count);
+    void grow(Arena &arena, uint32_t minimumCapacity);
+};
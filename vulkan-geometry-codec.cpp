@@ -0,0 +1,532 @@
+#include "vulkan-geometry-codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static constexpr uint8_t VERTEX_CODEC_VERSION = 2;
+static constexpr uint8_t INDEX_CODEC_VERSION = 1;
+static constexpr uint32_t VERTEX_WORDS = sizeof(Vertex) / sizeof(uint32_t);
+static_assert(sizeof(Vertex) % 16 == 0, "Vertices are interleaved back four words at a time");
+
+// Bytes taken by a group of 16 bytes of a plane, by mode: all zero, 2, 4 and 8 bits per byte
+static const size_t GROUP_SIZES[4] = {0, 4, 8, 16};
+
+static uint32_t zigzag(uint32_t value)
+{
+    return (value << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(value) >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value)
+{
+    return (value >> 1) ^ (0u - (value & 1));
+}
+
+// Groups of a byte plane after a 32 bits header giving the mode of each group, 2 bits per group
+static void encodeBytePlane(const uint8_t *bytes, size_t groupCount, std::vector<uint8_t> &data)
+{
+    size_t headerOffset = data.size();
+    data.resize(headerOffset + sizeof(uint32_t));
+    uint32_t header = 0;
+    for (size_t group = 0; group < groupCount; ++group)
+    {
+        const uint8_t *groupBytes = bytes + group * 16;
+        uint8_t maxByte = *std::max_element(groupBytes, groupBytes + 16);
+        uint32_t mode = maxByte == 0 ? 0 : maxByte < 4 ? 1 : maxByte < 16 ? 2 : 3;
+        header |= mode << (2 * group);
+        if (mode == 1)
+        {
+            for (int i = 0; i < 16; i += 4)
+            {
+                data.push_back(static_cast<uint8_t>(groupBytes[i] | groupBytes[i + 1] << 2 | groupBytes[i + 2] << 4 |
+                                                    groupBytes[i + 3] << 6));
+            }
+        }
+        else if (mode == 2)
+        {
+            for (int i = 0; i < 16; i += 2)
+            {
+                data.push_back(static_cast<uint8_t>(groupBytes[i] | groupBytes[i + 1] << 4));
+            }
+        }
+        else if (mode == 3)
+        {
+            data.insert(data.end(), groupBytes, groupBytes + 16);
+        }
+    }
+    memcpy(&data[headerOffset], &header, sizeof(uint32_t));
+}
+
+// Unpack groupCount groups of a byte plane to bytes, returns the size read from data, 0 if it runs past size
+static size_t decodeBytePlane(const uint8_t *data, size_t size, size_t groupCount, uint8_t *bytes)
+{
+    if (size < sizeof(uint32_t))
+    {
+        return 0;
+    }
+    uint32_t header;
+    memcpy(&header, data, sizeof(uint32_t));
+    size_t planeSize = sizeof(uint32_t);
+    for (size_t group = 0; group < groupCount; ++group)
+    {
+        planeSize += GROUP_SIZES[(header >> (2 * group)) & 3];
+    }
+    if (planeSize > size)
+    {
+        return 0;
+    }
+
+    const uint8_t *groupData = data + sizeof(uint32_t);
+    for (size_t group = 0; group < groupCount; ++group)
+    {
+        uint32_t mode = (header >> (2 * group)) & 3;
+        uint8_t *groupBytes = bytes + group * 16;
+#if defined(__SSE2__)
+        // Fields are spread to bytes by shifting whole 16 bits lanes, the mask drops what came from the other byte
+        __m128i unpacked;
+        if (mode == 0)
+        {
+            unpacked = _mm_setzero_si128();
+        }
+        else if (mode == 1)
+        {
+            int32_t packed;
+            memcpy(&packed, groupData, sizeof(int32_t));
+            __m128i fields = _mm_cvtsi32_si128(packed);
+            __m128i mask = _mm_set1_epi8(3);
+            __m128i first = _mm_and_si128(fields, mask);
+            __m128i second = _mm_and_si128(_mm_srli_epi16(fields, 2), mask);
+            __m128i third = _mm_and_si128(_mm_srli_epi16(fields, 4), mask);
+            __m128i fourth = _mm_and_si128(_mm_srli_epi16(fields, 6), mask);
+            unpacked = _mm_unpacklo_epi16(_mm_unpacklo_epi8(first, second), _mm_unpacklo_epi8(third, fourth));
+        }
+        else if (mode == 2)
+        {
+            __m128i fields = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(groupData));
+            __m128i mask = _mm_set1_epi8(15);
+            unpacked = _mm_unpacklo_epi8(_mm_and_si128(fields, mask), _mm_and_si128(_mm_srli_epi16(fields, 4), mask));
+        }
+        else
+        {
+            unpacked = _mm_loadu_si128(reinterpret_cast<const __m128i *>(groupData));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(groupBytes), unpacked);
+#else
+        if (mode == 0)
+        {
+            memset(groupBytes, 0, 16);
+        }
+        else if (mode == 3)
+        {
+            memcpy(groupBytes, groupData, 16);
+        }
+        else
+        {
+            uint32_t bits = mode == 1 ? 2 : 4;
+            uint32_t mask = (1u << bits) - 1;
+            for (uint32_t i = 0; i < 16; ++i)
+            {
+                groupBytes[i] = (groupData[i * bits / 8] >> (i * bits % 8)) & mask;
+            }
+        }
+#endif
+        groupData += GROUP_SIZES[mode];
+    }
+    return planeSize;
+}
+
+// Words of a column from its 4 byte planes: undo the zigzag and delta coding, previous being the word before the
+// first one. Returns the last word, padding vertices decoding to copies of it.
+static uint32_t decodeColumn(const uint8_t planes[4][GeometryCodec::VERTEX_BLOCK_SIZE], size_t groupCount,
+                             uint32_t previous, uint32_t *words)
+{
+#if defined(__SSE2__)
+    __m128i carry = _mm_set1_epi32(static_cast<int32_t>(previous));
+    __m128i one = _mm_set1_epi32(1);
+    for (size_t group = 0; group < groupCount; ++group)
+    {
+        // Bytes of 16 words, interleaved back into the words
+        const __m128i *planeBytes[4];
+        for (int byte = 0; byte < 4; ++byte)
+        {
+            planeBytes[byte] = reinterpret_cast<const __m128i *>(planes[byte] + group * 16);
+        }
+        __m128i low01 = _mm_unpacklo_epi8(_mm_load_si128(planeBytes[0]), _mm_load_si128(planeBytes[1]));
+        __m128i high01 = _mm_unpackhi_epi8(_mm_load_si128(planeBytes[0]), _mm_load_si128(planeBytes[1]));
+        __m128i low23 = _mm_unpacklo_epi8(_mm_load_si128(planeBytes[2]), _mm_load_si128(planeBytes[3]));
+        __m128i high23 = _mm_unpackhi_epi8(_mm_load_si128(planeBytes[2]), _mm_load_si128(planeBytes[3]));
+        __m128i quads[4] = {_mm_unpacklo_epi16(low01, low23), _mm_unpackhi_epi16(low01, low23),
+                            _mm_unpacklo_epi16(high01, high23), _mm_unpackhi_epi16(high01, high23)};
+        for (int quad = 0; quad < 4; ++quad)
+        {
+            __m128i delta = _mm_xor_si128(_mm_srli_epi32(quads[quad], 1),
+                                          _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(quads[quad], one)));
+            // Prefix sum of the 4 deltas in two steps, on top of the last word of the previous quad
+            delta = _mm_add_epi32(delta, _mm_slli_si128(delta, 4));
+            delta = _mm_add_epi32(delta, _mm_slli_si128(delta, 8));
+            __m128i word = _mm_add_epi32(delta, carry);
+            _mm_store_si128(reinterpret_cast<__m128i *>(words + group * 16 + quad * 4), word);
+            carry = _mm_shuffle_epi32(word, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+    }
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(carry));
+#else
+    for (size_t i = 0; i < groupCount * 16; ++i)
+    {
+        uint32_t zigzagged = planes[0][i] | planes[1][i] << 8 | planes[2][i] << 16 | uint32_t(planes[3][i]) << 24;
+        previous += unzigzag(zigzagged);
+        words[i] = previous;
+    }
+    return previous;
+#endif
+}
+
+// Columns of vertexCount vertices back to interleaved vertices
+static void interleaveColumns(const uint32_t columns[VERTEX_WORDS][GeometryCodec::VERTEX_BLOCK_SIZE],
+                              size_t vertexCount, uint8_t *vertices)
+{
+    size_t vertex = 0;
+#if defined(__SSE2__)
+    // 4x4 words transposes: 4 vertices by 4 words
+    for (; vertex + 4 <= vertexCount; vertex += 4)
+    {
+        for (uint32_t column = 0; column < VERTEX_WORDS; column += 4)
+        {
+            __m128 rows[4];
+            for (int i = 0; i < 4; ++i)
+            {
+                const __m128i *words = reinterpret_cast<const __m128i *>(&columns[column + i][vertex]);
+                rows[i] = _mm_castsi128_ps(_mm_load_si128(words));
+            }
+            _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+            for (int i = 0; i < 4; ++i)
+            {
+                float *words = reinterpret_cast<float *>(vertices + (vertex + i) * sizeof(Vertex) + column * 4);
+                _mm_storeu_ps(words, rows[i]);
+            }
+        }
+    }
+#endif
+    for (; vertex < vertexCount; ++vertex)
+    {
+        for (uint32_t column = 0; column < VERTEX_WORDS; ++column)
+        {
+            memcpy(vertices + vertex * sizeof(Vertex) + column * 4, &columns[column][vertex], sizeof(uint32_t));
+        }
+    }
+}
+
+std::vector<uint8_t> GeometryCodec::encodeVertices(const Vertex *vertices, size_t vertexCount)
+{
+    // Version and vertex count, which the byte planes only give to a group of 16 vertices
+    std::vector<uint8_t> data{VERTEX_CODEC_VERSION};
+    uint32_t count = static_cast<uint32_t>(vertexCount);
+    data.resize(1 + sizeof(uint32_t));
+    memcpy(&data[1], &count, sizeof(uint32_t));
+    const uint8_t *vertexBytes = reinterpret_cast<const uint8_t *>(vertices);
+    uint32_t previous[VERTEX_WORDS] = {};
+    // Padding after the last vertex is zero deltas
+    uint8_t planes[4][VERTEX_BLOCK_SIZE];
+    for (size_t blockStart = 0; blockStart < vertexCount; blockStart += VERTEX_BLOCK_SIZE)
+    {
+        size_t blockCount = std::min<size_t>(VERTEX_BLOCK_SIZE, vertexCount - blockStart);
+        size_t groupCount = (blockCount + 15) / 16;
+        for (uint32_t column = 0; column < VERTEX_WORDS; ++column)
+        {
+            memset(planes, 0, sizeof(planes));
+            for (size_t i = 0; i < blockCount; ++i)
+            {
+                uint32_t word;
+                memcpy(&word, vertexBytes + (blockStart + i) * sizeof(Vertex) + column * 4, sizeof(uint32_t));
+                uint32_t zigzagged = zigzag(word - previous[column]);
+                previous[column] = word;
+                for (int byte = 0; byte < 4; ++byte)
+                {
+                    planes[byte][i] = static_cast<uint8_t>(zigzagged >> (8 * byte));
+                }
+            }
+            for (int byte = 0; byte < 4; ++byte)
+            {
+                encodeBytePlane(planes[byte], groupCount, data);
+            }
+        }
+    }
+    return data;
+}
+
+bool GeometryCodec::decodeVertices(Vertex *vertices, size_t vertexCount, const uint8_t *data, size_t size)
+{
+    if (size < 1 + sizeof(uint32_t) || data[0] != VERTEX_CODEC_VERSION)
+    {
+        return false;
+    }
+    uint32_t count;
+    memcpy(&count, data + 1, sizeof(uint32_t));
+    if (count != vertexCount)
+    {
+        return false;
+    }
+    size_t offset = 1 + sizeof(uint32_t);
+    alignas(16) uint8_t planes[4][VERTEX_BLOCK_SIZE];
+    alignas(16) uint32_t columns[VERTEX_WORDS][VERTEX_BLOCK_SIZE];
+    uint32_t previous[VERTEX_WORDS] = {};
+    uint8_t *vertexBytes = reinterpret_cast<uint8_t *>(vertices);
+    for (size_t blockStart = 0; blockStart < vertexCount; blockStart += VERTEX_BLOCK_SIZE)
+    {
+        size_t blockCount = std::min<size_t>(VERTEX_BLOCK_SIZE, vertexCount - blockStart);
+        size_t groupCount = (blockCount + 15) / 16;
+        for (uint32_t column = 0; column < VERTEX_WORDS; ++column)
+        {
+            for (int byte = 0; byte < 4; ++byte)
+            {
+                size_t planeSize = decodeBytePlane(data + offset, size - offset, groupCount, planes[byte]);
+                if (planeSize == 0)
+                {
+                    return false;
+                }
+                offset += planeSize;
+            }
+            previous[column] = decodeColumn(planes, groupCount, previous[column], columns[column]);
+        }
+        interleaveColumns(columns, blockCount, vertexBytes + blockStart * sizeof(Vertex));
+    }
+    return offset == size;
+}
+
+// Recent edges and vertices, updated the same way by the encoder and the decoder. Empty slots hold an invalid
+// vertex, which the decoder rejects.
+struct IndexCodingState
+{
+    uint32_t edges[GeometryCodec::EDGE_FIFO_SIZE][2];
+    uint32_t vertices[GeometryCodec::VERTEX_FIFO_SIZE];
+    uint32_t edgeOffset{0};
+    uint32_t vertexOffset{0};
+    uint32_t next{0}; // Lowest vertex never coded as next
+    uint32_t last{0}; // Previous vertex, base of the explicit deltas
+
+    IndexCodingState()
+    {
+        memset(edges, 0xff, sizeof(edges));
+        memset(vertices, 0xff, sizeof(vertices));
+    }
+
+    // Edges are stored the way a neighbour going around the same way sees them: reversed
+    void pushTriangle(uint32_t a, uint32_t b, uint32_t c)
+    {
+        uint32_t corners[3] = {a, b, c};
+        for (int i = 0; i < 3; ++i)
+        {
+            edges[edgeOffset][0] = corners[(i + 1) % 3];
+            edges[edgeOffset][1] = corners[i];
+            edgeOffset = edgeOffset + 1 == GeometryCodec::EDGE_FIFO_SIZE ? 0 : edgeOffset + 1;
+        }
+    }
+    void pushVertex(uint32_t vertex)
+    {
+        vertices[vertexOffset] = vertex;
+        vertexOffset = vertexOffset + 1 == GeometryCodec::VERTEX_FIFO_SIZE ? 0 : vertexOffset + 1;
+    }
+};
+
+static void writeVarint(std::vector<uint8_t> &data, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        data.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back(static_cast<uint8_t>(value));
+}
+
+static bool readVarint(const uint8_t *&data, const uint8_t *end, uint32_t &value)
+{
+    value = 0;
+    for (uint32_t shift = 0; shift < 35 && data < end; shift += 7)
+    {
+        uint8_t byte = *data++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<uint8_t> GeometryCodec::encodeIndices(const uint32_t *indices, size_t indexCount)
+{
+    if (indexCount % 3 != 0)
+    {
+        throw std::runtime_error("Only triangle lists can be encoded");
+    }
+
+    IndexCodingState state;
+    std::vector<uint8_t> codes;
+    std::vector<uint8_t> deltas;
+    codes.reserve(indexCount / 3 + indexCount / 12);
+    // Code nibble of a vertex: 0 for next, 1 + slot in the vertex FIFO, 15 for a delta
+    auto encodeVertex = [&](uint32_t vertex) {
+        uint32_t code = 15;
+        if (vertex == state.next)
+        {
+            code = 0;
+            state.next++;
+            state.pushVertex(vertex);
+        }
+        else
+        {
+            const uint32_t *slot = std::find(state.vertices, state.vertices + VERTEX_FIFO_SIZE, vertex);
+            if (slot != state.vertices + VERTEX_FIFO_SIZE)
+            {
+                code = 1 + static_cast<uint32_t>(slot - state.vertices);
+            }
+            else
+            {
+                writeVarint(deltas, zigzag(vertex - state.last));
+                state.pushVertex(vertex);
+            }
+        }
+        state.last = vertex;
+        return code;
+    };
+
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        uint32_t triangle[3] = {indices[i], indices[i + 1], indices[i + 2]};
+        // Any of the three edges may be shared, the triangle is rotated to start with it
+        uint32_t edge = EDGE_FIFO_SIZE;
+        for (int rotation = 0; rotation < 3 && edge == EDGE_FIFO_SIZE; ++rotation)
+        {
+            for (uint32_t slot = 0; slot < EDGE_FIFO_SIZE; ++slot)
+            {
+                if (state.edges[slot][0] == triangle[rotation] && state.edges[slot][1] == triangle[(rotation + 1) % 3])
+                {
+                    edge = slot;
+                    std::rotate(triangle, triangle + rotation, triangle + 3);
+                    break;
+                }
+            }
+        }
+
+        if (edge < EDGE_FIFO_SIZE)
+        {
+            codes.push_back(static_cast<uint8_t>(edge << 4 | encodeVertex(triangle[2])));
+        }
+        else
+        {
+            uint32_t firstCode = encodeVertex(triangle[0]);
+            uint32_t secondCode = encodeVertex(triangle[1]);
+            uint32_t thirdCode = encodeVertex(triangle[2]);
+            codes.push_back(static_cast<uint8_t>(0xf0 | firstCode));
+            codes.push_back(static_cast<uint8_t>(secondCode << 4 | thirdCode));
+        }
+        state.pushTriangle(triangle[0], triangle[1], triangle[2]);
+    }
+
+    // Version, code size, codes then deltas
+    std::vector<uint8_t> data{INDEX_CODEC_VERSION};
+    uint32_t codeSize = static_cast<uint32_t>(codes.size());
+    data.resize(1 + sizeof(uint32_t));
+    memcpy(&data[1], &codeSize, sizeof(uint32_t));
+    data.insert(data.end(), codes.begin(), codes.end());
+    data.insert(data.end(), deltas.begin(), deltas.end());
+    return data;
+}
+
+template <typename IndexType>
+static bool decodeIndexStream(IndexType *indices, size_t indexCount, size_t vertexCount, const uint8_t *data,
+                              size_t size)
+{
+    if (indexCount % 3 != 0 || size < 1 + sizeof(uint32_t) || data[0] != INDEX_CODEC_VERSION)
+    {
+        return false;
+    }
+    uint32_t codeSize;
+    memcpy(&codeSize, data + 1, sizeof(uint32_t));
+    if (codeSize > size - 1 - sizeof(uint32_t))
+    {
+        return false;
+    }
+    const uint8_t *code = data + 1 + sizeof(uint32_t);
+    const uint8_t *codeEnd = code + codeSize;
+    const uint8_t *delta = codeEnd;
+    const uint8_t *deltaEnd = data + size;
+
+    IndexCodingState state;
+    bool isValid = true;
+    auto decodeVertex = [&](uint32_t vertexCode) {
+        uint32_t vertex;
+        if (vertexCode == 0)
+        {
+            vertex = state.next++;
+            state.pushVertex(vertex);
+        }
+        else if (vertexCode < 15)
+        {
+            vertex = state.vertices[vertexCode - 1];
+        }
+        else
+        {
+            uint32_t zigzagged = 0;
+            isValid = isValid && readVarint(delta, deltaEnd, zigzagged);
+            vertex = state.last + unzigzag(zigzagged);
+            state.pushVertex(vertex);
+        }
+        state.last = vertex;
+        return vertex;
+    };
+
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        if (code == codeEnd)
+        {
+            return false;
+        }
+        uint32_t triangleCode = *code++;
+        uint32_t a;
+        uint32_t b;
+        uint32_t c;
+        if ((triangleCode >> 4) < GeometryCodec::EDGE_FIFO_SIZE)
+        {
+            a = state.edges[triangleCode >> 4][0];
+            b = state.edges[triangleCode >> 4][1];
+            c = decodeVertex(triangleCode & 15);
+        }
+        else
+        {
+            if (code == codeEnd)
+            {
+                return false;
+            }
+            uint32_t secondCode = *code++;
+            a = decodeVertex(triangleCode & 15);
+            b = decodeVertex(secondCode >> 4);
+            c = decodeVertex(secondCode & 15);
+        }
+        if (!isValid || a >= vertexCount || b >= vertexCount || c >= vertexCount)
+        {
+            return false;
+        }
+        indices[i] = static_cast<IndexType>(a);
+        indices[i + 1] = static_cast<IndexType>(b);
+        indices[i + 2] = static_cast<IndexType>(c);
+        state.pushTriangle(a, b, c);
+    }
+    return code == codeEnd && delta == deltaEnd;
+}
+
+bool GeometryCodec::decodeIndices(uint32_t *indices, size_t indexCount, size_t vertexCount, const uint8_t *data,
+                                  size_t size)
+{
+    return decodeIndexStream(indices, indexCount, vertexCount, data, size);
+}
+
+bool GeometryCodec::decodeIndices(uint16_t *indices, size_t indexCount, size_t vertexCount, const uint8_t *data,
+                                  size_t size)
+{
+    return vertexCount <= UINT16_MAX + 1 && decodeIndexStream(indices, indexCount, vertexCount, data, size);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "vulkan-mesh.h"
+
+// Lossless compression of mesh cache geometry, decoded on the way to staging.
+//
+// Vertices: a Vertex is seen as 32 bits words. Each word is delta coded against the same word of the previous
+// vertex then zigzag coded, so that the close neighbours left by the vertex fetch ordering give small values,
+// and the words of a block of vertices are split in byte planes. A plane is stored as groups of 16 bytes, each
+// with the fewest bits per byte that fit it: 0 (e.g. the constant color), 2, 4 or 8. Decoding is a few SSE2
+// shuffles per group, then a prefix sum and a transpose back to interleaved vertices.
+//
+// Indices: triangle lists, coded a triangle at a time. A triangle sharing an edge with one of the last triangles
+// refers to it in a FIFO of edges and only codes its third vertex, the others code all three (the triangle may be
+// rotated, its winding is kept). A vertex is the next one never used so far, the common case in vertex fetch
+// order, one of a FIFO of recent vertices, or a varint delta from the previous vertex. That makes one code byte
+// per triangle, two without a shared edge, and a few varints.
+class GeometryCodec
+{
+  public:
+    // Vertices decoded together through structure of arrays scratch
+    static constexpr uint32_t VERTEX_BLOCK_SIZE = 256;
+    // A FIFO slot is a nibble of the triangle code, the remaining values mean no edge or vertex there
+    static constexpr uint32_t EDGE_FIFO_SIZE = 15;
+    static constexpr uint32_t VERTEX_FIFO_SIZE = 14;
+
+    static std::vector<uint8_t> encodeVertices(const Vertex *vertices, size_t vertexCount);
+    // Returns false when data is not a stream of exactly vertexCount vertices
+    static bool decodeVertices(Vertex *vertices, size_t vertexCount, const uint8_t *data, size_t size);
+
+    // Throws std::runtime_error when indexCount is not a multiple of 3
+    static std::vector<uint8_t> encodeIndices(const uint32_t *indices, size_t indexCount);
+    // Returns false when data is not a stream of exactly indexCount indices, all below vertexCount.
+    // The 16 bits version narrows on the fly, for meshes using 16 bits indices (see VulkanMesh::chooseIndexType).
+    static bool decodeIndices(uint32_t *indices, size_t indexCount, size_t vertexCount, const uint8_t *data,
+                              size_t size);
+    static bool decodeIndices(uint16_t *indices, size_t indexCount, size_t vertexCount, const uint8_t *data,
+                              size_t size);
+};
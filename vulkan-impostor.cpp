@@ -0,0 +1,78 @@
+#include "vulkan-impostor.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+static constexpr float PI = 3.14159265358979f;
+
+glm::vec3 ImpostorAtlas::getViewDirection(uint32_t column, uint32_t row)
+{
+    // Elevations at the middle of their band, from -90 degrees (below) on the first row to 90 on the last
+    float azimuth = column * 2.0f * PI / AZIMUTH_COUNT;
+    float elevation = -0.5f * PI + (row + 0.5f) * PI / ELEVATION_COUNT;
+    return glm::vec3(std::cos(elevation) * std::sin(azimuth), std::sin(elevation),
+                     std::cos(elevation) * std::cos(azimuth));
+}
+
+void ImpostorAtlas::findCell(const glm::vec3 &direction, uint32_t *column, uint32_t *row)
+{
+    glm::vec3 unitDirection = glm::length(direction) > 0.0f ? glm::normalize(direction) : glm::vec3(0.0f, 0.0f, 1.0f);
+    float azimuth = std::atan2(unitDirection.x, unitDirection.z);
+    float elevation = std::asin(std::max(-1.0f, std::min(unitDirection.y, 1.0f)));
+    int azimuthStep = static_cast<int>(std::lround(azimuth * AZIMUTH_COUNT / (2.0f * PI)));
+    *column = static_cast<uint32_t>((azimuthStep % static_cast<int>(AZIMUTH_COUNT) + AZIMUTH_COUNT) % AZIMUTH_COUNT);
+    int elevationBand = static_cast<int>((elevation + 0.5f * PI) * ELEVATION_COUNT / PI);
+    *row = static_cast<uint32_t>(std::max(0, std::min(elevationBand, static_cast<int>(ELEVATION_COUNT) - 1)));
+}
+
+glm::mat4 ImpostorAtlas::getViewProjection(uint32_t column, uint32_t row, const glm::vec3 &center, float radius)
+{
+    // Eye two radii away: the sphere spans [radius, 3 * radius] in depth, and [-radius, radius] across
+    radius = std::max(radius, 1e-6f);
+    glm::vec3 eye = center + getViewDirection(column, row) * (2.0f * radius);
+    glm::mat4 view = glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // Orthographic, y downward and depth in [0, 1] as Vulkan expects
+    float near = radius;
+    float far = 3.0f * radius;
+    glm::mat4 projection(1.0f);
+    projection[0][0] = 1.0f / radius;
+    projection[1][1] = -1.0f / radius;
+    projection[2][2] = -1.0f / (far - near);
+    projection[3][2] = -near / (far - near);
+    return projection * view;
+}
+
+ImpostorInstance ImpostorAtlas::getInstance(const glm::mat4 &modelMatrix, const glm::vec3 &center, float radius,
+                                            const glm::vec3 &cameraPosition)
+{
+    glm::mat3 rotation(modelMatrix);
+    glm::vec3 forward = center - cameraPosition;
+    forward = glm::length(forward) > 0.0f ? glm::normalize(forward) : glm::vec3(0.0f, 0.0f, -1.0f);
+
+    // Same axes as the lookAt of the baked views, with the model's up instead of the model space +Y
+    glm::vec3 modelUp = glm::normalize(rotation * glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::vec3 right = glm::cross(forward, modelUp);
+    if (glm::length(right) < 1e-4f)
+    {
+        // Looking along the up axis, any right axis does
+        right = glm::cross(forward, std::abs(forward.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                                              : glm::vec3(0.0f, 0.0f, 1.0f));
+    }
+    right = glm::normalize(right);
+    glm::vec3 up = glm::cross(right, forward);
+
+    uint32_t column;
+    uint32_t row;
+    findCell(glm::inverse(rotation) * (cameraPosition - center), &column, &row);
+
+    ImpostorInstance instance;
+    instance.centerRadius = glm::vec4(center, radius);
+    instance.right = glm::vec4(right, 0.0f);
+    instance.up = glm::vec4(up, 0.0f);
+    instance.cellRect = glm::vec4(static_cast<float>(column) / AZIMUTH_COUNT, static_cast<float>(row) / ELEVATION_COUNT,
+                                  1.0f / AZIMUTH_COUNT, 1.0f / ELEVATION_COUNT);
+    return instance;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+// One camera-facing quad of the instanced impostor draw, read per instance by shaders/impostor.vert
+struct ImpostorInstance
+{
+    glm::vec4 centerRadius; // World space bounding sphere of the model
+    glm::vec4 right;        // World space axes of the quad, unit vectors
+    glm::vec4 up;
+    glm::vec4 cellRect; // Atlas cell, uv offset in xy and uv size in zw
+};
+
+// Layout of a multi-view impostor atlas: a cell per view of the model, columns going around it (azimuths) and rows
+// from below to above it (elevations). Each view is an orthographic projection of the bounding sphere of the model
+// towards its center, with the model's +Y axis up. Poles are never looked at straight on, so up is always defined.
+class ImpostorAtlas
+{
+  public:
+    static constexpr uint32_t AZIMUTH_COUNT = 16;
+    static constexpr uint32_t ELEVATION_COUNT = 8;
+    static constexpr uint32_t CELL_SIZE = 128; // In pixels, models covering less on screen switch to their impostor
+    static constexpr uint32_t WIDTH = AZIMUTH_COUNT * CELL_SIZE;
+    static constexpr uint32_t HEIGHT = ELEVATION_COUNT * CELL_SIZE;
+
+    // Model space unit vector from the center of the model towards the camera of a cell
+    static glm::vec3 getViewDirection(uint32_t column, uint32_t row);
+    // Cell looking from the closest direction to direction, in model space and not necessarily normalized
+    static void findCell(const glm::vec3 &direction, uint32_t *column, uint32_t *row);
+    // Projection times view of a cell, in Vulkan clip space, for a model bounded by (center, radius)
+    static glm::mat4 getViewProjection(uint32_t column, uint32_t row, const glm::vec3 &center, float radius);
+    // Quad of a model drawn with modelMatrix, (center, radius) being its bounding sphere in world space: facing the
+    // camera, its up axis along the model's +Y, textured with the cell of the closest view
+    static ImpostorInstance getInstance(const glm::mat4 &modelMatrix, const glm::vec3 &center, float radius,
+                                        const glm::vec3 &cameraPosition);
+};
@@ -0,0 +1,503 @@
+#include "vulkan-memory-allocator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+TlsfAllocator::TlsfAllocator(uint64_t sizeP) : size(sizeP), freeBytes(sizeP)
+{
+    for (auto &lists : freeLists)
+    {
+        std::fill(std::begin(lists), std::end(lists), NO_NODE);
+    }
+    uint32_t node = createNode(0, size);
+    insertFreeNode(node);
+}
+
+static uint32_t getMostSignificantBit(uint64_t value)
+{
+    return 63 - static_cast<uint32_t>(__builtin_clzll(value));
+}
+
+void TlsfAllocator::mapSize(uint64_t size, uint32_t *firstLevel, uint32_t *secondLevel)
+{
+    if (size < SMALL_SIZE)
+    {
+        *firstLevel = 0;
+        *secondLevel = static_cast<uint32_t>(size / (SMALL_SIZE / SECOND_LEVEL_COUNT));
+        return;
+    }
+    // Power of two, then the next SECOND_LEVEL_LOG2 bits below it as linear step
+    uint32_t bit = getMostSignificantBit(size);
+    *firstLevel = bit - SMALL_SIZE_LOG2 + 1;
+    *secondLevel = static_cast<uint32_t>(size >> (bit - SECOND_LEVEL_LOG2)) ^ SECOND_LEVEL_COUNT;
+}
+
+uint32_t TlsfAllocator::findFreeNode(uint64_t size) const
+{
+    // Rounded up to the next size class: any range of that class or above fits, the first one is taken
+    uint64_t step = size < SMALL_SIZE ? SMALL_SIZE / SECOND_LEVEL_COUNT
+                                      : uint64_t(1) << (getMostSignificantBit(size) - SECOND_LEVEL_LOG2);
+    if (size > UINT64_MAX - step)
+    {
+        return NO_NODE;
+    }
+    uint32_t firstLevel;
+    uint32_t secondLevel;
+    mapSize(size + step - 1, &firstLevel, &secondLevel);
+
+    uint32_t secondLevelBitmap = secondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+    if (!secondLevelBitmap)
+    {
+        // None in this power of two, take the smallest non empty list of a larger one
+        uint64_t firstLevelBitmap = this->firstLevelBitmap & (~uint64_t(0) << (firstLevel + 1));
+        if (!firstLevelBitmap)
+        {
+            return NO_NODE;
+        }
+        firstLevel = static_cast<uint32_t>(__builtin_ctzll(firstLevelBitmap));
+        secondLevelBitmap = secondLevelBitmaps[firstLevel];
+    }
+    secondLevel = static_cast<uint32_t>(__builtin_ctz(secondLevelBitmap));
+    return freeLists[firstLevel][secondLevel];
+}
+
+uint32_t TlsfAllocator::createNode(uint64_t offset, uint64_t size)
+{
+    uint32_t node;
+    if (!unusedNodes.empty())
+    {
+        node = unusedNodes.back();
+        unusedNodes.pop_back();
+    }
+    else
+    {
+        node = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+    }
+    nodes[node] = Node{offset, size, NO_NODE, NO_NODE, NO_NODE, NO_NODE, true};
+    return node;
+}
+
+void TlsfAllocator::insertFreeNode(uint32_t node)
+{
+    uint32_t firstLevel;
+    uint32_t secondLevel;
+    mapSize(nodes[node].size, &firstLevel, &secondLevel);
+    uint32_t &head = freeLists[firstLevel][secondLevel];
+    nodes[node].free = true;
+    nodes[node].previousFree = NO_NODE;
+    nodes[node].nextFree = head;
+    if (head != NO_NODE)
+    {
+        nodes[head].previousFree = node;
+    }
+    head = node;
+    firstLevelBitmap |= uint64_t(1) << firstLevel;
+    secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+}
+
+void TlsfAllocator::removeFreeNode(uint32_t node)
+{
+    uint32_t firstLevel;
+    uint32_t secondLevel;
+    mapSize(nodes[node].size, &firstLevel, &secondLevel);
+    Node &removed = nodes[node];
+    if (removed.previousFree != NO_NODE)
+    {
+        nodes[removed.previousFree].nextFree = removed.nextFree;
+    }
+    else
+    {
+        freeLists[firstLevel][secondLevel] = removed.nextFree;
+    }
+    if (removed.nextFree != NO_NODE)
+    {
+        nodes[removed.nextFree].previousFree = removed.previousFree;
+    }
+    removed.free = false;
+
+    if (freeLists[firstLevel][secondLevel] == NO_NODE)
+    {
+        secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+        if (!secondLevelBitmaps[firstLevel])
+        {
+            firstLevelBitmap &= ~(uint64_t(1) << firstLevel);
+        }
+    }
+}
+
+void TlsfAllocator::splitFront(uint32_t node, uint64_t size)
+{
+    uint32_t front = createNode(nodes[node].offset, size);
+    uint32_t previous = nodes[node].previousPhysical;
+    nodes[front].previousPhysical = previous;
+    nodes[front].nextPhysical = node;
+    if (previous != NO_NODE)
+    {
+        nodes[previous].nextPhysical = front;
+    }
+    nodes[node].previousPhysical = front;
+    nodes[node].offset += size;
+    nodes[node].size -= size;
+    insertFreeNode(front);
+}
+
+void TlsfAllocator::splitBack(uint32_t node, uint64_t size)
+{
+    uint32_t back = createNode(nodes[node].offset + size, nodes[node].size - size);
+    uint32_t next = nodes[node].nextPhysical;
+    nodes[back].previousPhysical = node;
+    nodes[back].nextPhysical = next;
+    if (next != NO_NODE)
+    {
+        nodes[next].previousPhysical = back;
+    }
+    nodes[node].nextPhysical = back;
+    nodes[node].size = size;
+    insertFreeNode(back);
+}
+
+void TlsfAllocator::mergeNext(uint32_t node, uint32_t next)
+{
+    nodes[node].size += nodes[next].size;
+    uint32_t nextNext = nodes[next].nextPhysical;
+    nodes[node].nextPhysical = nextNext;
+    if (nextNext != NO_NODE)
+    {
+        nodes[nextNext].previousPhysical = node;
+    }
+    unusedNodes.push_back(next);
+}
+
+uint32_t TlsfAllocator::allocate(uint64_t size, uint64_t alignment, uint64_t *offset)
+{
+    if (size == 0 || size > freeBytes)
+    {
+        return NO_NODE;
+    }
+    alignment = std::max<uint64_t>(alignment, 1);
+    auto alignOffset = [alignment](uint64_t value) { return (value + alignment - 1) & ~(alignment - 1); };
+    auto fits = [&](uint32_t node) {
+        return node != NO_NODE && alignOffset(nodes[node].offset) + size <= nodes[node].offset + nodes[node].size;
+    };
+
+    // A range of the size class may lack room for the alignment padding, then look for one with room for any
+    uint32_t node = findFreeNode(size);
+    if (!fits(node))
+    {
+        node = findFreeNode(size + alignment - 1);
+        if (node == NO_NODE)
+        {
+            return NO_NODE;
+        }
+    }
+    removeFreeNode(node);
+
+    // Padding and what is left past the range go back to the free lists. Their neighbours are in use: free nodes
+    // are always merged.
+    uint64_t padding = alignOffset(nodes[node].offset) - nodes[node].offset;
+    if (padding > 0)
+    {
+        splitFront(node, padding);
+    }
+    if (nodes[node].size > size)
+    {
+        splitBack(node, size);
+    }
+    nodes[node].free = false;
+    freeBytes -= size;
+    ++allocationCount;
+    *offset = nodes[node].offset;
+    return node;
+}
+
+void TlsfAllocator::free(uint32_t node)
+{
+    freeBytes += nodes[node].size;
+    --allocationCount;
+
+    uint32_t previous = nodes[node].previousPhysical;
+    if (previous != NO_NODE && nodes[previous].free)
+    {
+        removeFreeNode(previous);
+        mergeNext(previous, node);
+        node = previous;
+    }
+    uint32_t next = nodes[node].nextPhysical;
+    if (next != NO_NODE && nodes[next].free)
+    {
+        removeFreeNode(next);
+        mergeNext(node, next);
+    }
+    insertFreeNode(node);
+}
+
+uint64_t TlsfAllocator::getLargestFreeRange() const
+{
+    if (!firstLevelBitmap)
+    {
+        return 0;
+    }
+    // The largest range is in the highest non empty list, which is not sorted
+    uint32_t firstLevel = getMostSignificantBit(firstLevelBitmap);
+    uint32_t secondLevel = 31 - static_cast<uint32_t>(__builtin_clz(secondLevelBitmaps[firstLevel]));
+    uint64_t largest = 0;
+    for (uint32_t node = freeLists[firstLevel][secondLevel]; node != NO_NODE; node = nodes[node].nextFree)
+    {
+        largest = std::max(largest, nodes[node].size);
+    }
+    return largest;
+}
+
+void DeviceMemoryAllocator::create(vk::PhysicalDevice physicalDevice, vk::Device deviceP)
+{
+    device = deviceP;
+    memoryProperties = physicalDevice.getMemoryProperties();
+    vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+    bufferImageGranularity = limits.bufferImageGranularity;
+    maxDeviceMemoryCount = limits.maxMemoryAllocationCount;
+}
+
+void DeviceMemoryAllocator::destroy()
+{
+    if (allocationCount > 0)
+    {
+        printf("%zu device memory allocations still alive, freed with their blocks\n", allocationCount);
+    }
+    for (auto &pool : pools)
+    {
+        for (auto &block : pool.blocks)
+        {
+            if (block)
+            {
+                freeDeviceMemory(block->memory, block->mapped != nullptr);
+            }
+        }
+    }
+    pools.clear();
+    allocationCount = 0;
+}
+
+uint32_t DeviceMemoryAllocator::findMemoryType(uint32_t allowedTypes, vk::MemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+    {
+        if ((allowedTypes & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+        {
+            return i;
+        }
+    }
+    throw std::runtime_error("Failed to find a suitable memory type");
+}
+
+size_t DeviceMemoryAllocator::getPool(uint32_t memoryType, ResourceTiling tiling)
+{
+    // Without granularity constraint, buffers and images share blocks
+    if (bufferImageGranularity <= 1)
+    {
+        tiling = ResourceTiling::Linear;
+    }
+    for (size_t i = 0; i < pools.size(); ++i)
+    {
+        if (pools[i].memoryType == memoryType && pools[i].tiling == tiling)
+        {
+            return i;
+        }
+    }
+    Pool pool{};
+    pool.memoryType = memoryType;
+    pool.tiling = tiling;
+    vk::DeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    pool.blockSize = std::min(BLOCK_SIZE, heapSize / 8);
+    pools.push_back(std::move(pool));
+    return pools.size() - 1;
+}
+
+vk::DeviceMemory DeviceMemoryAllocator::allocateDeviceMemory(uint32_t memoryType, vk::DeviceSize size, char **mapped)
+{
+    if (deviceMemoryCount >= maxDeviceMemoryCount)
+    {
+        throw std::runtime_error("Too many device memory allocations");
+    }
+    vk::MemoryAllocateInfo memoryAllocInfo{};
+    memoryAllocInfo.allocationSize = size;
+    memoryAllocInfo.memoryTypeIndex = memoryType;
+    vk::DeviceMemory memory;
+    auto result = device.allocateMemory(&memoryAllocInfo, nullptr, &memory);
+    if (result != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Failed to allocate device memory");
+    }
+
+    // Mapped once for all the allocations in it: a device memory can't be mapped twice at the same time
+    *mapped = nullptr;
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+    {
+        void *data;
+        device.mapMemory(memory, 0, VK_WHOLE_SIZE, {}, &data);
+        *mapped = static_cast<char *>(data);
+    }
+    ++deviceMemoryCount;
+    peakDeviceMemoryCount = std::max(peakDeviceMemoryCount, deviceMemoryCount);
+    return memory;
+}
+
+void DeviceMemoryAllocator::freeDeviceMemory(vk::DeviceMemory memory, bool mapped)
+{
+    if (mapped)
+    {
+        device.unmapMemory(memory);
+    }
+    device.freeMemory(memory, nullptr);
+    --deviceMemoryCount;
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocate(const vk::MemoryRequirements &requirements,
+                                                 vk::MemoryPropertyFlags properties, ResourceTiling tiling)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    MemoryAllocation allocation{};
+    uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+    allocation.pool = static_cast<uint32_t>(getPool(memoryType, tiling));
+    allocation.size = requirements.size;
+    Pool &pool = pools[allocation.pool];
+
+    if (requirements.size > pool.blockSize / 2)
+    {
+        // Big resources would leave most of a block unused, or not fit at all
+        allocation.memory = allocateDeviceMemory(memoryType, requirements.size, &allocation.mapped);
+        dedicatedBytes += requirements.size;
+    }
+    else
+    {
+        // First block with room, then the first empty slot for a new block
+        uint64_t offset = 0;
+        size_t freeSlot = pool.blocks.size();
+        for (size_t i = 0; i < pool.blocks.size() && allocation.node == TlsfAllocator::NO_NODE; ++i)
+        {
+            if (!pool.blocks[i])
+            {
+                freeSlot = std::min(freeSlot, i);
+                continue;
+            }
+            allocation.node = pool.blocks[i]->ranges.allocate(requirements.size, requirements.alignment, &offset);
+            allocation.block = static_cast<uint32_t>(i);
+        }
+        if (allocation.node == TlsfAllocator::NO_NODE)
+        {
+            char *mapped;
+            vk::DeviceMemory memory = allocateDeviceMemory(memoryType, pool.blockSize, &mapped);
+            if (freeSlot == pool.blocks.size())
+            {
+                pool.blocks.emplace_back();
+            }
+            pool.blocks[freeSlot] = std::make_unique<Block>(memory, mapped, pool.blockSize);
+            allocation.block = static_cast<uint32_t>(freeSlot);
+            allocation.node =
+                pool.blocks[freeSlot]->ranges.allocate(requirements.size, requirements.alignment, &offset);
+        }
+        Block &block = *pool.blocks[allocation.block];
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+    }
+    ++allocationCount;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ++allocateCalls;
+    allocateSeconds += seconds;
+    maxAllocateSeconds = std::max(maxAllocateSeconds, seconds);
+    return allocation;
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocateBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties)
+{
+    vk::MemoryRequirements memoryRequirements;
+    device.getBufferMemoryRequirements(buffer, &memoryRequirements);
+    MemoryAllocation allocation = allocate(memoryRequirements, properties, ResourceTiling::Linear);
+    device.bindBufferMemory(buffer, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocateImage(vk::Image image, vk::ImageTiling imageTiling,
+                                                      vk::MemoryPropertyFlags properties)
+{
+    vk::MemoryRequirements memoryRequirements = device.getImageMemoryRequirements(image);
+    MemoryAllocation allocation =
+        allocate(memoryRequirements, properties,
+                 imageTiling == vk::ImageTiling::eOptimal ? ResourceTiling::Optimal : ResourceTiling::Linear);
+    device.bindImageMemory(image, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+void DeviceMemoryAllocator::free(MemoryAllocation &allocation)
+{
+    if (!allocation.memory)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    Pool &pool = pools[allocation.pool];
+    if (allocation.node == TlsfAllocator::NO_NODE)
+    {
+        freeDeviceMemory(allocation.memory, allocation.mapped != nullptr);
+        dedicatedBytes -= allocation.size;
+    }
+    else
+    {
+        std::unique_ptr<Block> &block = pool.blocks[allocation.block];
+        block->ranges.free(allocation.node);
+        // One empty block is kept per pool, so that a resource freed and created again every frame does not
+        // allocate device memory each time
+        if (block->ranges.getAllocationCount() == 0)
+        {
+            bool otherEmptyBlock = std::any_of(pool.blocks.begin(), pool.blocks.end(), [&](const auto &other) {
+                return other && other != block && other->ranges.getAllocationCount() == 0;
+            });
+            if (otherEmptyBlock)
+            {
+                freeDeviceMemory(block->memory, block->mapped != nullptr);
+                block.reset();
+            }
+        }
+    }
+    --allocationCount;
+    allocation = MemoryAllocation{};
+}
+
+DeviceMemoryStats DeviceMemoryAllocator::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    DeviceMemoryStats stats{};
+    stats.allocationCount = allocationCount;
+    stats.deviceMemoryCount = deviceMemoryCount;
+    stats.peakDeviceMemoryCount = peakDeviceMemoryCount;
+    stats.maxDeviceMemoryCount = maxDeviceMemoryCount;
+    stats.dedicatedBytes = dedicatedBytes;
+    vk::DeviceSize freeBytes = 0;
+    vk::DeviceSize largestFreeBytes = 0;
+    for (const auto &pool : pools)
+    {
+        for (const auto &block : pool.blocks)
+        {
+            if (!block)
+            {
+                continue;
+            }
+            ++stats.blockCount;
+            stats.blockBytes += block->ranges.getSize();
+            stats.usedBlockBytes += block->ranges.getSize() - block->ranges.getFreeBytes();
+            freeBytes += block->ranges.getFreeBytes();
+            largestFreeBytes += block->ranges.getLargestFreeRange();
+        }
+    }
+    stats.fragmentation = freeBytes > 0 ? 1.0 - static_cast<double>(largestFreeBytes) / freeBytes : 0.0;
+    stats.allocateCalls = allocateCalls;
+    stats.averageAllocateMicroseconds = allocateCalls > 0 ? allocateSeconds * 1e6 / allocateCalls : 0.0;
+    stats.maxAllocateMicroseconds = maxAllocateSeconds * 1e6;
+    return stats;
+}
@@ -0,0 +1,198 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// Two level segregated fit allocator of byte ranges in [0, size): free ranges are kept in lists by size class, a
+// power of two (first level) split in 16 linear steps (second level), with a bitmap of the non empty lists at each
+// level. Finding a free range that fits and freeing one (merged with its free neighbours) are both constant time,
+// whatever the number of ranges. Only offsets are handled, the memory itself is DeviceMemoryAllocator's.
+class TlsfAllocator
+{
+  public:
+    static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+    explicit TlsfAllocator(uint64_t size);
+
+    // Offset of a range of size bytes aligned to alignment (a power of two), into offset, and the node to give back
+    // to free(). NO_NODE when no free range is big enough.
+    uint32_t allocate(uint64_t size, uint64_t alignment, uint64_t *offset);
+    void free(uint32_t node);
+
+    uint64_t getSize() const
+    {
+        return size;
+    }
+    uint64_t getFreeBytes() const
+    {
+        return freeBytes;
+    }
+    uint32_t getAllocationCount() const
+    {
+        return allocationCount;
+    }
+    // Walks the free lists from the largest size class, for reports only
+    uint64_t getLargestFreeRange() const;
+
+  private:
+    static constexpr uint32_t SECOND_LEVEL_LOG2 = 4;
+    static constexpr uint32_t SECOND_LEVEL_COUNT = 1 << SECOND_LEVEL_LOG2;
+    // Ranges under SMALL_SIZE all go to the first level 0, in steps of SMALL_SIZE / SECOND_LEVEL_COUNT bytes
+    static constexpr uint32_t SMALL_SIZE_LOG2 = 8;
+    static constexpr uint64_t SMALL_SIZE = 1 << SMALL_SIZE_LOG2;
+    static constexpr uint32_t FIRST_LEVEL_COUNT = 64 - SMALL_SIZE_LOG2 + 1;
+
+    // A range of the allocator, free or not, linked to its physical neighbours and, when free, to the other free
+    // ranges of its size class
+    struct Node
+    {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t previousPhysical;
+        uint32_t nextPhysical;
+        uint32_t previousFree;
+        uint32_t nextFree;
+        bool free;
+    };
+
+    uint64_t size;
+    uint64_t freeBytes;
+    uint32_t allocationCount{0};
+    std::vector<Node> nodes;
+    std::vector<uint32_t> unusedNodes; // Slots of merged nodes, reused before growing nodes
+    uint64_t firstLevelBitmap{0};
+    uint32_t secondLevelBitmaps[FIRST_LEVEL_COUNT]{};
+    uint32_t freeLists[FIRST_LEVEL_COUNT][SECOND_LEVEL_COUNT];
+
+    static void mapSize(uint64_t size, uint32_t *firstLevel, uint32_t *secondLevel);
+    // Head of a list whose every range is at least size bytes, NO_NODE if there is none
+    uint32_t findFreeNode(uint64_t size) const;
+    uint32_t createNode(uint64_t offset, uint64_t size);
+    void insertFreeNode(uint32_t node);
+    void removeFreeNode(uint32_t node);
+    // Cut the first size bytes of node off as a new free node placed right before it
+    void splitFront(uint32_t node, uint64_t size);
+    // Cut what is past the first size bytes of node off as a new free node placed right after it
+    void splitBack(uint32_t node, uint64_t size);
+    // Merge next, a free node, into node, its physical predecessor
+    void mergeNext(uint32_t node, uint32_t next);
+};
+
+// Where a buffer or an image lives: a range of a device memory object, most of the time shared with other resources
+struct MemoryAllocation
+{
+    vk::DeviceMemory memory;
+    vk::DeviceSize offset{0};
+    vk::DeviceSize size{0};
+    char *mapped{nullptr}; // Start of the range in host visible memory, mapped for the life of the allocation
+    uint32_t pool{0};
+    uint32_t block{0};
+    uint32_t node{TlsfAllocator::NO_NODE}; // NO_NODE for a dedicated allocation, with a device memory of its own
+};
+
+// Buffers and linearly tiled images are linear, optimally tiled images are not, they may not share a page of
+// bufferImageGranularity bytes
+enum class ResourceTiling
+{
+    Linear,
+    Optimal
+};
+
+struct DeviceMemoryStats
+{
+    size_t allocationCount{0};   // Live buffers and images
+    size_t deviceMemoryCount{0}; // Live vkAllocateMemory, blocks and dedicated allocations
+    size_t peakDeviceMemoryCount{0};
+    uint32_t maxDeviceMemoryCount{0}; // maxMemoryAllocationCount
+    size_t blockCount{0};
+    vk::DeviceSize blockBytes{0};
+    vk::DeviceSize usedBlockBytes{0};
+    vk::DeviceSize dedicatedBytes{0};
+    // Free bytes of the blocks out of their largest free range, over all their free bytes: 0 when each block's
+    // free space is in one piece
+    double fragmentation{0.0};
+    size_t allocateCalls{0};
+    double averageAllocateMicroseconds{0.0};
+    double maxAllocateMicroseconds{0.0};
+};
+
+// Device memory for every buffer and image of the renderer, instead of one vkAllocateMemory each: drivers allow
+// as few as 4096 device memory objects (maxMemoryAllocationCount), and allocating one is slow. Memory is taken from
+// the driver in large blocks, one list per memory type (and per tiling when bufferImageGranularity requires it),
+// resources being sub-allocated in them by a TlsfAllocator. Resources over half a block get dedicated memory.
+// Host visible blocks are mapped once when created, allocations point into the mapping.
+// Allocation and free lock a mutex: resources may be created from the workers.
+class DeviceMemoryAllocator
+{
+  public:
+    // Block size for heaps of at least 8 blocks, smaller heaps get blocks of an eighth of their size
+    static constexpr vk::DeviceSize BLOCK_SIZE = 64 * 1024 * 1024;
+
+    DeviceMemoryAllocator() = default;
+    DeviceMemoryAllocator(const DeviceMemoryAllocator &) = delete;
+    DeviceMemoryAllocator &operator=(const DeviceMemoryAllocator &) = delete;
+
+    void create(vk::PhysicalDevice physicalDevice, vk::Device deviceP);
+    // Every allocation must have been freed
+    void destroy();
+
+    vk::Device getDevice() const
+    {
+        return device;
+    }
+
+    MemoryAllocation allocate(const vk::MemoryRequirements &requirements, vk::MemoryPropertyFlags properties,
+                              ResourceTiling tiling);
+    // Allocate and bind memory for a created buffer or image
+    MemoryAllocation allocateBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties);
+    MemoryAllocation allocateImage(vk::Image image, vk::ImageTiling imageTiling, vk::MemoryPropertyFlags properties);
+    // Give the range back, the allocation is reset. A null allocation is ignored.
+    void free(MemoryAllocation &allocation);
+
+    DeviceMemoryStats getStats() const;
+
+  private:
+    struct Block
+    {
+        vk::DeviceMemory memory;
+        char *mapped;
+        TlsfAllocator ranges;
+
+        Block(vk::DeviceMemory memoryP, char *mappedP, vk::DeviceSize size)
+            : memory(memoryP), mapped(mappedP), ranges(size)
+        {
+        }
+    };
+    // Blocks of one memory type and tiling, null slots are destroyed blocks: allocations keep block indices
+    struct Pool
+    {
+        uint32_t memoryType;
+        ResourceTiling tiling;
+        vk::DeviceSize blockSize;
+        std::vector<std::unique_ptr<Block>> blocks;
+    };
+
+    vk::Device device;
+    vk::PhysicalDeviceMemoryProperties memoryProperties;
+    vk::DeviceSize bufferImageGranularity{1};
+    uint32_t maxDeviceMemoryCount{0};
+    std::vector<Pool> pools;
+
+    mutable std::mutex mutex;
+    size_t allocationCount{0};
+    size_t deviceMemoryCount{0};
+    size_t peakDeviceMemoryCount{0};
+    vk::DeviceSize dedicatedBytes{0};
+    size_t allocateCalls{0};
+    double allocateSeconds{0.0};
+    double maxAllocateSeconds{0.0};
+
+    uint32_t findMemoryType(uint32_t allowedTypes, vk::MemoryPropertyFlags properties) const;
+    size_t getPool(uint32_t memoryType, ResourceTiling tiling);
+    // vkAllocateMemory, mapped when host visible
+    vk::DeviceMemory allocateDeviceMemory(uint32_t memoryType, vk::DeviceSize size, char **mapped);
+    void freeDeviceMemory(vk::DeviceMemory memory, bool mapped);
+};
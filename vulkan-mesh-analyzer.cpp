@@ -0,0 +1,206 @@
+#include "vulkan-mesh-analyzer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <limits>
+
+float MeshAnalysis::getImportedBytesPerTriangle() const
+{
+    size_t triangleCount = indexCount / 3;
+    size_t bytes = vertexCount * sizeof(Vertex) + indexCount * sizeof(uint32_t);
+    return triangleCount ? static_cast<float>(bytes) / triangleCount : 0.0f;
+}
+
+float MeshAnalysis::getPackedBytesPerTriangle() const
+{
+    size_t triangleCount = indexCount / 3;
+    return triangleCount ? static_cast<float>(packedBytes) / triangleCount : 0.0f;
+}
+
+std::vector<glm::vec3> MeshAnalyzer::getViewDirections()
+{
+    std::vector<glm::vec3> directions;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        for (float sign : {1.0f, -1.0f})
+        {
+            glm::vec3 direction(0.0f);
+            direction[axis] = sign;
+            directions.push_back(direction);
+        }
+    }
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        directions.push_back(glm::normalize(
+            glm::vec3(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f)));
+    }
+    return directions;
+}
+
+OverdrawStats MeshAnalyzer::analyzeOverdraw(const Vertex *vertices, const uint32_t *indices, size_t indexCount,
+                                            const glm::vec3 &viewDirection, uint32_t resolution)
+{
+    OverdrawStats stats;
+    if (indexCount == 0)
+    {
+        return stats;
+    }
+
+    // Screen basis of a camera looking along viewDirection: right x up points back at the camera, so counter
+    // clockwise triangles on screen have a positive area
+    glm::vec3 upHint = std::abs(viewDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::vec3 right = glm::normalize(glm::cross(viewDirection, upHint));
+    glm::vec3 up = glm::cross(right, viewDirection);
+
+    // Screen position and depth of the referenced vertices, the bounds fitted to the render target
+    glm::vec2 screenMin(std::numeric_limits<float>::max());
+    glm::vec2 screenMax(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        glm::vec2 screen(glm::dot(vertices[indices[i]].pos, right), glm::dot(vertices[indices[i]].pos, up));
+        screenMin = glm::min(screenMin, screen);
+        screenMax = glm::max(screenMax, screen);
+    }
+    float extent = std::max(std::max(screenMax.x - screenMin.x, screenMax.y - screenMin.y), 1e-6f);
+    float scale = resolution / extent;
+    auto project = [&](const glm::vec3 &position) {
+        return glm::vec3((glm::dot(position, right) - screenMin.x) * scale,
+                         (glm::dot(position, up) - screenMin.y) * scale, glm::dot(position, viewDirection));
+    };
+
+    std::vector<float> depths(resolution * resolution, std::numeric_limits<float>::max());
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        glm::vec3 a = project(vertices[indices[i]].pos);
+        glm::vec3 b = project(vertices[indices[i + 1]].pos);
+        glm::vec3 c = project(vertices[indices[i + 2]].pos);
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        if (area <= 0.0f)
+        {
+            continue;
+        }
+
+        // Pixel centers inside all three edges, depth interpolated with the barycentric coordinates
+        int minX = std::max(0, static_cast<int>(std::floor(std::min({a.x, b.x, c.x}))));
+        int maxX = std::min(static_cast<int>(resolution) - 1, static_cast<int>(std::ceil(std::max({a.x, b.x, c.x}))));
+        int minY = std::max(0, static_cast<int>(std::floor(std::min({a.y, b.y, c.y}))));
+        int maxY = std::min(static_cast<int>(resolution) - 1, static_cast<int>(std::ceil(std::max({a.y, b.y, c.y}))));
+        for (int y = minY; y <= maxY; ++y)
+        {
+            for (int x = minX; x <= maxX; ++x)
+            {
+                float px = x + 0.5f;
+                float py = y + 0.5f;
+                float weightA = (b.x - px) * (c.y - py) - (b.y - py) * (c.x - px);
+                float weightB = (c.x - px) * (a.y - py) - (c.y - py) * (a.x - px);
+                float weightC = (a.x - px) * (b.y - py) - (a.y - py) * (b.x - px);
+                if (weightA < 0.0f || weightB < 0.0f || weightC < 0.0f)
+                {
+                    continue;
+                }
+                float depth = (weightA * a.z + weightB * b.z + weightC * c.z) / area;
+                float &storedDepth = depths[y * resolution + x];
+                if (depth < storedDepth)
+                {
+                    stats.pixelsCovered += storedDepth == std::numeric_limits<float>::max() ? 1 : 0;
+                    stats.pixelsShaded++;
+                    storedDepth = depth;
+                }
+            }
+        }
+    }
+    return stats;
+}
+
+VertexFetchStats MeshAnalyzer::analyzeVertexFetch(const uint32_t *indices, size_t indexCount, size_t vertexCount,
+                                                  size_t vertexSize)
+{
+    VertexFetchStats stats;
+
+    // Same FIFO timestamps as MeshOptimizer::analyzeVertexCache, for the vertices then for the lines they span
+    const uint32_t cacheSize = MeshOptimizer::CACHE_SIZE;
+    std::vector<uint32_t> vertexTimes(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    uint32_t vertexTimestamp = cacheSize + 1;
+    std::vector<uint32_t> lineTimes((vertexCount * vertexSize) / FETCH_CACHE_LINE_SIZE + 1, 0);
+    uint32_t lineTimestamp = FETCH_CACHE_LINE_COUNT + 1;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t vertex = indices[i];
+        if (!referenced[vertex])
+        {
+            referenced[vertex] = true;
+            stats.vertexBytes += vertexSize;
+        }
+        if (vertexTimestamp - vertexTimes[vertex] <= cacheSize)
+        {
+            continue;
+        }
+        vertexTimes[vertex] = vertexTimestamp++;
+
+        size_t firstLine = vertex * vertexSize / FETCH_CACHE_LINE_SIZE;
+        size_t lastLine = ((vertex + 1) * vertexSize - 1) / FETCH_CACHE_LINE_SIZE;
+        for (size_t line = firstLine; line <= lastLine; ++line)
+        {
+            if (lineTimestamp - lineTimes[line] > FETCH_CACHE_LINE_COUNT)
+            {
+                lineTimes[line] = lineTimestamp++;
+                stats.bytesFetched += FETCH_CACHE_LINE_SIZE;
+            }
+        }
+    }
+    return stats;
+}
+
+size_t MeshAnalyzer::countDuplicateVertices(const Vertex *vertices, size_t vertexCount)
+{
+    // Sorted by content, duplicates end up next to each other
+    std::vector<uint32_t> order(vertexCount);
+    for (uint32_t i = 0; i < vertexCount; ++i)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t first, uint32_t second) {
+        return memcmp(&vertices[first], &vertices[second], sizeof(Vertex)) < 0;
+    });
+    size_t duplicateCount = 0;
+    for (size_t i = 1; i < order.size(); ++i)
+    {
+        duplicateCount += memcmp(&vertices[order[i - 1]], &vertices[order[i]], sizeof(Vertex)) == 0 ? 1 : 0;
+    }
+    return duplicateCount;
+}
+
+MeshAnalysis MeshAnalyzer::analyzeMesh(const MeshView &meshView)
+{
+    MeshData decodedMesh;
+    MeshView mesh = meshView.decode(decodedMesh);
+
+    // Coarser levels follow the full one in the index buffer, they would skew the cache and overdraw figures
+    size_t indexCount = mesh.lodCount > 0 ? mesh.lods[0].indexCount : mesh.indexCount;
+    const uint32_t *indices = mesh.indices + (mesh.lodCount > 0 ? mesh.lods[0].indexOffset : 0);
+
+    MeshAnalysis analysis;
+    analysis.vertexCount = mesh.vertexCount;
+    analysis.indexCount = indexCount;
+    for (size_t i = 0; i < std::size(CACHE_SIZES); ++i)
+    {
+        analysis.vertexCache[i] =
+            MeshOptimizer::analyzeVertexCache(indices, indexCount, mesh.vertexCount, CACHE_SIZES[i]);
+    }
+    for (const glm::vec3 &viewDirection : getViewDirections())
+    {
+        OverdrawStats overdraw = analyzeOverdraw(mesh.vertices, indices, indexCount, viewDirection);
+        analysis.overdraw += overdraw;
+        analysis.maxOverdraw = std::max(analysis.maxOverdraw, overdraw.getOverdraw());
+    }
+    analysis.vertexFetch = analyzeVertexFetch(indices, indexCount, mesh.vertexCount, sizeof(PackedVertex));
+    analysis.duplicateVertexCount = countDuplicateVertices(mesh.vertices, mesh.vertexCount);
+    analysis.sourceVertexCount = mesh.vertexCount;
+    size_t indexSize = VulkanMesh::chooseIndexType(mesh.vertexCount) == vk::IndexType::eUint16 ? sizeof(uint16_t)
+                                                                                                 : sizeof(uint32_t);
+    analysis.packedBytes = mesh.vertexCount * sizeof(PackedVertex) + indexCount * indexSize;
+    return analysis;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "vulkan-mesh-optimizer.h"
+
+// Fragments of a mesh drawn alone, rasterized on the CPU from one view direction
+struct OverdrawStats
+{
+    size_t pixelsCovered{0};
+    size_t pixelsShaded{0}; // Fragments passing the depth test when drawn, in index buffer order
+
+    // Fragment shader invocations per covered pixel, 1 is ideal
+    float getOverdraw() const
+    {
+        return pixelsCovered ? static_cast<float>(pixelsShaded) / pixelsCovered : 0.0f;
+    }
+
+    OverdrawStats &operator+=(const OverdrawStats &other)
+    {
+        pixelsCovered += other.pixelsCovered;
+        pixelsShaded += other.pixelsShaded;
+        return *this;
+    }
+};
+
+// Vertex buffer memory read by the vertex shader invocations, simulated with a FIFO cache of cache lines
+struct VertexFetchStats
+{
+    size_t vertexBytes{0};  // Size of the vertices referenced by at least one triangle
+    size_t bytesFetched{0}; // Cache lines loaded
+
+    // Bytes fetched per byte of vertex data, 1 when the vertex buffer is read once in order
+    float getOverfetch() const
+    {
+        return vertexBytes ? static_cast<float>(bytesFetched) / vertexBytes : 0.0f;
+    }
+
+    VertexFetchStats &operator+=(const VertexFetchStats &other)
+    {
+        vertexBytes += other.vertexBytes;
+        bytesFetched += other.bytesFetched;
+        return *this;
+    }
+};
+
+struct MeshAnalysis
+{
+    size_t vertexCount{0};
+    size_t indexCount{0};
+    VertexCacheStats vertexCache[3]; // For each of MeshAnalyzer::CACHE_SIZES
+    OverdrawStats overdraw;          // All the view directions together
+    float maxOverdraw{0.0f};         // Worst view direction
+    VertexFetchStats vertexFetch;    // Packed vertices, the renderer's default format
+    // Vertices identical to an earlier one, which the index buffer could share, out of sourceVertexCount: the
+    // vertices of the mesh as given, or of its source before an import joined them
+    size_t duplicateVertexCount{0};
+    size_t sourceVertexCount{0};
+    // Geometry memory as uploaded with packed vertices, indices narrowed when they fit (see
+    // VulkanMesh::chooseIndexType)
+    size_t packedBytes{0};
+
+    float getDuplicateVertexRatio() const
+    {
+        return sourceVertexCount ? static_cast<float>(duplicateVertexCount) / sourceVertexCount : 0.0f;
+    }
+    // Geometry memory per triangle, as imported (full vertices, 32 bits indices) and as uploaded
+    float getImportedBytesPerTriangle() const;
+    float getPackedBytesPerTriangle() const;
+};
+
+// Offline report of how GPU friendly a mesh is, CPU only so that it also runs on build machines without a GPU.
+// Every statistic is computed on the index buffer order as given: run it before and after MeshOptimizer to see
+// what the import processing gains.
+class MeshAnalyzer
+{
+  public:
+    // Post-transform cache sizes: small and older GPUs, MeshOptimizer's target, large
+    static constexpr uint32_t CACHE_SIZES[3] = {8, MeshOptimizer::CACHE_SIZE, 32};
+    // Overdraw render target side, in pixels, the mesh bounds fitted to it
+    static constexpr uint32_t OVERDRAW_RESOLUTION = 256;
+    // Vertex fetch cache: 64 lines of 64 bytes
+    static constexpr uint32_t FETCH_CACHE_LINE_SIZE = 64;
+    static constexpr uint32_t FETCH_CACHE_LINE_COUNT = 64;
+
+    // Along the three axes both ways, then towards the eight corners of the bounding box
+    static std::vector<glm::vec3> getViewDirections();
+
+    // Orthographic view looking along viewDirection, back faces culled (counter-clockwise front faces, like the
+    // renderer's pipeline)
+    static OverdrawStats analyzeOverdraw(const Vertex *vertices, const uint32_t *indices, size_t indexCount,
+                                         const glm::vec3 &viewDirection, uint32_t resolution = OVERDRAW_RESOLUTION);
+    // Vertices are fetched by the post-transform cache misses, vertexSize bytes each
+    static VertexFetchStats analyzeVertexFetch(const uint32_t *indices, size_t indexCount, size_t vertexCount,
+                                               size_t vertexSize);
+    static size_t countDuplicateVertices(const Vertex *vertices, size_t vertexCount);
+
+    // Everything above for the mesh's full level of detail. A compressed view is decoded first.
+    static MeshAnalysis analyzeMesh(const MeshView &meshView);
+};
@@ -0,0 +1,543 @@
+#include "vulkan-mesh-cache.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+#include "vulkan-geometry-codec.h"
+
+static size_t alignOffset(size_t offset)
+{
+    return (offset + 15) & ~size_t(15);
+}
+
+// Unique to the writer: the same model may be imported by several workers at once, e.g. a reload and a bake
+static std::string getTemporaryPath(const std::string &path)
+{
+    static std::atomic<uint64_t> writerCount{0};
+    return path + "." + std::to_string(getpid()) + "." + std::to_string(writerCount++) + ".tmp";
+}
+
+// Length prefixed string, returns false if it runs past the end of the mapping
+static bool readString(const char *bytes, size_t mappingSize, size_t &offset, std::string &value)
+{
+    uint32_t length;
+    if (offset + sizeof(uint32_t) > mappingSize)
+    {
+        return false;
+    }
+    memcpy(&length, bytes + offset, sizeof(uint32_t));
+    offset += sizeof(uint32_t);
+    if (offset + length > mappingSize)
+    {
+        return false;
+    }
+    value.assign(bytes + offset, length);
+    offset += length;
+    return true;
+}
+
+// Whether the file still has the size and content it had when baked (size MeshCache::MISSING_FILE: it did not
+// exist, and still must not). Size and modification time are compared first; when only the time differs the file
+// may just have been touched, the content hash decides, and touchedTime gets the time to store instead.
+static bool isFileUnchanged(const std::string &path, uint64_t size, int64_t modifiedTime, uint64_t hash,
+                            int64_t *touchedTime)
+{
+    uint64_t currentSize;
+    int64_t currentModifiedTime;
+    *touchedTime = modifiedTime;
+    if (!getFileStat(path, &currentSize, &currentModifiedTime))
+    {
+        return size == MeshCache::MISSING_FILE;
+    }
+    if (currentSize != size)
+    {
+        return false;
+    }
+    if (currentModifiedTime != modifiedTime)
+    {
+        if (hashFile(path) != hash)
+        {
+            return false;
+        }
+        *touchedTime = currentModifiedTime;
+    }
+    return true;
+}
+
+MeshCache::~MeshCache()
+{
+    close();
+}
+
+std::string MeshCache::getCachePath(const std::string &sourcePath)
+{
+    return sourcePath + ".vkmesh";
+}
+
+bool MeshCache::open(const std::string &sourcePath, uint32_t importFlags, uint32_t bakeFlags)
+{
+    close();
+
+    std::string cachePath = getCachePath(sourcePath);
+    int fd = ::open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat cacheStat;
+    if (fstat(fd, &cacheStat) != 0 || static_cast<size_t>(cacheStat.st_size) < sizeof(MeshCacheHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    mappingSize = static_cast<size_t>(cacheStat.st_size);
+    // Read only private mapping: pages are loaded on demand when copied to staging
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        mapping = nullptr;
+        mappingSize = 0;
+        return false;
+    }
+
+    std::vector<std::pair<uint64_t, int64_t>> touchedTimes;
+    if (!parse(sourcePath, importFlags, bakeFlags, touchedTimes))
+    {
+        close();
+        return false;
+    }
+
+    // Store the new modification times in place, the next run is back to the cheap check. Not being able to write
+    // (read only directory) only means hashing again.
+    if (!touchedTimes.empty())
+    {
+        fd = ::open(cachePath.c_str(), O_WRONLY);
+        if (fd >= 0)
+        {
+            for (const auto &touchedTime : touchedTimes)
+            {
+                if (pwrite(fd, &touchedTime.second, sizeof(int64_t), static_cast<off_t>(touchedTime.first)) !=
+                    sizeof(int64_t))
+                {
+                    break;
+                }
+            }
+            ::close(fd);
+        }
+    }
+    return true;
+}
+
+bool MeshCache::parse(const std::string &sourcePath, uint32_t importFlags, uint32_t bakeFlags,
+                      std::vector<std::pair<uint64_t, int64_t>> &touchedTimes)
+{
+    const char *bytes = static_cast<const char *>(mapping);
+    const MeshCacheHeader *header = reinterpret_cast<const MeshCacheHeader *>(bytes);
+
+    if (header->magic != MAGIC || header->version != VERSION || header->importFlags != importFlags ||
+        header->bakeFlags != bakeFlags || header->vertexStride != sizeof(Vertex) || header->fileSize != mappingSize)
+    {
+        return false;
+    }
+
+    // The source, then every file the import read besides it. Without the source nothing could be imported again:
+    // the cache is used as it is, whatever the state of the other files.
+    uint64_t sourceSize;
+    int64_t touchedTime;
+    bool isSourcePresent = getFileStat(sourcePath, &sourceSize, &touchedTime);
+    if (!isSourcePresent)
+    {
+        printf("WARNING: %s is missing, using its mesh cache as is\n", sourcePath.c_str());
+    }
+    else if (!isFileUnchanged(sourcePath, header->sourceSize, header->sourceModifiedTime, header->sourceHash,
+                              &touchedTime))
+    {
+        return false;
+    }
+    else if (touchedTime != header->sourceModifiedTime)
+    {
+        touchedTimes.emplace_back(offsetof(MeshCacheHeader, sourceModifiedTime), touchedTime);
+    }
+    if (header->dependencyTableOffset + header->dependencyCount * sizeof(MeshCacheDependency) > mappingSize)
+    {
+        return false;
+    }
+    const MeshCacheDependency *dependencies =
+        reinterpret_cast<const MeshCacheDependency *>(bytes + header->dependencyTableOffset);
+    size_t dependencyNameOffset = header->dependencyNameTableOffset;
+    for (uint32_t i = 0; i < header->dependencyCount && isSourcePresent; ++i)
+    {
+        std::string path;
+        if (!readString(bytes, mappingSize, dependencyNameOffset, path) ||
+            !isFileUnchanged(path, dependencies[i].size, dependencies[i].modifiedTime, dependencies[i].hash,
+                             &touchedTime))
+        {
+            return false;
+        }
+        if (touchedTime != dependencies[i].modifiedTime)
+        {
+            touchedTimes.emplace_back(header->dependencyTableOffset + i * sizeof(MeshCacheDependency) +
+                                          offsetof(MeshCacheDependency, modifiedTime),
+                                      touchedTime);
+        }
+    }
+
+    size_t recordsOffset = header->recordOffset;
+    if (recordsOffset + header->meshCount * sizeof(MeshCacheRecord) > mappingSize)
+    {
+        return false;
+    }
+    const MeshCacheRecord *records = reinterpret_cast<const MeshCacheRecord *>(bytes + recordsOffset);
+
+    // Compressed streams are checked when decoded, only their bounds here
+    bool isCompressed = (bakeFlags & BAKE_COMPRESSED) != 0;
+    storedGeometryBytes = 0;
+    rawGeometryBytes = 0;
+    std::unordered_set<uint64_t> storedVertexOffsets;
+    meshes.resize(header->meshCount);
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        const MeshCacheRecord &record = records[i];
+        size_t vertexBytes = isCompressed ? record.encodedVertexSize : record.vertexCount * sizeof(Vertex);
+        size_t indexBytes = isCompressed ? record.encodedIndexSize : record.indexCount * sizeof(uint32_t);
+        if (record.vertexOffset + vertexBytes > mappingSize || record.indexOffset + indexBytes > mappingSize ||
+            record.lodOffset + record.lodCount * sizeof(MeshLod) > mappingSize ||
+            record.meshletOffset + record.meshletCount * sizeof(Meshlet) > mappingSize)
+        {
+            return false;
+        }
+        if (isCompressed)
+        {
+            meshes[i].encodedVertices = reinterpret_cast<const uint8_t *>(bytes + record.vertexOffset);
+            meshes[i].encodedVertexSize = record.encodedVertexSize;
+            meshes[i].encodedIndices = reinterpret_cast<const uint8_t *>(bytes + record.indexOffset);
+            meshes[i].encodedIndexSize = record.encodedIndexSize;
+        }
+        else
+        {
+            meshes[i].vertices = reinterpret_cast<const Vertex *>(bytes + record.vertexOffset);
+            meshes[i].indices = reinterpret_cast<const uint32_t *>(bytes + record.indexOffset);
+        }
+        meshes[i].vertexCount = record.vertexCount;
+        meshes[i].indexCount = record.indexCount;
+        meshes[i].materialIndex = record.materialIndex;
+        meshes[i].boundsMin = {record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]};
+        meshes[i].boundsMax = {record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]};
+        meshes[i].lods = reinterpret_cast<const MeshLod *>(bytes + record.lodOffset);
+        meshes[i].lodCount = record.lodCount;
+        meshes[i].meshlets = reinterpret_cast<const Meshlet *>(bytes + record.meshletOffset);
+        meshes[i].meshletCount = record.meshletCount;
+        meshes[i].nodeIndex = record.nodeIndex;
+        if (record.nodeIndex >= header->nodeCount && header->nodeCount > 0)
+        {
+            return false;
+        }
+        // Duplicates share the first mesh's arrays, counted once
+        if (storedVertexOffsets.insert(record.vertexOffset).second)
+        {
+            storedGeometryBytes += vertexBytes + indexBytes;
+            rawGeometryBytes += record.vertexCount * sizeof(Vertex) + record.indexCount * sizeof(uint32_t);
+        }
+    }
+
+    // Material to texture file names table
+    size_t offset = header->textureTableOffset;
+    textureNames.resize(header->textureCount);
+    for (auto &textureName : textureNames)
+    {
+        if (!readString(bytes, mappingSize, offset, textureName))
+        {
+            return false;
+        }
+    }
+
+    // Scene graph, rebuilt node by node: addNode checks the depth first order, and computes the world transforms
+    if (header->nodeTableOffset + header->nodeCount * sizeof(MeshCacheNode) > mappingSize)
+    {
+        return false;
+    }
+    const MeshCacheNode *nodes = reinterpret_cast<const MeshCacheNode *>(bytes + header->nodeTableOffset);
+    offset = header->nodeNameTableOffset;
+    sceneGraph = SceneGraph{};
+    sceneGraph.reserve(header->nodeCount);
+    for (uint32_t i = 0; i < header->nodeCount; ++i)
+    {
+        std::string name;
+        if (!readString(bytes, mappingSize, offset, name))
+        {
+            return false;
+        }
+        glm::mat4 localTransform;
+        memcpy(&localTransform, nodes[i].localTransform, sizeof(localTransform));
+        try
+        {
+            sceneGraph.addNode(nodes[i].parent, localTransform, name);
+        }
+        catch (const std::runtime_error &)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MeshCache::close()
+{
+    if (mapping)
+    {
+        munmap(mapping, mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    meshes.clear();
+    textureNames.clear();
+    storedGeometryBytes = 0;
+    rawGeometryBytes = 0;
+    sceneGraph = SceneGraph{};
+}
+
+void MeshCache::releaseMeshPages(size_t index) const
+{
+    // Whole pages inside the mesh's arrays only, the neighbours' data may still be needed
+    const MeshView &mesh = meshes[index];
+    const char *bytes = static_cast<const char *>(mapping);
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    auto release = [&](const void *data, size_t size) {
+        size_t start = static_cast<const char *>(data) - bytes;
+        size_t pageStart = (start + pageSize - 1) / pageSize * pageSize;
+        size_t pageEnd = (start + size) / pageSize * pageSize;
+        if (pageEnd > pageStart)
+        {
+            madvise(const_cast<char *>(bytes) + pageStart, pageEnd - pageStart, MADV_DONTNEED);
+        }
+    };
+    if (mesh.isEncoded())
+    {
+        release(mesh.encodedVertices, mesh.encodedVertexSize);
+        release(mesh.encodedIndices, mesh.encodedIndexSize);
+    }
+    else
+    {
+        release(mesh.vertices, mesh.vertexCount * sizeof(Vertex));
+        release(mesh.indices, mesh.indexCount * sizeof(uint32_t));
+    }
+}
+
+bool MeshCache::write(const std::string &sourcePath, uint32_t importFlags, uint32_t bakeFlags,
+                      const std::vector<MeshView> &meshes, const std::vector<uint32_t> &duplicateOf,
+                      const std::vector<std::string> &textureNames, const SceneGraph &sceneGraph,
+                      const std::vector<std::string> &dependencies)
+{
+    MeshCacheWriter writer;
+    if (!writer.open(sourcePath, importFlags, bakeFlags, textureNames, sceneGraph, dependencies))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        bool isDuplicate = !duplicateOf.empty() && duplicateOf[i] != i;
+        if (!(isDuplicate ? writer.addDuplicateMesh(meshes[i], duplicateOf[i]) : writer.addMesh(meshes[i])))
+        {
+            return false;
+        }
+    }
+    return writer.finish();
+}
+
+MeshCacheWriter::~MeshCacheWriter()
+{
+    if (file.is_open())
+    {
+        file.close();
+        std::remove(temporaryPath.c_str());
+    }
+}
+
+void MeshCacheWriter::writeBytes(const void *data, size_t size)
+{
+    file.write(static_cast<const char *>(data), size);
+    offset += size;
+}
+
+void MeshCacheWriter::writeString(const std::string &value)
+{
+    uint32_t length = static_cast<uint32_t>(value.size());
+    writeBytes(&length, sizeof(uint32_t));
+    writeBytes(value.data(), length);
+}
+
+void MeshCacheWriter::alignFile()
+{
+    static const char zeros[16] = {};
+    writeBytes(zeros, alignOffset(offset) - offset);
+}
+
+bool MeshCacheWriter::open(const std::string &sourcePath, uint32_t importFlags, uint32_t bakeFlags,
+                           const std::vector<std::string> &textureNames, const SceneGraph &sceneGraph,
+                           const std::vector<std::string> &dependencies)
+{
+    header = MeshCacheHeader{};
+    header.magic = MeshCache::MAGIC;
+    header.version = MeshCache::VERSION;
+    header.importFlags = importFlags;
+    header.bakeFlags = bakeFlags;
+    header.vertexStride = sizeof(Vertex);
+    if (!getFileStat(sourcePath, &header.sourceSize, &header.sourceModifiedTime))
+    {
+        return false;
+    }
+    header.sourceHash = hashFile(sourcePath);
+    header.textureCount = static_cast<uint32_t>(textureNames.size());
+    header.nodeCount = static_cast<uint32_t>(sceneGraph.getNodeCount());
+    header.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    records.clear();
+
+    cachePath = MeshCache::getCachePath(sourcePath);
+    temporaryPath = getTemporaryPath(cachePath);
+    file.open(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // Header placeholder, rewritten by finish() once every offset is known
+    offset = 0;
+    writeBytes(&header, sizeof(MeshCacheHeader));
+    alignFile();
+    header.textureTableOffset = offset;
+    for (const auto &textureName : textureNames)
+    {
+        writeString(textureName);
+    }
+    alignFile();
+    header.nodeTableOffset = offset;
+    for (uint32_t i = 0; i < header.nodeCount; ++i)
+    {
+        MeshCacheNode node{};
+        node.parent = sceneGraph.getParent(i);
+        memcpy(node.localTransform, &sceneGraph.getLocalTransform(i), sizeof(node.localTransform));
+        writeBytes(&node, sizeof(MeshCacheNode));
+    }
+    alignFile();
+    header.nodeNameTableOffset = offset;
+    for (uint32_t i = 0; i < header.nodeCount; ++i)
+    {
+        writeString(sceneGraph.getName(i));
+    }
+    alignFile();
+    header.dependencyTableOffset = offset;
+    for (const auto &path : dependencies)
+    {
+        MeshCacheDependency dependency{};
+        if (getFileStat(path, &dependency.size, &dependency.modifiedTime))
+        {
+            dependency.hash = hashFile(path);
+        }
+        else
+        {
+            // Looked for but not found: creating it later must invalidate the cache too
+            dependency.size = MeshCache::MISSING_FILE;
+        }
+        writeBytes(&dependency, sizeof(MeshCacheDependency));
+    }
+    alignFile();
+    header.dependencyNameTableOffset = offset;
+    for (const auto &path : dependencies)
+    {
+        writeString(path);
+    }
+    return file.good();
+}
+
+bool MeshCacheWriter::addMesh(const MeshView &mesh)
+{
+    MeshCacheRecord record{};
+    record.materialIndex = mesh.materialIndex;
+    record.nodeIndex = mesh.nodeIndex;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        record.boundsMin[axis] = mesh.boundsMin[axis];
+        record.boundsMax[axis] = mesh.boundsMax[axis];
+    }
+
+    record.vertexCount = static_cast<uint32_t>(mesh.vertexCount);
+    record.indexCount = static_cast<uint32_t>(mesh.indexCount);
+    if (header.bakeFlags & MeshCache::BAKE_COMPRESSED)
+    {
+        std::vector<uint8_t> encodedVertices = GeometryCodec::encodeVertices(mesh.vertices, mesh.vertexCount);
+        std::vector<uint8_t> encodedIndices = GeometryCodec::encodeIndices(mesh.indices, mesh.indexCount);
+        alignFile();
+        record.vertexOffset = offset;
+        record.encodedVertexSize = static_cast<uint32_t>(encodedVertices.size());
+        writeBytes(encodedVertices.data(), encodedVertices.size());
+        alignFile();
+        record.indexOffset = offset;
+        record.encodedIndexSize = static_cast<uint32_t>(encodedIndices.size());
+        writeBytes(encodedIndices.data(), encodedIndices.size());
+    }
+    else
+    {
+        alignFile();
+        record.vertexOffset = offset;
+        writeBytes(mesh.vertices, mesh.vertexCount * sizeof(Vertex));
+        alignFile();
+        record.indexOffset = offset;
+        writeBytes(mesh.indices, mesh.indexCount * sizeof(uint32_t));
+    }
+    alignFile();
+    record.lodOffset = offset;
+    record.lodCount = static_cast<uint32_t>(mesh.lodCount);
+    writeBytes(mesh.lods, mesh.lodCount * sizeof(MeshLod));
+    alignFile();
+    record.meshletOffset = offset;
+    record.meshletCount = static_cast<uint32_t>(mesh.meshletCount);
+    writeBytes(mesh.meshlets, mesh.meshletCount * sizeof(Meshlet));
+
+    records.push_back(record);
+    return file.good();
+}
+
+bool MeshCacheWriter::addDuplicateMesh(const MeshView &mesh, uint32_t geometryRecord)
+{
+    if (geometryRecord >= records.size())
+    {
+        return false;
+    }
+    MeshCacheRecord record = records[geometryRecord];
+    record.materialIndex = mesh.materialIndex;
+    record.nodeIndex = mesh.nodeIndex;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        record.boundsMin[axis] = mesh.boundsMin[axis];
+        record.boundsMax[axis] = mesh.boundsMax[axis];
+    }
+    records.push_back(record);
+    return file.good();
+}
+
+bool MeshCacheWriter::finish()
+{
+    alignFile();
+    header.meshCount = static_cast<uint32_t>(records.size());
+    header.recordOffset = offset;
+    writeBytes(records.data(), records.size() * sizeof(MeshCacheRecord));
+    header.fileSize = offset;
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(MeshCacheHeader));
+    file.close();
+    if (file.fail())
+    {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return std::rename(temporaryPath.c_str(), cachePath.c_str()) == 0;
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "vulkan-mesh.h"
+#include "vulkan-scene-graph.h"
+
+// Baked binary copy of an imported model, written next to the source file on first import.
+// Later runs memory-map it and hand the vertex and index arrays straight to the staging buffers,
+// without going through Assimp at all.
+//
+// File layout, every section starting on a 16 bytes boundary:
+//   MeshCacheHeader
+//   Texture table: for each material, uint32_t length followed by the file name characters
+//   Node table: MeshCacheNode[nodeCount], the scene graph in depth first order
+//   Node name table: for each node, uint32_t length followed by the name characters
+//   Dependency table: MeshCacheDependency[dependencyCount], the files besides the source that the import read
+//   Dependency name table: for each dependency, uint32_t length followed by its path
+//   For each mesh: its Vertex array, uint32_t index array (all the levels of detail together), MeshLod array and
+//   Meshlet array. With BAKE_COMPRESSED, the vertex and index arrays are GeometryCodec streams instead.
+//   MeshCacheRecord[meshCount], last so that meshes can be written as they are processed. Duplicated meshes
+//   point at the arrays of the first one.
+struct MeshCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t importFlags;  // Post processing flags the cache was built with
+    uint32_t vertexStride; // sizeof(Vertex) when the cache was written
+    uint64_t sourceSize;
+    int64_t sourceModifiedTime; // Nanoseconds since epoch
+    uint64_t sourceHash;
+    uint32_t meshCount;
+    uint32_t textureCount;
+    uint64_t textureTableOffset;
+    uint64_t fileSize;
+    uint32_t bakeFlags; // MeshCache::BAKE_* processing applied after the import
+    uint32_t nodeCount;
+    uint64_t nodeTableOffset;
+    uint64_t nodeNameTableOffset;
+    uint64_t recordOffset;
+    uint32_t dependencyCount;
+    uint32_t reserved;
+    uint64_t dependencyTableOffset;
+    uint64_t dependencyNameTableOffset;
+};
+
+// A file the import read besides the source, material libraries: the cache is outdated when one of them changes
+struct MeshCacheDependency
+{
+    uint64_t size; // MeshCache::MISSING_FILE if the file did not exist when the cache was written
+    int64_t modifiedTime;
+    uint64_t hash;
+};
+
+struct MeshCacheNode
+{
+    uint32_t parent; // SceneGraph::NO_PARENT for a root
+    float localTransform[16]; // Column major
+};
+
+struct MeshCacheRecord
+{
+    uint64_t vertexOffset; // In bytes from the start of the file
+    uint64_t indexOffset;
+    uint64_t lodOffset;
+    uint64_t meshletOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t materialIndex;
+    uint32_t lodCount;
+    uint32_t meshletCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t nodeIndex;
+    uint32_t encodedVertexSize; // Sizes of the GeometryCodec streams, 0 when not compressed
+    uint32_t encodedIndexSize;
+};
+
+class MeshCache
+{
+  public:
+    static constexpr uint32_t MAGIC = 0x48534d56; // "VMSH"
+    static constexpr uint32_t VERSION = 10;
+    static constexpr uint64_t MISSING_FILE = UINT64_MAX;
+    // Processing done on our side once imported, part of the cache key like the import flags
+    static constexpr uint32_t BAKE_OPTIMIZED = 1 << 0;   // Vertex cache, overdraw and vertex fetch reordering
+    static constexpr uint32_t BAKE_SPLIT_16BIT = 1 << 1; // Meshes split in chunks addressable with 16 bits indices
+    static constexpr uint32_t BAKE_MESHLETS = 1 << 2;    // Clusters with culling data for the full level
+    static constexpr uint32_t BAKE_NATIVE_OBJ = 1 << 3;  // Imported by ObjLoader rather than Assimp
+    static constexpr uint32_t BAKE_COMPRESSED = 1 << 4;  // Vertices and indices stored with GeometryCodec
+    // Bits 8 to 15: length of the LOD chain requested, 0 or 1 meaning no simplified levels
+    static constexpr uint32_t BAKE_LOD_COUNT_SHIFT = 8;
+
+    MeshCache() = default;
+    ~MeshCache();
+    MeshCache(const MeshCache &) = delete;
+    MeshCache &operator=(const MeshCache &) = delete;
+
+    // Map the cache of sourcePath, returns false if it is missing, outdated or built with other flags. Source or
+    // dependencies only touched (same content, other modification time) get their new time stored in the file,
+    // so that they are not hashed again on every run. A missing source is not an error: the cache is all there is.
+    bool open(const std::string &sourcePath, uint32_t importFlags, uint32_t bakeFlags);
+    void close();
+
+    // Bake imported meshes for sourcePath. Failing to write is not fatal, the next run will import again.
+    // duplicateOf, from MeshOptimizer::findDuplicateMeshes or empty, stores the geometry of duplicates once.
+    // dependencies are the other files the import read (or looked for), checked by open() like the source.
+    static bool write(const std::string &sourcePath, uint32_t importFlags, uint32_t bakeFlags,
+                      const std::vector<MeshView> &meshes, const std::vector<uint32_t> &duplicateOf,
+                      const std::vector<std::string> &textureNames, const SceneGraph &sceneGraph,
+                      const std::vector<std::string> &dependencies);
+    static std::string getCachePath(const std::string &sourcePath);
+
+    size_t getMeshCount() const
+    {
+        return meshes.size();
+    }
+    // The view points into the mapped file and is only valid while the cache stays open
+    const MeshView &getMesh(size_t index) const
+    {
+        return meshes[index];
+    }
+    const std::vector<std::string> &getTextureNames() const
+    {
+        return textureNames;
+    }
+    const SceneGraph &getSceneGraph() const
+    {
+        return sceneGraph;
+    }
+    // Hint that the mesh was uploaded: its pages are dropped from memory, and read from the file again if used
+    void releaseMeshPages(size_t index) const;
+    // Bytes of vertex and index data in the file, against the raw arrays they decode to
+    uint64_t getStoredGeometryBytes() const
+    {
+        return storedGeometryBytes;
+    }
+    uint64_t getRawGeometryBytes() const
+    {
+        return rawGeometryBytes;
+    }
+
+  private:
+    void *mapping{nullptr};
+    size_t mappingSize{0};
+
+    std::vector<MeshView> meshes;
+    std::vector<std::string> textureNames;
+    SceneGraph sceneGraph;
+    uint64_t storedGeometryBytes{0};
+    uint64_t rawGeometryBytes{0};
+
+    // File offsets of the modification times to rewrite, with their new value, for the files found only touched
+    bool parse(const std::string &sourcePath, uint32_t importFlags, uint32_t bakeFlags,
+               std::vector<std::pair<uint64_t, int64_t>> &touchedTimes);
+};
+
+// Writes a cache one mesh at a time, so that a big model never has to be in memory whole: each mesh goes to the
+// file as soon as it is added, the records and the header once finished. Writes under a temporary name unique to
+// the writer, renamed by finish(): an unfinished or failed cache never replaces a good one.
+class MeshCacheWriter
+{
+  public:
+    MeshCacheWriter() = default;
+    ~MeshCacheWriter();
+    MeshCacheWriter(const MeshCacheWriter &) = delete;
+    MeshCacheWriter &operator=(const MeshCacheWriter &) = delete;
+
+    bool open(const std::string &sourcePath, uint32_t importFlags, uint32_t bakeFlags,
+              const std::vector<std::string> &textureNames, const SceneGraph &sceneGraph,
+              const std::vector<std::string> &dependencies);
+    bool addMesh(const MeshView &mesh);
+    // Mesh with the same geometry as the one added as record geometryRecord, possibly translated: only its record is
+    // written, with its own bounds
+    bool addDuplicateMesh(const MeshView &mesh, uint32_t geometryRecord);
+    bool finish();
+
+  private:
+    std::ofstream file;
+    std::string cachePath;
+    std::string temporaryPath;
+    MeshCacheHeader header{};
+    std::vector<MeshCacheRecord> records;
+    uint64_t offset{0};
+
+    void writeBytes(const void *data, size_t size);
+    void writeString(const std::string &value);
+    // Zeros up to the next 16 bytes boundary
+    void alignFile();
+};
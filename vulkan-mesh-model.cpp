@@ -1,10 +1,11 @@
 #include "vulkan-mesh-model.h"
 
-VulkanMeshModel::VulkanMeshModel()
+VulkanMeshModel::VulkanMeshModel() : model(glm::mat4(1.0f))
 {
 }
 
-VulkanMeshModel::VulkanMeshModel(std::vector<VulkanMesh> meshesP) : meshes(meshesP), model(glm::mat4(1.0f))
+VulkanMeshModel::VulkanMeshModel(std::vector<VulkanMesh> meshesP)
+    : meshes(meshesP), model(glm::mat4(1.0f)), geometryUsers(std::make_shared<int>(0))
 {
 }
 
@@ -23,10 +24,14 @@ VulkanMesh *VulkanMeshModel::getMesh(size_t index)
 
 void VulkanMeshModel::destroyMeshModel()
 {
-    for (auto &mesh : meshes)
+    if (geometryUsers.use_count() <= 1)
     {
-        mesh.destroyBuffers();
+        for (auto &mesh : meshes)
+        {
+            mesh.releaseGeometry();
+        }
     }
+    geometryUsers.reset();
 }
 
 std::vector<std::string> VulkanMeshModel::loadMaterials(const aiScene *scene)
@@ -60,12 +65,12 @@ std::vector<std::string> VulkanMeshModel::loadMaterials(const aiScene *scene)
     return textures;
 }
 
-VulkanMesh VulkanMeshModel::loadMesh(vk::PhysicalDevice physicalDeviceP, vk::Device deviceP, vk::Queue transferQueue,
-                                     vk::CommandPool transferCommandPool, aiMesh *mesh, const aiScene *scene,
-                                     std::vector<int> matToTex)
+MeshData VulkanMeshModel::loadMesh(aiMesh *mesh, const aiScene *scene)
 {
-    std::vector<Vertex> vertices(mesh->mNumVertices);
-    std::vector<uint32_t> indices;
+    MeshData meshData;
+    std::vector<Vertex> &vertices = meshData.vertices;
+    std::vector<uint32_t> &indices = meshData.indices;
+    vertices.resize(mesh->mNumVertices);
     // Copy all vertices
     for (size_t i = 0; i < mesh->mNumVertices; ++i)
     {
@@ -84,6 +89,7 @@ VulkanMesh VulkanMeshModel::loadMesh(vk::PhysicalDevice physicalDeviceP, vk::Dev
         vertices[i].col = {1.0f, 1.0f, 1.0f};
     }
     // Copy all indices, stored by face (triangle)
+    indices.reserve(mesh->mNumFaces * 3);
     for (size_t i = 0; i < mesh->mNumFaces; ++i)
     {
         aiFace face = mesh->mFaces[i];
@@ -92,34 +98,167 @@ VulkanMesh VulkanMeshModel::loadMesh(vk::PhysicalDevice physicalDeviceP, vk::Dev
             indices.push_back(face.mIndices[j]);
         }
     }
-    // Create new mesh
-    VulkanMesh newMesh = VulkanMesh(physicalDeviceP, deviceP, transferQueue, transferCommandPool, &vertices, &indices,
-                                    matToTex[mesh->mMaterialIndex]);
-    return newMesh;
+    // Bounds are stored alongside the geometry, e.g. in the mesh cache
+    if (!vertices.empty())
+    {
+        meshData.boundsMin = vertices[0].pos;
+        meshData.boundsMax = vertices[0].pos;
+        for (const Vertex &vertex : vertices)
+        {
+            meshData.boundsMin = glm::min(meshData.boundsMin, vertex.pos);
+            meshData.boundsMax = glm::max(meshData.boundsMax, vertex.pos);
+        }
+    }
+    meshData.materialIndex = mesh->mMaterialIndex;
+    return meshData;
+}
+
+std::vector<MeshData> VulkanMeshModel::loadNode(aiNode *node, const aiScene *scene, ThreadPool &threadPool,
+                                                SceneGraph &sceneGraph)
+{
+    // Flatten the tree first, so the conversions can be spread over the workers
+    std::vector<aiMesh *> sceneMeshes;
+    std::vector<uint32_t> meshNodes;
+    collectNodeMeshes(node, scene, SceneGraph::NO_PARENT, sceneGraph, sceneMeshes, meshNodes);
+
+    // Each worker writes its own slot: results come out in node order whatever the scheduling
+    std::vector<MeshData> meshes(sceneMeshes.size());
+    threadPool.parallelFor(sceneMeshes.size(), [&](size_t i) {
+        meshes[i] = loadMesh(sceneMeshes[i], scene);
+        meshes[i].nodeIndex = meshNodes[i];
+    });
+    return meshes;
 }
 
-std::vector<VulkanMesh> VulkanMeshModel::loadNode(vk::PhysicalDevice physicalDeviceP, vk::Device deviceP,
-                                                  vk::Queue transferQueue, vk::CommandPool transferCommandPool,
-                                                  aiNode *node, const aiScene *scene, std::vector<int> matToTex)
+// Assimp matrices are row major, glm ones column major
+static glm::mat4 toGlmMatrix(const aiMatrix4x4 &matrix)
 {
-    std::vector<VulkanMesh> meshes;
-    // Go through each mesh at this node and create it, then add it to our meshList
+    glm::mat4 result;
+    for (int row = 0; row < 4; ++row)
+    {
+        for (int column = 0; column < 4; ++column)
+        {
+            result[column][row] = matrix[row][column];
+        }
+    }
+    return result;
+}
+
+void VulkanMeshModel::collectNodeMeshes(aiNode *node, const aiScene *scene, uint32_t parentNode,
+                                        SceneGraph &sceneGraph, std::vector<aiMesh *> &meshes,
+                                        std::vector<uint32_t> &meshNodes)
+{
+    // Recursion visits the nodes depth first, the order the scene graph stores them in
+    uint32_t sceneNode = sceneGraph.addNode(parentNode, toGlmMatrix(node->mTransformation), node->mName.C_Str());
+
+    // Go through each mesh at this node and add it to our meshList
     for (size_t i = 0; i < node->mNumMeshes; ++i)
     {
-        // Load mesh
-        meshes.push_back(loadMesh(physicalDeviceP, deviceP, transferQueue, transferCommandPool,
-                                  scene->mMeshes[node->mMeshes[i]], scene, matToTex));
+        meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+        meshNodes.push_back(sceneNode);
         // Explanation of scene->mMeshes[node->mMeshes[i]]:
         // The scene actually hold the data for the meshes, and the nodes store ids of
         // meshes, that relate to the scene meshes.
     }
-    // Go through each node attached to this node and load it,
-    // then append their meshes to this node's meshes
+    // Go through each node attached to this node, their meshes come after this node's meshes
     for (size_t i = 0; i < node->mNumChildren; ++i)
     {
-        std::vector<VulkanMesh> newMeshes =
-            loadNode(physicalDeviceP, deviceP, transferQueue, transferCommandPool, node->mChildren[i], scene, matToTex);
-        meshes.insert(end(meshes), begin(newMeshes), end(newMeshes));
+        collectNodeMeshes(node->mChildren[i], scene, sceneNode, sceneGraph, meshes, meshNodes);
     }
-    return meshes;
+}
+
+void VulkanMeshModel::loadMeshSkin(aiMesh *mesh, uint32_t meshNode, const SceneGraph &sceneGraph,
+                                   std::vector<VertexSkin> &skins, Skin &skin)
+{
+    skins.assign(mesh->mNumVertices, VertexSkin{});
+    skin.jointNodes.clear();
+    skin.inverseBindMatrices.clear();
+    if (!mesh->HasBones())
+    {
+        // Rigid mesh: every vertex follows its own node
+        skin.jointNodes.push_back(meshNode);
+        skin.inverseBindMatrices.push_back(glm::mat4(1.0f));
+        for (auto &vertexSkin : skins)
+        {
+            vertexSkin.weights[0] = 65535;
+        }
+        return;
+    }
+    if (mesh->mNumBones > UINT16_MAX)
+    {
+        throw std::runtime_error("Too many bones in mesh: " + std::string(mesh->mName.C_Str()));
+    }
+
+    // Assimp lists the vertices of each bone, they are gathered per vertex before keeping the largest weights
+    std::vector<std::vector<JointWeight>> influences(mesh->mNumVertices);
+    for (uint32_t joint = 0; joint < mesh->mNumBones; ++joint)
+    {
+        const aiBone *bone = mesh->mBones[joint];
+        uint32_t node = sceneGraph.findNode(bone->mName.C_Str());
+        if (node == SceneGraph::NO_PARENT)
+        {
+            throw std::runtime_error("Bone without a node: " + std::string(bone->mName.C_Str()));
+        }
+        skin.jointNodes.push_back(node);
+        skin.inverseBindMatrices.push_back(toGlmMatrix(bone->mOffsetMatrix));
+        for (size_t i = 0; i < bone->mNumWeights; ++i)
+        {
+            const aiVertexWeight &weight = bone->mWeights[i];
+            influences[weight.mVertexId].push_back(JointWeight{joint, weight.mWeight});
+        }
+    }
+    for (size_t i = 0; i < skins.size(); ++i)
+    {
+        skins[i] = Skeleton::packVertexSkin(influences[i]);
+    }
+}
+
+std::vector<AnimationClip> VulkanMeshModel::loadAnimations(const aiScene *scene, const SceneGraph &sceneGraph)
+{
+    std::vector<AnimationClip> clips(scene->mNumAnimations);
+    for (size_t i = 0; i < clips.size(); ++i)
+    {
+        const aiAnimation *animation = scene->mAnimations[i];
+        AnimationClip &clip = clips[i];
+        // Files without a rate are played at 25 ticks per second, like Assimp's viewer does
+        double ticksPerSecond = animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+        clip.name = animation->mName.C_Str();
+        clip.duration = static_cast<float>(animation->mDuration / ticksPerSecond);
+        clip.translationRanges.resize(sceneGraph.getNodeCount());
+        clip.rotationRanges.resize(sceneGraph.getNodeCount());
+        clip.scaleRanges.resize(sceneGraph.getNodeCount());
+
+        for (size_t j = 0; j < animation->mNumChannels; ++j)
+        {
+            const aiNodeAnim *channel = animation->mChannels[j];
+            uint32_t node = sceneGraph.findNode(channel->mNodeName.C_Str());
+            if (node == SceneGraph::NO_PARENT)
+            {
+                continue;
+            }
+            clip.translationRanges[node] = {static_cast<uint32_t>(clip.translationTimes.size()),
+                                            channel->mNumPositionKeys};
+            for (size_t k = 0; k < channel->mNumPositionKeys; ++k)
+            {
+                const aiVectorKey &key = channel->mPositionKeys[k];
+                clip.translationTimes.push_back(static_cast<float>(key.mTime / ticksPerSecond));
+                clip.translations.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            clip.rotationRanges[node] = {static_cast<uint32_t>(clip.rotationTimes.size()), channel->mNumRotationKeys};
+            for (size_t k = 0; k < channel->mNumRotationKeys; ++k)
+            {
+                const aiQuatKey &key = channel->mRotationKeys[k];
+                clip.rotationTimes.push_back(static_cast<float>(key.mTime / ticksPerSecond));
+                clip.rotations.push_back(glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            clip.scaleRanges[node] = {static_cast<uint32_t>(clip.scaleTimes.size()), channel->mNumScalingKeys};
+            for (size_t k = 0; k < channel->mNumScalingKeys; ++k)
+            {
+                const aiVectorKey &key = channel->mScalingKeys[k];
+                clip.scaleTimes.push_back(static_cast<float>(key.mTime / ticksPerSecond));
+                clip.scales.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+        }
+    }
+    return clips;
 }
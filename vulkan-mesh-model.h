@@ -1,9 +1,13 @@
 #pragma once
 #include <assimp/scene.h>
 #include <glm/glm.hpp>
+#include <memory>
 #include <vector>
 
 #include "vulkan-mesh.h"
+#include "vulkan-scene-graph.h"
+#include "vulkan-skeletal-animation.h"
+#include "vulkan-thread-pool.h"
 
 class VulkanMeshModel
 {
@@ -29,17 +33,51 @@ class VulkanMeshModel
         model = modelP;
     }
 
+    // Give the geometry back once the last copy of the model is destroyed, instances being copies
     void destroyMeshModel();
 
+    // Texture references held by this model, released when the model is destroyed
+    const std::vector<int> &getTextureIds() const
+    {
+        return textureIds;
+    }
+    void setTextureIds(const std::vector<int> &textureIdsP)
+    {
+        textureIds = textureIdsP;
+    }
+
+    // Node hierarchy of the model, a mesh is drawn with model * world transform of its node.
+    // Each instance has its own copy, so parts can be animated per instance.
+    SceneGraph &getSceneGraph()
+    {
+        return sceneGraph;
+    }
+    void setSceneGraph(const SceneGraph &sceneGraphP)
+    {
+        sceneGraph = sceneGraphP;
+    }
+
     static std::vector<std::string> loadMaterials(const aiScene *scene);
-    static VulkanMesh loadMesh(vk::PhysicalDevice physicalDeviceP, vk::Device deviceP, vk::Queue transferQueue,
-                               vk::CommandPool transferCommandPool, aiMesh *mesh, const aiScene *scene,
-                               std::vector<int> matToTex);
-    static std::vector<VulkanMesh> loadNode(vk::PhysicalDevice physicalDeviceP, vk::Device deviceP,
-                                            vk::Queue transferQueue, vk::CommandPool transferCommandPool, aiNode *node,
-                                            const aiScene *scene, std::vector<int> matToTex);
+    // Conversion from Assimp to CPU-side mesh data, uploading is left to the caller
+    static MeshData loadMesh(aiMesh *mesh, const aiScene *scene);
+    // Meshes are converted in parallel on threadPool, the result keeps the node traversal order.
+    // The nodes are added to sceneGraph with their transforms, each mesh pointing at its node.
+    static std::vector<MeshData> loadNode(aiNode *node, const aiScene *scene, ThreadPool &threadPool,
+                                          SceneGraph &sceneGraph);
+    static void collectNodeMeshes(aiNode *node, const aiScene *scene, uint32_t parentNode, SceneGraph &sceneGraph,
+                                  std::vector<aiMesh *> &meshes, std::vector<uint32_t> &meshNodes);
+    // Joints and per vertex influences of a mesh hanging from meshNode, bones found by name in sceneGraph.
+    // Expects at most four weights per vertex (aiProcess_LimitBoneWeights), keeps the four largest otherwise.
+    static void loadMeshSkin(aiMesh *mesh, uint32_t meshNode, const SceneGraph &sceneGraph,
+                             std::vector<VertexSkin> &skins, Skin &skin);
+    // Every animation of the scene, key times converted from ticks to seconds
+    static std::vector<AnimationClip> loadAnimations(const aiScene *scene, const SceneGraph &sceneGraph);
 
   private:
     std::vector<VulkanMesh> meshes;
     glm::mat4 model;
+    std::vector<int> textureIds;
+    SceneGraph sceneGraph;
+    // Shared by every copy of the model, its use count tells when the geometry is no longer drawn
+    std::shared_ptr<int> geometryUsers;
 };
@@ -0,0 +1,481 @@
+#include "vulkan-mesh-optimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(const uint32_t *indices, size_t indexCount, size_t vertexCount,
+                                                   uint32_t cacheSize)
+{
+    VertexCacheStats stats;
+    stats.triangleCount = indexCount / 3;
+
+    // A vertex is in the FIFO while fewer than cacheSize misses happened since it was inserted
+    std::vector<uint32_t> cacheTimes(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    uint32_t timestamp = cacheSize + 1;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t vertex = indices[i];
+        if (timestamp - cacheTimes[vertex] > cacheSize)
+        {
+            cacheTimes[vertex] = timestamp++;
+            stats.cacheMisses++;
+        }
+        if (!referenced[vertex])
+        {
+            referenced[vertex] = true;
+            stats.vertexCount++;
+        }
+    }
+    return stats;
+}
+
+void MeshOptimizer::optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount,
+                                        std::vector<uint32_t> &clusterStarts, uint32_t cacheSize)
+{
+    size_t triangleCount = indices.size() / 3;
+    clusterStarts.clear();
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // Triangles using each vertex, as one flat array: adjacency[adjacencyOffsets[v] .. adjacencyOffsets[v + 1]]
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for (uint32_t vertex : indices)
+    {
+        liveTriangles[vertex]++;
+    }
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t vertex = 0; vertex < vertexCount; ++vertex)
+    {
+        adjacencyOffsets[vertex + 1] = adjacencyOffsets[vertex] + liveTriangles[vertex];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+    {
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            adjacency[adjacencyFill[indices[triangle * 3 + corner]]++] = static_cast<uint32_t>(triangle);
+        }
+    }
+
+    std::vector<uint32_t> cacheTimes(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEndStack;
+    deadEndStack.reserve(indices.size());
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    uint32_t timestamp = cacheSize + 1;
+    // Next vertex to look at in input order, once the dead-end stack is exhausted
+    size_t cursor = 0;
+
+    int64_t fanningVertex = indices[0];
+    bool isRestart = true;
+    while (fanningVertex >= 0)
+    {
+        if (isRestart)
+        {
+            clusterStarts.push_back(static_cast<uint32_t>(output.size() / 3));
+        }
+
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (uint32_t i = adjacencyOffsets[fanningVertex]; i < adjacencyOffsets[fanningVertex + 1]; ++i)
+        {
+            uint32_t triangle = adjacency[i];
+            if (emitted[triangle])
+            {
+                continue;
+            }
+            emitted[triangle] = true;
+            for (size_t corner = 0; corner < 3; ++corner)
+            {
+                uint32_t vertex = indices[triangle * 3 + corner];
+                output.push_back(vertex);
+                deadEndStack.push_back(vertex);
+                candidates.push_back(vertex);
+                liveTriangles[vertex]--;
+                if (timestamp - cacheTimes[vertex] > cacheSize)
+                {
+                    cacheTimes[vertex] = timestamp++;
+                }
+            }
+        }
+
+        // Next fanning vertex: among the vertices just emitted, the oldest one that will still be in the cache
+        // once all of its remaining triangles are emitted (each adds at most 2 vertices).
+        // Any vertex with triangles left is better than none.
+        int64_t nextVertex = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t vertex : candidates)
+        {
+            if (liveTriangles[vertex] == 0)
+            {
+                continue;
+            }
+            int64_t priority = 0;
+            if (timestamp - cacheTimes[vertex] + 2 * liveTriangles[vertex] <= cacheSize)
+            {
+                priority = timestamp - cacheTimes[vertex];
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                nextVertex = vertex;
+            }
+        }
+
+        // Dead end: restart from the most recently used vertex with triangles left, else the next one in input order
+        isRestart = nextVertex < 0;
+        while (nextVertex < 0 && !deadEndStack.empty())
+        {
+            uint32_t vertex = deadEndStack.back();
+            deadEndStack.pop_back();
+            if (liveTriangles[vertex] > 0)
+            {
+                nextVertex = vertex;
+            }
+        }
+        while (nextVertex < 0 && cursor < vertexCount)
+        {
+            if (liveTriangles[cursor] > 0)
+            {
+                nextVertex = cursor;
+            }
+            ++cursor;
+        }
+        fanningVertex = nextVertex;
+    }
+    indices.swap(output);
+}
+
+void MeshOptimizer::optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices,
+                                     std::vector<uint32_t> clusterStarts, float threshold)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || clusterStarts.empty())
+    {
+        return;
+    }
+
+    // Split the clusters further wherever their running ACMR, starting from an empty cache, is already as good
+    // as the whole mesh's: more, smaller clusters to sort for a small loss in cache efficiency
+    float meshACMR = analyzeVertexCache(indices.data(), indices.size(), vertices.size()).getACMR();
+    std::vector<uint32_t> softClusterStarts;
+    std::vector<uint32_t> cacheTimes(vertices.size(), 0);
+    uint32_t timestamp = CACHE_SIZE + 1;
+    clusterStarts.push_back(static_cast<uint32_t>(triangleCount));
+    for (size_t cluster = 0; cluster + 1 < clusterStarts.size(); ++cluster)
+    {
+        softClusterStarts.push_back(clusterStarts[cluster]);
+        timestamp += CACHE_SIZE + 1;
+        size_t clusterMisses = 0;
+        size_t clusterTriangles = 0;
+        for (uint32_t triangle = clusterStarts[cluster]; triangle < clusterStarts[cluster + 1]; ++triangle)
+        {
+            for (size_t corner = 0; corner < 3; ++corner)
+            {
+                uint32_t vertex = indices[triangle * 3 + corner];
+                if (timestamp - cacheTimes[vertex] > CACHE_SIZE)
+                {
+                    cacheTimes[vertex] = timestamp++;
+                    clusterMisses++;
+                }
+            }
+            clusterTriangles++;
+            if (triangle + 1 < clusterStarts[cluster + 1] && clusterMisses <= threshold * meshACMR * clusterTriangles)
+            {
+                softClusterStarts.push_back(triangle + 1);
+                timestamp += CACHE_SIZE + 1;
+                clusterMisses = 0;
+                clusterTriangles = 0;
+            }
+        }
+    }
+    softClusterStarts.push_back(static_cast<uint32_t>(triangleCount));
+
+    // Area weighted centroid and normal of each cluster, and centroid of the whole mesh
+    size_t clusterCount = softClusterStarts.size() - 1;
+    std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t cluster = 0; cluster < clusterCount; ++cluster)
+    {
+        float clusterArea = 0.0f;
+        for (uint32_t triangle = softClusterStarts[cluster]; triangle < softClusterStarts[cluster + 1]; ++triangle)
+        {
+            const glm::vec3 &p0 = vertices[indices[triangle * 3 + 0]].pos;
+            const glm::vec3 &p1 = vertices[indices[triangle * 3 + 1]].pos;
+            const glm::vec3 &p2 = vertices[indices[triangle * 3 + 2]].pos;
+            // Length of the cross product is twice the area: the factor cancels out
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+            clusterCentroids[cluster] += (p0 + p1 + p2) * (area / 3.0f);
+            clusterNormals[cluster] += normal;
+            clusterArea += area;
+        }
+        meshCentroid += clusterCentroids[cluster];
+        meshArea += clusterArea;
+        if (clusterArea > 0.0f)
+        {
+            clusterCentroids[cluster] /= clusterArea;
+        }
+    }
+    if (meshArea > 0.0f)
+    {
+        meshCentroid /= meshArea;
+    }
+
+    // Clusters far out along their normal tend to occlude the others: draw them first
+    std::vector<float> sortKeys(clusterCount, 0.0f);
+    for (size_t cluster = 0; cluster < clusterCount; ++cluster)
+    {
+        float normalLength = glm::length(clusterNormals[cluster]);
+        if (normalLength > 0.0f)
+        {
+            sortKeys[cluster] =
+                glm::dot(clusterCentroids[cluster] - meshCentroid, clusterNormals[cluster] / normalLength);
+        }
+    }
+    std::vector<uint32_t> clusterOrder(clusterCount);
+    for (size_t cluster = 0; cluster < clusterCount; ++cluster)
+    {
+        clusterOrder[cluster] = static_cast<uint32_t>(cluster);
+    }
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(),
+                     [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    for (uint32_t cluster : clusterOrder)
+    {
+        output.insert(output.end(), indices.begin() + softClusterStarts[cluster] * 3,
+                      indices.begin() + softClusterStarts[cluster + 1] * 3);
+    }
+    indices.swap(output);
+}
+
+void MeshOptimizer::optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+    const uint32_t unused = ~0u;
+    std::vector<uint32_t> remap(vertices.size(), unused);
+    std::vector<Vertex> output;
+    output.reserve(vertices.size());
+    for (uint32_t &index : indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = static_cast<uint32_t>(output.size());
+            output.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(output);
+}
+
+void MeshOptimizer::optimizeMesh(MeshData &mesh)
+{
+    std::vector<uint32_t> clusterStarts;
+    optimizeVertexCache(mesh.indices, mesh.vertices.size(), clusterStarts);
+    optimizeOverdraw(mesh.indices, mesh.vertices, clusterStarts);
+    optimizeVertexFetch(mesh.vertices, mesh.indices);
+}
+
+std::vector<MeshData> MeshOptimizer::splitMesh(const MeshData &mesh, size_t maxVertexCount)
+{
+    std::vector<MeshData> chunks;
+    const uint32_t unused = ~0u;
+    // Position of each source vertex in the current chunk
+    std::vector<uint32_t> remap(mesh.vertices.size(), unused);
+    std::vector<uint32_t> remappedVertices;
+
+    MeshData chunk;
+    auto finishChunk = [&]() {
+        chunk.materialIndex = mesh.materialIndex;
+        chunk.nodeIndex = mesh.nodeIndex;
+        chunk.boundsMin = chunk.vertices[0].pos;
+        chunk.boundsMax = chunk.vertices[0].pos;
+        for (const Vertex &vertex : chunk.vertices)
+        {
+            chunk.boundsMin = glm::min(chunk.boundsMin, vertex.pos);
+            chunk.boundsMax = glm::max(chunk.boundsMax, vertex.pos);
+        }
+        chunks.push_back(std::move(chunk));
+        chunk = MeshData();
+        for (uint32_t vertex : remappedVertices)
+        {
+            remap[vertex] = unused;
+        }
+        remappedVertices.clear();
+    };
+
+    for (size_t triangle = 0; triangle + 2 < mesh.indices.size(); triangle += 3)
+    {
+        size_t newVertexCount = 0;
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            newVertexCount += remap[mesh.indices[triangle + corner]] == unused ? 1 : 0;
+        }
+        if (chunk.vertices.size() + newVertexCount > maxVertexCount)
+        {
+            finishChunk();
+        }
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            uint32_t vertex = mesh.indices[triangle + corner];
+            if (remap[vertex] == unused)
+            {
+                remap[vertex] = static_cast<uint32_t>(chunk.vertices.size());
+                remappedVertices.push_back(vertex);
+                chunk.vertices.push_back(mesh.vertices[vertex]);
+            }
+            chunk.indices.push_back(remap[vertex]);
+        }
+    }
+    if (!chunk.vertices.empty())
+    {
+        finishChunk();
+    }
+    return chunks;
+}
+
+float MeshOptimizer::getTranslationTolerance(const glm::vec3 &firstMin, const glm::vec3 &firstMax,
+                                             const glm::vec3 &secondMin, const glm::vec3 &secondMax)
+{
+    glm::vec3 magnitude =
+        glm::max(glm::max(glm::abs(firstMin), glm::abs(firstMax)), glm::max(glm::abs(secondMin), glm::abs(secondMax)));
+    return TRANSLATION_TOLERANCE * std::numeric_limits<float>::epsilon() *
+           std::max({magnitude.x, magnitude.y, magnitude.z});
+}
+
+std::vector<uint32_t> MeshOptimizer::findDuplicateMeshes(const std::vector<MeshView> &meshes)
+{
+    // Same sizes first, a cheap key that leaves most unique meshes alone in their bucket. Bounds are left out: a
+    // translated copy has other bounds.
+    auto getShapeKey = [](const MeshView &mesh) {
+        size_t sizes[4] = {mesh.vertexCount, mesh.indexCount, mesh.lodCount, mesh.meshletCount};
+        return hashBytes(sizes, sizeof(sizes));
+    };
+    auto isSameArray = [](const void *first, const void *second, size_t size) {
+        // Views of a mesh cache share the arrays of the duplicates baked in it
+        return size == 0 || first == second || memcmp(first, second, size) == 0;
+    };
+    // Positions relative to the bounds, within the rounding of the translation
+    auto isSameVertices = [](const MeshView &first, const MeshView &second) {
+        if (first.vertices == second.vertices)
+        {
+            return true;
+        }
+        glm::vec3 offset = second.boundsMin - first.boundsMin;
+        glm::vec3 tolerance(
+            getTranslationTolerance(first.boundsMin, first.boundsMax, second.boundsMin, second.boundsMax));
+        for (size_t i = 0; i < first.vertexCount; ++i)
+        {
+            const Vertex &firstVertex = first.vertices[i];
+            const Vertex &secondVertex = second.vertices[i];
+            if (firstVertex.tex != secondVertex.tex || firstVertex.col != secondVertex.col ||
+                glm::any(glm::greaterThan(glm::abs(firstVertex.pos + offset - secondVertex.pos), tolerance)))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto isSameGeometry = [&](const MeshView &first, const MeshView &second) {
+        if (first.vertexCount != second.vertexCount || first.indexCount != second.indexCount ||
+            first.lodCount != second.lodCount || first.meshletCount != second.meshletCount ||
+            first.isEncoded() != second.isEncoded())
+        {
+            return false;
+        }
+        if (first.isEncoded())
+        {
+            return first.encodedVertexSize == second.encodedVertexSize &&
+                   first.encodedIndexSize == second.encodedIndexSize &&
+                   isSameArray(first.encodedVertices, second.encodedVertices, first.encodedVertexSize) &&
+                   isSameArray(first.encodedIndices, second.encodedIndices, first.encodedIndexSize) &&
+                   isSameArray(first.lods, second.lods, first.lodCount * sizeof(MeshLod)) &&
+                   isSameArray(first.meshlets, second.meshlets, first.meshletCount * sizeof(Meshlet));
+        }
+        // Levels and meshlets are made from the geometry: once it matches, the first mesh's ones serve its
+        // duplicates, only the index ranges of the levels are compared
+        for (size_t i = 0; i < first.lodCount; ++i)
+        {
+            if (first.lods[i].indexOffset != second.lods[i].indexOffset ||
+                first.lods[i].indexCount != second.lods[i].indexCount)
+            {
+                return false;
+            }
+        }
+        return isSameArray(first.indices, second.indices, first.indexCount * sizeof(uint32_t)) &&
+               isSameVertices(first, second);
+    };
+
+    std::vector<uint64_t> shapeKeys(meshes.size());
+    std::unordered_map<uint64_t, uint32_t> shapeCounts;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        shapeKeys[i] = getShapeKey(meshes[i]);
+        shapeCounts[shapeKeys[i]]++;
+    }
+
+    // Then the hash of the content a translation leaves alone, confirmed by comparing the arrays as hashes may
+    // collide
+    std::vector<uint32_t> duplicateOf(meshes.size());
+    std::unordered_map<uint64_t, std::vector<uint32_t>> firstMeshes;
+    // Keyed by the vertex array, or the vertex stream of a compressed cache
+    std::unordered_map<const void *, uint32_t> firstMeshesByArray;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        duplicateOf[i] = static_cast<uint32_t>(i);
+        if (shapeCounts[shapeKeys[i]] < 2)
+        {
+            continue;
+        }
+        // Arrays already seen need no hashing
+        const MeshView &mesh = meshes[i];
+        const void *vertexArray = mesh.isEncoded() ? static_cast<const void *>(mesh.encodedVertices) : mesh.vertices;
+        auto sameArrays = firstMeshesByArray.find(vertexArray);
+        if (sameArrays != firstMeshesByArray.end() && isSameGeometry(meshes[sameArrays->second], mesh))
+        {
+            duplicateOf[i] = sameArrays->second;
+            continue;
+        }
+        firstMeshesByArray.emplace(vertexArray, static_cast<uint32_t>(i));
+        uint64_t contentKey = shapeKeys[i];
+        if (mesh.isEncoded())
+        {
+            // The codec is deterministic: same geometry, same streams
+            contentKey = hashBytes(mesh.encodedVertices, mesh.encodedVertexSize, contentKey);
+            contentKey = hashBytes(mesh.encodedIndices, mesh.encodedIndexSize, contentKey);
+        }
+        else
+        {
+            contentKey = hashBytes(mesh.indices, mesh.indexCount * sizeof(uint32_t), contentKey);
+            for (size_t vertex = 0; vertex < mesh.vertexCount; ++vertex)
+            {
+                contentKey = hashBytes(&mesh.vertices[vertex].tex, sizeof(glm::vec2), contentKey);
+            }
+        }
+        std::vector<uint32_t> &candidates = firstMeshes[contentKey];
+        for (uint32_t candidate : candidates)
+        {
+            if (isSameGeometry(meshes[candidate], mesh))
+            {
+                duplicateOf[i] = candidate;
+                break;
+            }
+        }
+        if (duplicateOf[i] == i)
+        {
+            candidates.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    return duplicateOf;
+}
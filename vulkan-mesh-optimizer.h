@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "vulkan-mesh.h"
+
+// Post-transform vertex cache efficiency of an index buffer, simulated with a FIFO cache
+struct VertexCacheStats
+{
+    size_t triangleCount{0};
+    size_t vertexCount{0}; // Vertices referenced by at least one triangle
+    size_t cacheMisses{0}; // Vertex shader invocations
+
+    // Average cache miss ratio: shader invocations per triangle, 0.5 at best on a regular grid, 3 at worst
+    float getACMR() const
+    {
+        return triangleCount ? static_cast<float>(cacheMisses) / triangleCount : 0.0f;
+    }
+    // Average transformed vertex ratio: shader invocations per vertex, 1 is ideal
+    float getATVR() const
+    {
+        return vertexCount ? static_cast<float>(cacheMisses) / vertexCount : 0.0f;
+    }
+
+    VertexCacheStats &operator+=(const VertexCacheStats &other)
+    {
+        triangleCount += other.triangleCount;
+        vertexCount += other.vertexCount;
+        cacheMisses += other.cacheMisses;
+        return *this;
+    }
+};
+
+// Reordering of imported triangle lists for the GPU, run once at import time (results are baked in the mesh cache):
+//   1. Vertex cache: Tipsify (Sander, Nehab, Barczak 2007) fans around recently used vertices
+//   2. Overdraw: the Tipsify clusters are sorted so the ones facing outward are drawn first
+//   3. Vertex fetch: vertices are renumbered in first use order, the vertex buffer is read almost linearly
+class MeshOptimizer
+{
+  public:
+    // Cache size targeted by Tipsify and used for the statistics, close to the effective size on current GPUs
+    static constexpr uint32_t CACHE_SIZE = 16;
+    // Clusters may be split further as long as their ACMR stays within this factor of the whole mesh's
+    static constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+    static VertexCacheStats analyzeVertexCache(const uint32_t *indices, size_t indexCount, size_t vertexCount,
+                                               uint32_t cacheSize = CACHE_SIZE);
+
+    // Reorder triangles for vertex cache reuse. clusterStarts receives the first triangle of every cluster,
+    // a cluster ending where Tipsify had to restart from a vertex outside of the cache.
+    static void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount,
+                                    std::vector<uint32_t> &clusterStarts, uint32_t cacheSize = CACHE_SIZE);
+    // Reorder the clusters of a cache optimized index buffer, outward facing ones first
+    static void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices,
+                                 std::vector<uint32_t> clusterStarts, float threshold = OVERDRAW_THRESHOLD);
+    // Renumber vertices in first use order, unreferenced vertices are dropped
+    static void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+    // The three steps above, in order
+    static void optimizeMesh(MeshData &mesh);
+
+    // Cut a mesh into consecutive runs of triangles using at most maxVertexCount vertices each, so that every
+    // chunk can use 16 bits indices. Triangle order, hence cache and overdraw ordering, is kept.
+    static std::vector<MeshData> splitMesh(const MeshData &mesh, size_t maxVertexCount);
+
+    // For each mesh, the index of the first mesh with the same geometry up to a translation (vertices, indices,
+    // levels of detail and meshlets), or its own index when it is the first. Material and node may differ: all the
+    // duplicates of a mesh can draw from a single GPU copy, moved by the difference of their bounds. Positions are
+    // compared relative to the bounds, the other attributes and the indices exactly. Compressed views only match
+    // at the same position, their streams are compared as they are.
+    static std::vector<uint32_t> findDuplicateMeshes(const std::vector<MeshView> &meshes);
+    // Positions of a translated duplicate may differ from the first mesh's moved by the translation by its rounding:
+    // up to this many float epsilons of the largest coordinate of their bounds
+    static constexpr float TRANSLATION_TOLERANCE = 8.0f;
+    static float getTranslationTolerance(const glm::vec3 &firstMin, const glm::vec3 &firstMax,
+                                         const glm::vec3 &secondMin, const glm::vec3 &secondMax);
+};
@@ -0,0 +1,300 @@
+#include "vulkan-mesh-simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#include "vulkan-mesh-optimizer.h"
+
+// Sum of squared distances to a set of planes, weighted by triangle area:
+//   error(p) = p^T A p + 2 b.p + c with A = sum n n^T, b = sum d n, c = sum d^2
+struct Quadric
+{
+    double a00{0.0}, a01{0.0}, a02{0.0}, a11{0.0}, a12{0.0}, a22{0.0};
+    double b0{0.0}, b1{0.0}, b2{0.0};
+    double c{0.0};
+    double weight{0.0};
+
+    void addPlane(const glm::vec3 &normal, float distance, double planeWeight)
+    {
+        a00 += planeWeight * normal.x * normal.x;
+        a01 += planeWeight * normal.x * normal.y;
+        a02 += planeWeight * normal.x * normal.z;
+        a11 += planeWeight * normal.y * normal.y;
+        a12 += planeWeight * normal.y * normal.z;
+        a22 += planeWeight * normal.z * normal.z;
+        b0 += planeWeight * normal.x * distance;
+        b1 += planeWeight * normal.y * distance;
+        b2 += planeWeight * normal.z * distance;
+        c += planeWeight * distance * distance;
+        weight += planeWeight;
+    }
+
+    void add(const Quadric &other)
+    {
+        a00 += other.a00;
+        a01 += other.a01;
+        a02 += other.a02;
+        a11 += other.a11;
+        a12 += other.a12;
+        a22 += other.a22;
+        b0 += other.b0;
+        b1 += other.b1;
+        b2 += other.b2;
+        c += other.c;
+        weight += other.weight;
+    }
+
+    double evaluate(const glm::vec3 &p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double error = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                       2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        return std::max(error, 0.0);
+    }
+};
+
+struct Collapse
+{
+    uint32_t from;
+    uint32_t to;
+    double error; // Mean squared distance to the planes of both endpoints, at the destination
+};
+
+static uint64_t getEdgeKey(uint32_t a, uint32_t b)
+{
+    return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+static glm::vec3 getTriangleNormal(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2)
+{
+    return glm::cross(p1 - p0, p2 - p0);
+}
+
+std::vector<uint32_t> MeshSimplifier::simplify(const std::vector<Vertex> &vertices, const uint32_t *indices,
+                                               size_t indexCount, size_t targetIndexCount, float *resultError)
+{
+    std::vector<uint32_t> result(indices, indices + indexCount);
+    size_t vertexCount = vertices.size();
+    double maxError = 0.0;
+
+    // Planes of the original triangles, so that errors keep measuring the distance to the full mesh
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i + 2 < result.size(); i += 3)
+    {
+        const glm::vec3 &p0 = vertices[result[i]].pos;
+        glm::vec3 normal = getTriangleNormal(p0, vertices[result[i + 1]].pos, vertices[result[i + 2]].pos);
+        float doubleArea = glm::length(normal);
+        if (doubleArea == 0.0f)
+        {
+            continue;
+        }
+        normal /= doubleArea;
+        float distance = -glm::dot(normal, p0);
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            quadrics[result[i + corner]].addPlane(normal, distance, doubleArea * 0.5);
+        }
+    }
+
+    std::vector<uint32_t> liveTriangles(vertexCount);
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool> locked(vertexCount);
+    std::vector<bool> touched(vertexCount);
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    std::vector<Collapse> collapses;
+
+    // Each pass collapses an independent set of edges, cheapest first, then rebuilds the topology
+    while (result.size() > targetIndexCount)
+    {
+        size_t triangleCount = result.size() / 3;
+
+        // Border edges belong to a single triangle, their vertices are locked
+        edgeUses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (size_t corner = 0; corner < 3; ++corner)
+            {
+                edgeUses[getEdgeKey(result[i + corner], result[i + (corner + 1) % 3])]++;
+            }
+        }
+        std::fill(locked.begin(), locked.end(), false);
+        for (const auto &edge : edgeUses)
+        {
+            if (edge.second == 1)
+            {
+                locked[edge.first >> 32] = true;
+                locked[edge.first & 0xffffffffu] = true;
+            }
+        }
+
+        // Triangles using each vertex, as one flat array like in MeshOptimizer::optimizeVertexCache
+        std::fill(liveTriangles.begin(), liveTriangles.end(), 0);
+        for (uint32_t vertex : result)
+        {
+            liveTriangles[vertex]++;
+        }
+        for (size_t vertex = 0; vertex < vertexCount; ++vertex)
+        {
+            adjacencyOffsets[vertex + 1] = adjacencyOffsets[vertex] + liveTriangles[vertex];
+        }
+        adjacency.resize(result.size());
+        std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+        {
+            for (size_t corner = 0; corner < 3; ++corner)
+            {
+                adjacency[adjacencyFill[result[triangle * 3 + corner]]++] = static_cast<uint32_t>(triangle);
+            }
+        }
+
+        // Both directions of every edge, the moving endpoint must not be locked
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (size_t corner = 0; corner < 3; ++corner)
+            {
+                uint32_t a = result[i + corner];
+                uint32_t b = result[i + (corner + 1) % 3];
+                for (int direction = 0; direction < 2; ++direction)
+                {
+                    uint32_t from = direction == 0 ? a : b;
+                    uint32_t to = direction == 0 ? b : a;
+                    if (locked[from])
+                    {
+                        continue;
+                    }
+                    Quadric quadric = quadrics[from];
+                    quadric.add(quadrics[to]);
+                    double error = quadric.weight > 0.0 ? quadric.evaluate(vertices[to].pos) / quadric.weight : 0.0;
+                    collapses.push_back(Collapse{from, to, error});
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse &a, const Collapse &b) { return a.error < b.error; });
+
+        for (size_t vertex = 0; vertex < vertexCount; ++vertex)
+        {
+            remap[vertex] = static_cast<uint32_t>(vertex);
+        }
+        std::fill(touched.begin(), touched.end(), false);
+        size_t trianglesToRemove = triangleCount - targetIndexCount / 3;
+        size_t removedTriangles = 0;
+        size_t collapseCount = 0;
+        for (const auto &collapse : collapses)
+        {
+            if (removedTriangles >= trianglesToRemove)
+            {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to])
+            {
+                continue;
+            }
+
+            // Triangles around the moving vertex must not flip, the ones on the edge disappear
+            bool flips = false;
+            size_t edgeTriangles = 0;
+            for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; ++a)
+            {
+                const uint32_t *triangle = &result[adjacency[a] * 3];
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                {
+                    edgeTriangles++;
+                    continue;
+                }
+                glm::vec3 before[3];
+                glm::vec3 after[3];
+                for (size_t corner = 0; corner < 3; ++corner)
+                {
+                    before[corner] = vertices[triangle[corner]].pos;
+                    after[corner] = triangle[corner] == collapse.from ? vertices[collapse.to].pos : before[corner];
+                }
+                if (glm::dot(getTriangleNormal(before[0], before[1], before[2]),
+                             getTriangleNormal(after[0], after[1], after[2])) <= 0.0f)
+                {
+                    flips = true;
+                    break;
+                }
+            }
+            if (flips)
+            {
+                continue;
+            }
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            maxError = std::max(maxError, collapse.error);
+            removedTriangles += edgeTriangles;
+            collapseCount++;
+            // Everything around is frozen until the next pass, the adjacency would be stale otherwise
+            for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; ++a)
+            {
+                for (size_t corner = 0; corner < 3; ++corner)
+                {
+                    touched[result[adjacency[a] * 3 + corner]] = true;
+                }
+            }
+        }
+        if (collapseCount == 0)
+        {
+            break;
+        }
+
+        // Apply the collapses and drop the triangles that became degenerate
+        size_t writeIndex = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            uint32_t a = remap[result[i]];
+            uint32_t b = remap[result[i + 1]];
+            uint32_t c = remap[result[i + 2]];
+            if (a != b && b != c && a != c)
+            {
+                result[writeIndex++] = a;
+                result[writeIndex++] = b;
+                result[writeIndex++] = c;
+            }
+        }
+        result.resize(writeIndex);
+    }
+
+    *resultError = static_cast<float>(std::sqrt(maxError));
+    return result;
+}
+
+void MeshSimplifier::generateLods(MeshData &mesh, uint32_t lodCount, float reduction)
+{
+    size_t fullIndexCount = mesh.indices.size();
+    mesh.lods.clear();
+    mesh.lods.push_back(MeshLod{0, static_cast<uint32_t>(fullIndexCount), 0.0f});
+
+    float error = 0.0f;
+    float targetRatio = 1.0f;
+    std::vector<uint32_t> clusterStarts;
+    for (uint32_t level = 1; level < lodCount; ++level)
+    {
+        // Every level starts again from the full mesh, errors then always refer to the original surface
+        targetRatio *= reduction;
+        size_t targetIndexCount = static_cast<size_t>(fullIndexCount / 3 * targetRatio) * 3;
+        if (targetIndexCount == 0)
+        {
+            break;
+        }
+        float levelError;
+        std::vector<uint32_t> lodIndices =
+            MeshSimplifier::simplify(mesh.vertices, mesh.indices.data(), fullIndexCount, targetIndexCount, &levelError);
+        if (lodIndices.empty() || lodIndices.size() > mesh.lods.back().indexCount * (1.0f - MIN_LOD_SAVING))
+        {
+            break;
+        }
+
+        MeshOptimizer::optimizeVertexCache(lodIndices, mesh.vertices.size(), clusterStarts);
+        error = std::max(error, levelError);
+        mesh.lods.push_back(
+            MeshLod{static_cast<uint32_t>(mesh.indices.size()), static_cast<uint32_t>(lodIndices.size()), error});
+        mesh.indices.insert(mesh.indices.end(), lodIndices.begin(), lodIndices.end());
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "vulkan-mesh.h"
+
+// Level of detail generation at import time (results are baked in the mesh cache).
+// Simplification collapses edges by increasing quadric error (Garland, Heckbert 1997): every vertex accumulates the
+// planes of the triangles around it, and collapsing an edge moves one endpoint onto the other, so no vertex is
+// created and all the levels of a mesh index the same vertex buffer.
+// Vertices on a border of the index topology never move. Vertices split for texture seams are such borders,
+// which keeps UVs intact at the cost of simplifying less around the seams.
+class MeshSimplifier
+{
+  public:
+    // Levels in a chain, the full mesh included
+    static constexpr uint32_t DEFAULT_LOD_COUNT = 4;
+    // Triangle count of each level relative to the previous one
+    static constexpr float LOD_REDUCTION = 0.5f;
+    // A level saving less than this fraction of the previous one's triangles ends the chain
+    static constexpr float MIN_LOD_SAVING = 0.1f;
+
+    // Collapse edges of the triangle list until at most targetIndexCount indices remain or no collapse is possible.
+    // resultError receives the largest error of the collapses done, as an object space distance.
+    static std::vector<uint32_t> simplify(const std::vector<Vertex> &vertices, const uint32_t *indices,
+                                          size_t indexCount, size_t targetIndexCount, float *resultError);
+
+    // Append up to lodCount - 1 simplified levels to mesh.indices, each cache optimized, and describe the chain
+    // in mesh.lods, the original indices being level 0. Errors are made non decreasing along the chain.
+    static void generateLods(MeshData &mesh, uint32_t lodCount, float reduction = LOD_REDUCTION);
+};
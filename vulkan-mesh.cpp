@@ -1,125 +1,231 @@
 #include "vulkan-mesh.h"
 
-VulkanMesh::VulkanMesh(vk::PhysicalDevice physicalDeviceP, vk::Device deviceP, vk::Queue transferQueue,
-                       vk::CommandPool transferCommandPool, std::vector<Vertex> *vertices,
-                       std::vector<uint32_t> *indices, int texIdP)
-    : vertexCount(vertices->size()), indexCount(indices->size()), physicalDevice(physicalDeviceP), device(deviceP),
-      texId(texIdP)
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "vulkan-geometry-codec.h"
+
+MeshView MeshView::decode(MeshData &data) const
 {
-    createVertexBuffer(transferQueue, transferCommandPool, vertices);
-    createIndexBuffer(transferQueue, transferCommandPool, indices);
-    model.model = glm::mat4(1.0f);
+    if (!isEncoded())
+    {
+        return *this;
+    }
+    data.vertices.resize(vertexCount);
+    data.indices.resize(indexCount);
+    if (!GeometryCodec::decodeVertices(data.vertices.data(), vertexCount, encodedVertices, encodedVertexSize) ||
+        !GeometryCodec::decodeIndices(data.indices.data(), indexCount, vertexCount, encodedIndices, encodedIndexSize))
+    {
+        throw std::runtime_error("Corrupt compressed mesh geometry");
+    }
+    MeshView decoded = *this;
+    decoded.vertices = data.vertices.data();
+    decoded.indices = data.indices.data();
+    decoded.encodedVertices = nullptr;
+    decoded.encodedVertexSize = 0;
+    decoded.encodedIndices = nullptr;
+    decoded.encodedIndexSize = 0;
+    return decoded;
 }
 
-size_t VulkanMesh::getVextexCount()
+VulkanMesh::VulkanMesh(GeometryBuffer &geometryBufferP, UploadBatch &uploadBatch, const MeshView &meshView,
+                       int texIdP, VertexFormat vertexFormatP)
+    : vertexCount(meshView.vertexCount), indexCount(meshView.indexCount), texId(texIdP), vertexFormat(vertexFormatP),
+      geometryBuffer(&geometryBufferP)
 {
-    return vertexCount;
+    // The view may point straight into a memory-mapped file: vertices go from there to staging in one pass,
+    // converted on the way when packed, without any intermediate array
+    void *stagedVertices = createVertexBuffer(uploadBatch);
+    if (meshView.isEncoded() && vertexFormat == VertexFormat::Packed)
+    {
+        // Quantization scans the vertices twice, it works on a decoded copy
+        std::vector<Vertex> vertices(vertexCount);
+        if (!GeometryCodec::decodeVertices(vertices.data(), vertexCount, meshView.encodedVertices,
+                                           meshView.encodedVertexSize))
+        {
+            throw std::runtime_error("Corrupt compressed mesh vertices");
+        }
+        MeshView decodedView = meshView;
+        decodedView.vertices = vertices.data();
+        packVertices(decodedView, static_cast<PackedVertex *>(stagedVertices), &dequantization);
+    }
+    else if (meshView.isEncoded())
+    {
+        // Decoded straight into staging
+        if (!GeometryCodec::decodeVertices(static_cast<Vertex *>(stagedVertices), vertexCount,
+                                           meshView.encodedVertices, meshView.encodedVertexSize))
+        {
+            throw std::runtime_error("Corrupt compressed mesh vertices");
+        }
+    }
+    else if (vertexFormat == VertexFormat::Packed)
+    {
+        packVertices(meshView, static_cast<PackedVertex *>(stagedVertices), &dequantization);
+    }
+    else if (vertexCount > 0)
+    {
+        memcpy(stagedVertices, meshView.vertices, static_cast<size_t>(getVertexBufferSize()));
+    }
+    createIndexBuffer(uploadBatch, meshView);
+    model.model = glm::mat4(1.0f);
+
+    if (meshView.lodCount > 0)
+    {
+        lods.assign(meshView.lods, meshView.lods + meshView.lodCount);
+    }
+    else
+    {
+        lods.push_back(MeshLod{0, static_cast<uint32_t>(indexCount), 0.0f});
+    }
+    meshlets = std::make_shared<const std::vector<Meshlet>>(meshView.meshlets,
+                                                            meshView.meshlets + meshView.meshletCount);
+    boundsCenter = (meshView.boundsMin + meshView.boundsMax) * 0.5f;
+    boundsRadius = glm::length(meshView.boundsMax - meshView.boundsMin) * 0.5f;
+    nodeIndex = meshView.nodeIndex;
 }
 
-vk::Buffer VulkanMesh::getVertexBuffer()
+const MeshLod &VulkanMesh::selectLod(float errorToPixels, float pixelThreshold)
 {
-    return vertexBuffer;
+    // Errors grow along the chain, so the first level over the threshold ends the search
+    uint32_t lod = 0;
+    while (lod + 1 < lods.size() && lods[lod + 1].error * errorToPixels < pixelThreshold)
+    {
+        lod++;
+    }
+    if (lod > currentLod)
+    {
+        // Coarser levels must be comfortably under the threshold, finer ones are taken right away
+        uint32_t coarserLod = currentLod;
+        while (coarserLod < lod &&
+               lods[coarserLod + 1].error * errorToPixels < pixelThreshold * (1.0f - LOD_HYSTERESIS))
+        {
+            coarserLod++;
+        }
+        lod = coarserLod;
+    }
+    currentLod = lod;
+    return lods[currentLod];
 }
 
-size_t VulkanMesh::getIndexCount()
+void VulkanMesh::packVertices(const MeshView &meshView, PackedVertex *packedVertices,
+                              VertexDequantization *dequantization)
 {
-    return indexCount;
+    if (meshView.vertexCount == 0)
+    {
+        return;
+    }
+
+    // Positions map [boundsMin, boundsMax] to [-1, 1], the bounds come with the mesh
+    glm::vec3 center = (meshView.boundsMin + meshView.boundsMax) * 0.5f;
+    glm::vec3 halfExtent = glm::max((meshView.boundsMax - meshView.boundsMin) * 0.5f, glm::vec3(1e-6f));
+    // Texture coordinates map their own range to [0, 1], tiled UVs keep the full 16 bits precision
+    glm::vec2 texMin = meshView.vertices[0].tex;
+    glm::vec2 texMax = meshView.vertices[0].tex;
+    for (size_t i = 0; i < meshView.vertexCount; ++i)
+    {
+        texMin = glm::min(texMin, meshView.vertices[i].tex);
+        texMax = glm::max(texMax, meshView.vertices[i].tex);
+    }
+    glm::vec2 texRange = glm::max(texMax - texMin, glm::vec2(1e-6f));
+
+    for (size_t i = 0; i < meshView.vertexCount; ++i)
+    {
+        const Vertex &vertex = meshView.vertices[i];
+        glm::vec3 position = glm::clamp((vertex.pos - center) / halfExtent, glm::vec3(-1.0f), glm::vec3(1.0f));
+        glm::vec2 tex = glm::clamp((vertex.tex - texMin) / texRange, glm::vec2(0.0f), glm::vec2(1.0f));
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            packedVertices[i].pos[axis] = static_cast<int16_t>(std::round(position[axis] * 32767.0f));
+        }
+        packedVertices[i].pos[3] = 0;
+        packedVertices[i].tex[0] = static_cast<uint16_t>(std::round(tex.x * 65535.0f));
+        packedVertices[i].tex[1] = static_cast<uint16_t>(std::round(tex.y * 65535.0f));
+    }
+
+    dequantization->positionScale = glm::vec4(halfExtent, 1.0f);
+    dequantization->positionOffset = glm::vec4(center, 0.0f);
+    dequantization->texScaleOffset = glm::vec4(texRange, texMin);
 }
 
-vk::Buffer VulkanMesh::getIndexBuffer()
+size_t VulkanMesh::getVextexCount()
 {
-    return indexBuffer;
+    return vertexCount;
 }
 
-void VulkanMesh::destroyBuffers()
+size_t VulkanMesh::getIndexCount()
 {
-    device.destroyBuffer(vertexBuffer, nullptr);
-    device.freeMemory(vertexBufferMemory, nullptr);
-    device.destroyBuffer(indexBuffer, nullptr);
-    device.freeMemory(indexBufferMemory, nullptr);
+    return indexCount;
 }
 
-void VulkanMesh::createVertexBuffer(vk::Queue transferQueue, vk::CommandPool transferCommandPool,
-                                    std::vector<Vertex> *vertices)
+VulkanMesh VulkanMesh::shareGeometry(int texIdP, uint32_t nodeIndexP, const glm::vec3 &translationP) const
 {
-    vk::DeviceSize bufferSize = sizeof(Vertex) * vertices->size();
-
-    // Temporary buffer to stage vertex data before transfering to GPU
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-
-    createBuffer(physicalDevice, device, bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, &stagingBuffer,
-                 &stagingBufferMemory);
-
-    // Map memory to staging buffer
-    void *data;
-    device.mapMemory(stagingBufferMemory, {}, bufferSize, {}, &data);
-    memcpy(data, vertices->data(), static_cast<size_t>(bufferSize));
-    device.unmapMemory(stagingBufferMemory);
-
-    // Create buffer with vk::BufferUsageFlagBits::eTransferDst to mark as recipient of transfer data
-    // Buffer memory need to be vk::MemoryPropertyFlagBits::eDeviceLocal meaning memory is on GPU only
-    // and not CPU-accessible
-    createBuffer(physicalDevice, device, bufferSize,
-                 vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
-                 vk::MemoryPropertyFlagBits::eDeviceLocal, &vertexBuffer, &vertexBufferMemory);
-
-    // Copy staging buffer to vertex buffer on GPU
-    copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize);
-
-    // Clean staging buffer
-    device.destroyBuffer(stagingBuffer, nullptr);
-    device.freeMemory(stagingBufferMemory, nullptr);
+    VulkanMesh occurrence = *this;
+    occurrence.texId = texIdP;
+    occurrence.nodeIndex = nodeIndexP;
+    occurrence.boundsCenter = boundsCenter - translation + translationP;
+    occurrence.translation = translationP;
+    occurrence.currentLod = 0;
+    occurrence.geometryBuffer = nullptr;
+    return occurrence;
 }
 
-void VulkanMesh::createIndexBuffer(vk::Queue transferQueue, vk::CommandPool transferCommandPool,
-                                   std::vector<uint32_t> *indices)
+void VulkanMesh::releaseGeometry()
 {
-    vk::DeviceSize bufferSize = sizeof(uint32_t) * indices->size();
-
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    createBuffer(physicalDevice, device, bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, &stagingBuffer,
-                 &stagingBufferMemory);
-
-    void *data;
-    device.mapMemory(stagingBufferMemory, {}, bufferSize, {}, &data);
-    memcpy(data, indices->data(), static_cast<size_t>(bufferSize));
-    device.unmapMemory(stagingBufferMemory);
-
-    // This time with vk::BufferUsageFlagBits::eIndexBuffer, &indexBuffer and &indexBufferMemory
-    createBuffer(physicalDevice, device, bufferSize,
-                 vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
-                 vk::MemoryPropertyFlagBits::eDeviceLocal, &indexBuffer, &indexBufferMemory);
+    if (geometryBuffer)
+    {
+        geometryBuffer->freeVertices(vertexFormat, vertexRange);
+        geometryBuffer->freeIndices(indexType, indexRange);
+    }
+    geometryBuffer = nullptr;
+}
 
-    // Copy to indexBuffer
-    copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
+void *VulkanMesh::createVertexBuffer(UploadBatch &uploadBatch)
+{
+    // Sub-allocate the vertices in the renderer's vertex buffer for this format
+    vertexRange = geometryBuffer->allocateVertices(vertexFormat, static_cast<uint32_t>(vertexCount));
 
-    device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingBufferMemory);
+    // Room for the vertex data in staging, the copy to the vertex buffer on GPU happens when the batch is submitted
+    return uploadBatch.stageBuffer(getVertexBufferSize(), geometryBuffer->getVertexBuffer(vertexFormat),
+                                   geometryBuffer->getVertexByteOffset(vertexFormat, vertexRange));
 }
 
-uint32_t VulkanMesh::findMemoryTypeIndex(vk::PhysicalDevice physicalDevice, uint32_t allowedTypes,
-                                         vk::MemoryPropertyFlags properties)
+void VulkanMesh::createIndexBuffer(UploadBatch &uploadBatch, const MeshView &meshView)
 {
-    // Get properties of physical device
-    vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
-
-    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
-    {
-        // We iterate through each bit, shifting of 1 (with i) each time.
-        // This way we go through each type to check it is allowed.
-        if ((allowedTypes & (1 << i))
-            // Desired property bit flags are part of memory type's property flags.
-            // By checking the equality, we check that all properties are available at the
-            // same time, and not only one property is common.
-            && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+    // Narrow the indices when they all fit in 16 bits: half the memory and fetch bandwidth.
+    // Indices stay relative to the mesh, the vertex offset is applied by the draw.
+    indexType = chooseIndexType(vertexCount);
+    indexRange = geometryBuffer->allocateIndices(indexType, static_cast<uint32_t>(indexCount));
+
+    void *stagedIndices =
+        uploadBatch.stageBuffer(getIndexBufferSize(), geometryBuffer->getIndexBuffer(indexType),
+                                geometryBuffer->getIndexByteOffset(indexType, indexRange));
+    if (meshView.isEncoded())
+    {
+        // Decoded straight into staging, narrowed on the way
+        bool isDecoded = indexType == vk::IndexType::eUint16
+                             ? GeometryCodec::decodeIndices(static_cast<uint16_t *>(stagedIndices), indexCount,
+                                                            vertexCount, meshView.encodedIndices,
+                                                            meshView.encodedIndexSize)
+                             : GeometryCodec::decodeIndices(static_cast<uint32_t *>(stagedIndices), indexCount,
+                                                            vertexCount, meshView.encodedIndices,
+                                                            meshView.encodedIndexSize);
+        if (!isDecoded)
+        {
+            throw std::runtime_error("Corrupt compressed mesh indices");
+        }
+    }
+    else if (indexType == vk::IndexType::eUint16)
+    {
+        // Narrowed straight into staging
+        uint16_t *narrowIndices = static_cast<uint16_t *>(stagedIndices);
+        for (size_t i = 0; i < indexCount; ++i)
         {
-            // If this type is an allowed type and has the flags we want,
-            // then i is the current index of the memory type we want to use. Return it.
-            return i;
+            narrowIndices[i] = static_cast<uint16_t>(meshView.indices[i]);
         }
     }
+    else if (indexCount > 0)
+    {
+        memcpy(stagedIndices, meshView.indices, static_cast<size_t>(getIndexBufferSize()));
+    }
 }
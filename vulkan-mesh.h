@@ -2,8 +2,11 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <memory>
 #include <vector>
 
+#include "vulkan-geometry-buffer.h"
+#include "vulkan-upload-batch.h"
 #include "vulkan-utilities.h"
 
 struct Model
@@ -11,19 +14,161 @@ struct Model
     glm::mat4 model;
 };
 
+// Second part of the vertex shader push constants, right after Model, set for each mesh:
+//   position = packed position * positionScale + positionOffset
+//   tex = packed tex * texScaleOffset.xy + texScaleOffset.zw
+// Identity for meshes with full float vertices.
+struct VertexDequantization
+{
+    glm::vec4 positionScale{1.0f};
+    glm::vec4 positionOffset{0.0f};
+    glm::vec4 texScaleOffset{1.0f, 1.0f, 0.0f, 0.0f};
+};
+
+// Level of detail of a mesh: a range of its index buffer, every level using the same vertices.
+// error is how far, in object space, the simplification may have moved the surface, 0 for the full mesh.
+struct MeshLod
+{
+    uint32_t indexOffset{0};
+    uint32_t indexCount{0};
+    float error{0.0f};
+};
+
+// Cluster of consecutive triangles of a mesh's full level, with what is needed to skip it when it can't be seen.
+// The normal cone bounds the normals of its triangles: all of them are back facing when the camera is far enough
+// along coneAxis (see MeshletBuilder::isBackfacing). coneCutoff is the sine of the cone half angle, 1 when the
+// cone is too wide to ever cull the cluster.
+struct Meshlet
+{
+    uint32_t indexOffset{0};
+    uint32_t triangleCount{0};
+    glm::vec3 center{0.0f}; // Bounding sphere, object space
+    float radius{0.0f};
+    glm::vec3 coneAxis{0.0f};
+    float coneCutoff{1.0f};
+};
+
+struct MeshData;
+
+// Non-owning view on CPU-side geometry, pointing either into a MeshData or into a memory-mapped mesh cache.
+// A compressed cache gives the GeometryCodec streams instead of the vertex and index arrays, left null.
+struct MeshView
+{
+    const Vertex *vertices{nullptr};
+    size_t vertexCount{0};
+    const uint32_t *indices{nullptr};
+    size_t indexCount{0};
+    uint32_t materialIndex{0};
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+    const MeshLod *lods{nullptr}; // None: a single level made of all the indices
+    size_t lodCount{0};
+    const Meshlet *meshlets{nullptr}; // Clusters of the full level, none when not built
+    size_t meshletCount{0};
+    uint32_t nodeIndex{0}; // Scene graph node the mesh hangs from, its vertices are in that node's space
+    const uint8_t *encodedVertices{nullptr};
+    size_t encodedVertexSize{0};
+    const uint8_t *encodedIndices{nullptr};
+    size_t encodedIndexSize{0};
+
+    bool isEncoded() const
+    {
+        return encodedVertices != nullptr;
+    }
+    // Vertices and indices decoded into data, or data itself when they are not encoded.
+    // Throws std::runtime_error on corrupt streams.
+    MeshView decode(MeshData &data) const;
+};
+
+// CPU-side geometry of a single mesh, as converted from the importer
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices; // Once LODs are generated, every level one after the other, full mesh first
+    uint32_t materialIndex{0};
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+    std::vector<MeshLod> lods;
+    std::vector<Meshlet> meshlets;
+    uint32_t nodeIndex{0};
+
+    MeshView getView() const
+    {
+        return MeshView{vertices.data(), vertices.size(), indices.data(), indices.size(),   materialIndex,
+                        boundsMin,       boundsMax,       lods.data(),    lods.size(),      meshlets.data(),
+                        meshlets.size(), nodeIndex};
+    }
+};
+
 class VulkanMesh
 {
   public:
-    VulkanMesh(vk::PhysicalDevice physicalDeviceP, vk::Device deviceP, vk::Queue transferQueue,
-               vk::CommandPool transferCommandPool, std::vector<Vertex> *vertices, std::vector<uint32_t> *indices,
-               int texIdP);
+    // Ranges are allocated in geometryBufferP right away, their content is copied when uploadBatch is submitted.
+    // Reserve them in the geometry buffer beforehand (see GeometryBuffer::reserveVertices).
+    // With VertexFormat::Packed, vertices are quantized on the way to staging.
+    VulkanMesh(GeometryBuffer &geometryBufferP, UploadBatch &uploadBatch, const MeshView &meshView, int texIdP,
+               VertexFormat vertexFormatP = VertexFormat::Full);
     VulkanMesh() = default;
     ~VulkanMesh() = default;
+    // Another occurrence of the same geometry, e.g. a mesh found duplicated at import, drawn with its own texture
+    // and node, moved by translationP in its node's space. It never releases the shared ranges: that is left to the
+    // mesh it was made from.
+    VulkanMesh shareGeometry(int texIdP, uint32_t nodeIndexP, const glm::vec3 &translationP = glm::vec3(0.0f)) const;
 
     size_t getVextexCount();
-    vk::Buffer getVertexBuffer();
     size_t getIndexCount();
-    vk::Buffer getIndexBuffer();
+    // Arguments of drawIndexed: the mesh lives in the geometry buffer ranges
+    uint32_t getFirstIndex() const
+    {
+        return indexRange.offset;
+    }
+    int32_t getVertexOffset() const
+    {
+        return static_cast<int32_t>(vertexRange.offset);
+    }
+    // Levels of detail, the full mesh first, then coarser and coarser ones
+    size_t getLodCount() const
+    {
+        return lods.size();
+    }
+    const MeshLod &getLod(size_t index) const
+    {
+        return lods[index];
+    }
+    // Pick the coarsest level whose error stays under pixelThreshold once multiplied by errorToPixels.
+    // Moving to a coarser level than the current one needs a LOD_HYSTERESIS margin, so that a mesh sitting at
+    // a switch distance does not pop back and forth every frame.
+    const MeshLod &selectLod(float errorToPixels, float pixelThreshold);
+    // Clusters of the full level, empty when they were not built
+    const std::vector<Meshlet> &getMeshlets() const
+    {
+        return *meshlets;
+    }
+    // Bounding sphere in object space, translation included
+    glm::vec3 getBoundsCenter() const
+    {
+        return boundsCenter;
+    }
+    float getBoundsRadius() const
+    {
+        return boundsRadius;
+    }
+    // Node of the model's scene graph whose world transform places the mesh in the model
+    uint32_t getNodeIndex() const
+    {
+        return nodeIndex;
+    }
+    // Applied before the node's transform: where an occurrence sharing another mesh's geometry sits relative to it.
+    // Vertices and meshlets are the shared ones, untranslated.
+    const glm::vec3 &getTranslation() const
+    {
+        return translation;
+    }
+    // 16 bits when every vertex can be addressed with it, 32 bits otherwise
+    vk::IndexType getIndexType() const
+    {
+        return indexType;
+    }
 
     Model getModel() const
     {
@@ -37,26 +182,64 @@ class VulkanMesh
     {
         return texId;
     }
+    VertexFormat getVertexFormat() const
+    {
+        return vertexFormat;
+    }
+    const VertexDequantization &getDequantization() const
+    {
+        return dequantization;
+    }
+    // Device memory taken by the vertex and index buffers
+    vk::DeviceSize getVertexBufferSize() const
+    {
+        return vertexCount * (vertexFormat == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex));
+    }
+    vk::DeviceSize getIndexBufferSize() const
+    {
+        return indexCount * (indexType == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t));
+    }
 
-    void destroyBuffers();
+    // Largest vertex count addressable with 16 bits indices
+    static constexpr size_t MAX_16BIT_VERTEX_COUNT = 65536;
+    static vk::IndexType chooseIndexType(size_t vertexCount)
+    {
+        return vertexCount <= MAX_16BIT_VERTEX_COUNT ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+    }
+    // Fraction of the threshold the error of a coarser level must be under before switching to it
+    static constexpr float LOD_HYSTERESIS = 0.25f;
+
+    // Quantize the vertexCount vertices to PackedVertex into packedVertices, usually staging memory, filling the
+    // matching dequantization constants
+    static void packVertices(const MeshView &meshView, PackedVertex *packedVertices,
+                             VertexDequantization *dequantization);
+
+    // Give the ranges back to the geometry buffer
+    void releaseGeometry();
 
   private:
     size_t vertexCount{0};
     size_t indexCount{0};
     Model model;
     int texId;
+    VertexFormat vertexFormat{VertexFormat::Full};
+    VertexDequantization dequantization;
+    vk::IndexType indexType{vk::IndexType::eUint32};
+    std::vector<MeshLod> lods;
+    uint32_t currentLod{0};
+    // Shared with the copies of the mesh in model instances
+    std::shared_ptr<const std::vector<Meshlet>> meshlets{std::make_shared<const std::vector<Meshlet>>()};
+    glm::vec3 boundsCenter{0.0f};
+    float boundsRadius{0.0f};
+    uint32_t nodeIndex{0};
+    glm::vec3 translation{0.0f};
+
+    GeometryBuffer *geometryBuffer{nullptr};
+    GeometryRange vertexRange;
+    GeometryRange indexRange;
 
-    vk::Buffer vertexBuffer;
-    vk::PhysicalDevice physicalDevice;
-    vk::Device device;
-    vk::DeviceMemory vertexBufferMemory;
-    vk::Buffer indexBuffer;
-    vk::DeviceMemory indexBufferMemory;
-
-    void createVertexBuffer(vk::Queue transferQueue, vk::CommandPool transferCommandPool,
-                            std::vector<Vertex> *vertices);
-    void createIndexBuffer(vk::Queue transferQueue, vk::CommandPool transferCommandPool,
-                           std::vector<uint32_t> *indices);
-    uint32_t findMemoryTypeIndex(vk::PhysicalDevice physicalDevice, uint32_t allowedTypes,
-                                 vk::MemoryPropertyFlags properties);
+    // Sub-allocate the vertices, returns where to write them in staging
+    void *createVertexBuffer(UploadBatch &uploadBatch);
+    // Indices copied, or decoded, straight into staging
+    void createIndexBuffer(UploadBatch &uploadBatch, const MeshView &meshView);
 };
@@ -0,0 +1,155 @@
+#include "vulkan-meshlet-builder.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Bounding sphere and normal cone of the triangles [firstTriangle, firstTriangle + triangleCount)
+static Meshlet finishMeshlet(const std::vector<Vertex> &vertices, const uint32_t *indices, uint32_t firstTriangle,
+                             uint32_t triangleCount)
+{
+    Meshlet meshlet;
+    meshlet.indexOffset = firstTriangle * 3;
+    meshlet.triangleCount = triangleCount;
+    const uint32_t *meshletIndices = indices + meshlet.indexOffset;
+    size_t meshletIndexCount = triangleCount * 3;
+
+    // Sphere around the box of the corners, tighter than around the centroid for the flat clusters we get
+    glm::vec3 boxMin = vertices[meshletIndices[0]].pos;
+    glm::vec3 boxMax = boxMin;
+    for (size_t i = 1; i < meshletIndexCount; ++i)
+    {
+        boxMin = glm::min(boxMin, vertices[meshletIndices[i]].pos);
+        boxMax = glm::max(boxMax, vertices[meshletIndices[i]].pos);
+    }
+    meshlet.center = (boxMin + boxMax) * 0.5f;
+    for (size_t i = 0; i < meshletIndexCount; ++i)
+    {
+        meshlet.radius = std::max(meshlet.radius, glm::length(vertices[meshletIndices[i]].pos - meshlet.center));
+    }
+
+    // Cone axis along the mean normal, opened as much as the normal furthest from it
+    std::vector<glm::vec3> normals;
+    normals.reserve(triangleCount);
+    glm::vec3 normalSum(0.0f);
+    for (size_t i = 0; i < meshletIndexCount; i += 3)
+    {
+        const glm::vec3 &p0 = vertices[meshletIndices[i]].pos;
+        const glm::vec3 &p1 = vertices[meshletIndices[i + 1]].pos;
+        const glm::vec3 &p2 = vertices[meshletIndices[i + 2]].pos;
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+        if (length > 0.0f)
+        {
+            normals.push_back(normal / length);
+            normalSum += normals.back();
+        }
+    }
+    float sumLength = glm::length(normalSum);
+    if (normals.empty() || sumLength < 1e-6f)
+    {
+        return meshlet;
+    }
+    glm::vec3 axis = normalSum / sumLength;
+    float minDot = 1.0f;
+    for (const auto &normal : normals)
+    {
+        minDot = std::min(minDot, glm::dot(axis, normal));
+    }
+    // Normals spread over more than a half space: some triangle always faces the camera
+    if (minDot <= 0.0f)
+    {
+        return meshlet;
+    }
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    return meshlet;
+}
+
+std::vector<Meshlet> MeshletBuilder::buildMeshlets(const std::vector<Vertex> &vertices, const uint32_t *indices,
+                                                   size_t indexCount, uint32_t maxVertices, uint32_t maxTriangles)
+{
+    std::vector<Meshlet> meshlets;
+    // Index + 1 of the last meshlet that used each vertex, to count the unique vertices of the current one
+    std::vector<uint32_t> vertexMeshlet(vertices.size(), 0);
+    uint32_t meshletTag = 1;
+    uint32_t firstTriangle = 0;
+    uint32_t triangleCount = 0;
+    uint32_t vertexCount = 0;
+
+    for (uint32_t triangle = 0; triangle < indexCount / 3; ++triangle)
+    {
+        const uint32_t *corners = indices + triangle * 3;
+        uint32_t newVertices = 0;
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            // Repeated corners only exist in degenerate triangles, counting them twice is harmless
+            newVertices += vertexMeshlet[corners[corner]] != meshletTag ? 1 : 0;
+        }
+        if (triangleCount > 0 && (vertexCount + newVertices > maxVertices || triangleCount == maxTriangles))
+        {
+            meshlets.push_back(finishMeshlet(vertices, indices, firstTriangle, triangleCount));
+            meshletTag++;
+            firstTriangle = triangle;
+            triangleCount = 0;
+            vertexCount = 0;
+        }
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            if (vertexMeshlet[corners[corner]] != meshletTag)
+            {
+                vertexMeshlet[corners[corner]] = meshletTag;
+                vertexCount++;
+            }
+        }
+        triangleCount++;
+    }
+    if (triangleCount > 0)
+    {
+        meshlets.push_back(finishMeshlet(vertices, indices, firstTriangle, triangleCount));
+    }
+    return meshlets;
+}
+
+bool MeshletBuilder::isBackfacing(const Meshlet &meshlet, const glm::vec3 &cameraPosition)
+{
+    // A triangle faces away when the view direction v, from the camera to it, has dot(v, normal) > 0. With every
+    // normal within the cone half angle a of the axis, that holds once the angle between v and the axis is under
+    // 90 - a degrees: dot(v, axis) > sin(a) |v|. Over the whole sphere, v moves by at most its radius.
+    glm::vec3 view = meshlet.center - cameraPosition;
+    return glm::dot(view, meshlet.coneAxis) - meshlet.radius >
+           meshlet.coneCutoff * (glm::length(view) + meshlet.radius);
+}
+
+void MeshletBuilder::getFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6])
+{
+    // Gribb and Hartmann: a point is inside when -w <= x, y, z <= w in clip space. The near plane is the OpenGL one
+    // (the projection is built without GLM_FORCE_DEPTH_ZERO_TO_ONE), never closer than the one Vulkan clips at
+    glm::vec4 rows[4];
+    for (int row = 0; row < 4; ++row)
+    {
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row],
+                              viewProjection[3][row]);
+    }
+    planes[0] = rows[3] + rows[0];
+    planes[1] = rows[3] - rows[0];
+    planes[2] = rows[3] + rows[1];
+    planes[3] = rows[3] - rows[1];
+    planes[4] = rows[3] + rows[2];
+    planes[5] = rows[3] - rows[2];
+    for (int plane = 0; plane < 6; ++plane)
+    {
+        planes[plane] /= glm::length(glm::vec3(planes[plane]));
+    }
+}
+
+bool MeshletBuilder::isOutsideFrustum(const glm::vec4 planes[6], const glm::vec3 &center, float radius)
+{
+    for (int plane = 0; plane < 6; ++plane)
+    {
+        if (glm::dot(glm::vec3(planes[plane]), center) + planes[plane].w < -radius)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "vulkan-mesh.h"
+
+// Per frame culling statistics of the clusters of the meshes drawn at full detail
+struct MeshletCullingStats
+{
+    size_t meshletCount{0};
+    size_t frustumCulled{0};
+    size_t backfaceCulled{0};
+    size_t drawCount{0}; // drawIndexed calls left once consecutive visible clusters are merged
+};
+
+// Partition of a mesh's triangles into small clusters (meshlets) that can be culled on their own.
+// Triangles are taken in index buffer order, a new meshlet starting when the next triangle would exceed the vertex
+// or triangle limit: the cache and overdraw ordering is kept, and every meshlet stays a range of the index buffer.
+class MeshletBuilder
+{
+  public:
+    // Same limits as the usual mesh shader meshlets, so clusters stay small enough to cull at a fine grain
+    static constexpr uint32_t MAX_VERTICES = 64;
+    static constexpr uint32_t MAX_TRIANGLES = 124;
+
+    static std::vector<Meshlet> buildMeshlets(const std::vector<Vertex> &vertices, const uint32_t *indices,
+                                              size_t indexCount, uint32_t maxVertices = MAX_VERTICES,
+                                              uint32_t maxTriangles = MAX_TRIANGLES);
+
+    // Every triangle of the meshlet faces away from cameraPosition, given in the meshlet's object space.
+    // The test is conservative for any camera position, thanks to the bounding sphere.
+    static bool isBackfacing(const Meshlet &meshlet, const glm::vec3 &cameraPosition);
+
+    // World space frustum planes (inward normals) of a projection * view matrix
+    static void getFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6]);
+    static bool isOutsideFrustum(const glm::vec4 planes[6], const glm::vec3 &center, float radius);
+};
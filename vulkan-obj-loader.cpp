@@ -0,0 +1,718 @@
+#include "vulkan-obj-loader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// Face corner as written in the file, 0 based. Negative (relative) indices can't be resolved before knowing how many
+// elements the previous chunks hold: they are stored relative to the chunk's first element and flagged.
+struct ObjCorner
+{
+    int32_t position;
+    int32_t texCoord; // -1 when absent
+    uint32_t relativeFlags; // OBJ_RELATIVE_*
+};
+
+static constexpr uint32_t OBJ_RELATIVE_POSITION = 1 << 0;
+static constexpr uint32_t OBJ_RELATIVE_TEX_COORD = 1 << 1;
+
+// o, g or usemtl statement: the faces after it may go to another mesh
+struct ObjStatement
+{
+    uint32_t firstFace; // In the chunk
+    bool isObject;      // o or g, otherwise usemtl
+    std::string name;
+};
+
+struct ObjChunk
+{
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texCoords;
+    std::vector<ObjCorner> corners;
+    std::vector<uint32_t> faceStarts; // First corner of each face, then the corner count
+    std::vector<ObjStatement> statements;
+    std::vector<std::string> materialLibraries;
+};
+
+// Faces [firstFace, endFace) of a chunk
+struct ObjMeshPiece
+{
+    uint32_t chunk;
+    uint32_t firstFace;
+    uint32_t endFace;
+};
+
+struct ObjMeshBuild
+{
+    uint32_t materialIndex;
+    uint32_t nodeIndex;
+    std::vector<ObjMeshPiece> pieces;
+};
+
+static bool isBlank(char character)
+{
+    return character == ' ' || character == '\t' || character == '\r';
+}
+
+static bool isDigit(char character)
+{
+    return character >= '0' && character <= '9';
+}
+
+static void skipBlanks(const char *&cursor, const char *end)
+{
+    while (cursor < end && isBlank(*cursor))
+    {
+        ++cursor;
+    }
+}
+
+static const char *findLineEnd(const char *cursor, const char *end)
+{
+    const char *lineEnd = static_cast<const char *>(memchr(cursor, '\n', end - cursor));
+    return lineEnd ? lineEnd : end;
+}
+
+// Rest of the line without the surrounding blanks
+static std::string readRestOfLine(const char *cursor, const char *lineEnd)
+{
+    skipBlanks(cursor, lineEnd);
+    while (lineEnd > cursor && isBlank(lineEnd[-1]))
+    {
+        --lineEnd;
+    }
+    return std::string(cursor, lineEnd);
+}
+
+// Doubles represent every integer up to 2^53 and every power of ten up to 1e22 exactly, so for such mantissas and
+// exponents a single multiplication or division is correctly rounded (Clinger's fast path). Anything else, far
+// less common in exported files, goes through strtod.
+static const double POWERS_OF_TEN[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                       1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static bool parseFloatSlow(const char *start, const char *&cursor, const char *end, float &value)
+{
+    // The mapping is not null terminated, strtod gets a copy of the token
+    char token[64];
+    const char *tokenEnd = start;
+    while (tokenEnd < end && !isBlank(*tokenEnd) && *tokenEnd != '\n' && tokenEnd - start < 63)
+    {
+        ++tokenEnd;
+    }
+    memcpy(token, start, tokenEnd - start);
+    token[tokenEnd - start] = '\0';
+    char *parsedEnd;
+    value = static_cast<float>(strtod(token, &parsedEnd));
+    cursor = start + (parsedEnd - token);
+    return parsedEnd != token;
+}
+
+static bool parseFloat(const char *&cursor, const char *end, float &value)
+{
+    skipBlanks(cursor, end);
+    const char *start = cursor;
+    bool isNegative = false;
+    if (cursor < end && (*cursor == '-' || *cursor == '+'))
+    {
+        isNegative = *cursor == '-';
+        ++cursor;
+    }
+
+    // Up to 19 significant digits fit in the mantissa, the exponent accounts for the others
+    uint64_t mantissa = 0;
+    int significantDigits = 0;
+    int exponent = 0;
+    bool hasDigits = false;
+    for (; cursor < end && isDigit(*cursor); ++cursor)
+    {
+        hasDigits = true;
+        if (significantDigits < 19)
+        {
+            mantissa = mantissa * 10 + (*cursor - '0');
+            significantDigits += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+    if (cursor < end && *cursor == '.')
+    {
+        for (++cursor; cursor < end && isDigit(*cursor); ++cursor)
+        {
+            hasDigits = true;
+            if (significantDigits < 19)
+            {
+                mantissa = mantissa * 10 + (*cursor - '0');
+                significantDigits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (!hasDigits)
+    {
+        // inf, nan...
+        return parseFloatSlow(start, cursor, end, value);
+    }
+    if (cursor < end && (*cursor == 'e' || *cursor == 'E'))
+    {
+        const char *exponentCursor = cursor + 1;
+        bool isExponentNegative = false;
+        if (exponentCursor < end && (*exponentCursor == '-' || *exponentCursor == '+'))
+        {
+            isExponentNegative = *exponentCursor == '-';
+            ++exponentCursor;
+        }
+        if (exponentCursor < end && isDigit(*exponentCursor))
+        {
+            int explicitExponent = 0;
+            for (; exponentCursor < end && isDigit(*exponentCursor); ++exponentCursor)
+            {
+                explicitExponent = std::min(explicitExponent * 10 + (*exponentCursor - '0'), 100000);
+            }
+            exponent += isExponentNegative ? -explicitExponent : explicitExponent;
+            cursor = exponentCursor;
+        }
+    }
+
+    if (mantissa > (uint64_t(1) << 53) || exponent < -22 || exponent > 22)
+    {
+        return parseFloatSlow(start, cursor, end, value);
+    }
+    double result = static_cast<double>(mantissa);
+    result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+    value = static_cast<float>(isNegative ? -result : result);
+    return true;
+}
+
+// Face index: 1 based from the start, or negative counting back from the last element defined
+static bool parseIndex(const char *&cursor, const char *end, int64_t &index)
+{
+    bool isNegative = false;
+    if (cursor < end && *cursor == '-')
+    {
+        isNegative = true;
+        ++cursor;
+    }
+    if (cursor >= end || !isDigit(*cursor))
+    {
+        return false;
+    }
+    index = 0;
+    for (; cursor < end && isDigit(*cursor); ++cursor)
+    {
+        index = std::min<int64_t>(index * 10 + (*cursor - '0'), INT32_MAX);
+    }
+    index = isNegative ? -index : index;
+    return index != 0;
+}
+
+// Index of a face corner relative to the chunk, given how many elements the chunk defined so far
+static void resolveIndex(int64_t index, size_t chunkCount, uint32_t relativeFlag, int32_t &resolved,
+                         uint32_t &relativeFlags)
+{
+    if (index > 0)
+    {
+        resolved = static_cast<int32_t>(index - 1);
+        return;
+    }
+    // Can point into previous chunks, in which case it is negative until the chunk's base is added
+    resolved = static_cast<int32_t>(static_cast<int64_t>(chunkCount) + index);
+    relativeFlags |= relativeFlag;
+}
+
+static void parseChunk(const char *cursor, const char *end, ObjChunk &chunk, const std::string &filename)
+{
+    auto malformed = [&filename](const char *what) {
+        throw std::runtime_error(std::string("Malformed OBJ ") + what + " in " + filename);
+    };
+
+    while (cursor < end)
+    {
+        const char *lineEnd = findLineEnd(cursor, end);
+        skipBlanks(cursor, lineEnd);
+        const char *keyword = cursor;
+        while (cursor < lineEnd && !isBlank(*cursor))
+        {
+            ++cursor;
+        }
+        size_t keywordLength = cursor - keyword;
+
+        if (keywordLength == 1 && keyword[0] == 'v')
+        {
+            glm::vec3 position;
+            if (!parseFloat(cursor, lineEnd, position.x) || !parseFloat(cursor, lineEnd, position.y) ||
+                !parseFloat(cursor, lineEnd, position.z))
+            {
+                malformed("vertex");
+            }
+            chunk.positions.push_back(position);
+        }
+        else if (keywordLength == 2 && keyword[0] == 'v' && keyword[1] == 't')
+        {
+            glm::vec2 texCoord{0.0f, 0.0f};
+            if (!parseFloat(cursor, lineEnd, texCoord.x))
+            {
+                malformed("texture coordinate");
+            }
+            parseFloat(cursor, lineEnd, texCoord.y);
+            // aiProcess_FlipUVs
+            texCoord.y = 1.0f - texCoord.y;
+            chunk.texCoords.push_back(texCoord);
+        }
+        else if (keywordLength == 1 && keyword[0] == 'f')
+        {
+            uint32_t firstCorner = static_cast<uint32_t>(chunk.corners.size());
+            while (true)
+            {
+                skipBlanks(cursor, lineEnd);
+                if (cursor >= lineEnd)
+                {
+                    break;
+                }
+                // v, v/vt, v//vn or v/vt/vn
+                ObjCorner corner{0, -1, 0};
+                int64_t index;
+                if (!parseIndex(cursor, lineEnd, index))
+                {
+                    malformed("face");
+                }
+                resolveIndex(index, chunk.positions.size(), OBJ_RELATIVE_POSITION, corner.position,
+                             corner.relativeFlags);
+                if (cursor < lineEnd && *cursor == '/' && cursor + 1 < lineEnd && cursor[1] != '/')
+                {
+                    ++cursor;
+                    if (!parseIndex(cursor, lineEnd, index))
+                    {
+                        malformed("face");
+                    }
+                    resolveIndex(index, chunk.texCoords.size(), OBJ_RELATIVE_TEX_COORD, corner.texCoord,
+                                 corner.relativeFlags);
+                }
+                // The normal index, unused
+                while (cursor < lineEnd && !isBlank(*cursor))
+                {
+                    ++cursor;
+                }
+                chunk.corners.push_back(corner);
+            }
+            if (chunk.corners.size() - firstCorner < 3)
+            {
+                // Not a surface, Assimp would make a line or point primitive of it
+                chunk.corners.resize(firstCorner);
+            }
+            else
+            {
+                chunk.faceStarts.push_back(firstCorner);
+            }
+        }
+        else if ((keywordLength == 1 && (keyword[0] == 'o' || keyword[0] == 'g')) ||
+                 (keywordLength == 6 && memcmp(keyword, "usemtl", 6) == 0))
+        {
+            chunk.statements.push_back(ObjStatement{static_cast<uint32_t>(chunk.faceStarts.size()),
+                                                    keywordLength == 1, readRestOfLine(cursor, lineEnd)});
+        }
+        else if (keywordLength == 6 && memcmp(keyword, "mtllib", 6) == 0)
+        {
+            chunk.materialLibraries.push_back(readRestOfLine(cursor, lineEnd));
+        }
+        // Anything else (comments, normals, smoothing groups, lines...) is skipped
+
+        cursor = lineEnd + 1;
+    }
+    chunk.faceStarts.push_back(static_cast<uint32_t>(chunk.corners.size()));
+}
+
+// Texture file name of a map_Kd statement: options come first, and the name may contain spaces
+static std::string parseTextureName(const std::string &arguments)
+{
+    const char *cursor = arguments.data();
+    const char *end = cursor + arguments.size();
+    while (true)
+    {
+        skipBlanks(cursor, end);
+        if (cursor >= end || *cursor != '-')
+        {
+            break;
+        }
+        // Option, then its values: numbers, on/off, or the single word of -imfchan and -type
+        const char *option = cursor;
+        while (cursor < end && !isBlank(*cursor))
+        {
+            ++cursor;
+        }
+        bool takesWord = std::string(option, cursor) == "-imfchan" || std::string(option, cursor) == "-type";
+        while (true)
+        {
+            skipBlanks(cursor, end);
+            const char *value = cursor;
+            while (cursor < end && !isBlank(*cursor))
+            {
+                ++cursor;
+            }
+            std::string word(value, cursor);
+            float number;
+            const char *numberCursor = value;
+            bool isValue = !word.empty() && (takesWord || word == "on" || word == "off" ||
+                                             (parseFloat(numberCursor, cursor, number) && numberCursor == cursor));
+            if (!isValue)
+            {
+                cursor = value;
+                break;
+            }
+            if (takesWord)
+            {
+                break;
+            }
+        }
+    }
+    std::string path = readRestOfLine(cursor, end);
+    // Cut off any directory information, as the Assimp path does
+    size_t separator = path.rfind('\\');
+    return separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+// Materials of an MTL file, appended to materialNames and textureNames. Missing files are not an error.
+static void loadMaterialLibrary(const std::string &path, std::vector<std::string> &materialNames,
+                                std::vector<std::string> &textureNames)
+{
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        const char *cursor = line.data();
+        const char *end = cursor + line.size();
+        skipBlanks(cursor, end);
+        const char *keyword = cursor;
+        while (cursor < end && !isBlank(*cursor))
+        {
+            ++cursor;
+        }
+        std::string keywordString(keyword, cursor);
+        if (keywordString == "newmtl")
+        {
+            materialNames.push_back(readRestOfLine(cursor, end));
+            textureNames.push_back("");
+        }
+        else if (keywordString == "map_Kd" && !textureNames.empty())
+        {
+            textureNames.back() = parseTextureName(std::string(cursor, end));
+        }
+    }
+}
+
+static bool fileExists(const std::string &path)
+{
+    struct stat fileStat;
+    return stat(path.c_str(), &fileStat) == 0;
+}
+
+// Absolute 0 based indices of a corner, texCoord being -1 when absent
+static void resolveCorner(const ObjCorner &corner, size_t positionBase, size_t texCoordBase, size_t positionCount,
+                          size_t texCoordCount, int64_t &position, int64_t &texCoord, const std::string &filename)
+{
+    position = corner.position;
+    texCoord = corner.texCoord;
+    bool hasTexCoord = texCoord != -1 || (corner.relativeFlags & OBJ_RELATIVE_TEX_COORD);
+    if (corner.relativeFlags & OBJ_RELATIVE_POSITION)
+    {
+        position += positionBase;
+    }
+    if (corner.relativeFlags & OBJ_RELATIVE_TEX_COORD)
+    {
+        texCoord += texCoordBase;
+    }
+    if (position < 0 || position >= static_cast<int64_t>(positionCount) ||
+        (hasTexCoord && (texCoord < 0 || texCoord >= static_cast<int64_t>(texCoordCount))))
+    {
+        throw std::runtime_error("OBJ face index out of range in " + filename);
+    }
+}
+
+static MeshData assembleMesh(const ObjMeshBuild &build, const std::vector<ObjChunk> &chunks,
+                             const std::vector<size_t> &positionBases, const std::vector<size_t> &texCoordBases,
+                             size_t positionCount, size_t texCoordCount, const std::string &filename)
+{
+    // Range of the positions used, meshes of exported files use a contiguous block of them
+    MeshData meshData;
+    size_t cornerCount = 0;
+    int64_t firstPosition = std::numeric_limits<int64_t>::max();
+    int64_t lastPosition = 0;
+    for (const auto &piece : build.pieces)
+    {
+        const ObjChunk &chunk = chunks[piece.chunk];
+        for (uint32_t corner = chunk.faceStarts[piece.firstFace]; corner < chunk.faceStarts[piece.endFace]; ++corner)
+        {
+            int64_t position;
+            int64_t texCoord;
+            resolveCorner(chunk.corners[corner], positionBases[piece.chunk], texCoordBases[piece.chunk],
+                          positionCount, texCoordCount, position, texCoord, filename);
+            firstPosition = std::min(firstPosition, position);
+            lastPosition = std::max(lastPosition, position);
+            cornerCount++;
+        }
+    }
+    if (cornerCount == 0)
+    {
+        return meshData;
+    }
+    meshData.vertices.reserve(std::min<size_t>(cornerCount, lastPosition - firstPosition + 1));
+    meshData.indices.reserve(cornerCount * 3);
+
+    // aiProcess_JoinIdenticalVertices: corners with the same position and texture coordinates share a vertex.
+    // Vertices are found from their position, through a table over the range of positions, then a list of the
+    // vertices sharing it with other texture coordinates. Much cheaper than hashing every corner.
+    const uint32_t NO_VERTEX = UINT32_MAX;
+    std::vector<uint32_t> positionVertices(lastPosition - firstPosition + 1, NO_VERTEX);
+    std::vector<uint32_t> nextVertices;        // Next vertex with the same position
+    std::vector<int64_t> vertexTexCoords;       // Texture coordinates index of each vertex
+    nextVertices.reserve(meshData.vertices.capacity());
+    vertexTexCoords.reserve(meshData.vertices.capacity());
+    auto getVertexId = [&](const ObjCorner &corner, uint32_t chunkIndex) {
+        int64_t position;
+        int64_t texCoord;
+        resolveCorner(corner, positionBases[chunkIndex], texCoordBases[chunkIndex], positionCount, texCoordCount,
+                      position, texCoord, filename);
+        uint32_t &firstVertex = positionVertices[position - firstPosition];
+        for (uint32_t vertexId = firstVertex; vertexId != NO_VERTEX; vertexId = nextVertices[vertexId])
+        {
+            if (vertexTexCoords[vertexId] == texCoord)
+            {
+                return vertexId;
+            }
+        }
+
+        uint32_t vertexId = static_cast<uint32_t>(meshData.vertices.size());
+        nextVertices.push_back(firstVertex);
+        vertexTexCoords.push_back(texCoord);
+        firstVertex = vertexId;
+
+        // Elements are looked up in the chunk that defined them
+        Vertex vertex;
+        size_t positionChunk =
+            std::upper_bound(positionBases.begin(), positionBases.end(), position) - positionBases.begin() - 1;
+        vertex.pos = chunks[positionChunk].positions[position - positionBases[positionChunk]];
+        vertex.col = {1.0f, 1.0f, 1.0f};
+        vertex.tex = {0.0f, 0.0f};
+        if (texCoord >= 0)
+        {
+            size_t texCoordChunk =
+                std::upper_bound(texCoordBases.begin(), texCoordBases.end(), texCoord) - texCoordBases.begin() - 1;
+            vertex.tex = chunks[texCoordChunk].texCoords[texCoord - texCoordBases[texCoordChunk]];
+        }
+        meshData.vertices.push_back(vertex);
+        return vertexId;
+    };
+
+    for (const auto &piece : build.pieces)
+    {
+        const ObjChunk &chunk = chunks[piece.chunk];
+        for (uint32_t face = piece.firstFace; face < piece.endFace; ++face)
+        {
+            // aiProcess_Triangulate: polygons become triangle fans
+            uint32_t firstCorner = chunk.faceStarts[face];
+            uint32_t endCorner = chunk.faceStarts[face + 1];
+            uint32_t first = getVertexId(chunk.corners[firstCorner], piece.chunk);
+            uint32_t previous = getVertexId(chunk.corners[firstCorner + 1], piece.chunk);
+            for (uint32_t corner = firstCorner + 2; corner < endCorner; ++corner)
+            {
+                uint32_t current = getVertexId(chunk.corners[corner], piece.chunk);
+                meshData.indices.push_back(first);
+                meshData.indices.push_back(previous);
+                meshData.indices.push_back(current);
+                previous = current;
+            }
+        }
+    }
+
+    if (!meshData.vertices.empty())
+    {
+        meshData.boundsMin = meshData.vertices[0].pos;
+        meshData.boundsMax = meshData.vertices[0].pos;
+        for (const Vertex &vertex : meshData.vertices)
+        {
+            meshData.boundsMin = glm::min(meshData.boundsMin, vertex.pos);
+            meshData.boundsMax = glm::max(meshData.boundsMax, vertex.pos);
+        }
+    }
+    meshData.materialIndex = build.materialIndex;
+    meshData.nodeIndex = build.nodeIndex;
+    return meshData;
+}
+
+bool ObjLoader::isObjFile(const std::string &filename)
+{
+    size_t dot = filename.rfind('.');
+    if (dot == std::string::npos)
+    {
+        return false;
+    }
+    std::string extension = filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == "obj";
+}
+
+ObjModel ObjLoader::load(const std::string &filename, ThreadPool &threadPool)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open OBJ file: " + filename);
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Failed to open OBJ file: " + filename);
+    }
+    size_t fileSize = static_cast<size_t>(fileStat.st_size);
+    void *mapping = fileSize > 0 ? mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Failed to map OBJ file: " + filename);
+    }
+    if (mapping)
+    {
+        // Every page is read once, by whichever worker parses its chunk
+        madvise(mapping, fileSize, MADV_WILLNEED);
+    }
+
+    // A few chunks per worker so that uneven chunks (faces parse slower than vertices) still balance
+    const char *bytes = static_cast<const char *>(mapping);
+    size_t chunkSize = std::max(MIN_CHUNK_SIZE, fileSize / (threadPool.getThreadCount() * 4 + 1));
+    std::vector<const char *> chunkStarts{bytes};
+    while (chunkStarts.back() + chunkSize < bytes + fileSize)
+    {
+        const char *lineEnd = findLineEnd(chunkStarts.back() + chunkSize, bytes + fileSize);
+        if (lineEnd >= bytes + fileSize)
+        {
+            break;
+        }
+        chunkStarts.push_back(lineEnd + 1);
+    }
+    chunkStarts.push_back(bytes + fileSize);
+
+    std::vector<ObjChunk> chunks(chunkStarts.size() - 1);
+    try
+    {
+        threadPool.parallelFor(chunks.size(), [&](size_t i) {
+            parseChunk(chunkStarts[i], chunkStarts[i + 1], chunks[i], filename);
+        });
+    }
+    catch (...)
+    {
+        if (mapping)
+        {
+            munmap(mapping, fileSize);
+        }
+        throw;
+    }
+    if (mapping)
+    {
+        munmap(mapping, fileSize);
+    }
+
+    // Where each chunk's elements start in the whole file
+    std::vector<size_t> positionBases(chunks.size());
+    std::vector<size_t> texCoordBases(chunks.size());
+    size_t positionCount = 0;
+    size_t texCoordCount = 0;
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        positionBases[i] = positionCount;
+        texCoordBases[i] = texCoordCount;
+        positionCount += chunks[i].positions.size();
+        texCoordCount += chunks[i].texCoords.size();
+    }
+
+    // Materials: the default one first, as Assimp does, then those of every library in order. Like Assimp, fall back
+    // on the MTL file named after the model when a library can't be found (exporters often write stale names).
+    ObjModel objModel;
+    std::vector<std::string> materialNames{""};
+    objModel.textureNames.push_back("");
+    size_t directoryEnd = filename.find_last_of("/\\");
+    std::string directory = directoryEnd == std::string::npos ? "" : filename.substr(0, directoryEnd + 1);
+    for (const auto &chunk : chunks)
+    {
+        for (const auto &library : chunk.materialLibraries)
+        {
+            std::string libraryPath = directory + library;
+            objModel.dependencies.push_back(libraryPath);
+            if (!fileExists(libraryPath))
+            {
+                libraryPath = filename.substr(0, filename.rfind('.')) + ".mtl";
+                objModel.dependencies.push_back(libraryPath);
+            }
+            loadMaterialLibrary(libraryPath, materialNames, objModel.textureNames);
+        }
+    }
+    std::unordered_map<std::string, uint32_t> materialIndices;
+    for (size_t i = materialNames.size(); i-- > 1;)
+    {
+        // The first definition wins
+        materialIndices[materialNames[i]] = static_cast<uint32_t>(i);
+    }
+
+    // Cut the faces in meshes, in file order: a new mesh starts on every object, and on every material change
+    SceneGraph &sceneGraph = objModel.sceneGraph;
+    uint32_t rootNode = sceneGraph.addNode(SceneGraph::NO_PARENT, glm::mat4(1.0f), filename);
+    std::vector<ObjMeshBuild> meshBuilds;
+    uint32_t currentMaterial = 0;
+    uint32_t currentNode = rootNode;
+    bool hasCurrentMesh = false;
+    for (uint32_t chunkIndex = 0; chunkIndex < chunks.size(); ++chunkIndex)
+    {
+        const ObjChunk &chunk = chunks[chunkIndex];
+        uint32_t faceCount = static_cast<uint32_t>(chunk.faceStarts.size() - 1);
+        uint32_t firstFace = 0;
+        auto addFaces = [&](uint32_t endFace) {
+            if (endFace == firstFace)
+            {
+                return;
+            }
+            if (!hasCurrentMesh)
+            {
+                meshBuilds.push_back(ObjMeshBuild{currentMaterial, currentNode, {}});
+                hasCurrentMesh = true;
+            }
+            meshBuilds.back().pieces.push_back(ObjMeshPiece{chunkIndex, firstFace, endFace});
+            firstFace = endFace;
+        };
+        for (const auto &statement : chunk.statements)
+        {
+            addFaces(statement.firstFace);
+            if (statement.isObject)
+            {
+                // Objects hang from the root, after the previous object's subtree
+                currentNode = sceneGraph.addNode(rootNode, glm::mat4(1.0f), statement.name);
+                hasCurrentMesh = false;
+                continue;
+            }
+            auto material = materialIndices.find(statement.name);
+            uint32_t materialIndex = material != materialIndices.end() ? material->second : 0;
+            if (materialIndex != currentMaterial)
+            {
+                currentMaterial = materialIndex;
+                hasCurrentMesh = false;
+            }
+        }
+        addFaces(faceCount);
+    }
+
+    objModel.meshes.resize(meshBuilds.size());
+    threadPool.parallelFor(meshBuilds.size(), [&](size_t i) {
+        objModel.meshes[i] = assembleMesh(meshBuilds[i], chunks, positionBases, texCoordBases, positionCount,
+                                          texCoordCount, filename);
+    });
+    return objModel;
+}
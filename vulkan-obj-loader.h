@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vulkan-mesh.h"
+#include "vulkan-scene-graph.h"
+#include "vulkan-thread-pool.h"
+
+// Native import result, laid out like the Assimp path's: material 0 is the default one, then the materials of the
+// MTL files in order. The scene graph has a root node and one child per object or group.
+struct ObjModel
+{
+    std::vector<MeshData> meshes;
+    std::vector<std::string> textureNames; // Diffuse texture file name per material, empty for none
+    SceneGraph sceneGraph;
+    std::vector<std::string> dependencies; // Material libraries looked for, found or not, for the mesh cache key
+};
+
+// Wavefront OBJ reader, the fast path for our main interchange format. The file is memory-mapped and split in
+// chunks on line boundaries, parsed in parallel. The chunks are then stitched together in order (negative indices,
+// objects and materials spanning chunks) and each mesh is assembled on its own worker.
+// Output matches the Assimp import with MESH_IMPORT_FLAGS: triangulated faces, flipped V coordinates, vertices
+// shared between faces when they have the same position and texture coordinates.
+// Normals are skipped, as are lines, points, and free-form geometry. Line continuations are not supported.
+class ObjLoader
+{
+  public:
+    // Chunks are at least this big, so per chunk overhead stays small next to parsing
+    static constexpr size_t MIN_CHUNK_SIZE = 64 * 1024;
+
+    static bool isObjFile(const std::string &filename);
+    // Throws std::runtime_error when the file can't be read or is malformed
+    static ObjModel load(const std::string &filename, ThreadPool &threadPool);
+};
@@ -1,6 +1,12 @@
 #include "vulkan-renderer.h"
 
+#include <algorithm>
+#include <assimp/DefaultIOSystem.h>
+#include <chrono>
+#include <filesystem>
+#include <map>
 #include <set>
+#include <tuple>
 #include <vulkan/vulkan_enums.hpp>
 
 const std::vector<const char *> VulkanRenderer::validationLayers{"VK_LAYER_KHRONOS_validation"};
@@ -23,6 +29,7 @@ int VulkanRenderer::init(GLFWwindow *windowP)
         surface = createSurface();
         getPhysicalDevice();
         createLogicalDevice();
+        memoryAllocator.create(mainDevice.physicalDevice, mainDevice.logicalDevice);
         createSwapchain();
         createRenderPass();
         createDescriptorSetLayout();
@@ -32,6 +39,7 @@ int VulkanRenderer::init(GLFWwindow *windowP)
         createDepthBufferImage();
         createFramebuffers();
         createGraphicsCommandPool();
+        geometryBuffer.create(memoryAllocator, graphicsQueue, graphicsCommandPool);
 
         // Data
         createUniformBuffers();
@@ -70,6 +78,11 @@ void VulkanRenderer::draw()
     mainDevice.logicalDevice.waitForFences(drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint32_t>::max());
     // When passing the fence, we close it behind us
     mainDevice.logicalDevice.resetFences(drawFences[currentFrame]);
+    frameNumber++;
+    // Frames up to frameNumber - MAX_FRAME_DRAWS are complete, what only they used can go
+    releaseRetiredResources(false);
+    geometryBuffer.releaseReplacedBuffers(false);
+    releaseImpostorBakes(false);
 
     // 1. Get next available image to draw and set a semaphore to signal
     // when we're finished with the image.
@@ -78,6 +91,17 @@ void VulkanRenderer::draw()
                                                       imageAvailable[currentFrame], VK_NULL_HANDLE))
             .value;
 
+    // Streamed and reloaded models get their share of uploads for this frame, finished ones are drawn right away
+    processFileChanges();
+    processTextureReloads();
+    processModelLoads();
+    // Only the subtrees of the nodes moved since the last frame are recomputed
+    for (auto &meshModel : meshModels)
+    {
+        meshModel.getSceneGraph().updateWorldTransforms();
+    }
+    // With the world transforms up to date, static models changed since the last frame go to their batches
+    updateStaticBatches();
     recordCommands(imageToBeDrawnIndex);
     updateUniformBuffers(imageToBeDrawnIndex);
 
@@ -122,12 +146,95 @@ void VulkanRenderer::clean()
 
     mainDevice.logicalDevice.destroyImageView(colorImageView);
     mainDevice.logicalDevice.destroyImage(colorImage);
-    mainDevice.logicalDevice.freeMemory(colorImageMemory);
+    memoryAllocator.free(colorImageMemory);
 
+    fileWatcher.close();
+    // Imports and decodes still running on the workers read the renderer's settings, they finish first
+    for (auto &load : modelLoads)
+    {
+        if (load.import.valid())
+        {
+            load.import.wait();
+        }
+        for (auto &decodedTexture : load.decodedTextures)
+        {
+            if (decodedTexture.valid())
+            {
+                decodedTexture.wait();
+            }
+        }
+    }
+    for (auto &reload : textureReloads)
+    {
+        if (reload.decodedTexture.valid())
+        {
+            reload.decodedTexture.wait();
+        }
+        destroyTextureReload(reload);
+    }
+    textureReloads.clear();
+    for (auto &load : modelLoads)
+    {
+        cancelModelLoad(load);
+    }
+    modelLoads.clear();
+    releaseRetiredResources(true);
     for (auto &model : meshModels)
     {
         model.destroyMeshModel();
     }
+    // Bakes read the renderer's import settings, uploads wait for their copies when destroyed
+    for (auto &bake : staticModelBakes)
+    {
+        bake.second.wait();
+    }
+    staticModelBakes.clear();
+    for (auto &batch : staticBatches)
+    {
+        batch.upload.reset();
+        batch.mesh.releaseGeometry();
+        batch.pendingMesh.releaseGeometry();
+    }
+    staticBatches.clear();
+    geometryBuffer.destroy();
+
+    // Assets are shared by their copies, the last copy destroys them
+    for (auto &skinnedModel : skinnedModels)
+    {
+        if (skinnedModel.asset && skinnedModel.asset.use_count() == 1)
+        {
+            destroySkinnedModelAsset(*skinnedModel.asset);
+        }
+        skinnedModel.asset.reset();
+    }
+    for (size_t i = 0; i < paletteBuffers.size(); ++i)
+    {
+        mainDevice.logicalDevice.destroyBuffer(paletteBuffers[i]);
+        memoryAllocator.free(paletteBufferMemories[i]);
+        mainDevice.logicalDevice.destroyBuffer(skinnedVertexBuffers[i]);
+        memoryAllocator.free(skinnedVertexBufferMemories[i]);
+    }
+    mainDevice.logicalDevice.destroyQueryPool(skinningQueryPool);
+    mainDevice.logicalDevice.destroyPipeline(skinningPipeline);
+    mainDevice.logicalDevice.destroyPipelineLayout(skinningPipelineLayout);
+    mainDevice.logicalDevice.destroyDescriptorPool(skinningDescriptorPool);
+    mainDevice.logicalDevice.destroyDescriptorSetLayout(skinningDescriptorSetLayout);
+
+    for (size_t i = 0; i < meshInstanceBuffers.size(); ++i)
+    {
+        mainDevice.logicalDevice.destroyBuffer(meshInstanceBuffers[i]);
+        memoryAllocator.free(meshInstanceBufferMemories[i]);
+    }
+    releaseImpostorBakes(true);
+    for (size_t i = 0; i < impostorInstanceBuffers.size(); ++i)
+    {
+        mainDevice.logicalDevice.destroyBuffer(impostorInstanceBuffers[i]);
+        memoryAllocator.free(impostorInstanceBufferMemories[i]);
+    }
+    mainDevice.logicalDevice.destroyBuffer(impostorBakeUniformBuffer);
+    memoryAllocator.free(impostorBakeUniformBufferMemory);
+    mainDevice.logicalDevice.destroyPipeline(impostorPipeline);
+    mainDevice.logicalDevice.destroyRenderPass(impostorRenderPass);
 
     mainDevice.logicalDevice.destroyDescriptorPool(samplerDescriptorPool, nullptr);
     mainDevice.logicalDevice.destroyDescriptorSetLayout(samplerDescriptorSetLayout, nullptr);
@@ -138,22 +245,18 @@ void VulkanRenderer::clean()
     {
         mainDevice.logicalDevice.destroyImageView(textureImageViews[i], nullptr);
         mainDevice.logicalDevice.destroyImage(textureImages[i], nullptr);
-        mainDevice.logicalDevice.freeMemory(textureImageMemory[i], nullptr);
+        memoryAllocator.free(textureImageMemory[i]);
     }
 
     mainDevice.logicalDevice.destroyImageView(depthBufferImageView);
     mainDevice.logicalDevice.destroyImage(depthBufferImage);
-    mainDevice.logicalDevice.freeMemory(depthBufferImageMemory);
+    memoryAllocator.free(depthBufferImageMemory);
     mainDevice.logicalDevice.destroyDescriptorPool(descriptorPool);
     mainDevice.logicalDevice.destroyDescriptorSetLayout(descriptorSetLayout);
     for (size_t i = 0; i < swapchainImages.size(); ++i)
     {
         mainDevice.logicalDevice.destroyBuffer(vpUniformBuffer[i]);
-        mainDevice.logicalDevice.freeMemory(vpUniformBufferMemory[i]);
-    }
-    for (auto &mesh : meshes)
-    {
-        mesh.destroyBuffers();
+        memoryAllocator.free(vpUniformBufferMemory[i]);
     }
     for (size_t i = 0; i < MAX_FRAME_DRAWS; ++i)
     {
@@ -166,6 +269,9 @@ void VulkanRenderer::clean()
     {
         mainDevice.logicalDevice.destroyFramebuffer(framebuffer);
     }
+    mainDevice.logicalDevice.destroyPipeline(instancedPackedGraphicsPipeline);
+    mainDevice.logicalDevice.destroyPipeline(instancedGraphicsPipeline);
+    mainDevice.logicalDevice.destroyPipeline(packedGraphicsPipeline);
     mainDevice.logicalDevice.destroyPipeline(graphicsPipeline);
     mainDevice.logicalDevice.destroyPipelineLayout(pipelineLayout);
     mainDevice.logicalDevice.destroyRenderPass(renderPass);
@@ -179,6 +285,8 @@ void VulkanRenderer::clean()
     {
         destroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
     }
+    // Every buffer and image is gone, their blocks can go
+    memoryAllocator.destroy();
     mainDevice.logicalDevice.destroy();
     instance.destroy();
 }
@@ -367,6 +475,20 @@ void VulkanRenderer::getPhysicalDevice()
         msaaSamples = vk::SampleCountFlagBits::e2;
     else
         msaaSamples = vk::SampleCountFlagBits::e1;
+
+    // Block compressed textures need the feature and both formats to be sampleable, otherwise stay on RGBA8
+    textureCompressionSupported = mainDevice.physicalDevice.getFeatures().textureCompressionBC;
+    try
+    {
+        chooseSupportedFormat({vk::Format::eBc1RgbaUnormBlock}, vk::ImageTiling::eOptimal,
+                              vk::FormatFeatureFlagBits::eSampledImage);
+        chooseSupportedFormat({vk::Format::eBc3UnormBlock}, vk::ImageTiling::eOptimal,
+                              vk::FormatFeatureFlagBits::eSampledImage);
+    }
+    catch (const std::runtime_error &)
+    {
+        textureCompressionSupported = false;
+    }
 }
 
 bool VulkanRenderer::checkDeviceSuitable(vk::PhysicalDevice device)
@@ -460,6 +582,7 @@ void VulkanRenderer::createLogicalDevice()
     vk::PhysicalDeviceFeatures deviceFeatures{}; // For now, no device features (tessellation etc.)
     deviceFeatures.samplerAnisotropy = true;
     deviceFeatures.sampleRateShading = true;
+    deviceFeatures.textureCompressionBC = textureCompressionSupported;
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
     // Create the logical device for the given physical device
@@ -748,8 +871,8 @@ void VulkanRenderer::createGraphicsPipeline()
     // Draw each first vertex of each instance, then the next vertex etc.
     bindingDescription.inputRate = vk::VertexInputRate::eVertex;
 
-    // Different attributes
-    std::array<vk::VertexInputAttributeDescription, 3> attributeDescriptions;
+    // Different attributes. The color is not read anymore: it was always white.
+    std::array<vk::VertexInputAttributeDescription, 2> attributeDescriptions;
 
     // Position attributes
     // -- Binding of first attribute. Relate to binding description.
@@ -761,17 +884,11 @@ void VulkanRenderer::createGraphicsPipeline()
     // Offset of data in vertex, like in OpenGL. The offset function automatically find it.
     attributeDescriptions[0].offset = offsetof(Vertex, pos);
 
-    // Color attributes
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = vk::Format::eR32G32B32Sfloat;
-    attributeDescriptions[1].offset = offsetof(Vertex, col);
-
     // Texture attributes
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = vk::Format::eR32G32Sfloat;
-    attributeDescriptions[2].offset = offsetof(Vertex, tex);
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 2;
+    attributeDescriptions[1].format = vk::Format::eR32G32Sfloat;
+    attributeDescriptions[1].offset = offsetof(Vertex, tex);
 
     // -- VERTEX INPUT STAGE --
     vk::PipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
@@ -810,9 +927,9 @@ void VulkanRenderer::createGraphicsPipeline()
 
     // -- DYNAMIC STATE --
     // This will be alterable, so you don't have to create an entire pipeline when you want to change parameters.
-    // We won't use this feature, this is an example.
-    /*
-    vector<vk::DynamicState> dynamicStateEnables;
+    // Impostor atlases are baked with this same pipeline, one viewport per atlas cell: the values above are only
+    // the ones of the swapchain, set again when recording each frame.
+    std::vector<vk::DynamicState> dynamicStateEnables;
     // Viewport can be resized in the command buffer with vkCmdSetViewport(commandBuffer, 0, 1, &newViewport);
     dynamicStateEnables.push_back(vk::DynamicState::eViewport);
     // Scissors can be resized in the command buffer with vkCmdSetScissor(commandBuffer, 0, 1, &newScissor);
@@ -821,7 +938,6 @@ void VulkanRenderer::createGraphicsPipeline()
     vk::PipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
     dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
     dynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();
-    */
 
     // -- RASTERIZER --
     vk::PipelineRasterizationStateCreateInfo rasterizerCreateInfo{};
@@ -911,7 +1027,7 @@ void VulkanRenderer::createGraphicsPipeline()
     graphicsPipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
     graphicsPipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
     graphicsPipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
-    graphicsPipelineCreateInfo.pDynamicState = nullptr;
+    graphicsPipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
     graphicsPipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
     graphicsPipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
     graphicsPipelineCreateInfo.pColorBlendState = &colorBlendingCreateInfo;
@@ -935,7 +1051,69 @@ void VulkanRenderer::createGraphicsPipeline()
     }
     graphicsPipeline = result.value;
 
+    // Same pipeline for meshes with packed vertices, only the vertex input changes: normalized formats reach
+    // the shader as floats, then the per mesh dequantization push constants scale them back
+    bindingDescription.stride = sizeof(PackedVertex);
+    std::array<vk::VertexInputAttributeDescription, 2> packedAttributeDescriptions;
+    packedAttributeDescriptions[0].binding = 0;
+    packedAttributeDescriptions[0].location = 0;
+    packedAttributeDescriptions[0].format = vk::Format::eR16G16B16A16Snorm;
+    packedAttributeDescriptions[0].offset = offsetof(PackedVertex, pos);
+    packedAttributeDescriptions[1].binding = 0;
+    packedAttributeDescriptions[1].location = 2;
+    packedAttributeDescriptions[1].format = vk::Format::eR16G16Unorm;
+    packedAttributeDescriptions[1].offset = offsetof(PackedVertex, tex);
+    vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(packedAttributeDescriptions.size());
+    vertexInputCreateInfo.pVertexAttributeDescriptions = packedAttributeDescriptions.data();
+
+    result = mainDevice.logicalDevice.createGraphicsPipeline(VK_NULL_HANDLE, graphicsPipelineCreateInfo);
+    if (result.result != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Cound not create the packed vertices graphics pipeline");
+    }
+    packedGraphicsPipeline = result.value;
+
+    // Instanced variants of both, for the occurrences of a shared geometry drawn with a single call: a second
+    // binding steps through their model matrices once per instance, a matrix column per location
+    vk::ShaderModule instancedShaderModule = createShaderModule(readShaderFile("shaders/instanced_vert.spv"));
+    shaderStages[0].module = instancedShaderModule;
+    std::array<vk::VertexInputBindingDescription, 2> instancedBindingDescriptions{
+        bindingDescription, vk::VertexInputBindingDescription{1, sizeof(glm::mat4), vk::VertexInputRate::eInstance}};
+    vertexInputCreateInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(instancedBindingDescriptions.size());
+    vertexInputCreateInfo.pVertexBindingDescriptions = instancedBindingDescriptions.data();
+    vk::Pipeline *instancedPipelines[2] = {&instancedGraphicsPipeline, &instancedPackedGraphicsPipeline};
+    for (int packed = 0; packed < 2; ++packed)
+    {
+        instancedBindingDescriptions[0].stride = packed ? sizeof(PackedVertex) : sizeof(Vertex);
+        std::vector<vk::VertexInputAttributeDescription> instancedAttributeDescriptions;
+        if (packed)
+        {
+            instancedAttributeDescriptions.assign(packedAttributeDescriptions.begin(),
+                                                  packedAttributeDescriptions.end());
+        }
+        else
+        {
+            instancedAttributeDescriptions.assign(attributeDescriptions.begin(), attributeDescriptions.end());
+        }
+        for (uint32_t column = 0; column < 4; ++column)
+        {
+            instancedAttributeDescriptions.push_back(vk::VertexInputAttributeDescription{
+                3 + column, 1, vk::Format::eR32G32B32A32Sfloat, column * sizeof(glm::vec4)});
+        }
+        vertexInputCreateInfo.vertexAttributeDescriptionCount =
+            static_cast<uint32_t>(instancedAttributeDescriptions.size());
+        vertexInputCreateInfo.pVertexAttributeDescriptions = instancedAttributeDescriptions.data();
+
+        result = mainDevice.logicalDevice.createGraphicsPipeline(VK_NULL_HANDLE, graphicsPipelineCreateInfo);
+        if (result.result != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("Cound not create an instanced graphics pipeline");
+        }
+        *instancedPipelines[packed] = result.value;
+    }
+
     // Destroy shader modules
+    mainDevice.logicalDevice.destroyShaderModule(instancedShaderModule);
     mainDevice.logicalDevice.destroyShaderModule(fragmentShaderModule);
     mainDevice.logicalDevice.destroyShaderModule(vertexShaderModule);
 }
@@ -989,9 +1167,7 @@ void VulkanRenderer::createRenderPass()
     // Depth attachment of renderpass
     vk::AttachmentDescription depthAttachment{};
 
-    std::vector<vk::Format> formats{vk::Format::eD32SfloatS8Uint, vk::Format::eD32Sfloat, vk::Format::eD24UnormS8Uint};
-    depthAttachment.format =
-        chooseSupportedFormat(formats, vk::ImageTiling::eOptimal, vk::FormatFeatureFlagBits::eDepthStencilAttachment);
+    depthAttachment.format = chooseDepthFormat();
     depthAttachment.samples = msaaSamples;
 
     // Clear when we start the render pass.
@@ -1177,47 +1353,182 @@ void VulkanRenderer::recordCommands(uint32_t currentImage)
     // Because 1-to-1 relationship
     renderPassBeginInfo.framebuffer = swapchainFramebuffers[currentImage];
 
+    auto recordStartTime = std::chrono::high_resolution_clock::now();
     // Start recording commands to command buffer
     commandBuffers[currentImage].begin(commandBufferBeginInfo);
+    // Compute work can't be recorded inside a render pass
+    recordSkinning(currentImage);
 
     // Begin render pass
     // All draw commands inline (no secondary command buffers)
     commandBuffers[currentImage].beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+    // Dynamic in the pipelines, for the impostor bakes
+    vk::Viewport viewport{0.0f, 0.0f, static_cast<float>(swapchainExtent.width),
+                          static_cast<float>(swapchainExtent.height), 0.0f, 1.0f};
+    commandBuffers[currentImage].setViewport(0, viewport);
+    commandBuffers[currentImage].setScissor(0, renderPassBeginInfo.renderArea);
+
+    // Pipelines only differ by their vertex input: switch when the vertex format of the meshes changes.
+    // All meshes of a vertex format share one vertex buffer, and all meshes of an index type one index buffer,
+    // so buffers are bound again only on those changes too.
+    MeshBindings meshBindings;
+
+    // Levels of detail are picked from their error projected on screen: an object space error e at distance d
+    // covers e / d * (height / 2) / tan(fovy / 2) pixels, and projection[1][1] is 1 / tan(fovy / 2)
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(viewProjection.view)[3]);
+    float pixelsPerUnit = std::abs(viewProjection.projection[1][1]) * swapchainExtent.height * 0.5f;
+    drawnTriangleCount = 0;
+
+    // Meshlets and static batches are tested against the world space frustum
+    glm::vec4 frustumPlanes[6];
+    MeshletBuilder::getFrustumPlanes(viewProjection.projection * viewProjection.view, frustumPlanes);
+    meshletCullingStats = MeshletCullingStats();
+    drawCallCount = 0;
+    for (auto &instances : impostorInstances)
+    {
+        instances.clear();
+    }
 
-    // Bind pipeline to be used in render pass, you could switch pipelines for different subpasses
-    commandBuffers[currentImage].bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
-
-    // Draw all meshes
+    // Gather the meshes of all models, drawn by drawMeshes
+    meshDraws.clear();
     for (size_t j = 0; j < meshModels.size(); ++j)
     {
-        // Push constants to given shader stage
-        VulkanMeshModel model = meshModels[j];
-        glm::mat4 modelMatrix = model.getModel();
-        commandBuffers[currentImage].pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(Model),
-                                                   &modelMatrix);
+        // By reference: meshes keep their current level of detail from frame to frame
+        VulkanMeshModel &model = meshModels[j];
+        const SceneGraph &sceneGraph = model.getSceneGraph();
+        // Drawn with the static batches, once they have it
+        if (meshModelBatchedFlags[j])
+        {
+            continue;
+        }
+        // Once the model covers fewer pixels than an atlas cell, a quad of its impostor replaces its meshes
+        if (impostorRenderingEnabled && meshModelImpostorIds[j] >= 0)
+        {
+            const Impostor &impostor = impostors[meshModelImpostorIds[j]];
+            glm::mat4 rootMatrix = model.getModel();
+            glm::vec3 center = glm::vec3(rootMatrix * glm::vec4(impostor.center, 1.0f));
+            float radius = impostor.radius * std::max({glm::length(glm::vec3(rootMatrix[0])),
+                                                       glm::length(glm::vec3(rootMatrix[1])),
+                                                       glm::length(glm::vec3(rootMatrix[2]))});
+            float distance = glm::length(center - cameraPosition);
+            if (distance > radius && 2.0f * radius * pixelsPerUnit / distance < ImpostorAtlas::CELL_SIZE)
+            {
+                if (!MeshletBuilder::isOutsideFrustum(frustumPlanes, center, radius))
+                {
+                    impostorInstances[meshModelImpostorIds[j]].push_back(
+                        ImpostorAtlas::getInstance(rootMatrix, center, radius, cameraPosition));
+                }
+                continue;
+            }
+        }
 
-        // We have one model matrix for each object, then several children meshes
+        // Each mesh is drawn with the model matrix times the world transform of its node, and its translation when
+        // it shares the geometry of a mesh at another position. Meshes of a node are consecutive, so the matrix and
+        // its scale are only computed on node changes.
+        glm::mat4 modelMatrix;
+        float modelScale = 1.0f;
+        uint32_t boundNode = SceneGraph::NO_PARENT;
         for (size_t k = 0; k < model.getMeshCount(); ++k)
         {
-            // Bind vertex buffer
-            vk::Buffer vertexBuffers[] = {model.getMesh(k)->getVertexBuffer()};
-            vk::DeviceSize offsets[] = {0};
-            commandBuffers[currentImage].bindVertexBuffers(0, 1, vertexBuffers, offsets);
+            uint32_t meshNode = sceneGraph.getNodeCount() > 0 ? model.getMesh(k)->getNodeIndex() : 0;
+            if (k == 0 || meshNode != boundNode)
+            {
+                modelMatrix = sceneGraph.getNodeCount() > 0
+                                  ? model.getModel() * sceneGraph.getWorldTransform(meshNode)
+                                  : model.getModel();
+                modelScale = std::max({glm::length(glm::vec3(modelMatrix[0])),
+                                       glm::length(glm::vec3(modelMatrix[1])),
+                                       glm::length(glm::vec3(modelMatrix[2]))});
+                boundNode = meshNode;
+            }
+
+            // Level of detail from the distance to the bounding sphere, the full mesh once the camera is inside
+            VulkanMesh *mesh = model.getMesh(k);
+            const MeshLod *lod = &mesh->getLod(0);
+            if (meshLodSelectionEnabled)
+            {
+                glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(mesh->getBoundsCenter(), 1.0f));
+                float distance = glm::length(center - cameraPosition) - mesh->getBoundsRadius() * modelScale;
+                float errorToPixels = distance > 0.0f ? modelScale * pixelsPerUnit / distance
+                                                      : std::numeric_limits<float>::max();
+                lod = &mesh->selectLod(errorToPixels, lodPixelThreshold);
+            }
+            glm::mat4 meshMatrix = glm::translate(modelMatrix, mesh->getTranslation());
+            meshDraws.push_back(MeshDraw{mesh, lod, meshMatrix, modelScale});
+        }
+    }
+    drawMeshes(currentImage, frustumPlanes, cameraPosition, meshBindings);
 
-            // Bind index buffer
-            commandBuffers[currentImage].bindIndexBuffer(model.getMesh(k)->getIndexBuffer(), 0, vk::IndexType::eUint32);
+    // Static batches are already in world space, each is a single draw culled with its bounds
+    glm::mat4 identityMatrix(1.0f);
+    commandBuffers[currentImage].pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(Model),
+                                               &identityMatrix);
+    for (auto &batch : staticBatches)
+    {
+        VulkanMesh *mesh = &batch.mesh;
+        if (mesh->getIndexCount() == 0 ||
+            MeshletBuilder::isOutsideFrustum(frustumPlanes, mesh->getBoundsCenter(), mesh->getBoundsRadius()))
+        {
+            continue;
+        }
+        bindMesh(commandBuffers[currentImage], mesh, descriptorSets[currentImage], meshBindings);
+        drawnTriangleCount += mesh->getIndexCount() / 3;
+        drawCallCount++;
+        commandBuffers[currentImage].drawIndexed(static_cast<uint32_t>(mesh->getIndexCount()), 1,
+                                                 mesh->getFirstIndex(), mesh->getVertexOffset(), 0);
+    }
 
-            // Bind descriptor sets
-            std::array<vk::DescriptorSet, 2> descriptorSetsGroup{descriptorSets[currentImage],
-                                                                 samplerDescriptorSets[model.getMesh(k)->getTexId()]};
+    drawSkinnedModels(currentImage, meshBindings);
 
+    // Impostors: the instances of every atlas one after the other in this image's buffer, a draw per atlas
+    drawnImpostorCount = 0;
+    for (const auto &instances : impostorInstances)
+    {
+        drawnImpostorCount += instances.size();
+    }
+    if (drawnImpostorCount > 0)
+    {
+        if (impostorInstanceCapacities[currentImage] < drawnImpostorCount)
+        {
+            // Doubled, so that a growing scene only reallocates a few times. Earlier frames may still read the
+            // old buffer.
+            retireBuffer(impostorInstanceBuffers[currentImage], impostorInstanceBufferMemories[currentImage]);
+            impostorInstanceCapacities[currentImage] =
+                std::max(drawnImpostorCount, impostorInstanceCapacities[currentImage] * 2);
+            createBuffer(memoryAllocator, impostorInstanceCapacities[currentImage] * sizeof(ImpostorInstance),
+                         vk::BufferUsageFlagBits::eVertexBuffer,
+                         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                         &impostorInstanceBuffers[currentImage], &impostorInstanceBufferMemories[currentImage]);
+        }
+        ImpostorInstance *instanceData =
+            reinterpret_cast<ImpostorInstance *>(impostorInstanceBufferMemories[currentImage].mapped);
+        for (const auto &instances : impostorInstances)
+        {
+            std::copy(instances.begin(), instances.end(), instanceData);
+            instanceData += instances.size();
+        }
+
+        commandBuffers[currentImage].bindPipeline(vk::PipelineBindPoint::eGraphics, impostorPipeline);
+        vk::DeviceSize offset = 0;
+        commandBuffers[currentImage].bindVertexBuffers(0, 1, &impostorInstanceBuffers[currentImage], &offset);
+        uint32_t firstInstance = 0;
+        for (size_t i = 0; i < impostors.size(); ++i)
+        {
+            uint32_t instanceCount = static_cast<uint32_t>(impostorInstances[i].size());
+            if (instanceCount == 0)
+            {
+                continue;
+            }
+            std::array<vk::DescriptorSet, 2> descriptorSetsGroup{descriptorSets[currentImage],
+                                                                 samplerDescriptorSets[impostors[i].textureId]};
             commandBuffers[currentImage].bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0,
                                                             static_cast<uint32_t>(descriptorSetsGroup.size()),
                                                             descriptorSetsGroup.data(), 0, nullptr);
-
-            // Execute pipeline
-            commandBuffers[currentImage].drawIndexed(static_cast<uint32_t>(model.getMesh(k)->getIndexCount()), 1, 0, 0,
-                                                     0);
+            // Two triangles per quad, made up in the vertex shader
+            commandBuffers[currentImage].draw(6, instanceCount, 0, firstInstance);
+            firstInstance += instanceCount;
+            drawnTriangleCount += 2 * instanceCount;
+            drawCallCount++;
         }
     }
 
@@ -1226,6 +1537,173 @@ void VulkanRenderer::recordCommands(uint32_t currentImage)
 
     // Stop recordind to command buffer
     commandBuffers[currentImage].end();
+    auto recordEndTime = std::chrono::high_resolution_clock::now();
+    recordMilliseconds = std::chrono::duration<double, std::milli>(recordEndTime - recordStartTime).count();
+}
+
+void VulkanRenderer::drawMeshes(uint32_t currentImage, const glm::vec4 *frustumPlanes,
+                                const glm::vec3 &cameraPosition, MeshBindings &meshBindings)
+{
+    if (meshDraws.empty())
+    {
+        return;
+    }
+    vk::CommandBuffer commandBuffer = commandBuffers[currentImage];
+
+    // Sorted by what a single draw needs to share: pipeline, texture and index range. The occurrences of a shared
+    // geometry (deduplicated meshes, model instances) at the same level and with the same texture end up together.
+    auto getDrawKey = [](const MeshDraw &draw) {
+        return std::make_tuple(draw.mesh->getVertexFormat(), draw.mesh->getTexId(), draw.mesh->getIndexType(),
+                               draw.mesh->getVertexOffset(), draw.mesh->getFirstIndex() + draw.lod->indexOffset,
+                               draw.lod->indexCount);
+    };
+    std::sort(meshDraws.begin(), meshDraws.end(),
+              [&](const MeshDraw &first, const MeshDraw &second) { return getDrawKey(first) < getDrawKey(second); });
+
+    // The model matrices of this image, instance i being draw i
+    if (meshInstanceCapacities[currentImage] < meshDraws.size())
+    {
+        // Doubled, so that a growing scene only reallocates a few times. Earlier frames may still read the old
+        // buffer.
+        retireBuffer(meshInstanceBuffers[currentImage], meshInstanceBufferMemories[currentImage]);
+        meshInstanceCapacities[currentImage] = std::max(meshDraws.size(), meshInstanceCapacities[currentImage] * 2);
+        createBuffer(memoryAllocator, meshInstanceCapacities[currentImage] * sizeof(glm::mat4),
+                     vk::BufferUsageFlagBits::eVertexBuffer,
+                     vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                     &meshInstanceBuffers[currentImage], &meshInstanceBufferMemories[currentImage]);
+    }
+    glm::mat4 *instanceMatrices = reinterpret_cast<glm::mat4 *>(meshInstanceBufferMemories[currentImage].mapped);
+    for (size_t i = 0; i < meshDraws.size(); ++i)
+    {
+        instanceMatrices[i] = meshDraws[i].matrix;
+    }
+    vk::DeviceSize instanceOffset = 0;
+    commandBuffer.bindVertexBuffers(1, 1, &meshInstanceBuffers[currentImage], &instanceOffset);
+
+    for (size_t runStart = 0, runEnd = 0; runStart < meshDraws.size(); runStart = runEnd)
+    {
+        runEnd = runStart + 1;
+        while (runEnd < meshDraws.size() && getDrawKey(meshDraws[runEnd]) == getDrawKey(meshDraws[runStart]))
+        {
+            runEnd++;
+        }
+        const MeshDraw &draw = meshDraws[runStart];
+        VulkanMesh *mesh = draw.mesh;
+        const MeshLod *lod = draw.lod;
+        uint32_t instanceCount = static_cast<uint32_t>(runEnd - runStart);
+
+        // Execute pipeline, the mesh being a range of the shared buffers: a single call for all the occurrences.
+        // A lone occurrence at full detail has its meshlets culled instead.
+        const std::vector<Meshlet> &meshlets = mesh->getMeshlets();
+        if (instanceCount > 1 || !meshletCullingEnabled || lod != &mesh->getLod(0) || meshlets.empty())
+        {
+            bindMesh(commandBuffer, mesh, descriptorSets[currentImage], meshBindings, true);
+            drawnTriangleCount += lod->indexCount / 3 * instanceCount;
+            drawCallCount++;
+            commandBuffer.drawIndexed(lod->indexCount, instanceCount, mesh->getFirstIndex() + lod->indexOffset,
+                                      mesh->getVertexOffset(), static_cast<uint32_t>(runStart));
+            continue;
+        }
+
+        // Meshlets are tested against the world space frustum, and against the camera position in object space for
+        // the back face cones: which side of a triangle a point is on doesn't change with the model matrix
+        commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(Model),
+                                    &draw.matrix);
+        bindMesh(commandBuffer, mesh, descriptorSets[currentImage], meshBindings);
+        glm::vec3 objectCameraPosition = glm::vec3(glm::inverse(draw.matrix) * glm::vec4(cameraPosition, 1.0f));
+
+        // Full level split in meshlets: draw the visible ones, consecutive ones with a single call
+        uint32_t meshletRunStart = 0;
+        uint32_t meshletRunCount = 0;
+        auto drawRun = [&]() {
+            if (meshletRunCount > 0)
+            {
+                commandBuffer.drawIndexed(meshletRunCount, 1, mesh->getFirstIndex() + meshletRunStart,
+                                          mesh->getVertexOffset(), 0);
+                drawnTriangleCount += meshletRunCount / 3;
+                meshletCullingStats.drawCount++;
+                drawCallCount++;
+            }
+            meshletRunCount = 0;
+        };
+        for (const auto &meshlet : meshlets)
+        {
+            meshletCullingStats.meshletCount++;
+            glm::vec3 center = glm::vec3(draw.matrix * glm::vec4(meshlet.center, 1.0f));
+            bool culled = true;
+            if (MeshletBuilder::isOutsideFrustum(frustumPlanes, center, meshlet.radius * draw.scale))
+            {
+                meshletCullingStats.frustumCulled++;
+            }
+            else if (MeshletBuilder::isBackfacing(meshlet, objectCameraPosition))
+            {
+                meshletCullingStats.backfaceCulled++;
+            }
+            else
+            {
+                culled = false;
+            }
+
+            if (culled)
+            {
+                drawRun();
+                continue;
+            }
+            if (meshletRunCount == 0)
+            {
+                meshletRunStart = meshlet.indexOffset;
+            }
+            meshletRunCount += meshlet.triangleCount * 3;
+        }
+        drawRun();
+    }
+}
+
+void VulkanRenderer::bindMesh(vk::CommandBuffer commandBuffer, VulkanMesh *mesh, vk::DescriptorSet viewProjectionSet,
+                              MeshBindings &bindings, bool isInstanced)
+{
+    vk::Pipeline meshPipeline;
+    if (isInstanced)
+    {
+        meshPipeline = mesh->getVertexFormat() == VertexFormat::Packed ? instancedPackedGraphicsPipeline
+                                                                        : instancedGraphicsPipeline;
+    }
+    else
+    {
+        meshPipeline = mesh->getVertexFormat() == VertexFormat::Packed ? packedGraphicsPipeline : graphicsPipeline;
+    }
+    if (meshPipeline != bindings.pipeline)
+    {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, meshPipeline);
+        bindings.pipeline = meshPipeline;
+    }
+    commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, sizeof(Model),
+                                sizeof(VertexDequantization), &mesh->getDequantization());
+
+    // Bind vertex buffer
+    vk::Buffer vertexBuffer = geometryBuffer.getVertexBuffer(mesh->getVertexFormat());
+    if (vertexBuffer != bindings.vertexBuffer)
+    {
+        vk::Buffer vertexBuffers[] = {vertexBuffer};
+        vk::DeviceSize offsets[] = {0};
+        commandBuffer.bindVertexBuffers(0, 1, vertexBuffers, offsets);
+        bindings.vertexBuffer = vertexBuffer;
+    }
+
+    // Bind index buffer
+    vk::Buffer indexBuffer = geometryBuffer.getIndexBuffer(mesh->getIndexType());
+    if (indexBuffer != bindings.indexBuffer)
+    {
+        commandBuffer.bindIndexBuffer(indexBuffer, 0, mesh->getIndexType());
+        bindings.indexBuffer = indexBuffer;
+    }
+
+    // Bind descriptor sets
+    std::array<vk::DescriptorSet, 2> descriptorSetsGroup{viewProjectionSet, samplerDescriptorSets[mesh->getTexId()]};
+
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0,
+                                     static_cast<uint32_t>(descriptorSetsGroup.size()), descriptorSetsGroup.data(), 0,
+                                     nullptr);
 }
 
 void VulkanRenderer::createSynchronisation()
@@ -1308,11 +1786,15 @@ void VulkanRenderer::createUniformBuffers()
     // Create uniform buffers
     for (size_t i = 0; i < swapchainImages.size(); ++i)
     {
-        createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, vpBufferSize,
-                     vk::BufferUsageFlagBits::eUniformBuffer,
+        createBuffer(memoryAllocator, vpBufferSize, vk::BufferUsageFlagBits::eUniformBuffer,
                      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
                      &vpUniformBuffer[i], &vpUniformBufferMemory[i]);
     }
+
+    // Mesh instance buffers are created by the first frames drawing meshes
+    meshInstanceBuffers.resize(swapchainImages.size());
+    meshInstanceBufferMemories.resize(swapchainImages.size());
+    meshInstanceCapacities.resize(swapchainImages.size(), 0);
 }
 
 void VulkanRenderer::createDescriptorPool()
@@ -1322,13 +1804,14 @@ void VulkanRenderer::createDescriptorPool()
     // View projection pool
     vk::DescriptorPoolSize vpPoolSize{};
     vpPoolSize.type = vk::DescriptorType::eUniformBuffer;
-    vpPoolSize.descriptorCount = static_cast<uint32_t>(vpUniformBuffer.size());
+    // One more for the impostor bakes
+    vpPoolSize.descriptorCount = static_cast<uint32_t>(vpUniformBuffer.size()) + 1;
 
     std::vector<vk::DescriptorPoolSize> poolSizes{vpPoolSize};
 
     // One descriptor set that contains one descriptor
     vk::DescriptorPoolCreateInfo poolCreateInfo{};
-    poolCreateInfo.maxSets = static_cast<uint32_t>(swapchainImages.size());
+    poolCreateInfo.maxSets = static_cast<uint32_t>(swapchainImages.size()) + 1;
     poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolCreateInfo.pPoolSizes = poolSizes.data();
 
@@ -1338,13 +1821,17 @@ void VulkanRenderer::createDescriptorPool()
     // -- SAMPLER DESCRIPTOR POOL --
     // Texture sampler pool
     vk::DescriptorPoolSize samplerPoolSize{};
+    samplerPoolSize.type = vk::DescriptorType::eCombinedImageSampler;
 
-    // We assume one texture byobject.
-    samplerPoolSize.descriptorCount = MAX_OBJECTS;
+    // A set per texture, impostor atlases included, and as many for the reloads: the new set of a texture is
+    // allocated before the old one is retired
+    samplerPoolSize.descriptorCount = 2 * MAX_TEXTURES;
     vk::DescriptorPoolCreateInfo samplerPoolCreateInfo{};
 
     // The maximum for this is actually very high
-    samplerPoolCreateInfo.maxSets = MAX_OBJECTS;
+    samplerPoolCreateInfo.maxSets = 2 * MAX_TEXTURES;
+    // Sets are given back to the pool when a texture loses its last reference
+    samplerPoolCreateInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
     samplerPoolCreateInfo.poolSizeCount = 1;
     samplerPoolCreateInfo.pPoolSizes = &samplerPoolSize;
 
@@ -1404,20 +1891,44 @@ void VulkanRenderer::createDescriptorSets()
 
 void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
 {
-    // Copy view projection data
-    void *data;
-    mainDevice.logicalDevice.mapMemory(vpUniformBufferMemory[imageIndex], {}, sizeof(ViewProjection), {}, &data);
-    memcpy(data, &viewProjection, sizeof(ViewProjection));
-    mainDevice.logicalDevice.unmapMemory(vpUniformBufferMemory[imageIndex]);
+    // Copy view projection data, the buffer stays mapped
+    memcpy(vpUniformBufferMemory[imageIndex].mapped, &viewProjection, sizeof(ViewProjection));
 }
 
 void VulkanRenderer::updateModel(int modelId, glm::mat4 modelP)
 {
     if (modelId >= meshModels.size())
         return;
+    // A static model is only batched again when it actually moved
+    if (meshModelStaticFlags[modelId] && meshModels[modelId].getModel() != modelP)
+    {
+        staticBatchChanges.push_back(modelId);
+    }
     meshModels[modelId].setModel(modelP);
 }
 
+uint32_t VulkanRenderer::findMeshModelNode(int modelId, const std::string &name) const
+{
+    if (modelId < 0 || modelId >= meshModels.size())
+    {
+        throw std::runtime_error("Attempted to find a node of a model with not attributed index");
+    }
+    return meshModels[modelId].getSceneGraph().findNode(name);
+}
+
+void VulkanRenderer::setMeshModelNodeTransform(int modelId, uint32_t node, const glm::mat4 &localTransform)
+{
+    if (modelId < 0 || modelId >= meshModels.size() || node >= meshModels[modelId].getSceneGraph().getNodeCount())
+    {
+        throw std::runtime_error("Attempted to move a node that does not exist");
+    }
+    meshModels[modelId].getSceneGraph().setLocalTransform(node, localTransform);
+    if (meshModelStaticFlags[modelId])
+    {
+        staticBatchChanges.push_back(modelId);
+    }
+}
+
 void VulkanRenderer::allocateDynamicBufferTransferSpace()
 {
     // modelUniformAlignement = sizeof(Model) & ~(minUniformBufferOffet - 1);
@@ -1450,13 +1961,14 @@ void VulkanRenderer::createPushConstantRange()
     // Shader stage push constant will go to
     pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eVertex;
     pushConstantRange.offset = 0;
-    pushConstantRange.size = sizeof(Model);
+    // Model matrix, then the dequantization of the mesh being drawn
+    pushConstantRange.size = sizeof(Model) + sizeof(VertexDequantization);
 }
 
 vk::Image VulkanRenderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels,
                                       vk::SampleCountFlagBits numSamples, vk::Format format, vk::ImageTiling tiling,
                                       vk::ImageUsageFlags useFlags, vk::MemoryPropertyFlags propFlags,
-                                      vk::DeviceMemory *imageMemory)
+                                      MemoryAllocation *imageMemory)
 {
     vk::ImageCreateInfo imageCreateInfo{};
     imageCreateInfo.imageType = vk::ImageType::e2D;
@@ -1482,22 +1994,8 @@ vk::Image VulkanRenderer::createImage(uint32_t width, uint32_t height, uint32_t
     // Create the header of the image
     vk::Image image = mainDevice.logicalDevice.createImage(imageCreateInfo);
 
-    // Now we need to setup and allocate memory for the image
-    vk::MemoryRequirements memoryRequierements = mainDevice.logicalDevice.getImageMemoryRequirements(image);
-
-    vk::MemoryAllocateInfo memoryAllocInfo{};
-    memoryAllocInfo.allocationSize = memoryRequierements.size;
-    memoryAllocInfo.memoryTypeIndex =
-        findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequierements.memoryTypeBits, propFlags);
-
-    auto result = mainDevice.logicalDevice.allocateMemory(&memoryAllocInfo, nullptr, imageMemory);
-    if (result != vk::Result::eSuccess)
-    {
-        throw std::runtime_error("Failed to allocate memory for an image.");
-    }
-
-    // Connect memory to image
-    mainDevice.logicalDevice.bindImageMemory(image, *imageMemory, 0);
+    // Memory sub-allocated in a block shared with other images, bound at its offset
+    *imageMemory = memoryAllocator.allocateImage(image, tiling, propFlags);
 
     return image;
 }
@@ -1526,7 +2024,7 @@ vk::Format VulkanRenderer::chooseSupportedFormat(const std::vector<vk::Format> &
     throw std::runtime_error("Failed to find a matching format.");
 }
 
-void VulkanRenderer::createDepthBufferImage()
+vk::Format VulkanRenderer::chooseDepthFormat()
 {
     std::vector<vk::Format> formats{// Look for a format with 32bits death buffer and stencil buffer
                                     vk::Format::eD32SfloatS8Uint,
@@ -1535,9 +2033,14 @@ void VulkanRenderer::createDepthBufferImage()
                                     // if not 24bits depth and stencil buffer
                                     vk::Format::eD24UnormS8Uint};
 
-    vk::Format depthFormat = chooseSupportedFormat(formats, vk::ImageTiling::eOptimal,
-                                                   // Format supports depth and stencil attachment
-                                                   vk::FormatFeatureFlagBits::eDepthStencilAttachment);
+    return chooseSupportedFormat(formats, vk::ImageTiling::eOptimal,
+                                 // Format supports depth and stencil attachment
+                                 vk::FormatFeatureFlagBits::eDepthStencilAttachment);
+}
+
+void VulkanRenderer::createDepthBufferImage()
+{
+    vk::Format depthFormat = chooseDepthFormat();
 
     // Create image and image view
     depthBufferImage = createImage(swapchainExtent.width, swapchainExtent.height, 1, msaaSamples, depthFormat,
@@ -1548,13 +2051,27 @@ void VulkanRenderer::createDepthBufferImage()
 }
 
 stbi_uc *VulkanRenderer::loadTextureFile(const std::string &filename, int *width, int *height,
-                                         vk::DeviceSize *imageSize)
+                                         vk::DeviceSize *imageSize, uint64_t *contentHash)
 {
+    // Read the encoded file ourselves, its hash lets the texture cache spot copies under other names
+    std::string path = "textures/" + filename;
+    std::ifstream file{path, std::ios::binary | std::ios::ate};
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Failed to load texture file: " + path);
+    }
+    size_t fileSize = (size_t)file.tellg();
+    std::vector<char> fileBuffer(fileSize);
+    file.seekg(0);
+    file.read(fileBuffer.data(), fileSize);
+    *contentHash = hashBytes(fileBuffer.data(), fileBuffer.size());
+
     // Number of channel image uses
     int channels;
     // Load pixel data for image
-    std::string path = "textures/" + filename;
-    stbi_uc *image = stbi_load(path.c_str(), width, height, &channels, STBI_rgb_alpha);
+    stbi_uc *image = stbi_load_from_memory(reinterpret_cast<const stbi_uc *>(fileBuffer.data()),
+                                           static_cast<int>(fileBuffer.size()), width, height, &channels,
+                                           STBI_rgb_alpha);
     if (!image)
     {
         throw std::runtime_error("Failed to load texture file: " + path);
@@ -1564,85 +2081,268 @@ stbi_uc *VulkanRenderer::loadTextureFile(const std::string &filename, int *width
     return image;
 }
 
-int VulkanRenderer::createTextureImage(const std::string &filename, uint32_t &mipLevels)
+TextureData VulkanRenderer::decodeTextureFile(const std::string &filename)
 {
-    // Load image file
-    int width, height;
-    vk::DeviceSize imageSize;
-    stbi_uc *imageData = loadTextureFile(filename, &width, &height, &imageSize);
-    mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+    TextureData textureData;
+    stbi_uc *pixels = loadTextureFile(filename, &textureData.width, &textureData.height, &textureData.imageSize,
+                                      &textureData.contentHash);
+    textureData.storage = std::shared_ptr<const void>(pixels, stbi_image_free);
+    textureData.pixels = pixels;
+    return textureData;
+}
 
-    // Create staging buffer to hold loaded data, ready to copy to device
-    vk::Buffer imageStagingBuffer;
-    vk::DeviceMemory imageStagingBufferMemory;
-    createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize, vk::BufferUsageFlagBits::eTransferSrc,
-                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-                 &imageStagingBuffer, &imageStagingBufferMemory);
+TextureData VulkanRenderer::decodeTexture(const std::string &filename, bool compress, ThreadPool &threadPool)
+{
+    std::string path = "textures/" + filename;
+
+    // Converted on a previous run: map the container, every level is ready to be copied as is.
+    // A container converted with the other compression setting (e.g. another GPU) is converted again.
+    auto container = std::make_shared<TextureContainer>();
+    if (container->open(path) && isBlockCompressed(static_cast<vk::Format>(container->getHeader().format)) == compress)
+    {
+        const TextureContainerHeader &header = container->getHeader();
+        TextureData textureData;
+        textureData.pixels = container->getData();
+        textureData.width = header.width;
+        textureData.height = header.height;
+        textureData.mipLevels = header.mipLevels;
+        textureData.levelOffsets.assign(header.levelOffsets, header.levelOffsets + header.mipLevels);
+        textureData.imageSize = header.dataSize;
+        textureData.format = static_cast<vk::Format>(header.format);
+        textureData.contentHash = header.sourceHash;
+        textureData.storage = container;
+        return textureData;
+    }
+    container->close();
+
+    // First run: decode, filter the mip chain on the CPU and keep it for the next runs
+    TextureData sourceData = decodeTextureFile(filename);
+    std::vector<uint64_t> levelOffsets;
+    std::vector<uint64_t> levelSizes;
+    auto mipChain = std::make_shared<std::vector<unsigned char>>(
+        TextureContainer::buildMipChain(sourceData.pixels, sourceData.width, sourceData.height, levelOffsets,
+                                        levelSizes));
+    // Level 0 of the chain is a copy of the decoded image, which is not needed anymore
+    sourceData.storage.reset();
+    sourceData.pixels = nullptr;
+    vk::Format format = vk::Format::eR8G8B8A8Unorm;
+
+    if (compress)
+    {
+        // BC1 is enough for opaque images, BC3 keeps a full alpha channel
+        BlockFormat blockFormat = TextureCompression::hasAlpha(mipChain->data(), sourceData.width, sourceData.height)
+                                      ? BlockFormat::BC3
+                                      : BlockFormat::BC1;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        std::vector<uint64_t> compressedLevelOffsets;
+        std::vector<uint64_t> compressedLevelSizes;
+        auto compressedChain = std::make_shared<std::vector<unsigned char>>(TextureCompression::compressMipChain(
+            mipChain->data(), sourceData.width, sourceData.height, levelOffsets, blockFormat, threadPool,
+            compressedLevelOffsets, compressedLevelSizes));
+        auto endTime = std::chrono::high_resolution_clock::now();
+        printf("Compressed %s to %s: %.2f MB -> %.2f MB in %.2f ms\n", filename.c_str(),
+               blockFormat == BlockFormat::BC1 ? "BC1" : "BC3", mipChain->size() / (1024.0 * 1024.0),
+               compressedChain->size() / (1024.0 * 1024.0),
+               std::chrono::duration<double, std::milli>(endTime - startTime).count());
+
+        mipChain = compressedChain;
+        levelOffsets = compressedLevelOffsets;
+        levelSizes = compressedLevelSizes;
+        format = blockFormat == BlockFormat::BC1 ? vk::Format::eBc1RgbaUnormBlock : vk::Format::eBc3UnormBlock;
+    }
+
+    if (!TextureContainer::write(path, sourceData.contentHash, static_cast<uint32_t>(format), sourceData.width,
+                                 sourceData.height, levelOffsets, levelSizes, mipChain->data(), mipChain->size()))
+    {
+        printf("WARNING: Could not write texture container for %s\n", path.c_str());
+    }
+
+    TextureData textureData;
+    textureData.pixels = mipChain->data();
+    textureData.width = sourceData.width;
+    textureData.height = sourceData.height;
+    textureData.mipLevels = static_cast<uint32_t>(levelOffsets.size());
+    textureData.levelOffsets.assign(levelOffsets.begin(), levelOffsets.end());
+    textureData.imageSize = mipChain->size();
+    textureData.format = format;
+    textureData.contentHash = sourceData.contentHash;
+    textureData.storage = mipChain;
+    return textureData;
+}
 
-    // Copy image data to the staging buffer
-    void *data;
-    mainDevice.logicalDevice.mapMemory(imageStagingBufferMemory, {}, imageSize, {}, &data);
-    memcpy(data, imageData, static_cast<size_t>(imageSize));
-    mainDevice.logicalDevice.unmapMemory(imageStagingBufferMemory);
+bool VulkanRenderer::isBlockCompressed(vk::Format format)
+{
+    return format == vk::Format::eBc1RgbaUnormBlock || format == vk::Format::eBc3UnormBlock;
+}
 
-    // Free original image data
-    stbi_image_free(imageData);
+int VulkanRenderer::createTextureImage(const TextureData &textureData, uint32_t &mipLevels, UploadBatch &uploadBatch)
+{
+    // Mips were filtered on the CPU, they come with the pixels
+    mipLevels = textureData.mipLevels;
 
     // Create image to hold final texture
     vk::Image texImage;
-    vk::DeviceMemory texImageMemory;
-    texImage = createImage(
-        width, height, mipLevels, vk::SampleCountFlagBits::e1, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal,
-        vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eDeviceLocal, &texImageMemory);
-
-    // -- COPY DATA TO IMAGE --
-    // Transition image to be DST for copy operations
-    transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage,
-                          vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, mipLevels);
-
-    // Copy image data
-    copyImageBuffer(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, imageStagingBuffer, texImage, width,
-                    height);
-
-    /*
-    // -- READY FOR SHADER USE --
-    transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage,
-                          vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, mipLevels);
-    */
-
-    // -- GENERATE MIPMAPS AND READY FOR SHADER USE --
-    generateMipmaps(mainDevice.logicalDevice, mainDevice.physicalDevice, graphicsQueue, graphicsCommandPool, texImage,
-                    vk::Format::eR8G8B8A8Srgb, width, height, mipLevels);
+    MemoryAllocation texImageMemory;
+    texImage = createImage(textureData.width, textureData.height, mipLevels, vk::SampleCountFlagBits::e1,
+                           textureData.format, vk::ImageTiling::eOptimal,
+                           vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+                           vk::MemoryPropertyFlagBits::eDeviceLocal, &texImageMemory);
+
+    // Every level is staged now, the layout transitions and copies are recorded with the rest of the batch
+    uploadBatch.uploadImage(textureData.pixels, textureData.imageSize, texImage, textureData.width,
+                            textureData.height, textureData.levelOffsets);
 
     // Add texture data to vector for reference
     textureImages.push_back(texImage);
     textureImageMemory.push_back(texImageMemory);
 
-    // Destroy stagin buffers
-    mainDevice.logicalDevice.destroyBuffer(imageStagingBuffer, nullptr);
-    mainDevice.logicalDevice.freeMemory(imageStagingBufferMemory, nullptr);
-
     // Return index of new texture image
     return textureImages.size() - 1;
 }
 
 int VulkanRenderer::createTexture(const std::string &filename)
+{
+    return createTextures({filename}).front();
+}
+
+int VulkanRenderer::createTexture(const TextureData &textureData, UploadBatch &uploadBatch)
 {
     uint32_t mipLevels{0};
 
-    int textureImageLocation = createTextureImage(filename, mipLevels);
-    vk::ImageView imageView = createImageView(textureImages[textureImageLocation], vk::Format::eR8G8B8A8Unorm,
+    int textureImageLocation = createTextureImage(textureData, mipLevels, uploadBatch);
+    vk::ImageView imageView = createImageView(textureImages[textureImageLocation], textureData.format,
                                               vk::ImageAspectFlagBits::eColor, mipLevels);
 
     textureImageViews.push_back(imageView);
 
     int descriptorLoc = createTextureDescriptor(imageView);
 
+    // Register the new texture in the cache with a single reference, the caller's
+    textureRefCounts.push_back(1);
+    textureDeviceSizes.push_back(textureData.imageSize);
+    textureContentCache[textureData.contentHash] = descriptorLoc;
+
     // Return location of set with texture
     return descriptorLoc;
 }
 
+std::vector<int> VulkanRenderer::createTextures(const std::vector<std::string> &filenames)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Start decoding every texture missing from the cache at once on the workers.
+    // A file appearing several times in the list is only decoded once.
+    std::vector<int> textureIds(filenames.size(), 0);
+    std::vector<std::future<TextureData>> decodedTextures(filenames.size());
+    std::unordered_map<std::string, size_t> firstOccurrences;
+    for (size_t i = 0; i < filenames.size(); ++i)
+    {
+        if (filenames[i].empty() || texturePathCache.count(filenames[i]) ||
+            !firstOccurrences.emplace(filenames[i], i).second)
+        {
+            continue;
+        }
+        decodedTextures[i] = workerPool.submit([this, filename = filenames[i]]() {
+            return decodeTexture(filename, textureCompressionSupported, workerPool);
+        });
+    }
+
+    // Stage them in order as soon as they are ready, while the next ones are still being decoded,
+    // then upload them all with a single submission
+    UploadBatch uploadBatch(memoryAllocator, graphicsQueue, graphicsCommandPool);
+    for (size_t i = 0; i < filenames.size(); ++i)
+    {
+        if (filenames[i].empty())
+        {
+            // Texture 0 will be reserved for a default texture
+            textureIds[i] = 0;
+            continue;
+        }
+        // Known path, including a file decoded earlier in this same list
+        if (acquireCachedTexture(filenames[i], &textureIds[i]))
+        {
+            continue;
+        }
+        textureIds[i] = addDecodedTexture(filenames[i], decodedTextures[i].get(), uploadBatch);
+    }
+    vk::DeviceSize decodedBytes = uploadBatch.getStagedBytes();
+    uploadBatch.submit();
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    double milliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    printf("Decoded and uploaded %.1f MB of textures on %zu threads in %.2f ms\n",
+           decodedBytes / (1024.0 * 1024.0), workerPool.getThreadCount(), milliseconds);
+    printf("Texture cache: %zu hits, %zu misses, %.1f MB saved\n", textureCacheStats.hits, textureCacheStats.misses,
+           textureCacheStats.bytesSaved / (1024.0 * 1024.0));
+
+    return textureIds;
+}
+
+int VulkanRenderer::addDecodedTexture(const std::string &filename, const TextureData &textureData,
+                                      UploadBatch &uploadBatch)
+{
+    // Same content under another name: share the existing image and descriptor, a hit although it was decoded
+    auto cachedContent = textureContentCache.find(textureData.contentHash);
+    if (cachedContent != textureContentCache.end())
+    {
+        texturePathCache[filename] = cachedContent->second;
+        textureRefCounts[cachedContent->second]++;
+        textureCacheStats.hits++;
+        textureCacheStats.bytesSaved += textureDeviceSizes[cachedContent->second];
+        return cachedContent->second;
+    }
+
+    textureCacheStats.misses++;
+    int textureId = createTexture(textureData, uploadBatch);
+    texturePathCache[filename] = textureId;
+    return textureId;
+}
+
+bool VulkanRenderer::acquireCachedTexture(const std::string &filename, int *textureId)
+{
+    auto cachedPath = texturePathCache.find(filename);
+    if (cachedPath == texturePathCache.end())
+    {
+        return false;
+    }
+    *textureId = cachedPath->second;
+    textureRefCounts[*textureId]++;
+    textureCacheStats.hits++;
+    textureCacheStats.bytesSaved += textureDeviceSizes[*textureId];
+    return true;
+}
+
+void VulkanRenderer::releaseTexture(int textureId)
+{
+    if (textureId < 0 || textureId >= textureRefCounts.size() || textureRefCounts[textureId] == 0)
+    {
+        return;
+    }
+    if (--textureRefCounts[textureId] > 0)
+    {
+        return;
+    }
+
+    // Last reference gone: forget it in the cache and free its resources.
+    // The slot itself is not reused so that other texture ids stay valid.
+    for (auto it = texturePathCache.begin(); it != texturePathCache.end();)
+    {
+        it = it->second == textureId ? texturePathCache.erase(it) : std::next(it);
+    }
+    for (auto it = textureContentCache.begin(); it != textureContentCache.end();)
+    {
+        it = it->second == textureId ? textureContentCache.erase(it) : std::next(it);
+    }
+
+    mainDevice.logicalDevice.freeDescriptorSets(samplerDescriptorPool, samplerDescriptorSets[textureId]);
+    mainDevice.logicalDevice.destroyImageView(textureImageViews[textureId], nullptr);
+    mainDevice.logicalDevice.destroyImage(textureImages[textureId], nullptr);
+    memoryAllocator.free(textureImageMemory[textureId]);
+    samplerDescriptorSets[textureId] = nullptr;
+    textureImageViews[textureId] = nullptr;
+    textureImages[textureId] = VK_NULL_HANDLE;
+}
+
 void VulkanRenderer::createTextureSampler()
 {
     vk::SamplerCreateInfo samplerCreateInfo{};
@@ -1685,6 +2385,14 @@ void VulkanRenderer::createTextureSampler()
 }
 
 int VulkanRenderer::createTextureDescriptor(vk::ImageView textureImageView)
+{
+    // Add descriptor set to list
+    samplerDescriptorSets.push_back(allocateTextureDescriptorSet(textureImageView));
+
+    return samplerDescriptorSets.size() - 1;
+}
+
+vk::DescriptorSet VulkanRenderer::allocateTextureDescriptorSet(vk::ImageView textureImageView)
 {
     vk::DescriptorSet descriptorSet;
 
@@ -1724,57 +2432,2610 @@ int VulkanRenderer::createTextureDescriptor(vk::ImageView textureImageView)
     // Update new descriptor set
     mainDevice.logicalDevice.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
 
-    // Add descriptor set to list
-    samplerDescriptorSets.push_back(descriptorSet);
-
-    return samplerDescriptorSets.size() - 1;
+    return descriptorSet;
 }
 
-int VulkanRenderer::createMeshModel(const std::string &filename)
+// Assimp file access that keeps the paths the importer opened or looked for besides the model itself (material
+// libraries), so that the mesh cache can be invalidated when they change
+class RecordingIOSystem : public Assimp::DefaultIOSystem
 {
-    // Import model scene
-    Assimp::Importer importer;
-
+  public:
+    explicit RecordingIOSystem(const std::string &sourcePathP) : sourcePath(sourcePathP)
+    {
+    }
+
+    bool Exists(const char *path) const override
+    {
+        record(path);
+        return DefaultIOSystem::Exists(path);
+    }
+    Assimp::IOStream *Open(const char *path, const char *mode = "rb") override
+    {
+        record(path);
+        return DefaultIOSystem::Open(path, mode);
+    }
+
+    const std::vector<std::string> &getPaths() const
+    {
+        return paths;
+    }
+
+  private:
+    std::string sourcePath;
+    mutable std::vector<std::string> paths;
+
+    void record(const char *path) const
+    {
+        if (path != sourcePath && std::find(paths.begin(), paths.end(), path) == paths.end())
+        {
+            paths.push_back(path);
+        }
+    }
+};
+
+// duplicateOf from MeshOptimizer::findDuplicateMeshes, or empty when duplicates were not looked for
+static bool isDuplicateMesh(const std::vector<uint32_t> &duplicateOf, size_t mesh)
+{
+    return !duplicateOf.empty() && duplicateOf[mesh] != mesh;
+}
+
+// For each Assimp mesh, the first one converting to the same vertices and indices up to a translation (position,
+// first texture coordinates, faces), or its own index, like MeshOptimizer::findDuplicateMeshes on the converted
+// meshes. boundsMins receives the lowest corner of every mesh's bounds: duplicates are moved by their difference.
+static std::vector<uint32_t> findDuplicateSceneMeshes(const std::vector<aiMesh *> &meshes,
+                                                      std::vector<glm::vec3> &boundsMins)
+{
+    std::vector<glm::vec3> boundsMaxs(meshes.size(), glm::vec3(0.0f));
+    boundsMins.assign(meshes.size(), glm::vec3(0.0f));
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        const aiMesh *mesh = meshes[i];
+        for (unsigned int vertex = 0; vertex < mesh->mNumVertices; ++vertex)
+        {
+            glm::vec3 position(mesh->mVertices[vertex].x, mesh->mVertices[vertex].y, mesh->mVertices[vertex].z);
+            boundsMins[i] = vertex == 0 ? position : glm::min(boundsMins[i], position);
+            boundsMaxs[i] = vertex == 0 ? position : glm::max(boundsMaxs[i], position);
+        }
+    }
+
+    auto isSameMesh = [&](uint32_t firstIndex, uint32_t secondIndex) {
+        const aiMesh *first = meshes[firstIndex];
+        const aiMesh *second = meshes[secondIndex];
+        if (first == second)
+        {
+            return true;
+        }
+        if (first->mNumVertices != second->mNumVertices || first->mNumFaces != second->mNumFaces ||
+            (first->mTextureCoords[0] == nullptr) != (second->mTextureCoords[0] == nullptr) ||
+            (first->mTextureCoords[0] && memcmp(first->mTextureCoords[0], second->mTextureCoords[0],
+                                                first->mNumVertices * sizeof(aiVector3D)) != 0))
+        {
+            return false;
+        }
+        for (unsigned int i = 0; i < first->mNumFaces; ++i)
+        {
+            const aiFace &firstFace = first->mFaces[i];
+            const aiFace &secondFace = second->mFaces[i];
+            if (firstFace.mNumIndices != secondFace.mNumIndices ||
+                memcmp(firstFace.mIndices, secondFace.mIndices, firstFace.mNumIndices * sizeof(unsigned int)) != 0)
+            {
+                return false;
+            }
+        }
+        // Positions relative to the bounds, within the rounding of the translation
+        glm::vec3 offset = boundsMins[secondIndex] - boundsMins[firstIndex];
+        glm::vec3 tolerance(MeshOptimizer::getTranslationTolerance(boundsMins[firstIndex], boundsMaxs[firstIndex],
+                                                                   boundsMins[secondIndex], boundsMaxs[secondIndex]));
+        for (unsigned int i = 0; i < first->mNumVertices; ++i)
+        {
+            glm::vec3 firstPosition(first->mVertices[i].x, first->mVertices[i].y, first->mVertices[i].z);
+            glm::vec3 secondPosition(second->mVertices[i].x, second->mVertices[i].y, second->mVertices[i].z);
+            if (glm::any(glm::greaterThan(glm::abs(firstPosition + offset - secondPosition), tolerance)))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // Hashed on the sizes and faces, which a translation leaves alone, confirmed by comparing everything as hashes
+    // may collide
+    std::vector<uint32_t> duplicateOf(meshes.size());
+    std::unordered_map<uint64_t, std::vector<uint32_t>> firstMeshes;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        duplicateOf[i] = static_cast<uint32_t>(i);
+        const aiMesh *mesh = meshes[i];
+        unsigned int sizes[2] = {mesh->mNumVertices, mesh->mNumFaces};
+        uint64_t key = hashBytes(sizes, sizeof(sizes));
+        for (unsigned int face = 0; face < mesh->mNumFaces; ++face)
+        {
+            key = hashBytes(mesh->mFaces[face].mIndices, mesh->mFaces[face].mNumIndices * sizeof(unsigned int), key);
+        }
+        std::vector<uint32_t> &candidates = firstMeshes[key];
+        for (uint32_t candidate : candidates)
+        {
+            if (isSameMesh(candidate, static_cast<uint32_t>(i)))
+            {
+                duplicateOf[i] = candidate;
+                break;
+            }
+        }
+        if (duplicateOf[i] == i)
+        {
+            candidates.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    return duplicateOf;
+}
+
+// Meshes drawing from another one's geometry, and the device memory they would have taken
+static void printMeshDeduplication(const std::vector<VulkanMesh> &meshes, const std::vector<uint32_t> &duplicateOf)
+{
+    size_t duplicateCount = 0;
+    vk::DeviceSize savedBytes = 0;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        if (isDuplicateMesh(duplicateOf, i))
+        {
+            duplicateCount++;
+            savedBytes += meshes[i].getVertexBufferSize() + meshes[i].getIndexBufferSize();
+        }
+    }
+    if (duplicateCount > 0)
+    {
+        printf("Deduplicated %zu of %zu meshes, %.2f MB of geometry saved\n", duplicateCount, meshes.size(),
+               savedBytes / (1024.0 * 1024.0));
+    }
+}
+
+uint32_t VulkanRenderer::getMeshBakeFlags(const std::string &filename) const
+{
+    bool isNativeObj = nativeObjImportEnabled && ObjLoader::isObjFile(filename);
+    return MeshCache::BAKE_SPLIT_16BIT | (meshOptimizationEnabled ? MeshCache::BAKE_OPTIMIZED : 0) |
+           (meshletBuildingEnabled ? MeshCache::BAKE_MESHLETS : 0) | (isNativeObj ? MeshCache::BAKE_NATIVE_OBJ : 0) |
+           (meshCacheCompressionEnabled ? MeshCache::BAKE_COMPRESSED : 0) |
+           (meshLodCount > 1 ? meshLodCount << MeshCache::BAKE_LOD_COUNT_SHIFT : 0);
+}
+
+bool VulkanRenderer::openMeshCache(const std::string &filename, ModelImport &modelImport)
+{
+    modelImport.meshCache = std::make_unique<MeshCache>();
+    modelImport.isWarm = modelImport.meshCache->open(filename, MESH_IMPORT_FLAGS, getMeshBakeFlags(filename));
+    if (!modelImport.isWarm)
+    {
+        modelImport.meshCache.reset();
+        return false;
+    }
+    const MeshCache &meshCache = *modelImport.meshCache;
+    if (meshCache.getStoredGeometryBytes() < meshCache.getRawGeometryBytes())
+    {
+        printf("Mesh cache geometry: %.2f MB compressed from %.2f MB (%.2fx)\n",
+               meshCache.getStoredGeometryBytes() / (1024.0 * 1024.0),
+               meshCache.getRawGeometryBytes() / (1024.0 * 1024.0),
+               static_cast<double>(meshCache.getRawGeometryBytes()) / meshCache.getStoredGeometryBytes());
+    }
+    modelImport.textureNames = meshCache.getTextureNames();
+    modelImport.sceneGraph = meshCache.getSceneGraph();
+    for (size_t i = 0; i < meshCache.getMeshCount(); ++i)
+    {
+        modelImport.meshViews.push_back(meshCache.getMesh(i));
+    }
+    // Duplicates were baked pointing at the same arrays, found without hashing
+    modelImport.duplicateOf = MeshOptimizer::findDuplicateMeshes(modelImport.meshViews);
+    return true;
+}
+
+ModelImport VulkanRenderer::importMeshModel(const std::string &filename)
+{
+    ModelImport modelImport;
+
+    // Warm path: the baked mesh cache is mapped and its arrays go straight to staging, Assimp is never called
+    if (openMeshCache(filename, modelImport))
+    {
+        return modelImport;
+    }
+
+    importSourceMeshes(filename, modelImport);
+    std::vector<MeshData> &importedMeshes = modelImport.meshes;
+
+    // Duplicates are found among the source meshes: processing works on positions, and a copy at another position
+    // may not come out of it with the same triangle order, levels or meshlets. Only the first ones are processed.
+    std::vector<MeshView> sourceViews;
+    for (const auto &meshData : importedMeshes)
+    {
+        sourceViews.push_back(meshData.getView());
+    }
+    std::vector<uint32_t> sourceDuplicateOf = MeshOptimizer::findDuplicateMeshes(sourceViews);
+    std::vector<uint32_t> uniqueSources;
+    std::vector<MeshData> uniqueMeshes;
+    for (size_t i = 0; i < importedMeshes.size(); ++i)
+    {
+        if (sourceDuplicateOf[i] == i)
+        {
+            uniqueSources.push_back(static_cast<uint32_t>(i));
+            uniqueMeshes.push_back(std::move(importedMeshes[i]));
+        }
+    }
+    std::vector<uint32_t> processedSources;
+    processMeshes(uniqueMeshes, &processedSources);
+
+    // Meshes in source order, each duplicate made of views of its first mesh's processed meshes, moved by the
+    // difference of the source bounds. Moving the import around keeps the vectors' storage, and so the views valid.
+    std::vector<MeshView> &meshViews = modelImport.meshViews;
+    std::vector<uint32_t> &duplicateOf = modelImport.duplicateOf;
+    std::vector<uint32_t> sourceFirstMeshes(sourceViews.size(), 0);
+    std::vector<uint32_t> sourceMeshCounts(sourceViews.size(), 0);
+    size_t processed = 0;
+    for (size_t source = 0; source < sourceViews.size(); ++source)
+    {
+        uint32_t sourceFirst = sourceDuplicateOf[source];
+        if (sourceFirst != source)
+        {
+            glm::vec3 offset = sourceViews[source].boundsMin - sourceViews[sourceFirst].boundsMin;
+            for (uint32_t k = 0; k < sourceMeshCounts[sourceFirst]; ++k)
+            {
+                MeshView duplicateView = meshViews[sourceFirstMeshes[sourceFirst] + k];
+                duplicateView.materialIndex = sourceViews[source].materialIndex;
+                duplicateView.nodeIndex = sourceViews[source].nodeIndex;
+                duplicateView.boundsMin += offset;
+                duplicateView.boundsMax += offset;
+                meshViews.push_back(duplicateView);
+                duplicateOf.push_back(sourceFirstMeshes[sourceFirst] + k);
+            }
+            continue;
+        }
+        sourceFirstMeshes[source] = static_cast<uint32_t>(meshViews.size());
+        for (; processed < uniqueMeshes.size() && uniqueSources[processedSources[processed]] == source; ++processed)
+        {
+            meshViews.push_back(uniqueMeshes[processed].getView());
+            duplicateOf.push_back(static_cast<uint32_t>(meshViews.size() - 1));
+            sourceMeshCounts[source]++;
+        }
+    }
+    importedMeshes = std::move(uniqueMeshes);
+
+    if (!MeshCache::write(filename, MESH_IMPORT_FLAGS, getMeshBakeFlags(filename), meshViews,
+                          modelImport.duplicateOf, modelImport.textureNames, modelImport.sceneGraph,
+                          modelImport.dependencies))
+    {
+        printf("WARNING: Could not write mesh cache for %s\n", filename.c_str());
+    }
+    return modelImport;
+}
+
+void VulkanRenderer::importSourceMeshes(const std::string &filename, ModelImport &modelImport)
+{
+    std::vector<MeshData> &importedMeshes = modelImport.meshes;
+    if (nativeObjImportEnabled && ObjLoader::isObjFile(filename))
+    {
+        // Parsed straight into our vertex and index arrays, on the workers
+        auto parseStartTime = std::chrono::high_resolution_clock::now();
+        ObjModel objModel = ObjLoader::load(filename, workerPool);
+        auto parseEndTime = std::chrono::high_resolution_clock::now();
+        printf("Parsed %zu meshes on %zu threads in %.2f ms\n", objModel.meshes.size(), workerPool.getThreadCount(),
+               std::chrono::duration<double, std::milli>(parseEndTime - parseStartTime).count());
+        importedMeshes = std::move(objModel.meshes);
+        modelImport.textureNames = std::move(objModel.textureNames);
+        modelImport.sceneGraph = std::move(objModel.sceneGraph);
+        modelImport.dependencies = std::move(objModel.dependencies);
+    }
+    else
+    {
+        Assimp::Importer importer;
+        const aiScene *scene = readSourceScene(importer, filename, modelImport);
+
+        // Convert all our meshes on the workers
+        auto convertStartTime = std::chrono::high_resolution_clock::now();
+        importedMeshes = VulkanMeshModel::loadNode(scene->mRootNode, scene, workerPool, modelImport.sceneGraph);
+        auto convertEndTime = std::chrono::high_resolution_clock::now();
+        printf("Converted %zu meshes on %zu threads in %.2f ms\n", importedMeshes.size(),
+               workerPool.getThreadCount(),
+               std::chrono::duration<double, std::milli>(convertEndTime - convertStartTime).count());
+        // The Assimp scene is freed here, before any processing
+    }
+}
+
+const aiScene *VulkanRenderer::readSourceScene(Assimp::Importer &importer, const std::string &filename,
+                                               ModelImport &modelImport)
+{
+    // Import model scene, the importer owns the IO system
+    RecordingIOSystem *ioSystem = new RecordingIOSystem(filename);
+    importer.SetIOHandler(ioSystem);
+
     // We want the model to be in triangles, to flip vertically texels uvs,
     // and optimize the use of vertices
-    const aiScene *scene =
-        importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+    const aiScene *scene = importer.ReadFile(filename, MESH_IMPORT_FLAGS);
     if (!scene)
     {
         throw std::runtime_error("Failed to load mesh model: " + filename);
     }
+    modelImport.dependencies = ioSystem->getPaths();
     // Load materials with one to one relationship with texture ids
-    std::vector<std::string> textureNames = VulkanMeshModel::loadMaterials(scene);
+    modelImport.textureNames = VulkanMeshModel::loadMaterials(scene);
+    return scene;
+}
+
+void VulkanRenderer::processMeshes(std::vector<MeshData> &meshes, std::vector<uint32_t> *sourceMeshes)
+{
+    if (meshOptimizationEnabled)
+    {
+        optimizeMeshes(meshes);
+    }
+    splitLargeMeshes(meshes, sourceMeshes);
+    // Once triangles have their final order, meshlets being ranges of it
+    if (meshletBuildingEnabled)
+    {
+        buildMeshlets(meshes);
+    }
+    // Last, as the other steps only know about a single level
+    if (meshLodCount > 1)
+    {
+        generateMeshLods(meshes);
+    }
+}
 
-    // Conversion to material list ID to descriptor array ids (we don't keep empty files)
-    std::vector<int> matToTex(textureNames.size());
+void VulkanRenderer::reserveGeometry(const std::vector<MeshView> &meshViews, const std::vector<uint32_t> &duplicateOf,
+                                     size_t firstMesh, size_t meshCount, VertexFormat vertexFormat)
+{
+    size_t vertexTotal = 0;
+    size_t indexTotals[2] = {0, 0}; // 16 bits, 32 bits
+    for (size_t i = firstMesh; i < firstMesh + meshCount; ++i)
+    {
+        if (isDuplicateMesh(duplicateOf, i))
+        {
+            continue;
+        }
+        vertexTotal += meshViews[i].vertexCount;
+        bool is16Bit = VulkanMesh::chooseIndexType(meshViews[i].vertexCount) == vk::IndexType::eUint16;
+        indexTotals[is16Bit ? 0 : 1] += meshViews[i].indexCount;
+    }
+    geometryBuffer.reserveVertices(vertexFormat, static_cast<uint32_t>(vertexTotal));
+    geometryBuffer.reserveIndices(vk::IndexType::eUint16, static_cast<uint32_t>(indexTotals[0]));
+    geometryBuffer.reserveIndices(vk::IndexType::eUint32, static_cast<uint32_t>(indexTotals[1]));
+}
+
+VulkanMesh VulkanRenderer::createMesh(UploadBatch &uploadBatch, const std::vector<VulkanMesh> &meshes,
+                                      const MeshView &meshView, uint32_t duplicateOf, size_t meshIndex, int texId)
+{
+    if (duplicateOf != meshIndex)
+    {
+        // The view has the duplicate's own bounds: a copy found at another position is moved there
+        glm::vec3 translation =
+            (meshView.boundsMin + meshView.boundsMax) * 0.5f - meshes[duplicateOf].getBoundsCenter();
+        return meshes[duplicateOf].shareGeometry(texId, meshView.nodeIndex, translation);
+    }
+    return VulkanMesh(geometryBuffer, uploadBatch, meshView, texId, meshVertexFormat);
+}
 
-    // Loop over texture names and create textures for them
+VulkanMeshModel VulkanRenderer::assembleMeshModel(const std::vector<VulkanMesh> &meshes,
+                                                  const std::vector<std::string> &textureNames,
+                                                  const std::vector<int> &matToTex,
+                                                  const SceneGraph &sceneGraph)
+{
+    auto meshModel = VulkanMeshModel(meshes);
+    meshModel.setSceneGraph(sceneGraph);
+    std::vector<int> acquiredTextureIds;
     for (size_t i = 0; i < textureNames.size(); ++i)
     {
-        if (textureNames[i].empty())
+        if (!textureNames[i].empty())
         {
-            // Texture 0 will be reserved for a default texture
-            matToTex[i] = 0;
+            acquiredTextureIds.push_back(matToTex[i]);
         }
-        else
+    }
+    meshModel.setTextureIds(acquiredTextureIds);
+    return meshModel;
+}
+
+int VulkanRenderer::createMeshModel(const std::string &filename)
+{
+    if (importMemoryCeiling > 0)
+    {
+        return createMeshModelBounded(filename);
+    }
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    ModelImport modelImport = importMeshModel(filename);
+    const std::vector<MeshView> &meshViews = modelImport.meshViews;
+
+    // Conversion to material list ID to descriptor array ids (we don't keep empty files).
+    // Textures already loaded by other models or materials are shared through the cache.
+    std::vector<int> matToTex = createTextures(modelImport.textureNames);
+
+    const std::vector<uint32_t> &duplicateOf = modelImport.duplicateOf;
+
+    // Room for the whole model in the shared geometry buffers
+    reserveGeometry(meshViews, duplicateOf, 0, meshViews.size(), meshVertexFormat);
+
+    // Upload all our meshes as one batch: a single submission instead of one wait per buffer
+    UploadBatch uploadBatch(memoryAllocator, graphicsQueue, graphicsCommandPool);
+    std::vector<VulkanMesh> modelMeshes;
+    modelMeshes.reserve(meshViews.size());
+    for (size_t i = 0; i < meshViews.size(); ++i)
+    {
+        modelMeshes.push_back(createMesh(uploadBatch, modelMeshes, meshViews[i], duplicateOf[i], i,
+                                         matToTex[meshViews[i].materialIndex]));
+    }
+    uploadBatch.submit();
+
+    // Vertex memory actually used, against what full float vertices would take
+    vk::DeviceSize vertexBytes = 0;
+    vk::DeviceSize fullVertexBytes = 0;
+    vk::DeviceSize indexBytes = 0;
+    vk::DeviceSize fullIndexBytes = 0;
+    for (size_t i = 0; i < modelMeshes.size(); ++i)
+    {
+        if (isDuplicateMesh(duplicateOf, i))
         {
-            // Return the texture's id
-            matToTex[i] = createTexture(textureNames[i]);
+            continue;
         }
+        vertexBytes += modelMeshes[i].getVertexBufferSize();
+        fullVertexBytes += meshViews[i].vertexCount * sizeof(Vertex);
+        indexBytes += modelMeshes[i].getIndexBufferSize();
+        fullIndexBytes += meshViews[i].indexCount * sizeof(uint32_t);
     }
+    printf("Vertex buffers: %.2f MB (%.2f MB as full vertices)\n", vertexBytes / (1024.0 * 1024.0),
+           fullVertexBytes / (1024.0 * 1024.0));
+    printf("Index buffers: %.2f MB (%.2f MB as 32 bits indices)\n", indexBytes / (1024.0 * 1024.0),
+           fullIndexBytes / (1024.0 * 1024.0));
+    printMeshDeduplication(modelMeshes, duplicateOf);
+    printf("Geometry buffer: %.2f MB used of %.2f MB\n", geometryBuffer.getAllocatedBytes() / (1024.0 * 1024.0),
+           geometryBuffer.getCapacityBytes() / (1024.0 * 1024.0));
+
+    meshModels.push_back(assembleMeshModel(modelMeshes, modelImport.textureNames, matToTex, modelImport.sceneGraph));
+    meshModelLoadStates.push_back(ModelLoadState::Ready);
+    meshModelStaticFlags.push_back(0);
+    meshModelBatchedFlags.push_back(0);
+    meshModelImpostorIds.push_back(-1);
+    meshModelFilenames.push_back(filename);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("Loaded %s (%s) in %.2f ms, peak RSS %.1f MB\n", filename.c_str(),
+           modelImport.isWarm ? "warm, mesh cache" : "cold import",
+           std::chrono::duration<double, std::milli>(endTime - startTime).count(),
+           getPeakResidentBytes() / (1024.0 * 1024.0));
+
+    return meshModels.size() - 1;
+}
+
+int VulkanRenderer::createMeshModelBounded(const std::string &filename)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
 
-    // Load in all our meshes
-    std::vector<VulkanMesh> modelMeshes =
-        VulkanMeshModel::loadNode(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue,
-                                  graphicsCommandPool, scene->mRootNode, scene, matToTex);
+    // Source meshes only, converted and processed group by group below. An Assimp scene is kept as it is: its
+    // meshes are converted to our arrays one group at a time, never all together.
+    ModelImport modelImport;
+    Assimp::Importer importer;
+    std::vector<aiMesh *> sceneMeshes;
+    std::vector<uint32_t> sceneMeshNodes;
+    bool isSceneImport = false;
+    if (!openMeshCache(filename, modelImport))
+    {
+        if (nativeObjImportEnabled && ObjLoader::isObjFile(filename))
+        {
+            importSourceMeshes(filename, modelImport);
+        }
+        else
+        {
+            const aiScene *scene = readSourceScene(importer, filename, modelImport);
+            VulkanMeshModel::collectNodeMeshes(scene->mRootNode, scene, SceneGraph::NO_PARENT,
+                                               modelImport.sceneGraph, sceneMeshes, sceneMeshNodes);
+            isSceneImport = true;
+        }
+    }
+    std::vector<int> matToTex = createTextures(modelImport.textureNames);
+
+    // Half of the ceiling for staging, the other half for the group of meshes being processed
+    vk::DeviceSize stagingCeiling = std::max<vk::DeviceSize>(importMemoryCeiling / 2, 1);
+    size_t groupCeiling = std::max<size_t>(importMemoryCeiling / 4, 1);
+    UploadBatch uploadBatch(memoryAllocator, graphicsQueue, graphicsCommandPool);
+    std::vector<VulkanMesh> modelMeshes;
+    size_t submitCount = 0;
+    size_t releasedCacheMeshes = 0;
+    auto submitStaging = [&]() {
+        if (uploadBatch.getStagedBytes() == 0)
+        {
+            return;
+        }
+        uploadBatch.submit();
+        submitCount++;
+        // Mapped cache pages already uploaded can go too
+        for (; modelImport.isWarm && releasedCacheMeshes < modelMeshes.size(); ++releasedCacheMeshes)
+        {
+            modelImport.meshCache->releaseMeshPages(releasedCacheMeshes);
+        }
+    };
+    // Per model mesh, the first one with the same geometry
+    std::vector<uint32_t> duplicateOf;
+    // meshDuplicateOf in model mesh indices, the views following the meshes already created. Views of duplicates
+    // only need their material, node and bounds.
+    auto uploadMeshes = [&](const std::vector<MeshView> &meshViews, const std::vector<uint32_t> &meshDuplicateOf) {
+        uint32_t firstMesh = static_cast<uint32_t>(modelMeshes.size());
+        std::vector<MeshView> uploadedViews;
+        for (size_t i = 0; i < meshViews.size(); ++i)
+        {
+            if (meshDuplicateOf[i] == firstMesh + i)
+            {
+                uploadedViews.push_back(meshViews[i]);
+            }
+        }
+        // Growing a geometry arena replaces its buffer: reserve with nothing staged
+        submitStaging();
+        reserveGeometry(uploadedViews, {}, 0, uploadedViews.size(), meshVertexFormat);
+        for (size_t i = 0; i < meshViews.size(); ++i)
+        {
+            duplicateOf.push_back(meshDuplicateOf[i]);
+            modelMeshes.push_back(createMesh(uploadBatch, modelMeshes, meshViews[i], duplicateOf.back(),
+                                             modelMeshes.size(), matToTex[meshViews[i].materialIndex]));
+            if (uploadBatch.getStagedBytes() >= stagingCeiling)
+            {
+                submitStaging();
+            }
+        }
+    };
 
-    auto meshModel = VulkanMeshModel(modelMeshes);
+    size_t groupCount = 0;
+    if (modelImport.isWarm)
+    {
+        uploadMeshes(modelImport.meshViews, modelImport.duplicateOf);
+        groupCount = 1;
+    }
+    else
+    {
+        MeshCacheWriter cacheWriter;
+        bool isCacheWritten = cacheWriter.open(filename, MESH_IMPORT_FLAGS, getMeshBakeFlags(filename),
+                                               modelImport.textureNames, modelImport.sceneGraph,
+                                               modelImport.dependencies);
+        std::vector<MeshData> &sourceMeshes = modelImport.meshes;
+        size_t sourceCount = isSceneImport ? sceneMeshes.size() : sourceMeshes.size();
+
+        // Duplicates are found among the source meshes, all still there, rather than among processed groups: the
+        // earlier groups' arrays are gone by then, and processing may not give the same result for a copy at
+        // another position. The meshes processed from the first source serve its duplicates, records and geometry,
+        // moved by the difference of the source bounds.
+        std::vector<uint32_t> sourceDuplicateOf;
+        std::vector<uint32_t> sourceMaterials(sourceCount);
+        std::vector<uint32_t> sourceNodes(sourceCount);
+        std::vector<glm::vec3> sourceBoundsMins(sourceCount);
+        if (isSceneImport)
+        {
+            sourceDuplicateOf = findDuplicateSceneMeshes(sceneMeshes, sourceBoundsMins);
+            for (size_t i = 0; i < sourceCount; ++i)
+            {
+                sourceMaterials[i] = sceneMeshes[i]->mMaterialIndex;
+                sourceNodes[i] = sceneMeshNodes[i];
+            }
+        }
+        else
+        {
+            std::vector<MeshView> sourceViews;
+            for (size_t i = 0; i < sourceCount; ++i)
+            {
+                sourceViews.push_back(sourceMeshes[i].getView());
+                sourceMaterials[i] = sourceMeshes[i].materialIndex;
+                sourceNodes[i] = sourceMeshes[i].nodeIndex;
+                sourceBoundsMins[i] = sourceMeshes[i].boundsMin;
+            }
+            sourceDuplicateOf = MeshOptimizer::findDuplicateMeshes(sourceViews);
+        }
+        auto getSourceBytes = [&](size_t i) -> size_t {
+            if (sourceDuplicateOf[i] != i)
+            {
+                return 0;
+            }
+            size_t vertexCount = isSceneImport ? sceneMeshes[i]->mNumVertices : sourceMeshes[i].vertices.size();
+            size_t indexCount = isSceneImport ? sceneMeshes[i]->mNumFaces * 3 : sourceMeshes[i].indices.size();
+            return vertexCount * sizeof(Vertex) + indexCount * sizeof(uint32_t);
+        };
+
+        // Model meshes made from each source mesh: its first one and how many (large meshes are split), and the
+        // bounds of every model mesh, those of duplicates being moved from them
+        std::vector<uint32_t> sourceFirstMeshes(sourceCount, 0);
+        std::vector<uint32_t> sourceMeshCounts(sourceCount, 0);
+        std::vector<std::pair<glm::vec3, glm::vec3>> meshBounds;
+        for (size_t first = 0; first < sourceCount; groupCount++)
+        {
+            // Source meshes up to the group ceiling, at least one, converted (Assimp) or moved out (OBJ), so that
+            // each is freed with its group. Duplicates are neither converted nor processed.
+            size_t groupEnd = first;
+            size_t groupBytes = 0;
+            std::vector<uint32_t> groupSources;
+            for (; groupEnd < sourceCount && (groupSources.empty() || groupBytes < groupCeiling); ++groupEnd)
+            {
+                groupBytes += getSourceBytes(groupEnd);
+                if (sourceDuplicateOf[groupEnd] == groupEnd)
+                {
+                    groupSources.push_back(static_cast<uint32_t>(groupEnd));
+                }
+                else if (!isSceneImport)
+                {
+                    sourceMeshes[groupEnd] = MeshData{};
+                }
+            }
+            std::vector<MeshData> group(groupSources.size());
+            if (isSceneImport)
+            {
+                workerPool.parallelFor(group.size(), [&](size_t i) {
+                    group[i] = VulkanMeshModel::loadMesh(sceneMeshes[groupSources[i]], importer.GetScene());
+                    group[i].nodeIndex = sceneMeshNodes[groupSources[i]];
+                });
+            }
+            else
+            {
+                for (size_t i = 0; i < group.size(); ++i)
+                {
+                    group[i] = std::move(sourceMeshes[groupSources[i]]);
+                }
+            }
+            std::vector<uint32_t> processedSources;
+            processMeshes(group, &processedSources);
+
+            // Meshes in source order, each duplicate right where its source was
+            std::vector<MeshView> groupViews;
+            std::vector<uint32_t> groupDuplicateOf;
+            size_t processed = 0;
+            for (size_t source = first; source < groupEnd; ++source)
+            {
+                uint32_t sourceFirst = sourceDuplicateOf[source];
+                uint32_t meshIndex = static_cast<uint32_t>(modelMeshes.size() + groupViews.size());
+                if (sourceFirst != source)
+                {
+                    glm::vec3 offset = sourceBoundsMins[source] - sourceBoundsMins[sourceFirst];
+                    for (uint32_t k = 0; k < sourceMeshCounts[sourceFirst]; ++k)
+                    {
+                        MeshView duplicateView{};
+                        duplicateView.materialIndex = sourceMaterials[source];
+                        duplicateView.nodeIndex = sourceNodes[source];
+                        duplicateView.boundsMin = meshBounds[sourceFirstMeshes[sourceFirst] + k].first + offset;
+                        duplicateView.boundsMax = meshBounds[sourceFirstMeshes[sourceFirst] + k].second + offset;
+                        meshBounds.emplace_back(duplicateView.boundsMin, duplicateView.boundsMax);
+                        groupViews.push_back(duplicateView);
+                        groupDuplicateOf.push_back(sourceFirstMeshes[sourceFirst] + k);
+                        isCacheWritten = isCacheWritten &&
+                                         cacheWriter.addDuplicateMesh(duplicateView, groupDuplicateOf.back());
+                    }
+                    continue;
+                }
+                sourceFirstMeshes[source] = meshIndex;
+                for (; processed < group.size() && groupSources[processedSources[processed]] == source; ++processed)
+                {
+                    groupViews.push_back(group[processed].getView());
+                    groupDuplicateOf.push_back(meshIndex + sourceMeshCounts[source]++);
+                    meshBounds.emplace_back(groupViews.back().boundsMin, groupViews.back().boundsMax);
+                    isCacheWritten = isCacheWritten && cacheWriter.addMesh(groupViews.back());
+                }
+            }
+            uploadMeshes(groupViews, groupDuplicateOf);
+            first = groupEnd;
+        }
+        sourceMeshes.clear();
+        sourceMeshes.shrink_to_fit();
+        if (!isCacheWritten || !cacheWriter.finish())
+        {
+            printf("WARNING: Could not write mesh cache for %s\n", filename.c_str());
+        }
+    }
+    submitStaging();
+    printMeshDeduplication(modelMeshes, duplicateOf);
+
+    meshModels.push_back(assembleMeshModel(modelMeshes, modelImport.textureNames, matToTex, modelImport.sceneGraph));
+    meshModelLoadStates.push_back(ModelLoadState::Ready);
+    meshModelStaticFlags.push_back(0);
+    meshModelBatchedFlags.push_back(0);
+    meshModelImpostorIds.push_back(-1);
+    meshModelFilenames.push_back(filename);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("Loaded %s (%s) in %.2f ms under a %.1f MB import ceiling: %zu meshes in %zu groups, %zu submissions, "
+           "peak RSS %.1f MB\n",
+           filename.c_str(), modelImport.isWarm ? "warm, mesh cache" : "cold import",
+           std::chrono::duration<double, std::milli>(endTime - startTime).count(),
+           importMemoryCeiling / (1024.0 * 1024.0), modelMeshes.size(), groupCount, submitCount,
+           getPeakResidentBytes() / (1024.0 * 1024.0));
 
-    meshModels.push_back(meshModel);
     return meshModels.size() - 1;
 }
 
+int VulkanRenderer::createMeshModelAsync(const std::string &filename)
+{
+    // The slot is taken right away with an empty model, replaced once everything is uploaded
+    meshModels.push_back(VulkanMeshModel());
+    meshModelLoadStates.push_back(ModelLoadState::Loading);
+    meshModelStaticFlags.push_back(0);
+    meshModelBatchedFlags.push_back(0);
+    meshModelImpostorIds.push_back(-1);
+    meshModelFilenames.push_back(filename);
+
+    modelLoads.emplace_back();
+    ModelLoad &load = modelLoads.back();
+    load.modelId = meshModels.size() - 1;
+    load.filename = filename;
+    load.startTime = std::chrono::high_resolution_clock::now();
+    load.import = workerPool.submit([this, filename]() { return importMeshModel(filename); });
+    load.uploadBatch = std::make_unique<UploadBatch>(memoryAllocator, graphicsQueue, graphicsCommandPool);
+    return load.modelId;
+}
+
+ModelLoadState VulkanRenderer::getMeshModelLoadState(int modelId) const
+{
+    if (modelId < 0 || modelId >= meshModelLoadStates.size())
+    {
+        throw std::runtime_error("Attempted to get the load state of a model with not attributed index");
+    }
+    return meshModelLoadStates[modelId];
+}
+
+void VulkanRenderer::processModelLoads()
+{
+    while (!modelLoads.empty())
+    {
+        ModelLoad &load = modelLoads.front();
+        auto stepStartTime = std::chrono::high_resolution_clock::now();
+        bool isFinished = false;
+        try
+        {
+            if (!load.isImported)
+            {
+                if (load.import.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                {
+                    return;
+                }
+                load.modelImport = load.import.get();
+                load.isImported = true;
+
+                // Decode the textures missing from the cache on the workers, like createTextures. Cached ones are
+                // only acquired when their turn comes, so that an unlucky release meanwhile is noticed.
+                const std::vector<std::string> &textureNames = load.modelImport.textureNames;
+                load.decodedTextures.resize(textureNames.size());
+                load.matToTex.assign(textureNames.size(), -1);
+                std::unordered_map<std::string, size_t> firstOccurrences;
+                for (size_t i = 0; i < textureNames.size(); ++i)
+                {
+                    if (textureNames[i].empty() || texturePathCache.count(textureNames[i]) ||
+                        !firstOccurrences.emplace(textureNames[i], i).second)
+                    {
+                        continue;
+                    }
+                    load.decodedTextures[i] = workerPool.submit([this, filename = textureNames[i]]() {
+                        return decodeTexture(filename, textureCompressionSupported, workerPool);
+                    });
+                }
+            }
+
+            // One slice in flight at a time, the next one is staged once the GPU is done with the previous
+            if (!load.uploadBatch->isComplete())
+            {
+                return;
+            }
+            // Arena grows copied on the GPU since the last slice come first, over as many frames as needed
+            vk::DeviceSize growCharge =
+                std::min(geometryBuffer.getGrowCopiedBytes() - chargedGrowBytes, uploadBudget);
+            chargedGrowBytes += growCharge;
+            isFinished = stageModelLoad(load, uploadBudget - growCharge);
+            if (!isFinished)
+            {
+                load.uploadBatch->submitAsync();
+            }
+        }
+        catch (const std::runtime_error &e)
+        {
+            printf("ERROR: %s\n", e.what());
+            cancelModelLoad(load);
+            if (load.isReload)
+            {
+                printf("Hot reload of %s failed, keeping the previous version\n", load.filename.c_str());
+            }
+            else
+            {
+                meshModelLoadStates[load.modelId] = ModelLoadState::Failed;
+            }
+            modelLoads.pop_front();
+            continue;
+        }
+
+        auto stepEndTime = std::chrono::high_resolution_clock::now();
+        load.stepCount++;
+        load.maxStepMilliseconds = std::max(
+            load.maxStepMilliseconds, std::chrono::duration<double, std::milli>(stepEndTime - stepStartTime).count());
+        if (!isFinished)
+        {
+            return;
+        }
+
+        // Everything is on the device: the model takes its slot, keeping the matrix set while it was loading
+        VulkanMeshModel meshModel = assembleMeshModel(load.meshes, load.modelImport.textureNames, load.matToTex,
+                                                      load.modelImport.sceneGraph);
+        if (load.isReload)
+        {
+            finishModelReload(load, meshModel);
+            modelLoads.pop_front();
+            return;
+        }
+        meshModel.setModel(meshModels[load.modelId].getModel());
+        meshModels[load.modelId] = meshModel;
+        meshModelLoadStates[load.modelId] = ModelLoadState::Ready;
+
+        printMeshDeduplication(load.meshes, load.modelImport.duplicateOf);
+        printf("Streamed %s (%s) in %.2f ms over %zu frames: %.1f MB uploaded, longest frame step %.2f ms, "
+               "peak RSS %.1f MB\n",
+               load.filename.c_str(), load.modelImport.isWarm ? "warm, mesh cache" : "cold import",
+               std::chrono::duration<double, std::milli>(stepEndTime - load.startTime).count(), load.stepCount,
+               load.uploadedBytes / (1024.0 * 1024.0), load.maxStepMilliseconds,
+               getPeakResidentBytes() / (1024.0 * 1024.0));
+        modelLoads.pop_front();
+        // The budget of this frame went to the finished load, the next one starts on the next frame
+        return;
+    }
+}
+
+bool VulkanRenderer::stageModelLoad(ModelLoad &load, vk::DeviceSize budget)
+{
+    vk::DeviceSize stagedBytes = 0;
+
+    // Textures first, the meshes need their ids
+    const std::vector<std::string> &textureNames = load.modelImport.textureNames;
+    for (; load.nextTexture < textureNames.size(); ++load.nextTexture)
+    {
+        size_t i = load.nextTexture;
+        if (textureNames[i].empty())
+        {
+            // Texture 0 will be reserved for a default texture
+            load.matToTex[i] = 0;
+            continue;
+        }
+        // Known path, including a file of this model uploaded by an earlier slice
+        if (acquireCachedTexture(textureNames[i], &load.matToTex[i]))
+        {
+            continue;
+        }
+        if (stagedBytes >= budget)
+        {
+            return false;
+        }
+        if (!load.decodedTextures[i].valid())
+        {
+            // Was cached when the decodes started, and released since
+            load.decodedTextures[i] = workerPool.submit([this, filename = textureNames[i]]() {
+                return decodeTexture(filename, textureCompressionSupported, workerPool);
+            });
+        }
+        // Never wait for a decode here, the next frame will check again
+        if (load.decodedTextures[i].wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            return false;
+        }
+        vk::DeviceSize batchBytes = load.uploadBatch->getStagedBytes();
+        load.matToTex[i] = addDecodedTexture(textureNames[i], load.decodedTextures[i].get(), *load.uploadBatch);
+        stagedBytes += load.uploadBatch->getStagedBytes() - batchBytes;
+    }
+
+    // Then as many meshes as the budget allows, at least one per frame
+    const std::vector<MeshView> &meshViews = load.modelImport.meshViews;
+    const std::vector<uint32_t> &duplicateOf = load.modelImport.duplicateOf;
+    size_t sliceEnd = load.nextMesh;
+    vk::DeviceSize sliceBytes = stagedBytes;
+    while (sliceEnd < meshViews.size() && sliceBytes < budget)
+    {
+        // Duplicates upload nothing
+        if (isDuplicateMesh(duplicateOf, sliceEnd))
+        {
+            sliceEnd++;
+            continue;
+        }
+        const MeshView &meshView = meshViews[sliceEnd++];
+        vk::DeviceSize vertexSize = meshVertexFormat == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+        vk::DeviceSize indexSize =
+            VulkanMesh::chooseIndexType(meshView.vertexCount) == vk::IndexType::eUint16 ? 2 : 4;
+        sliceBytes += meshView.vertexCount * vertexSize + meshView.indexCount * indexSize;
+    }
+    if (sliceEnd > load.nextMesh)
+    {
+        // Reserved before staging, the buffers are never replaced while this slice is recorded
+        reserveGeometry(meshViews, duplicateOf, load.nextMesh, sliceEnd - load.nextMesh, meshVertexFormat);
+        vk::DeviceSize batchBytes = load.uploadBatch->getStagedBytes();
+        for (; load.nextMesh < sliceEnd; ++load.nextMesh)
+        {
+            const MeshView &meshView = meshViews[load.nextMesh];
+            load.meshes.push_back(createMesh(*load.uploadBatch, load.meshes, meshView, duplicateOf[load.nextMesh],
+                                             load.nextMesh, load.matToTex[meshView.materialIndex]));
+        }
+        stagedBytes += load.uploadBatch->getStagedBytes() - batchBytes;
+    }
+
+    load.uploadedBytes += stagedBytes;
+    // Finished once the last slice was staged and submitted by an earlier frame
+    return stagedBytes == 0 && load.nextMesh == meshViews.size();
+}
+
+void VulkanRenderer::cancelModelLoad(ModelLoad &load)
+{
+    // Waits for the slice in flight and frees its staging memory
+    load.uploadBatch.reset();
+    for (auto &mesh : load.meshes)
+    {
+        mesh.releaseGeometry();
+    }
+    load.meshes.clear();
+    const std::vector<std::string> &textureNames = load.modelImport.textureNames;
+    for (size_t i = 0; i < load.matToTex.size(); ++i)
+    {
+        if (!textureNames[i].empty() && load.matToTex[i] >= 0)
+        {
+            releaseTexture(load.matToTex[i]);
+        }
+    }
+    load.matToTex.clear();
+}
+
+void VulkanRenderer::finishModelReload(ModelLoad &load, const VulkanMeshModel &meshModel)
+{
+    // Every model still loaded from the file, instances included, gets the new version. The replaced ones were
+    // drawn up to the previous frame.
+    RetiredResources retired{};
+    retired.lastFrame = frameNumber - 1;
+    bool isFirst = true;
+    int impostorModelId = -1;
+    for (size_t modelId = 0; modelId < meshModels.size(); ++modelId)
+    {
+        if (meshModelFilenames[modelId] != load.filename || meshModelLoadStates[modelId] != ModelLoadState::Ready)
+        {
+            continue;
+        }
+        VulkanMeshModel reloadedModel = meshModel;
+        if (!isFirst)
+        {
+            // Further copies share the geometry, only the textures need an extra reference
+            for (int textureId : reloadedModel.getTextureIds())
+            {
+                textureRefCounts[textureId]++;
+            }
+        }
+        isFirst = false;
+        reloadedModel.setModel(meshModels[modelId].getModel());
+        retired.meshModels.push_back(meshModels[modelId]);
+        meshModels[modelId] = reloadedModel;
+        if (meshModelStaticFlags[modelId])
+        {
+            staticBatchChanges.push_back(static_cast<int>(modelId));
+        }
+        // The old atlas goes with the retired model, a new one is baked below
+        if (meshModelImpostorIds[modelId] >= 0)
+        {
+            meshModelImpostorIds[modelId] = -1;
+            impostorModelId = static_cast<int>(modelId);
+        }
+    }
+    if (isFirst)
+    {
+        // Destroyed while reloading
+        cancelModelLoad(load);
+        return;
+    }
+    retiredResources.push_back(std::move(retired));
+    if (impostorModelId >= 0)
+    {
+        createMeshModelImpostor(impostorModelId);
+    }
+
+    auto endTime = std::chrono::steady_clock::now();
+    printf("Hot reloaded %s in %.2f ms after the change, over %zu frames: %.1f MB uploaded, longest frame step "
+           "%.2f ms\n",
+           load.filename.c_str(), std::chrono::duration<double, std::milli>(endTime - load.changeTime).count(),
+           load.stepCount, load.uploadedBytes / (1024.0 * 1024.0), load.maxStepMilliseconds);
+}
+
+bool VulkanRenderer::enableHotReload(const std::vector<std::string> &directories)
+{
+    bool isWatching = true;
+    for (const auto &directory : directories)
+    {
+        if (!fileWatcher.addDirectory(directory))
+        {
+            printf("WARNING: Could not watch %s for hot reload\n", directory.c_str());
+            isWatching = false;
+        }
+    }
+    return isWatching;
+}
+
+void VulkanRenderer::processFileChanges()
+{
+    for (const auto &change : fileWatcher.poll())
+    {
+        std::filesystem::path changedPath = std::filesystem::path(change.path).lexically_normal();
+
+        // Models, one reload for the model and all its instances
+        for (size_t modelId = 0; modelId < meshModels.size(); ++modelId)
+        {
+            if (meshModelFilenames[modelId].empty() || meshModelLoadStates[modelId] != ModelLoadState::Ready ||
+                std::filesystem::path(meshModelFilenames[modelId]).lexically_normal() != changedPath)
+            {
+                continue;
+            }
+            printf("Hot reload: %s changed\n", meshModelFilenames[modelId].c_str());
+            modelLoads.emplace_back();
+            ModelLoad &load = modelLoads.back();
+            load.modelId = static_cast<int>(modelId);
+            load.filename = meshModelFilenames[modelId];
+            load.isReload = true;
+            load.changeTime = change.time;
+            load.startTime = std::chrono::high_resolution_clock::now();
+            // The mesh cache sees the source changed and imports it again
+            load.import = workerPool.submit([this, filename = load.filename]() { return importMeshModel(filename); });
+            load.uploadBatch = std::make_unique<UploadBatch>(memoryAllocator, graphicsQueue, graphicsCommandPool);
+            break;
+        }
+
+        // Textures, named relative to textures/ like in decodeTexture
+        std::filesystem::path textureName = changedPath.lexically_relative("textures");
+        auto cachedPath = texturePathCache.find(textureName.string());
+        if (textureName.empty() || cachedPath == texturePathCache.end())
+        {
+            continue;
+        }
+        printf("Hot reload: textures/%s changed\n", cachedPath->first.c_str());
+        TextureReload reload{};
+        reload.textureId = cachedPath->second;
+        reload.filename = cachedPath->first;
+        reload.changeTime = change.time;
+        // The texture container is older than its source now, decoding starts again from the file
+        reload.decodedTexture = workerPool.submit([this, filename = reload.filename]() {
+            return decodeTexture(filename, textureCompressionSupported, workerPool);
+        });
+        textureReloads.push_back(std::move(reload));
+    }
+}
+
+void VulkanRenderer::processTextureReloads()
+{
+    for (size_t i = 0; i < textureReloads.size();)
+    {
+        TextureReload &reload = textureReloads[i];
+        auto stepStartTime = std::chrono::high_resolution_clock::now();
+        bool isSwapped = false;
+        try
+        {
+            if (!reload.uploadBatch)
+            {
+                if (reload.decodedTexture.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                {
+                    ++i;
+                    continue;
+                }
+                // The new version goes in an image of its own, the old one may be sampled by frames in flight
+                TextureData textureData = reload.decodedTexture.get();
+                reload.image = createImage(textureData.width, textureData.height, textureData.mipLevels,
+                                           vk::SampleCountFlagBits::e1, textureData.format, vk::ImageTiling::eOptimal,
+                                           vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+                                           vk::MemoryPropertyFlagBits::eDeviceLocal, &reload.imageMemory);
+                reload.imageView = createImageView(reload.image, textureData.format, vk::ImageAspectFlagBits::eColor,
+                                                   textureData.mipLevels);
+                reload.imageSize = textureData.imageSize;
+                reload.contentHash = textureData.contentHash;
+                reload.uploadBatch = std::make_unique<UploadBatch>(memoryAllocator, graphicsQueue, graphicsCommandPool);
+                reload.uploadBatch->uploadImage(textureData.pixels, textureData.imageSize, reload.image,
+                                                textureData.width, textureData.height, textureData.levelOffsets);
+                reload.uploadBatch->submitAsync();
+            }
+            else
+            {
+                if (!reload.uploadBatch->isComplete())
+                {
+                    ++i;
+                    continue;
+                }
+                // Released meanwhile, the new image was never used and simply goes away
+                int textureId = reload.textureId;
+                if (textureRefCounts[textureId] > 0)
+                {
+                    // Same id, so meshes keep pointing at it: only the slot contents change. Textures sharing the
+                    // id through the content cache see the new version too.
+                    vk::DescriptorSet descriptorSet = allocateTextureDescriptorSet(reload.imageView);
+                    RetiredResources retired{};
+                    retired.lastFrame = frameNumber - 1;
+                    retired.image = textureImages[textureId];
+                    retired.imageMemory = textureImageMemory[textureId];
+                    retired.imageView = textureImageViews[textureId];
+                    retired.descriptorSet = samplerDescriptorSets[textureId];
+                    retiredResources.push_back(std::move(retired));
+
+                    samplerDescriptorSets[textureId] = descriptorSet;
+                    textureImages[textureId] = reload.image;
+                    textureImageMemory[textureId] = reload.imageMemory;
+                    textureImageViews[textureId] = reload.imageView;
+                    textureDeviceSizes[textureId] = reload.imageSize;
+                    for (auto it = textureContentCache.begin(); it != textureContentCache.end();)
+                    {
+                        it = it->second == textureId ? textureContentCache.erase(it) : std::next(it);
+                    }
+                    textureContentCache[reload.contentHash] = textureId;
+                    reload.image = nullptr;
+                    reload.imageMemory = MemoryAllocation{};
+                    reload.imageView = nullptr;
+                    isSwapped = true;
+                }
+                destroyTextureReload(reload);
+            }
+        }
+        catch (const std::runtime_error &e)
+        {
+            printf("ERROR: %s\n", e.what());
+            printf("Hot reload of textures/%s failed, keeping the previous version\n", reload.filename.c_str());
+            destroyTextureReload(reload);
+            textureReloads.erase(textureReloads.begin() + i);
+            continue;
+        }
+
+        auto stepEndTime = std::chrono::high_resolution_clock::now();
+        reload.stepMilliseconds =
+            std::max(reload.stepMilliseconds,
+                     std::chrono::duration<double, std::milli>(stepEndTime - stepStartTime).count());
+        if (reload.uploadBatch)
+        {
+            // Uploading
+            ++i;
+            continue;
+        }
+        if (isSwapped)
+        {
+            printf("Hot reloaded textures/%s in %.2f ms after the change: %.1f MB uploaded, longest frame step "
+                   "%.2f ms\n",
+                   reload.filename.c_str(),
+                   std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - reload.changeTime)
+                       .count(),
+                   reload.imageSize / (1024.0 * 1024.0), reload.stepMilliseconds);
+        }
+        textureReloads.erase(textureReloads.begin() + i);
+    }
+}
+
+void VulkanRenderer::destroyTextureReload(TextureReload &reload)
+{
+    // Waits for the upload in flight, if any
+    reload.uploadBatch.reset();
+    mainDevice.logicalDevice.destroyImageView(reload.imageView, nullptr);
+    mainDevice.logicalDevice.destroyImage(reload.image, nullptr);
+    memoryAllocator.free(reload.imageMemory);
+    reload.imageView = nullptr;
+    reload.image = nullptr;
+}
+
+void VulkanRenderer::releaseRetiredResources(bool isDeviceIdle)
+{
+    // Retired in frame order, frames up to frameNumber - MAX_FRAME_DRAWS are complete once its fence was waited
+    while (!retiredResources.empty() &&
+           (isDeviceIdle || retiredResources.front().lastFrame + MAX_FRAME_DRAWS <= frameNumber))
+    {
+        RetiredResources &retired = retiredResources.front();
+        for (auto &meshModel : retired.meshModels)
+        {
+            meshModel.destroyMeshModel();
+            for (int textureId : meshModel.getTextureIds())
+            {
+                releaseTexture(textureId);
+            }
+        }
+        for (auto &mesh : retired.meshes)
+        {
+            mesh.releaseGeometry();
+        }
+        if (retired.descriptorSet)
+        {
+            mainDevice.logicalDevice.freeDescriptorSets(samplerDescriptorPool, retired.descriptorSet);
+        }
+        mainDevice.logicalDevice.destroyImageView(retired.imageView, nullptr);
+        mainDevice.logicalDevice.destroyImage(retired.image, nullptr);
+        memoryAllocator.free(retired.imageMemory);
+        for (size_t i = 0; i < retired.buffers.size(); ++i)
+        {
+            mainDevice.logicalDevice.destroyBuffer(retired.buffers[i], nullptr);
+            memoryAllocator.free(retired.bufferMemories[i]);
+        }
+        retiredResources.pop_front();
+    }
+}
+
+void VulkanRenderer::retireBuffer(vk::Buffer &buffer, MemoryAllocation &memory)
+{
+    if (!buffer)
+    {
+        return;
+    }
+    RetiredResources retired{};
+    retired.lastFrame = frameNumber - 1;
+    retired.buffers.push_back(buffer);
+    retired.bufferMemories.push_back(memory);
+    retiredResources.push_back(std::move(retired));
+    buffer = nullptr;
+    memory = MemoryAllocation();
+}
+
+void VulkanRenderer::optimizeMeshes(std::vector<MeshData> &meshes)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    std::vector<VertexCacheStats> statsBefore(meshes.size());
+    std::vector<VertexCacheStats> statsAfter(meshes.size());
+    workerPool.parallelFor(meshes.size(), [&](size_t i) {
+        MeshData &mesh = meshes[i];
+        statsBefore[i] =
+            MeshOptimizer::analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+        MeshOptimizer::optimizeMesh(mesh);
+        statsAfter[i] =
+            MeshOptimizer::analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+    });
+
+    // Totals over the whole model
+    VertexCacheStats totalBefore;
+    VertexCacheStats totalAfter;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        totalBefore += statsBefore[i];
+        totalAfter += statsAfter[i];
+    }
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("Optimized %zu meshes in %.2f ms: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (cache size %u)\n", meshes.size(),
+           std::chrono::duration<double, std::milli>(endTime - startTime).count(), totalBefore.getACMR(),
+           totalAfter.getACMR(), totalBefore.getATVR(), totalAfter.getATVR(), MeshOptimizer::CACHE_SIZE);
+}
+
+void VulkanRenderer::splitLargeMeshes(std::vector<MeshData> &meshes, std::vector<uint32_t> *sourceMeshes)
+{
+    // Only the rare meshes over 64K vertices are touched, the others move as they are
+    std::vector<MeshData> splitMeshes;
+    splitMeshes.reserve(meshes.size());
+    if (sourceMeshes)
+    {
+        sourceMeshes->clear();
+    }
+    size_t splitCount = 0;
+    size_t vertexTotal = 0;
+    size_t indexTotal = 0;
+    for (uint32_t i = 0; i < meshes.size(); ++i)
+    {
+        MeshData &mesh = meshes[i];
+        vertexTotal += mesh.vertices.size();
+        indexTotal += mesh.indices.size() / 3 * 3;
+        if (mesh.vertices.size() <= VulkanMesh::MAX_16BIT_VERTEX_COUNT)
+        {
+            splitMeshes.push_back(std::move(mesh));
+            if (sourceMeshes)
+            {
+                sourceMeshes->push_back(i);
+            }
+            continue;
+        }
+        std::vector<MeshData> chunks = MeshOptimizer::splitMesh(mesh, VulkanMesh::MAX_16BIT_VERTEX_COUNT);
+        printf("Split a mesh of %zu vertices into %zu chunks for 16 bits indices\n", mesh.vertices.size(),
+               chunks.size());
+        for (auto &chunk : chunks)
+        {
+            splitMeshes.push_back(std::move(chunk));
+            if (sourceMeshes)
+            {
+                sourceMeshes->push_back(i);
+            }
+        }
+        splitCount++;
+    }
+    // Every mesh was moved out, split or not
+    meshes.swap(splitMeshes);
+
+    // Splitting only cuts runs of triangles, every triangle is kept. Vertex counts change in split meshes (shared
+    // vertices repeated in several chunks, unreferenced ones dropped), so a model without large meshes must come out
+    // with exactly the vertices it went in with.
+    size_t splitVertexTotal = 0;
+    size_t splitIndexTotal = 0;
+    for (const auto &mesh : meshes)
+    {
+        splitVertexTotal += mesh.vertices.size();
+        splitIndexTotal += mesh.indices.size() / 3 * 3;
+    }
+    if (splitIndexTotal != indexTotal || (splitCount == 0 && splitVertexTotal != vertexTotal))
+    {
+        throw std::runtime_error("Splitting meshes for 16 bits indices changed the geometry: " +
+                                 std::to_string(vertexTotal) + " vertices and " + std::to_string(indexTotal) +
+                                 " indices became " + std::to_string(splitVertexTotal) + " and " +
+                                 std::to_string(splitIndexTotal));
+    }
+}
+
+void VulkanRenderer::generateMeshLods(std::vector<MeshData> &meshes)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    workerPool.parallelFor(meshes.size(), [&](size_t i) { MeshSimplifier::generateLods(meshes[i], meshLodCount); });
+
+    // Triangles of each level over the whole model, meshes with a shorter chain count their last level again
+    std::vector<size_t> levelTriangles(meshLodCount, 0);
+    for (const auto &mesh : meshes)
+    {
+        for (size_t level = 0; level < meshLodCount; ++level)
+        {
+            levelTriangles[level] += mesh.lods[std::min(level, mesh.lods.size() - 1)].indexCount / 3;
+        }
+    }
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("Generated %u LODs for %zu meshes in %.2f ms, triangles:", meshLodCount, meshes.size(),
+           std::chrono::duration<double, std::milli>(endTime - startTime).count());
+    for (size_t triangles : levelTriangles)
+    {
+        printf(" %zu", triangles);
+    }
+    printf("\n");
+}
+
+void VulkanRenderer::buildMeshlets(std::vector<MeshData> &meshes)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    workerPool.parallelFor(meshes.size(), [&](size_t i) {
+        MeshData &mesh = meshes[i];
+        mesh.meshlets = MeshletBuilder::buildMeshlets(mesh.vertices, mesh.indices.data(), mesh.indices.size());
+    });
+
+    size_t meshletCount = 0;
+    size_t triangleCount = 0;
+    size_t cullableCount = 0;
+    for (const auto &mesh : meshes)
+    {
+        meshletCount += mesh.meshlets.size();
+        triangleCount += mesh.indices.size() / 3;
+        for (const auto &meshlet : mesh.meshlets)
+        {
+            cullableCount += meshlet.coneCutoff < 1.0f ? 1 : 0;
+        }
+    }
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("Built %zu meshlets in %.2f ms: %.1f triangles each, %zu with a back face cone\n", meshletCount,
+           std::chrono::duration<double, std::milli>(endTime - startTime).count(),
+           meshletCount ? static_cast<double>(triangleCount) / meshletCount : 0.0, cullableCount);
+}
+
+int VulkanRenderer::createMeshModelInstance(int modelId)
+{
+    if (modelId < 0 || modelId >= meshModels.size())
+    {
+        throw std::runtime_error("Attempted to instance a model with not attributed index");
+    }
+    if (meshModelLoadStates[modelId] == ModelLoadState::Loading)
+    {
+        throw std::runtime_error("Attempted to instance a model still loading");
+    }
+
+    // The copy shares the geometry ranges, only the textures need an extra reference
+    VulkanMeshModel instance = meshModels[modelId];
+    for (int textureId : instance.getTextureIds())
+    {
+        textureRefCounts[textureId]++;
+    }
+    meshModels.push_back(instance);
+    meshModelLoadStates.push_back(meshModelLoadStates[modelId]);
+    // Instances are placed on their own, they start dynamic
+    meshModelStaticFlags.push_back(0);
+    meshModelBatchedFlags.push_back(0);
+    // The atlas is among the texture ids, shared like the other textures
+    meshModelImpostorIds.push_back(meshModelImpostorIds[modelId]);
+    meshModelFilenames.push_back(meshModelFilenames[modelId]);
+    return meshModels.size() - 1;
+}
+
+void VulkanRenderer::destroyMeshModel(int modelId)
+{
+    if (modelId < 0 || modelId >= meshModels.size())
+        return;
+
+    // The model may still be in use by frames in flight
+    mainDevice.logicalDevice.waitIdle();
+
+    // Still loading: the load is dropped along with what it already uploaded
+    for (auto load = modelLoads.begin(); load != modelLoads.end(); ++load)
+    {
+        if (load->modelId == modelId && !load->isReload)
+        {
+            cancelModelLoad(*load);
+            modelLoads.erase(load);
+            meshModelLoadStates[modelId] = ModelLoadState::Failed;
+            break;
+        }
+    }
+
+    meshModels[modelId].destroyMeshModel();
+    for (int textureId : meshModels[modelId].getTextureIds())
+    {
+        releaseTexture(textureId);
+    }
+    // Keep the slot so other model ids stay valid, an empty model draws nothing
+    meshModels[modelId] = VulkanMeshModel();
+    meshModelImpostorIds[modelId] = -1;
+    meshModelFilenames[modelId].clear();
+    // Its batches are rebuilt without it before the next frame is recorded
+    if (meshModelStaticFlags[modelId])
+    {
+        meshModelStaticFlags[modelId] = 0;
+        staticBatchChanges.push_back(modelId);
+    }
+}
+
+void VulkanRenderer::setMeshModelStatic(int modelId, bool isStatic)
+{
+    if (modelId < 0 || modelId >= meshModels.size())
+    {
+        throw std::runtime_error("Attempted to make static a model with not attributed index");
+    }
+    if (meshModelStaticFlags[modelId] != isStatic)
+    {
+        meshModelStaticFlags[modelId] = isStatic ? 1 : 0;
+        staticBatchChanges.push_back(modelId);
+    }
+}
+
+// Append view's full level of detail to batch, its vertices moved to world space by transform
+static void appendStaticGeometry(MeshData &batch, const MeshView &meshView, const glm::mat4 &transform)
+{
+    // Views of a compressed mesh cache are decoded first
+    MeshData decodedMesh;
+    MeshView view = meshView.decode(decodedMesh);
+    uint32_t firstVertex = static_cast<uint32_t>(batch.vertices.size());
+    for (size_t i = 0; i < view.vertexCount; ++i)
+    {
+        Vertex vertex = view.vertices[i];
+        vertex.pos = glm::vec3(transform * glm::vec4(vertex.pos, 1.0f));
+        batch.boundsMin = batch.vertices.empty() ? vertex.pos : glm::min(batch.boundsMin, vertex.pos);
+        batch.boundsMax = batch.vertices.empty() ? vertex.pos : glm::max(batch.boundsMax, vertex.pos);
+        batch.vertices.push_back(vertex);
+    }
+    // The coarser levels only use vertices of the full one
+    size_t indexOffset = view.lodCount > 0 ? view.lods[0].indexOffset : 0;
+    size_t indexCount = view.lodCount > 0 ? view.lods[0].indexCount : view.indexCount;
+    for (size_t i = indexOffset; i < indexOffset + indexCount; ++i)
+    {
+        batch.indices.push_back(firstVertex + view.indices[i]);
+    }
+}
+
+static bool containsModel(const std::vector<int> &modelIds, int modelId)
+{
+    return std::find(modelIds.begin(), modelIds.end(), modelId) != modelIds.end();
+}
+
+std::map<int, MeshData> VulkanRenderer::bakeStaticModel(const std::string &filename, const std::vector<int> &texIds,
+                                                        const std::vector<glm::mat4> &transforms)
+{
+    ModelImport modelImport = importMeshModel(filename);
+    if (modelImport.meshViews.size() != texIds.size())
+    {
+        // Mesh settings changed since the model was loaded
+        throw std::runtime_error("the mesh cache of " + filename + " no longer matches its model");
+    }
+    std::map<int, MeshData> textureGeometries;
+    for (size_t k = 0; k < modelImport.meshViews.size(); ++k)
+    {
+        appendStaticGeometry(textureGeometries[texIds[k]], modelImport.meshViews[k], transforms[k]);
+    }
+    return textureGeometries;
+}
+
+void VulkanRenderer::updateStaticBatches()
+{
+    bool isRebuilding = false;
+    for (const auto &batch : staticBatches)
+    {
+        isRebuilding = isRebuilding || batch.isDirty || batch.upload;
+    }
+    if (staticBatchChanges.empty() && staticModelBakes.empty() && !isRebuilding)
+    {
+        return;
+    }
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Changed models leave their batches. Those still loading stay pending, they have no meshes yet.
+    std::vector<int> changedModels;
+    std::vector<int> pendingModels;
+    for (int modelId : staticBatchChanges)
+    {
+        bool isLoading = meshModelLoadStates[modelId] == ModelLoadState::Loading;
+        std::vector<int> &changes = isLoading && meshModelStaticFlags[modelId] ? pendingModels : changedModels;
+        if (!containsModel(changes, modelId))
+        {
+            changes.push_back(modelId);
+        }
+    }
+    staticBatchChanges = pendingModels;
+    RetiredResources retired{};
+    retired.lastFrame = frameNumber - 1;
+    for (int modelId : changedModels)
+    {
+        // The worker finishes a bake of the previous version for nothing
+        staticModelBakes.erase(modelId);
+    }
+    for (auto &batch : staticBatches)
+    {
+        bool isLiveModelChanged = false;
+        for (auto part = batch.parts.begin(); part != batch.parts.end();)
+        {
+            int modelId = part->modelId;
+            if (!containsModel(changedModels, modelId))
+            {
+                ++part;
+                continue;
+            }
+            batch.vertexCount -= part->geometry.vertices.size();
+            part = batch.parts.erase(part);
+            batch.isDirty = true;
+            isLiveModelChanged = isLiveModelChanged || containsModel(batch.liveModels, modelId);
+            batch.isPendingStale = batch.isPendingStale || containsModel(batch.pendingModels, modelId);
+        }
+        // The uploaded mesh shows the model as it was: frames in flight may still draw it, the next ones draw the
+        // models left mesh by mesh until the batch is rebuilt
+        if (isLiveModelChanged)
+        {
+            retired.meshes.push_back(batch.mesh);
+            batch.mesh = VulkanMesh();
+            batch.liveModels.clear();
+        }
+    }
+
+    // Static ones are read again from their mesh caches and moved to world space on the workers, with the world
+    // transforms of this frame
+    for (int modelId : changedModels)
+    {
+        if (!meshModelStaticFlags[modelId] || meshModelLoadStates[modelId] != ModelLoadState::Ready)
+        {
+            continue;
+        }
+        VulkanMeshModel &model = meshModels[modelId];
+        const SceneGraph &sceneGraph = model.getSceneGraph();
+        std::vector<int> texIds;
+        std::vector<glm::mat4> transforms;
+        for (size_t k = 0; k < model.getMeshCount(); ++k)
+        {
+            VulkanMesh *mesh = model.getMesh(k);
+            glm::mat4 transform = sceneGraph.getNodeCount() > 0
+                                      ? model.getModel() * sceneGraph.getWorldTransform(mesh->getNodeIndex())
+                                      : model.getModel();
+            // Duplicates view the arrays of their first mesh, moved by their translation
+            transforms.push_back(glm::translate(transform, mesh->getTranslation()));
+            texIds.push_back(mesh->getTexId());
+        }
+        const std::string &filename = meshModelFilenames[modelId];
+        staticModelBakes[modelId] = workerPool.submit(
+            [this, filename, texIds, transforms]() { return bakeStaticModel(filename, texIds, transforms); });
+    }
+
+    // Baked ones join the last batch of each of their textures, or start a new one when it is full
+    for (auto bake = staticModelBakes.begin(); bake != staticModelBakes.end();)
+    {
+        if (bake->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            ++bake;
+            continue;
+        }
+        int modelId = bake->first;
+        std::map<int, MeshData> textureGeometries;
+        try
+        {
+            textureGeometries = bake->second.get();
+        }
+        catch (const std::runtime_error &e)
+        {
+            printf("WARNING: Could not batch static model %d, %s\n", modelId, e.what());
+            // Drawn mesh by mesh again
+            meshModelStaticFlags[modelId] = 0;
+        }
+        bake = staticModelBakes.erase(bake);
+        for (auto &textureGeometry : textureGeometries)
+        {
+            size_t vertexCount = textureGeometry.second.vertices.size();
+            StaticBatch *lastBatch = nullptr;
+            for (auto &batch : staticBatches)
+            {
+                lastBatch = batch.texId == textureGeometry.first ? &batch : lastBatch;
+            }
+            if (!lastBatch ||
+                (!lastBatch->parts.empty() && lastBatch->vertexCount + vertexCount > MAX_STATIC_BATCH_VERTICES))
+            {
+                staticBatches.emplace_back();
+                lastBatch = &staticBatches.back();
+                lastBatch->texId = textureGeometry.first;
+            }
+            lastBatch->parts.push_back(StaticBatchPart{modelId, std::move(textureGeometry.second)});
+            lastBatch->vertexCount += vertexCount;
+            lastBatch->isDirty = true;
+        }
+    }
+
+    // Uploaded rebuilds replace the drawn meshes, unless a model of theirs left the batch meanwhile
+    size_t swappedBatchCount = 0;
+    for (auto &batch : staticBatches)
+    {
+        if (!batch.upload || !batch.upload->isComplete())
+        {
+            continue;
+        }
+        batch.upload.reset();
+        if (batch.isPendingStale)
+        {
+            // Never drawn, and no longer read by the copies
+            batch.pendingMesh.releaseGeometry();
+        }
+        else
+        {
+            retired.meshes.push_back(batch.mesh);
+            batch.mesh = batch.pendingMesh;
+            batch.liveModels = std::move(batch.pendingModels);
+            swappedBatchCount++;
+        }
+        batch.pendingMesh = VulkanMesh();
+        batch.pendingModels.clear();
+        batch.isPendingStale = false;
+    }
+    // Frames in flight may still draw the replaced batches
+    if (!retired.meshes.empty())
+    {
+        retiredResources.push_back(std::move(retired));
+    }
+
+    // Changed batches with no upload in flight are rebuilt from the world space geometry of their parts
+    std::vector<MeshData> batchGeometries;
+    std::vector<StaticBatch *> rebuiltBatches;
+    for (auto &batch : staticBatches)
+    {
+        if (!batch.isDirty || batch.upload || batch.parts.empty())
+        {
+            continue;
+        }
+        MeshData batchGeometry;
+        batchGeometry.vertices.reserve(batch.vertexCount);
+        for (const auto &part : batch.parts)
+        {
+            const MeshData &partGeometry = part.geometry;
+            uint32_t firstVertex = static_cast<uint32_t>(batchGeometry.vertices.size());
+            if (!partGeometry.vertices.empty())
+            {
+                bool isFirst = batchGeometry.vertices.empty();
+                batchGeometry.boundsMin = isFirst ? partGeometry.boundsMin
+                                                  : glm::min(batchGeometry.boundsMin, partGeometry.boundsMin);
+                batchGeometry.boundsMax = isFirst ? partGeometry.boundsMax
+                                                  : glm::max(batchGeometry.boundsMax, partGeometry.boundsMax);
+            }
+            batchGeometry.vertices.insert(batchGeometry.vertices.end(), partGeometry.vertices.begin(),
+                                          partGeometry.vertices.end());
+            for (uint32_t index : partGeometry.indices)
+            {
+                batchGeometry.indices.push_back(firstVertex + index);
+            }
+            batch.pendingModels.push_back(part.modelId);
+        }
+        batch.isDirty = false;
+        batchGeometries.push_back(std::move(batchGeometry));
+        rebuiltBatches.push_back(&batch);
+    }
+    if (!rebuiltBatches.empty())
+    {
+        std::vector<MeshView> batchViews;
+        for (const auto &batchGeometry : batchGeometries)
+        {
+            batchViews.push_back(batchGeometry.getView());
+        }
+        // Batches have full vertices, in an arena of their own
+        reserveGeometry(batchViews, {}, 0, batchViews.size(), VertexFormat::Full);
+        // One submission for the batches rebuilt together, not waited for
+        auto uploadBatch = std::make_shared<UploadBatch>(memoryAllocator, graphicsQueue, graphicsCommandPool);
+        for (size_t i = 0; i < rebuiltBatches.size(); ++i)
+        {
+            rebuiltBatches[i]->pendingMesh =
+                VulkanMesh(geometryBuffer, *uploadBatch, batchViews[i], rebuiltBatches[i]->texId, VertexFormat::Full);
+            rebuiltBatches[i]->upload = uploadBatch;
+        }
+        uploadBatch->submitAsync();
+    }
+    staticBatches.erase(std::remove_if(staticBatches.begin(), staticBatches.end(),
+                                       [](const StaticBatch &batch) { return batch.parts.empty() && !batch.upload; }),
+                        staticBatches.end());
+
+    // Static models are drawn mesh by mesh until every batch with a part of them draws it
+    std::fill(meshModelBatchedFlags.begin(), meshModelBatchedFlags.end(), 0);
+    for (const auto &batch : staticBatches)
+    {
+        for (const auto &part : batch.parts)
+        {
+            meshModelBatchedFlags[part.modelId] = 1;
+        }
+    }
+    for (const auto &batch : staticBatches)
+    {
+        for (const auto &part : batch.parts)
+        {
+            if (!containsModel(batch.liveModels, part.modelId))
+            {
+                meshModelBatchedFlags[part.modelId] = 0;
+            }
+        }
+    }
+
+    if (rebuiltBatches.empty() && swappedBatchCount == 0)
+    {
+        return;
+    }
+    size_t batchedMeshCount = 0;
+    for (size_t modelId = 0; modelId < meshModels.size(); ++modelId)
+    {
+        batchedMeshCount += meshModelBatchedFlags[modelId] ? meshModels[modelId].getMeshCount() : 0;
+    }
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("Rebuilding %zu of %zu static batches, %zu swapped in, %.2f ms, %zu static meshes drawn in batches\n",
+           rebuiltBatches.size(), staticBatches.size(), swappedBatchCount,
+           std::chrono::duration<double, std::milli>(endTime - startTime).count(), batchedMeshCount);
+}
+
+void VulkanRenderer::createMeshModelImpostor(int modelId)
+{
+    if (modelId < 0 || modelId >= meshModels.size())
+    {
+        throw std::runtime_error("Attempted to create the impostor of a model with not attributed index");
+    }
+    if (meshModelLoadStates[modelId] != ModelLoadState::Ready)
+    {
+        throw std::runtime_error("Attempted to create the impostor of a model not loaded");
+    }
+    if (meshModelImpostorIds[modelId] >= 0)
+    {
+        return;
+    }
+
+    // Copies of the same file share the atlas, each holding a reference to it like to its other textures
+    int impostorId = bakeImpostor(meshModels[modelId]);
+    int textureId = impostors[impostorId].textureId;
+    bool isFirst = true;
+    for (size_t otherId = 0; otherId < meshModels.size(); ++otherId)
+    {
+        if (meshModelFilenames[otherId] != meshModelFilenames[modelId] ||
+            meshModelLoadStates[otherId] != ModelLoadState::Ready || meshModelImpostorIds[otherId] >= 0)
+        {
+            continue;
+        }
+        if (!isFirst)
+        {
+            textureRefCounts[textureId]++;
+        }
+        isFirst = false;
+        std::vector<int> textureIds = meshModels[otherId].getTextureIds();
+        textureIds.push_back(textureId);
+        meshModels[otherId].setTextureIds(textureIds);
+        meshModelImpostorIds[otherId] = impostorId;
+    }
+}
+
+void VulkanRenderer::createImpostorResources()
+{
+    // -- BAKE RENDER PASS --
+    // Same attachments as renderPass, only the resolved atlas is kept, to be sampled afterwards
+    std::array<vk::AttachmentDescription, 3> attachments{};
+    attachments[0].format = swapchainImageFormat;
+    attachments[0].samples = msaaSamples;
+    attachments[0].loadOp = vk::AttachmentLoadOp::eClear;
+    attachments[0].storeOp = vk::AttachmentStoreOp::eDontCare;
+    attachments[0].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    attachments[0].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    attachments[0].initialLayout = vk::ImageLayout::eUndefined;
+    attachments[0].finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+    attachments[1] = attachments[0];
+    attachments[1].format = chooseDepthFormat();
+    attachments[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    attachments[2] = attachments[0];
+    attachments[2].samples = vk::SampleCountFlagBits::e1;
+    attachments[2].loadOp = vk::AttachmentLoadOp::eDontCare;
+    attachments[2].storeOp = vk::AttachmentStoreOp::eStore;
+    attachments[2].finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+    vk::AttachmentReference colorAttachmentReference{0, vk::ImageLayout::eColorAttachmentOptimal};
+    vk::AttachmentReference depthAttachmentReference{1, vk::ImageLayout::eDepthStencilAttachmentOptimal};
+    vk::AttachmentReference colorAttachmentResolveReference{2, vk::ImageLayout::eColorAttachmentOptimal};
+    vk::SubpassDescription subpass{};
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentReference;
+    subpass.pDepthStencilAttachment = &depthAttachmentReference;
+    subpass.pResolveAttachments = &colorAttachmentResolveReference;
+
+    // The atlas is written, then read by fragment shaders of later submissions
+    vk::SubpassDependency dependency{};
+    dependency.srcSubpass = 0;
+    dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    dependency.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+    dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+    dependency.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    vk::RenderPassCreateInfo renderPassCreateInfo{};
+    renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassCreateInfo.pAttachments = attachments.data();
+    renderPassCreateInfo.subpassCount = 1;
+    renderPassCreateInfo.pSubpasses = &subpass;
+    renderPassCreateInfo.dependencyCount = 1;
+    renderPassCreateInfo.pDependencies = &dependency;
+    impostorRenderPass = mainDevice.logicalDevice.createRenderPass(renderPassCreateInfo);
+
+    // -- QUAD PIPELINE --
+    // Drawn in the main render pass with the layout of the mesh pipelines: view projection in set 0, atlas in set 1
+    vk::ShaderModule vertexShaderModule = createShaderModule(readShaderFile("shaders/impostor_vert.spv"));
+    vk::ShaderModule fragmentShaderModule = createShaderModule(readShaderFile("shaders/impostor_frag.spv"));
+    std::array<vk::PipelineShaderStageCreateInfo, 2> shaderStages{};
+    shaderStages[0].stage = vk::ShaderStageFlagBits::eVertex;
+    shaderStages[0].module = vertexShaderModule;
+    shaderStages[0].pName = "main";
+    shaderStages[1].stage = vk::ShaderStageFlagBits::eFragment;
+    shaderStages[1].module = fragmentShaderModule;
+    shaderStages[1].pName = "main";
+
+    // No vertex buffer, the instance buffer gives the quads
+    vk::VertexInputBindingDescription bindingDescription{0, sizeof(ImpostorInstance), vk::VertexInputRate::eInstance};
+    std::array<vk::VertexInputAttributeDescription, 4> attributeDescriptions;
+    attributeDescriptions[0] = {0, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(ImpostorInstance, centerRadius)};
+    attributeDescriptions[1] = {1, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(ImpostorInstance, right)};
+    attributeDescriptions[2] = {2, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(ImpostorInstance, up)};
+    attributeDescriptions[3] = {3, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(ImpostorInstance, cellRect)};
+    vk::PipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
+    vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
+    vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+    vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+    vk::PipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo{};
+    inputAssemblyCreateInfo.topology = vk::PrimitiveTopology::eTriangleList;
+
+    // Set when recording
+    vk::PipelineViewportStateCreateInfo viewportStateCreateInfo{};
+    viewportStateCreateInfo.viewportCount = 1;
+    viewportStateCreateInfo.scissorCount = 1;
+    std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
+    dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+    dynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
+
+    // Quads face the camera, whatever their winding
+    vk::PipelineRasterizationStateCreateInfo rasterizerCreateInfo{};
+    rasterizerCreateInfo.polygonMode = vk::PolygonMode::eFill;
+    rasterizerCreateInfo.lineWidth = 1.0f;
+    rasterizerCreateInfo.cullMode = vk::CullModeFlagBits::eNone;
+
+    vk::PipelineMultisampleStateCreateInfo multisamplingCreateInfo{};
+    multisamplingCreateInfo.rasterizationSamples = msaaSamples;
+
+    // Cut out in the fragment shader instead of blended, so that quads needn't be sorted
+    vk::PipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                                          vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    vk::PipelineColorBlendStateCreateInfo colorBlendingCreateInfo{};
+    colorBlendingCreateInfo.attachmentCount = 1;
+    colorBlendingCreateInfo.pAttachments = &colorBlendAttachment;
+
+    vk::PipelineDepthStencilStateCreateInfo depthStencilCreateInfo{};
+    depthStencilCreateInfo.depthTestEnable = true;
+    depthStencilCreateInfo.depthWriteEnable = true;
+    depthStencilCreateInfo.depthCompareOp = vk::CompareOp::eLess;
+
+    vk::GraphicsPipelineCreateInfo pipelineCreateInfo{};
+    pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+    pipelineCreateInfo.pStages = shaderStages.data();
+    pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+    pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
+    pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
+    pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+    pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
+    pipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
+    pipelineCreateInfo.pColorBlendState = &colorBlendingCreateInfo;
+    pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+    pipelineCreateInfo.layout = pipelineLayout;
+    pipelineCreateInfo.renderPass = renderPass;
+    pipelineCreateInfo.subpass = 0;
+    auto result = mainDevice.logicalDevice.createGraphicsPipeline(VK_NULL_HANDLE, pipelineCreateInfo);
+    mainDevice.logicalDevice.destroyShaderModule(fragmentShaderModule);
+    mainDevice.logicalDevice.destroyShaderModule(vertexShaderModule);
+    if (result.result != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Cound not create the impostor graphics pipeline");
+    }
+    impostorPipeline = result.value;
+
+    // -- BAKE VIEW PROJECTION --
+    createBuffer(memoryAllocator, sizeof(ViewProjection), vk::BufferUsageFlagBits::eUniformBuffer,
+                 vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                 &impostorBakeUniformBuffer, &impostorBakeUniformBufferMemory);
+    ViewProjection identityViewProjection{glm::mat4(1.0f), glm::mat4(1.0f)};
+    memcpy(impostorBakeUniformBufferMemory.mapped, &identityViewProjection, sizeof(ViewProjection));
+
+    vk::DescriptorSetAllocateInfo setAllocInfo{};
+    setAllocInfo.descriptorPool = descriptorPool;
+    setAllocInfo.descriptorSetCount = 1;
+    setAllocInfo.pSetLayouts = &descriptorSetLayout;
+    if (mainDevice.logicalDevice.allocateDescriptorSets(&setAllocInfo, &impostorBakeDescriptorSet) !=
+        vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Failed to allocate the impostor bake descriptor set.");
+    }
+    vk::DescriptorBufferInfo vpBufferInfo{impostorBakeUniformBuffer, 0, sizeof(ViewProjection)};
+    vk::WriteDescriptorSet vpSetWrite{};
+    vpSetWrite.dstSet = impostorBakeDescriptorSet;
+    vpSetWrite.dstBinding = 0;
+    vpSetWrite.descriptorType = vk::DescriptorType::eUniformBuffer;
+    vpSetWrite.descriptorCount = 1;
+    vpSetWrite.pBufferInfo = &vpBufferInfo;
+    mainDevice.logicalDevice.updateDescriptorSets(1, &vpSetWrite, 0, nullptr);
+
+    // Instance buffers are created by the first frames drawing impostors
+    impostorInstanceBuffers.resize(swapchainImages.size());
+    impostorInstanceBufferMemories.resize(swapchainImages.size());
+    impostorInstanceCapacities.resize(swapchainImages.size(), 0);
+}
+
+int VulkanRenderer::bakeImpostor(VulkanMeshModel &meshModel)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    if (!impostorPipeline)
+    {
+        createImpostorResources();
+    }
+
+    // Bounding sphere of the model around the center of the box of its mesh spheres, meshes placed by their nodes
+    SceneGraph &sceneGraph = meshModel.getSceneGraph();
+    auto getNodeTransform = [&](VulkanMesh *mesh) {
+        return sceneGraph.getNodeCount() > 0 ? sceneGraph.getWorldTransform(mesh->getNodeIndex()) : glm::mat4(1.0f);
+    };
+    std::vector<glm::vec4> meshSpheres;
+    glm::vec3 boundsMin(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+    for (size_t k = 0; k < meshModel.getMeshCount(); ++k)
+    {
+        VulkanMesh *mesh = meshModel.getMesh(k);
+        glm::mat4 transform = getNodeTransform(mesh);
+        float scale = std::max({glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])),
+                                glm::length(glm::vec3(transform[2]))});
+        glm::vec4 sphere(glm::vec3(transform * glm::vec4(mesh->getBoundsCenter(), 1.0f)),
+                         mesh->getBoundsRadius() * scale);
+        boundsMin = glm::min(boundsMin, glm::vec3(sphere) - sphere.w);
+        boundsMax = glm::max(boundsMax, glm::vec3(sphere) + sphere.w);
+        meshSpheres.push_back(sphere);
+    }
+    Impostor impostor{};
+    impostor.center = meshSpheres.empty() ? glm::vec3(0.0f) : (boundsMin + boundsMax) * 0.5f;
+    for (const auto &sphere : meshSpheres)
+    {
+        impostor.radius = std::max(impostor.radius, glm::length(glm::vec3(sphere) - impostor.center) + sphere.w);
+    }
+
+    // The atlas, and multisampled color and depth attachments the size of the whole atlas for the bake
+    MemoryAllocation atlasMemory;
+    vk::Image atlasImage = createImage(ImpostorAtlas::WIDTH, ImpostorAtlas::HEIGHT, 1, vk::SampleCountFlagBits::e1,
+                                       swapchainImageFormat, vk::ImageTiling::eOptimal,
+                                       vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+                                       vk::MemoryPropertyFlagBits::eDeviceLocal, &atlasMemory);
+    vk::ImageView atlasView = createImageView(atlasImage, swapchainImageFormat, vk::ImageAspectFlagBits::eColor, 1);
+    MemoryAllocation bakeColorMemory;
+    vk::Image bakeColorImage =
+        createImage(ImpostorAtlas::WIDTH, ImpostorAtlas::HEIGHT, 1, msaaSamples, swapchainImageFormat,
+                    vk::ImageTiling::eOptimal,
+                    vk::ImageUsageFlagBits::eTransientAttachment | vk::ImageUsageFlagBits::eColorAttachment,
+                    vk::MemoryPropertyFlagBits::eDeviceLocal, &bakeColorMemory);
+    vk::ImageView bakeColorView =
+        createImageView(bakeColorImage, swapchainImageFormat, vk::ImageAspectFlagBits::eColor, 1);
+    vk::Format depthFormat = chooseDepthFormat();
+    MemoryAllocation bakeDepthMemory;
+    vk::Image bakeDepthImage = createImage(ImpostorAtlas::WIDTH, ImpostorAtlas::HEIGHT, 1, msaaSamples, depthFormat,
+                                           vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eDepthStencilAttachment,
+                                           vk::MemoryPropertyFlagBits::eDeviceLocal, &bakeDepthMemory);
+    vk::ImageView bakeDepthView = createImageView(bakeDepthImage, depthFormat, vk::ImageAspectFlagBits::eDepth, 1);
+
+    std::array<vk::ImageView, 3> attachments{bakeColorView, bakeDepthView, atlasView};
+    vk::FramebufferCreateInfo framebufferCreateInfo{};
+    framebufferCreateInfo.renderPass = impostorRenderPass;
+    framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    framebufferCreateInfo.pAttachments = attachments.data();
+    framebufferCreateInfo.width = ImpostorAtlas::WIDTH;
+    framebufferCreateInfo.height = ImpostorAtlas::HEIGHT;
+    framebufferCreateInfo.layers = 1;
+    vk::Framebuffer framebuffer = mainDevice.logicalDevice.createFramebuffer(framebufferCreateInfo);
+
+    // Transparent around the model, the impostor shader cuts it out
+    std::array<vk::ClearValue, 2> clearValues{};
+    clearValues[0].color = vk::ClearColorValue{std::array<float, 4>{0.0f, 0.0f, 0.0f, 0.0f}};
+    clearValues[1].depthStencil.depth = 1.0f;
+    vk::RenderPassBeginInfo renderPassBeginInfo{};
+    renderPassBeginInfo.renderPass = impostorRenderPass;
+    renderPassBeginInfo.framebuffer = framebuffer;
+    renderPassBeginInfo.renderArea.extent = vk::Extent2D{ImpostorAtlas::WIDTH, ImpostorAtlas::HEIGHT};
+    renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassBeginInfo.pClearValues = clearValues.data();
+
+    // Every view with the mesh pipelines, a viewport per cell. The view projection set is the identity, the cell's
+    // view projection goes with the model matrix of each mesh. Full detail, without culling.
+    vk::CommandBuffer commandBuffer = beginCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool);
+    commandBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+    MeshBindings meshBindings;
+    for (uint32_t row = 0; row < ImpostorAtlas::ELEVATION_COUNT; ++row)
+    {
+        for (uint32_t column = 0; column < ImpostorAtlas::AZIMUTH_COUNT; ++column)
+        {
+            vk::Rect2D cell{vk::Offset2D{static_cast<int32_t>(column * ImpostorAtlas::CELL_SIZE),
+                                         static_cast<int32_t>(row * ImpostorAtlas::CELL_SIZE)},
+                            vk::Extent2D{ImpostorAtlas::CELL_SIZE, ImpostorAtlas::CELL_SIZE}};
+            vk::Viewport viewport{static_cast<float>(cell.offset.x), static_cast<float>(cell.offset.y),
+                                  static_cast<float>(ImpostorAtlas::CELL_SIZE),
+                                  static_cast<float>(ImpostorAtlas::CELL_SIZE), 0.0f, 1.0f};
+            commandBuffer.setViewport(0, viewport);
+            commandBuffer.setScissor(0, cell);
+
+            glm::mat4 cellViewProjection =
+                ImpostorAtlas::getViewProjection(column, row, impostor.center, impostor.radius);
+            for (size_t k = 0; k < meshModel.getMeshCount(); ++k)
+            {
+                VulkanMesh *mesh = meshModel.getMesh(k);
+                glm::mat4 cellMatrix =
+                    glm::translate(cellViewProjection * getNodeTransform(mesh), mesh->getTranslation());
+                commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(Model),
+                                            &cellMatrix);
+                bindMesh(commandBuffer, mesh, impostorBakeDescriptorSet, meshBindings);
+                const MeshLod &lod = mesh->getLod(0);
+                commandBuffer.drawIndexed(lod.indexCount, 1, mesh->getFirstIndex() + lod.indexOffset,
+                                          mesh->getVertexOffset(), 0);
+            }
+        }
+    }
+    commandBuffer.endRenderPass();
+    commandBuffer.end();
+
+    // Not waited for: frames and hot reloads go on while the GPU bakes, the attachments go once it is done
+    ImpostorBake bake{commandBuffer};
+    bake.fence = mainDevice.logicalDevice.createFence(vk::FenceCreateInfo{});
+    vk::SubmitInfo submitInfo{};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &bake.commandBuffer;
+    graphicsQueue.submit(1, &submitInfo, bake.fence);
+    bake.framebuffer = framebuffer;
+    bake.colorImage = bakeColorImage;
+    bake.colorMemory = bakeColorMemory;
+    bake.colorView = bakeColorView;
+    bake.depthImage = bakeDepthImage;
+    bake.depthMemory = bakeDepthMemory;
+    bake.depthView = bakeDepthView;
+    impostorBakes.push_back(bake);
+
+    // Registered like a loaded texture, outside of the caches: only the models of the impostor refer to it
+    textureImages.push_back(atlasImage);
+    textureImageMemory.push_back(atlasMemory);
+    textureImageViews.push_back(atlasView);
+    impostor.textureId = createTextureDescriptor(atlasView);
+    textureRefCounts.push_back(1);
+    textureDeviceSizes.push_back(static_cast<vk::DeviceSize>(ImpostorAtlas::WIDTH) * ImpostorAtlas::HEIGHT * 4);
+    impostors.push_back(impostor);
+    impostorInstances.resize(impostors.size());
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("Queued the bake of a %ux%u impostor atlas of %zu meshes from %u views in %.2f ms\n",
+           ImpostorAtlas::WIDTH, ImpostorAtlas::HEIGHT, meshModel.getMeshCount(),
+           ImpostorAtlas::AZIMUTH_COUNT * ImpostorAtlas::ELEVATION_COUNT,
+           std::chrono::duration<double, std::milli>(endTime - startTime).count());
+    return static_cast<int>(impostors.size()) - 1;
+}
+
+void VulkanRenderer::releaseImpostorBakes(bool wait)
+{
+    // Submitted in order, so completed in order too
+    size_t releasedCount = 0;
+    for (; releasedCount < impostorBakes.size(); ++releasedCount)
+    {
+        ImpostorBake &bake = impostorBakes[releasedCount];
+        if (wait)
+        {
+            mainDevice.logicalDevice.waitForFences(bake.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        }
+        else if (mainDevice.logicalDevice.getFenceStatus(bake.fence) != vk::Result::eSuccess)
+        {
+            break;
+        }
+        mainDevice.logicalDevice.destroyFence(bake.fence);
+        mainDevice.logicalDevice.freeCommandBuffers(graphicsCommandPool, bake.commandBuffer);
+        mainDevice.logicalDevice.destroyFramebuffer(bake.framebuffer);
+        mainDevice.logicalDevice.destroyImageView(bake.depthView);
+        mainDevice.logicalDevice.destroyImage(bake.depthImage);
+        memoryAllocator.free(bake.depthMemory);
+        mainDevice.logicalDevice.destroyImageView(bake.colorView);
+        mainDevice.logicalDevice.destroyImage(bake.colorImage);
+        memoryAllocator.free(bake.colorMemory);
+    }
+    impostorBakes.erase(impostorBakes.begin(), impostorBakes.begin() + releasedCount);
+}
+
+int VulkanRenderer::createSkinnedModel(const std::string &filename)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    if (!skinningPipeline)
+    {
+        createSkinningResources();
+    }
+
+    // Bone weights are limited to the four a VertexSkin holds, the mesh cache is skipped: it has no skins
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(filename, MESH_IMPORT_FLAGS | aiProcess_LimitBoneWeights);
+    if (!scene)
+    {
+        throw std::runtime_error("Failed to load skinned model: " + filename);
+    }
+    std::vector<std::string> textureNames = VulkanMeshModel::loadMaterials(scene);
+    SceneGraph sceneGraph;
+    std::vector<aiMesh *> sceneMeshes;
+    std::vector<uint32_t> meshNodes;
+    VulkanMeshModel::collectNodeMeshes(scene->mRootNode, scene, SceneGraph::NO_PARENT, sceneGraph, sceneMeshes,
+                                       meshNodes);
+    std::vector<MeshData> meshes(sceneMeshes.size());
+    std::vector<std::vector<VertexSkin>> meshSkins(sceneMeshes.size());
+    auto asset = std::make_shared<SkinnedModelAsset>();
+    asset->meshes.resize(sceneMeshes.size());
+    workerPool.parallelFor(sceneMeshes.size(), [&](size_t i) {
+        meshes[i] = VulkanMeshModel::loadMesh(sceneMeshes[i], scene);
+        VulkanMeshModel::loadMeshSkin(sceneMeshes[i], meshNodes[i], sceneGraph, meshSkins[i], asset->meshes[i].skin);
+    });
+    asset->skeleton = Skeleton(sceneGraph);
+    asset->clips = VulkanMeshModel::loadAnimations(scene, sceneGraph);
+
+    // Every mesh in the same buffers, joints offset by the start of their mesh's palette so that a single dispatch
+    // skins a whole copy
+    std::vector<Vertex> vertices;
+    std::vector<VertexSkin> skins;
+    std::vector<uint32_t> indices;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        SkinnedMesh &mesh = asset->meshes[i];
+        mesh.firstVertex = static_cast<uint32_t>(vertices.size());
+        mesh.vertexCount = static_cast<uint32_t>(meshes[i].vertices.size());
+        mesh.firstIndex = static_cast<uint32_t>(indices.size());
+        mesh.indexCount = static_cast<uint32_t>(meshes[i].indices.size());
+        mesh.paletteOffset = asset->jointCount;
+        asset->jointCount += static_cast<uint32_t>(mesh.skin.jointNodes.size());
+        if (asset->jointCount > UINT16_MAX + 1)
+        {
+            throw std::runtime_error("Too many joints in skinned model: " + filename);
+        }
+        vertices.insert(vertices.end(), meshes[i].vertices.begin(), meshes[i].vertices.end());
+        indices.insert(indices.end(), meshes[i].indices.begin(), meshes[i].indices.end());
+        for (VertexSkin skin : meshSkins[i])
+        {
+            for (uint16_t &joint : skin.joints)
+            {
+                joint = static_cast<uint16_t>(joint + mesh.paletteOffset);
+            }
+            skins.push_back(skin);
+        }
+    }
+    asset->vertexCount = static_cast<uint32_t>(vertices.size());
+    if (vertices.empty() || indices.empty())
+    {
+        throw std::runtime_error("Skinned model without geometry: " + filename);
+    }
+
+    std::vector<int> matToTex = createTextures(textureNames);
+    for (size_t i = 0; i < textureNames.size(); ++i)
+    {
+        if (!textureNames[i].empty())
+        {
+            asset->textureIds.push_back(matToTex[i]);
+        }
+    }
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        asset->meshes[i].texId = matToTex[meshes[i].materialIndex];
+    }
+
+    // Read by the compute pass only, the skinned vertices being what is drawn
+    vk::DeviceSize vertexBytes = vertices.size() * sizeof(Vertex);
+    vk::DeviceSize skinBytes = skins.size() * sizeof(VertexSkin);
+    vk::DeviceSize indexBytes = indices.size() * sizeof(uint32_t);
+    createBuffer(memoryAllocator, vertexBytes,
+                 vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal, &asset->vertexBuffer, &asset->vertexBufferMemory);
+    createBuffer(memoryAllocator, skinBytes,
+                 vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal, &asset->skinBuffer, &asset->skinBufferMemory);
+    createBuffer(memoryAllocator, indexBytes,
+                 vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal, &asset->indexBuffer, &asset->indexBufferMemory);
+    UploadBatch uploadBatch(memoryAllocator, graphicsQueue, graphicsCommandPool);
+    uploadBatch.uploadBuffer(vertices.data(), vertexBytes, asset->vertexBuffer);
+    uploadBatch.uploadBuffer(skins.data(), skinBytes, asset->skinBuffer);
+    uploadBatch.uploadBuffer(indices.data(), indexBytes, asset->indexBuffer);
+    uploadBatch.submit();
+
+    vk::DescriptorSetAllocateInfo setAllocInfo{};
+    setAllocInfo.descriptorPool = skinningDescriptorPool;
+    setAllocInfo.descriptorSetCount = 1;
+    setAllocInfo.pSetLayouts = &skinningDescriptorSetLayout;
+    if (mainDevice.logicalDevice.allocateDescriptorSets(&setAllocInfo, &asset->descriptorSet) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Failed to allocate the skinned model descriptor set.");
+    }
+    std::array<vk::DescriptorBufferInfo, 2> bufferInfos{
+        vk::DescriptorBufferInfo{asset->vertexBuffer, 0, VK_WHOLE_SIZE},
+        vk::DescriptorBufferInfo{asset->skinBuffer, 0, VK_WHOLE_SIZE}};
+    std::array<vk::WriteDescriptorSet, 2> setWrites{};
+    for (uint32_t binding = 0; binding < setWrites.size(); ++binding)
+    {
+        setWrites[binding].dstSet = asset->descriptorSet;
+        setWrites[binding].dstBinding = binding;
+        setWrites[binding].descriptorType = vk::DescriptorType::eStorageBuffer;
+        setWrites[binding].descriptorCount = 1;
+        setWrites[binding].pBufferInfo = &bufferInfos[binding];
+    }
+    mainDevice.logicalDevice.updateDescriptorSets(static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0,
+                                                  nullptr);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("Loaded skinned %s: %zu meshes, %u vertices, %u joints, %zu clips in %.2f ms\n", filename.c_str(),
+           asset->meshes.size(), asset->vertexCount, asset->jointCount, asset->clips.size(),
+           std::chrono::duration<double, std::milli>(endTime - startTime).count());
+    for (size_t i = 0; i < asset->clips.size(); ++i)
+    {
+        printf("  clip %zu: %s, %.2f s\n", i, asset->clips[i].name.c_str(), asset->clips[i].duration);
+    }
+
+    SkinnedModel skinnedModel;
+    skinnedModel.asset = asset;
+    skinnedModels.push_back(skinnedModel);
+    return static_cast<int>(skinnedModels.size() - 1);
+}
+
+int VulkanRenderer::createSkinnedModelInstance(int skinnedModelId)
+{
+    if (skinnedModelId < 0 || skinnedModelId >= skinnedModels.size() || !skinnedModels[skinnedModelId].asset)
+    {
+        throw std::runtime_error("Attempted to instance a skinned model with not attributed index");
+    }
+    // Textures belong to the shared asset, no extra reference
+    SkinnedModel instance;
+    instance.asset = skinnedModels[skinnedModelId].asset;
+    instance.model = skinnedModels[skinnedModelId].model;
+    instance.clipIndex = skinnedModels[skinnedModelId].clipIndex;
+    instance.time = skinnedModels[skinnedModelId].time;
+    skinnedModels.push_back(instance);
+    return static_cast<int>(skinnedModels.size() - 1);
+}
+
+void VulkanRenderer::destroySkinnedModel(int skinnedModelId)
+{
+    if (skinnedModelId < 0 || skinnedModelId >= skinnedModels.size() || !skinnedModels[skinnedModelId].asset)
+    {
+        return;
+    }
+    // The model may still be in use by frames in flight
+    mainDevice.logicalDevice.waitIdle();
+    if (skinnedModels[skinnedModelId].asset.use_count() == 1)
+    {
+        destroySkinnedModelAsset(*skinnedModels[skinnedModelId].asset);
+    }
+    // Keep the slot so other ids stay valid, a null asset draws nothing
+    skinnedModels[skinnedModelId] = SkinnedModel();
+}
+
+void VulkanRenderer::updateSkinnedModel(int skinnedModelId, const glm::mat4 &modelP)
+{
+    if (skinnedModelId < 0 || skinnedModelId >= skinnedModels.size())
+    {
+        return;
+    }
+    skinnedModels[skinnedModelId].model = modelP;
+}
+
+void VulkanRenderer::setSkinnedModelAnimation(int skinnedModelId, int clipIndex, float time)
+{
+    if (skinnedModelId < 0 || skinnedModelId >= skinnedModels.size() || !skinnedModels[skinnedModelId].asset ||
+        clipIndex >= static_cast<int>(skinnedModels[skinnedModelId].asset->clips.size()))
+    {
+        throw std::runtime_error("Attempted to play a clip that does not exist");
+    }
+    skinnedModels[skinnedModelId].clipIndex = clipIndex;
+    skinnedModels[skinnedModelId].time = time;
+}
+
+size_t VulkanRenderer::getSkinnedModelClipCount(int skinnedModelId) const
+{
+    if (skinnedModelId < 0 || skinnedModelId >= skinnedModels.size() || !skinnedModels[skinnedModelId].asset)
+    {
+        return 0;
+    }
+    return skinnedModels[skinnedModelId].asset->clips.size();
+}
+
+void VulkanRenderer::createSkinningResources()
+{
+    // Recorded in the graphics command buffers, before the render pass
+    QueueFamilyIndices indices = getQueueFamilies(mainDevice.physicalDevice);
+    std::vector<vk::QueueFamilyProperties> queueFamilies = mainDevice.physicalDevice.getQueueFamilyProperties();
+    if (!(queueFamilies[indices.graphicsFamily].queueFlags & vk::QueueFlagBits::eCompute))
+    {
+        throw std::runtime_error("The graphics queue does not support compute, needed for skinning");
+    }
+
+    // -- DESCRIPTOR SET LAYOUT AND POOL --
+    std::array<vk::DescriptorSetLayoutBinding, 2> layoutBindings{};
+    for (uint32_t binding = 0; binding < layoutBindings.size(); ++binding)
+    {
+        layoutBindings[binding].binding = binding;
+        layoutBindings[binding].descriptorType = vk::DescriptorType::eStorageBuffer;
+        layoutBindings[binding].descriptorCount = 1;
+        layoutBindings[binding].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+    vk::DescriptorSetLayoutCreateInfo layoutCreateInfo{};
+    layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+    layoutCreateInfo.pBindings = layoutBindings.data();
+    skinningDescriptorSetLayout = mainDevice.logicalDevice.createDescriptorSetLayout(layoutCreateInfo);
+
+    // A set per skinned model file and per frame in flight, model sets are freed with their model
+    uint32_t maxSets = MAX_SKINNED_ASSETS + static_cast<uint32_t>(MAX_FRAME_DRAWS);
+    vk::DescriptorPoolSize poolSize{vk::DescriptorType::eStorageBuffer, 2 * maxSets};
+    vk::DescriptorPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+    poolCreateInfo.maxSets = maxSets;
+    poolCreateInfo.poolSizeCount = 1;
+    poolCreateInfo.pPoolSizes = &poolSize;
+    skinningDescriptorPool = mainDevice.logicalDevice.createDescriptorPool(poolCreateInfo);
+
+    // -- COMPUTE PIPELINE --
+    vk::PushConstantRange skinningPushConstantRange{vk::ShaderStageFlagBits::eCompute, 0, 3 * sizeof(uint32_t)};
+    std::array<vk::DescriptorSetLayout, 2> setLayouts{skinningDescriptorSetLayout, skinningDescriptorSetLayout};
+    vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+    pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &skinningPushConstantRange;
+    skinningPipelineLayout = mainDevice.logicalDevice.createPipelineLayout(pipelineLayoutCreateInfo);
+
+    vk::ShaderModule computeShaderModule = createShaderModule(readShaderFile("shaders/skinning_comp.spv"));
+    vk::ComputePipelineCreateInfo pipelineCreateInfo{};
+    pipelineCreateInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineCreateInfo.stage.module = computeShaderModule;
+    pipelineCreateInfo.stage.pName = "main";
+    pipelineCreateInfo.layout = skinningPipelineLayout;
+    auto result = mainDevice.logicalDevice.createComputePipeline(VK_NULL_HANDLE, pipelineCreateInfo);
+    mainDevice.logicalDevice.destroyShaderModule(computeShaderModule);
+    if (result.result != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Cound not create the skinning compute pipeline");
+    }
+    skinningPipeline = result.value;
+
+    // -- FRAME RESOURCES --
+    // Buffers are created by the first frames drawing skinned models, the sets written then
+    std::vector<vk::DescriptorSetLayout> frameSetLayouts(MAX_FRAME_DRAWS, skinningDescriptorSetLayout);
+    vk::DescriptorSetAllocateInfo setAllocInfo{};
+    setAllocInfo.descriptorPool = skinningDescriptorPool;
+    setAllocInfo.descriptorSetCount = static_cast<uint32_t>(frameSetLayouts.size());
+    setAllocInfo.pSetLayouts = frameSetLayouts.data();
+    skinningFrameDescriptorSets.resize(MAX_FRAME_DRAWS);
+    if (mainDevice.logicalDevice.allocateDescriptorSets(&setAllocInfo, skinningFrameDescriptorSets.data()) !=
+        vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Failed to allocate the skinning descriptor sets.");
+    }
+    paletteBuffers.resize(MAX_FRAME_DRAWS);
+    paletteBufferMemories.resize(MAX_FRAME_DRAWS);
+    paletteCapacities.resize(MAX_FRAME_DRAWS, 0);
+    skinnedVertexBuffers.resize(MAX_FRAME_DRAWS);
+    skinnedVertexBufferMemories.resize(MAX_FRAME_DRAWS);
+    skinnedVertexCapacities.resize(MAX_FRAME_DRAWS, 0);
+
+    // Timestamps, when the graphics queue has them
+    vk::PhysicalDeviceProperties deviceProperties = mainDevice.physicalDevice.getProperties();
+    if (deviceProperties.limits.timestampComputeAndGraphics && queueFamilies[indices.graphicsFamily].timestampValidBits)
+    {
+        timestampPeriod = deviceProperties.limits.timestampPeriod;
+        vk::QueryPoolCreateInfo queryPoolCreateInfo{};
+        queryPoolCreateInfo.queryType = vk::QueryType::eTimestamp;
+        queryPoolCreateInfo.queryCount = 2 * static_cast<uint32_t>(MAX_FRAME_DRAWS);
+        skinningQueryPool = mainDevice.logicalDevice.createQueryPool(queryPoolCreateInfo);
+        skinningQueriesWritten.resize(MAX_FRAME_DRAWS, 0);
+    }
+}
+
+void VulkanRenderer::destroySkinnedModelAsset(SkinnedModelAsset &asset)
+{
+    mainDevice.logicalDevice.freeDescriptorSets(skinningDescriptorPool, asset.descriptorSet);
+    mainDevice.logicalDevice.destroyBuffer(asset.vertexBuffer);
+    memoryAllocator.free(asset.vertexBufferMemory);
+    mainDevice.logicalDevice.destroyBuffer(asset.skinBuffer);
+    memoryAllocator.free(asset.skinBufferMemory);
+    mainDevice.logicalDevice.destroyBuffer(asset.indexBuffer);
+    memoryAllocator.free(asset.indexBufferMemory);
+    for (int textureId : asset.textureIds)
+    {
+        releaseTexture(textureId);
+    }
+    asset.textureIds.clear();
+}
+
+void VulkanRenderer::recordSkinning(uint32_t currentImage)
+{
+    // Timestamps of the previous use of this frame's queries, complete since its fence was waited. Each comes with
+    // its availability, a result not yet written is skipped rather than read stale.
+    uint32_t firstQuery = 2 * static_cast<uint32_t>(currentFrame);
+    if (skinningQueryPool && skinningQueriesWritten[currentFrame])
+    {
+        uint64_t results[4]; // Timestamp then availability, for both queries
+        vk::Result result = mainDevice.logicalDevice.getQueryPoolResults(
+            skinningQueryPool, firstQuery, 2, sizeof(results), results, 2 * sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+        if (result == vk::Result::eSuccess && results[1] && results[3])
+        {
+            skinningGpuMilliseconds = (results[2] - results[0]) * timestampPeriod / 1e6;
+        }
+        skinningQueriesWritten[currentFrame] = 0;
+    }
+
+    // Each copy gets its range of the frame's palettes and skinned vertices
+    size_t paletteCount = 0;
+    skinnedVertexCount = 0;
+    std::vector<SkinnedModel *> drawnModels;
+    for (auto &skinnedModel : skinnedModels)
+    {
+        if (!skinnedModel.asset)
+        {
+            continue;
+        }
+        skinnedModel.paletteOffset = static_cast<uint32_t>(paletteCount);
+        skinnedModel.outputOffset = static_cast<uint32_t>(skinnedVertexCount);
+        paletteCount += skinnedModel.asset->jointCount;
+        skinnedVertexCount += skinnedModel.asset->vertexCount;
+        drawnModels.push_back(&skinnedModel);
+    }
+    paletteMilliseconds = 0.0;
+    if (drawnModels.empty())
+    {
+        return;
+    }
+
+    // Doubled, so that a growing crowd only reallocates a few times. The old buffers go once the frames in flight
+    // no longer read them, the frame's set, no longer read since its fence was waited, points at the new ones.
+    if (paletteCapacities[currentFrame] < paletteCount || skinnedVertexCapacities[currentFrame] < skinnedVertexCount)
+    {
+        if (paletteCapacities[currentFrame] < paletteCount)
+        {
+            retireBuffer(paletteBuffers[currentFrame], paletteBufferMemories[currentFrame]);
+            paletteCapacities[currentFrame] = std::max(paletteCount, paletteCapacities[currentFrame] * 2);
+            createBuffer(memoryAllocator, paletteCapacities[currentFrame] * sizeof(glm::mat4),
+                         vk::BufferUsageFlagBits::eStorageBuffer,
+                         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                         &paletteBuffers[currentFrame], &paletteBufferMemories[currentFrame]);
+        }
+        if (skinnedVertexCapacities[currentFrame] < skinnedVertexCount)
+        {
+            retireBuffer(skinnedVertexBuffers[currentFrame], skinnedVertexBufferMemories[currentFrame]);
+            skinnedVertexCapacities[currentFrame] =
+                std::max(skinnedVertexCount, skinnedVertexCapacities[currentFrame] * 2);
+            createBuffer(memoryAllocator, skinnedVertexCapacities[currentFrame] * sizeof(Vertex),
+                         vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,
+                         vk::MemoryPropertyFlagBits::eDeviceLocal, &skinnedVertexBuffers[currentFrame],
+                         &skinnedVertexBufferMemories[currentFrame]);
+        }
+        std::array<vk::DescriptorBufferInfo, 2> bufferInfos{
+            vk::DescriptorBufferInfo{paletteBuffers[currentFrame], 0, VK_WHOLE_SIZE},
+            vk::DescriptorBufferInfo{skinnedVertexBuffers[currentFrame], 0, VK_WHOLE_SIZE}};
+        std::array<vk::WriteDescriptorSet, 2> setWrites{};
+        for (uint32_t binding = 0; binding < setWrites.size(); ++binding)
+        {
+            setWrites[binding].dstSet = skinningFrameDescriptorSets[currentFrame];
+            setWrites[binding].dstBinding = binding;
+            setWrites[binding].descriptorType = vk::DescriptorType::eStorageBuffer;
+            setWrites[binding].descriptorCount = 1;
+            setWrites[binding].pBufferInfo = &bufferInfos[binding];
+        }
+        mainDevice.logicalDevice.updateDescriptorSets(static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0,
+                                                      nullptr);
+    }
+
+    // Palettes straight into the mapped buffer, a copy per task: each writes its own range
+    auto paletteStartTime = std::chrono::high_resolution_clock::now();
+    glm::mat4 *palettes = reinterpret_cast<glm::mat4 *>(paletteBufferMemories[currentFrame].mapped);
+    workerPool.parallelFor(drawnModels.size(), [&](size_t i) {
+        SkinnedModel &skinnedModel = *drawnModels[i];
+        const SkinnedModelAsset &asset = *skinnedModel.asset;
+        skinnedModel.nodeTransforms.resize(asset.skeleton.getNodeCount());
+        const AnimationClip *clip = skinnedModel.clipIndex >= 0 ? &asset.clips[skinnedModel.clipIndex] : nullptr;
+        asset.skeleton.evaluate(clip, skinnedModel.time, skinnedModel.nodeTransforms.data());
+        for (const auto &mesh : asset.meshes)
+        {
+            Skeleton::computePalette(mesh.skin, skinnedModel.nodeTransforms.data(),
+                                     palettes + skinnedModel.paletteOffset + mesh.paletteOffset);
+        }
+    });
+    auto paletteEndTime = std::chrono::high_resolution_clock::now();
+    paletteMilliseconds = std::chrono::duration<double, std::milli>(paletteEndTime - paletteStartTime).count();
+
+    // A dispatch per copy, the model's set only bound again when the model changes
+    vk::CommandBuffer commandBuffer = commandBuffers[currentImage];
+    if (skinningQueryPool)
+    {
+        commandBuffer.resetQueryPool(skinningQueryPool, firstQuery, 2);
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, skinningQueryPool, firstQuery);
+    }
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, skinningPipeline);
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, skinningPipelineLayout, 1, 1,
+                                     &skinningFrameDescriptorSets[currentFrame], 0, nullptr);
+    const SkinnedModelAsset *boundAsset = nullptr;
+    for (const SkinnedModel *skinnedModel : drawnModels)
+    {
+        const SkinnedModelAsset *asset = skinnedModel->asset.get();
+        if (asset != boundAsset)
+        {
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, skinningPipelineLayout, 0, 1,
+                                             &asset->descriptorSet, 0, nullptr);
+            boundAsset = asset;
+        }
+        uint32_t pushSkinning[3] = {asset->vertexCount, skinnedModel->paletteOffset, skinnedModel->outputOffset};
+        commandBuffer.pushConstants(skinningPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+                                    sizeof(pushSkinning), pushSkinning);
+        commandBuffer.dispatch((asset->vertexCount + 63) / 64, 1, 1);
+    }
+    if (skinningQueryPool)
+    {
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, skinningQueryPool, firstQuery + 1);
+        skinningQueriesWritten[currentFrame] = 1;
+    }
+
+    // Skinned vertices are read as vertex attributes by the render pass
+    vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eVertexAttributeRead};
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eVertexInput,
+                                  {}, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void VulkanRenderer::drawSkinnedModels(uint32_t currentImage, MeshBindings &bindings)
+{
+    if (skinnedVertexCount == 0)
+    {
+        return;
+    }
+
+    // Full float vertices in model space: identity dequantization, the copy's model matrix
+    vk::CommandBuffer commandBuffer = commandBuffers[currentImage];
+    if (bindings.pipeline != graphicsPipeline)
+    {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+        bindings.pipeline = graphicsPipeline;
+    }
+    VertexDequantization identityDequantization;
+    commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, sizeof(Model),
+                                sizeof(VertexDequantization), &identityDequantization);
+    vk::DeviceSize offset = 0;
+    commandBuffer.bindVertexBuffers(0, 1, &skinnedVertexBuffers[currentFrame], &offset);
+    bindings.vertexBuffer = skinnedVertexBuffers[currentFrame];
+
+    for (const auto &skinnedModel : skinnedModels)
+    {
+        if (!skinnedModel.asset)
+        {
+            continue;
+        }
+        const SkinnedModelAsset &asset = *skinnedModel.asset;
+        if (bindings.indexBuffer != asset.indexBuffer)
+        {
+            commandBuffer.bindIndexBuffer(asset.indexBuffer, 0, vk::IndexType::eUint32);
+            bindings.indexBuffer = asset.indexBuffer;
+        }
+        commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(Model),
+                                    &skinnedModel.model);
+        for (const auto &mesh : asset.meshes)
+        {
+            std::array<vk::DescriptorSet, 2> descriptorSetsGroup{descriptorSets[currentImage],
+                                                                 samplerDescriptorSets[mesh.texId]};
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0,
+                                             static_cast<uint32_t>(descriptorSetsGroup.size()),
+                                             descriptorSetsGroup.data(), 0, nullptr);
+            commandBuffer.drawIndexed(mesh.indexCount, 1, mesh.firstIndex,
+                                      static_cast<int32_t>(skinnedModel.outputOffset + mesh.firstVertex), 0);
+            drawnTriangleCount += mesh.indexCount / 3;
+            drawCallCount++;
+        }
+    }
+}
+
 void VulkanRenderer::createColorBufferImage()
 {
     vk::Format colorFormat = swapchainImageFormat;
@@ -10,11 +10,32 @@
 
 #include <stb_image.h>
 
+#include <chrono>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
 #include <stdexcept>
+#include <unordered_map>
 #include <vector>
 
+#include "vulkan-file-watcher.h"
+#include "vulkan-geometry-buffer.h"
+#include "vulkan-impostor.h"
+#include "vulkan-memory-allocator.h"
+#include "vulkan-mesh-cache.h"
 #include "vulkan-mesh-model.h"
+#include "vulkan-mesh-optimizer.h"
+#include "vulkan-mesh-simplifier.h"
 #include "vulkan-mesh.h"
+#include "vulkan-meshlet-builder.h"
+#include "vulkan-obj-loader.h"
+#include "vulkan-scene-graph.h"
+#include "vulkan-skeletal-animation.h"
+#include "vulkan-texture-compression.h"
+#include "vulkan-texture-container.h"
+#include "vulkan-thread-pool.h"
+#include "vulkan-upload-batch.h"
 #include "vulkan-utilities.h"
 
 struct ViewProjection
@@ -23,6 +44,49 @@ struct ViewProjection
     glm::mat4 view;
 };
 
+// Texture decoded on the CPU, waiting to be uploaded
+struct TextureData
+{
+    std::shared_ptr<const void> storage;  // Keeps pixels alive: stbi buffer, mip chain or mapped container
+    const unsigned char *pixels{nullptr}; // Every mip level one after the other, largest first
+    int width{0};
+    int height{0};
+    uint32_t mipLevels{1};
+    std::vector<vk::DeviceSize> levelOffsets{0};
+    vk::DeviceSize imageSize{0}; // Size of all the levels
+    vk::Format format{vk::Format::eR8G8B8A8Unorm};
+    uint64_t contentHash{0}; // Hash of the encoded file, shared by identical files under different names
+};
+
+struct TextureCacheStats
+{
+    size_t hits{0}; // Same path, or same content under another name
+    size_t misses{0};
+    vk::DeviceSize bytesSaved{0}; // Device memory not allocated thanks to cache hits
+};
+
+// CPU side of a model, imported or mapped from its mesh cache, waiting to be uploaded
+struct ModelImport
+{
+    std::unique_ptr<MeshCache> meshCache; // Warm import: the views point into its mapping
+    std::vector<MeshData> meshes;         // Cold import: the views point into these
+    std::vector<MeshView> meshViews;
+    // Per view, the first one with the same geometry (MeshOptimizer::findDuplicateMeshes): uploaded once. Views of
+    // duplicates have the first one's arrays with their own bounds, material and node.
+    std::vector<uint32_t> duplicateOf;
+    std::vector<std::string> textureNames;
+    SceneGraph sceneGraph;
+    std::vector<std::string> dependencies; // Cold import: files read besides the source, part of the cache key
+    bool isWarm{false};
+};
+
+enum class ModelLoadState
+{
+    Loading, // Draws nothing yet
+    Ready,
+    Failed // Import error or destroyed while loading, the model stays empty
+};
+
 class VulkanRenderer
 {
   public:
@@ -41,7 +105,169 @@ class VulkanRenderer
     void clean();
 
     void updateModel(int modelId, glm::mat4 modelP);
+    // Node of a model by its name in the source file, SceneGraph::NO_PARENT if there is none (or not loaded yet)
+    uint32_t findMeshModelNode(int modelId, const std::string &name) const;
+    // Move a part of a model relative to its parent node, the world transforms below it are updated before drawing
+    void setMeshModelNodeTransform(int modelId, uint32_t node, const glm::mat4 &localTransform);
     int createMeshModel(const std::string &filename);
+    // Another copy of a model, drawn with its own model matrix and LOD selection but sharing its geometry and
+    // textures. The geometry is released with the last of the model and its instances.
+    int createMeshModelInstance(int modelId);
+    void destroyMeshModel(int modelId);
+    // Static models are drawn from batches instead of mesh by mesh: their vertices are transformed to world space
+    // once and merged with those of the other static meshes of the same texture, a batch being a single draw.
+    // Only the batches of the textures of the model are rebuilt, its world space vertices being computed from its
+    // mesh cache on the workers and kept on the CPU for later rebuilds. The model is drawn mesh by mesh until they are
+    // uploaded. Moving a static model or one of its nodes rebuilds its batches again, so it is for models placed once.
+    // Static meshes are drawn at full detail, without meshlet culling, batches being frustum culled as a whole.
+    void setMeshModelStatic(int modelId, bool isStatic);
+    // Render the model once from every view of an ImpostorAtlas into a texture, then draw its distant copies as
+    // camera-facing quads textured with the closest view, all copies sharing an atlas in a single instanced draw.
+    // A copy switches to its quad once it covers fewer pixels than an atlas cell. Every loaded model of the same
+    // file gets the atlas, it is baked again when the file is hot reloaded. The atlas shows the nodes where they
+    // were at baking time, so it suits models whose parts don't move.
+    void createMeshModelImpostor(int modelId);
+    // Distant models drawn as their impostor (on by default), always as meshes when disabled
+    void setImpostorRendering(bool enabled)
+    {
+        impostorRenderingEnabled = enabled;
+    }
+    // Skinned models are animated: every frame, the joint matrices (palettes) of each of their copies are evaluated
+    // on the workers, then a compute pass skins their vertices into a per frame buffer, drawn with the full vertex
+    // mesh pipeline. Meshes without bones follow their node rigidly. They are imported from the source file every
+    // time and drawn as imported: no mesh cache, vertex reordering, levels of detail, meshlets nor impostors.
+    // Ids are their own, separate from those of the mesh models.
+    int createSkinnedModel(const std::string &filename);
+    // Another copy sharing the geometry, skeleton and clips, with its own model matrix, clip and time
+    int createSkinnedModelInstance(int skinnedModelId);
+    void destroySkinnedModel(int skinnedModelId);
+    void updateSkinnedModel(int skinnedModelId, const glm::mat4 &modelP);
+    // Clip by its index in the file, -1 for the bind pose, at time seconds, looped over the clip duration
+    void setSkinnedModelAnimation(int skinnedModelId, int clipIndex, float time);
+    size_t getSkinnedModelClipCount(int skinnedModelId) const;
+    // Vertices skinned by the last recorded frame, and the CPU time its palettes took
+    size_t getSkinnedVertexCount() const
+    {
+        return skinnedVertexCount;
+    }
+    double getPaletteMilliseconds() const
+    {
+        return paletteMilliseconds;
+    }
+    // GPU time of the skinning pass from timestamps, read back without waiting: that of a frame or two ago
+    double getSkinningGpuMilliseconds() const
+    {
+        return skinningGpuMilliseconds;
+    }
+    // Returns right away with the id of a model drawing nothing until it is loaded. Import and texture decoding
+    // run on the workers, the uploads are then spread over the next frames within the upload budget.
+    // The model matrix can be set meanwhile, it is kept.
+    int createMeshModelAsync(const std::string &filename);
+    ModelLoadState getMeshModelLoadState(int modelId) const;
+    // Bytes staged per frame by asynchronous loads, DEFAULT_UPLOAD_BUDGET by default. A frame stops staging once
+    // over it, so a single texture or mesh bigger than the budget still goes in one frame. Geometry arenas grown
+    // for a load copy their content on the GPU, those bytes are taken out of the following frames' budgets.
+    void setUploadBudget(vk::DeviceSize bytesPerFrame)
+    {
+        uploadBudget = std::max<vk::DeviceSize>(bytesPerFrame, 1);
+    }
+    static constexpr vk::DeviceSize DEFAULT_UPLOAD_BUDGET = 4 * 1024 * 1024;
+    // Watch directories, usually models/ and textures/, for changed files. Models and textures loaded from them
+    // are imported or decoded again in the background, then swapped in without stalling: what they replace is
+    // destroyed once the frames in flight that may still use it have retired.
+    bool enableHotReload(const std::vector<std::string> &directories);
+    // Reorder imported index and vertex buffers for the GPU caches (on by default), applies to models created after
+    void setMeshOptimization(bool enabled)
+    {
+        meshOptimizationEnabled = enabled;
+    }
+    // Host memory createMeshModel may use on top of the parsed source file, 0 (the default) for no limit. The
+    // source itself is not bounded: the Assimp scene, or the meshes of the OBJ loader, are in memory whole. With a
+    // ceiling, meshes are converted from the scene, processed, baked and uploaded a group at a time, each group's
+    // data freed once staged, and staging is submitted whenever it reaches half the ceiling. Duplicated meshes are
+    // found among the source meshes beforehand, whatever their group. Slower, as there are more submissions and
+    // less parallel processing, but the whole model is never held two or three times over.
+    void setImportMemoryCeiling(size_t bytes)
+    {
+        importMemoryCeiling = bytes;
+    }
+    // Import OBJ files with ObjLoader (on by default) instead of Assimp, applies to models created after
+    void setNativeObjImport(bool enabled)
+    {
+        nativeObjImportEnabled = enabled;
+    }
+    // Store the mesh caches written from now on compressed with GeometryCodec (on by default). Smaller files,
+    // faster to read from slow or network storage, decoded straight into staging.
+    void setMeshCacheCompression(bool enabled)
+    {
+        meshCacheCompressionEnabled = enabled;
+    }
+    // Vertex layout of the meshes of models created after, VertexFormat::Packed by default
+    void setMeshVertexFormat(VertexFormat vertexFormat)
+    {
+        meshVertexFormat = vertexFormat;
+    }
+    // Length of the LOD chain generated for models created after, 1 to only keep the full meshes
+    void setMeshLodCount(uint32_t lodCount)
+    {
+        meshLodCount = std::max(1u, std::min(lodCount, 255u));
+    }
+    // Per frame LOD selection (on by default), the full meshes are drawn when disabled
+    void setMeshLodSelection(bool enabled)
+    {
+        meshLodSelectionEnabled = enabled;
+    }
+    // Split meshes of models created after into meshlets with culling data (on by default)
+    void setMeshletBuilding(bool enabled)
+    {
+        meshletBuildingEnabled = enabled;
+    }
+    // Per frame frustum and back face culling of the meshlets of meshes drawn at full detail (on by default)
+    void setMeshletCulling(bool enabled)
+    {
+        meshletCullingEnabled = enabled;
+    }
+    // Triangles submitted by the last recorded frame
+    size_t getDrawnTriangleCount() const
+    {
+        return drawnTriangleCount;
+    }
+    // Draw calls of the last recorded frame, and the CPU time its recording took
+    size_t getDrawCallCount() const
+    {
+        return drawCallCount;
+    }
+    double getRecordMilliseconds() const
+    {
+        return recordMilliseconds;
+    }
+    // Models drawn as impostors in the last recorded frame
+    size_t getDrawnImpostorCount() const
+    {
+        return drawnImpostorCount;
+    }
+    const MeshletCullingStats &getMeshletCullingStats() const
+    {
+        return meshletCullingStats;
+    }
+    // Device memory allocations of every buffer and image, their blocks and how long allocating took
+    DeviceMemoryStats getDeviceMemoryStats() const
+    {
+        return memoryAllocator.getStats();
+    }
+
+    const TextureCacheStats &getTextureCacheStats() const
+    {
+        return textureCacheStats;
+    }
+
+    // CPU only, safe to call from any thread.
+    // decodeTexture returns the full pre-filtered mip chain, from the texture container when it is up to date,
+    // otherwise it decodes the source, filters its mips and writes the container for the next runs.
+    // With compress, the levels are BC1/BC3 encoded on threadPool before being written.
+    static TextureData decodeTexture(const std::string &filename, bool compress, ThreadPool &threadPool);
+    // Source image decoding alone, level 0 only
+    static TextureData decodeTextureFile(const std::string &filename);
 
   private:
     GLFWwindow *window;
@@ -65,6 +291,10 @@ class VulkanRenderer
     vk::PipelineLayout pipelineLayout;
     vk::RenderPass renderPass;
     vk::Pipeline graphicsPipeline;
+    vk::Pipeline packedGraphicsPipeline; // Same as graphicsPipeline, for meshes with PackedVertex
+    // Same as both, the model matrix read per instance from a second vertex binding (shaders/instanced.vert)
+    vk::Pipeline instancedGraphicsPipeline;
+    vk::Pipeline instancedPackedGraphicsPipeline;
 
     std::vector<vk::Framebuffer> swapchainFramebuffers;
     vk::CommandPool graphicsCommandPool;
@@ -76,11 +306,14 @@ class VulkanRenderer
     int currentFrame = 0;
     std::vector<vk::Fence> drawFences;
 
-    std::vector<VulkanMesh> meshes;
+    // Device memory of every buffer and image, created with the logical device
+    DeviceMemoryAllocator memoryAllocator;
+    // Vertex and index buffers shared by all meshes
+    GeometryBuffer geometryBuffer;
 
     vk::DescriptorSetLayout descriptorSetLayout;
     std::vector<vk::Buffer> vpUniformBuffer;
-    std::vector<vk::DeviceMemory> vpUniformBufferMemory;
+    std::vector<MemoryAllocation> vpUniformBufferMemory;
     vk::DescriptorPool descriptorPool;
     std::vector<vk::DescriptorSet> descriptorSets;
 
@@ -90,28 +323,284 @@ class VulkanRenderer
     Model *modelTransferSpace;
     const int MAX_OBJECTS = 20;
     std::vector<vk::Buffer> modelUniformBufferDynamic;
-    std::vector<vk::DeviceMemory> modelUniformBufferMemoryDynamic;
+    std::vector<MemoryAllocation> modelUniformBufferMemoryDynamic;
 
     vk::PushConstantRange pushConstantRange;
 
     vk::Image depthBufferImage;
-    vk::DeviceMemory depthBufferImageMemory;
+    MemoryAllocation depthBufferImageMemory;
     vk::ImageView depthBufferImageView;
 
     std::vector<VkImage> textureImages;
     std::vector<vk::ImageView> textureImageViews;
-    std::vector<VkDeviceMemory> textureImageMemory;
+    std::vector<MemoryAllocation> textureImageMemory;
+
+    // Texture cache, a texture id is both its index in textureImages and in samplerDescriptorSets
+    std::unordered_map<std::string, int> texturePathCache;
+    std::unordered_map<uint64_t, int> textureContentCache;
+    std::vector<uint32_t> textureRefCounts;
+    std::vector<vk::DeviceSize> textureDeviceSizes;
+    TextureCacheStats textureCacheStats;
+    // Device can sample BC1/BC3 images, textures are then stored compressed
+    bool textureCompressionSupported{false};
 
     vk::Sampler textureSampler;
+    // Textures alive at once, impostor atlases included
+    static constexpr uint32_t MAX_TEXTURES = 4096;
     vk::DescriptorPool samplerDescriptorPool;
     vk::DescriptorSetLayout samplerDescriptorSetLayout;
     std::vector<vk::DescriptorSet> samplerDescriptorSets;
 
     std::vector<VulkanMeshModel> meshModels;
+    std::vector<ModelLoadState> meshModelLoadStates;
+
+    // Static batching, see setMeshModelStatic
+    struct StaticBatchPart
+    {
+        int modelId;
+        // The model's meshes of the batch texture in world space, kept so that the batch is rebuilt without
+        // importing the model again
+        MeshData geometry;
+    };
+    // World space geometry of static meshes sharing a texture, in the shared geometry buffers with full vertices:
+    // 16 bits positions over the extent of a whole scene would be too coarse
+    struct StaticBatch
+    {
+        int texId;
+        std::vector<StaticBatchPart> parts;
+        size_t vertexCount{0};
+        VulkanMesh mesh;             // Drawn, empty while the batch has none uploaded
+        std::vector<int> liveModels; // Models in mesh, the others of parts are drawn mesh by mesh
+        bool isDirty{false};         // parts changed since pendingMesh or mesh was built
+        // Rebuild being copied to the device, swapped in for mesh once upload is complete. The batches rebuilt the
+        // same frame share their upload.
+        std::shared_ptr<UploadBatch> upload;
+        VulkanMesh pendingMesh;
+        std::vector<int> pendingModels;
+        bool isPendingStale{false}; // A model of pendingModels left the batch meanwhile, it is dropped
+    };
+    // A texture gets a new batch once its last one is full, unless a single model is bigger
+    static constexpr size_t MAX_STATIC_BATCH_VERTICES = 1024 * 1024;
+    std::vector<StaticBatch> staticBatches;
+    std::vector<uint8_t> meshModelStaticFlags;
+    // Static models drawn by their batches, every batch with a part of them having it in its mesh
+    std::vector<uint8_t> meshModelBatchedFlags;
+    // Models whose batches must be rebuilt: flag changed, moved, reloaded or destroyed
+    std::vector<int> staticBatchChanges;
+    // World space geometry of the static models joining batches, per texture, computed on the workers
+    std::unordered_map<int, std::future<std::map<int, MeshData>>> staticModelBakes;
+
+    // Impostors, see createMeshModelImpostor
+    struct Impostor
+    {
+        int textureId; // Atlas, referenced by the texture ids of the models using it
+        // Bounding sphere of the model's meshes in model space, the one the views were rendered around
+        glm::vec3 center;
+        float radius;
+    };
+    std::vector<Impostor> impostors;
+    std::vector<int> meshModelImpostorIds; // Index in impostors, -1 without one
+    bool impostorRenderingEnabled{true};
+    size_t drawnImpostorCount{0};
+    // Created with the first impostor. The bake render pass is compatible with renderPass, so that the mesh
+    // pipelines render the atlas cells, and leaves the atlas ready to be sampled.
+    vk::RenderPass impostorRenderPass;
+    vk::Pipeline impostorPipeline;
+    // Identity view projection: the cell's is pushed with each model matrix
+    vk::Buffer impostorBakeUniformBuffer;
+    MemoryAllocation impostorBakeUniformBufferMemory;
+    vk::DescriptorSet impostorBakeDescriptorSet;
+    // Instances of a frame, per swapchain image like the uniform buffers, grown when a frame needs more
+    std::vector<vk::Buffer> impostorInstanceBuffers;
+    std::vector<MemoryAllocation> impostorInstanceBufferMemories;
+    std::vector<size_t> impostorInstanceCapacities;
+    // Gathered per impostor while recording, then drawn one impostor after the other
+    std::vector<std::vector<ImpostorInstance>> impostorInstances;
+    // Bakes submitted without waiting, their attachments are destroyed once the fence signals. The atlas itself is
+    // usable right away: the bake render pass makes it visible to the fragment shaders of later submissions.
+    struct ImpostorBake
+    {
+        vk::CommandBuffer commandBuffer;
+        vk::Fence fence;
+        vk::Framebuffer framebuffer;
+        vk::Image colorImage;
+        MemoryAllocation colorMemory;
+        vk::ImageView colorView;
+        vk::Image depthImage;
+        MemoryAllocation depthMemory;
+        vk::ImageView depthView;
+    };
+    std::vector<ImpostorBake> impostorBakes;
+
+    // Skinned models, see createSkinnedModel
+    struct SkinnedMesh
+    {
+        uint32_t firstVertex; // In the model's vertex buffer, and in the skinned vertices of each copy
+        uint32_t vertexCount;
+        uint32_t firstIndex;
+        uint32_t indexCount; // Indices start from 0 for each mesh
+        uint32_t paletteOffset; // First joint of the mesh's skin in the model's palette
+        int texId;
+        Skin skin;
+    };
+    // Device side of a skinned model file, shared by its copies, destroyed with the last of them
+    struct SkinnedModelAsset
+    {
+        std::vector<SkinnedMesh> meshes;
+        Skeleton skeleton;
+        std::vector<AnimationClip> clips;
+        std::vector<int> textureIds;
+        uint32_t vertexCount{0};
+        uint32_t jointCount{0}; // Palette size, the joints of every mesh one after the other
+        // Bind pose vertices and VertexSkin, read by the compute pass through descriptorSet (set 0)
+        vk::Buffer vertexBuffer;
+        MemoryAllocation vertexBufferMemory;
+        vk::Buffer skinBuffer;
+        MemoryAllocation skinBufferMemory;
+        vk::Buffer indexBuffer;
+        MemoryAllocation indexBufferMemory;
+        vk::DescriptorSet descriptorSet;
+    };
+    struct SkinnedModel
+    {
+        std::shared_ptr<SkinnedModelAsset> asset; // Null once destroyed
+        glm::mat4 model{1.0f};
+        int clipIndex{-1};
+        float time{0.0f};
+        std::vector<glm::mat4> nodeTransforms; // Scratch of the palette evaluation
+        // Where this copy's palette and skinned vertices are in the frame being recorded
+        uint32_t paletteOffset{0};
+        uint32_t outputOffset{0};
+    };
+    std::vector<SkinnedModel> skinnedModels;
+    // Created with the first skinned model. A single set layout of two storage buffers for both sets: model
+    // vertices and skins in set 0, frame palettes and skinned vertices in set 1.
+    vk::DescriptorSetLayout skinningDescriptorSetLayout;
+    vk::PipelineLayout skinningPipelineLayout;
+    vk::Pipeline skinningPipeline;
+    vk::DescriptorPool skinningDescriptorPool;
+    static constexpr uint32_t MAX_SKINNED_ASSETS = 64;
+    // Per frame in flight, grown when a frame needs more: once the frame's fence is waited, its set is no longer
+    // read and is pointed at the grown buffers. Palettes are written by the CPU every frame, the skinned vertices
+    // stay on the GPU.
+    std::vector<vk::Buffer> paletteBuffers;
+    std::vector<MemoryAllocation> paletteBufferMemories;
+    std::vector<size_t> paletteCapacities; // In matrices
+    std::vector<vk::Buffer> skinnedVertexBuffers;
+    std::vector<MemoryAllocation> skinnedVertexBufferMemories;
+    std::vector<size_t> skinnedVertexCapacities; // In vertices
+    std::vector<vk::DescriptorSet> skinningFrameDescriptorSets;
+    // Two timestamps per frame in flight around the dispatches, none when the queue can't time them
+    vk::QueryPool skinningQueryPool;
+    std::vector<uint8_t> skinningQueriesWritten;
+    float timestampPeriod{0.0f}; // Nanoseconds per tick
+    size_t skinnedVertexCount{0};
+    double paletteMilliseconds{0.0};
+    double skinningGpuMilliseconds{0.0};
+
+    // Asynchronous model load, from createMeshModelAsync
+    struct ModelLoad
+    {
+        int modelId;
+        std::string filename;
+        std::chrono::high_resolution_clock::time_point startTime;
+        std::future<ModelImport> import;
+        ModelImport modelImport;
+        bool isImported{false};
+        // Per material: texture decoded on the workers, then descriptor id once uploaded or shared (-1 before)
+        std::vector<std::future<TextureData>> decodedTextures;
+        std::vector<int> matToTex;
+        size_t nextTexture{0};
+        size_t nextMesh{0};
+        std::vector<VulkanMesh> meshes;
+        // Slice of the current frame, in flight until its fence is signaled
+        std::unique_ptr<UploadBatch> uploadBatch;
+        size_t stepCount{0};
+        double maxStepMilliseconds{0.0};
+        vk::DeviceSize uploadedBytes{0};
+        // Hot reload: replaces every ready model loaded from filename instead of filling the modelId slot
+        bool isReload{false};
+        std::chrono::steady_clock::time_point changeTime;
+    };
+    // First in first out, only the front load uploads
+    std::deque<ModelLoad> modelLoads;
+    vk::DeviceSize uploadBudget{DEFAULT_UPLOAD_BUDGET};
+    // Bytes of geometry arena grows already taken out of upload budgets, GeometryBuffer::getGrowCopiedBytes() at most
+    vk::DeviceSize chargedGrowBytes{0};
+
+    // Hot reload
+    FileWatcher fileWatcher;
+    std::vector<std::string> meshModelFilenames; // Source of each model, empty once destroyed
+    uint64_t frameNumber{0};                    // Frame being recorded
+    // Texture decoded again, then uploaded as a new image before taking the place of the old one
+    struct TextureReload
+    {
+        int textureId;
+        std::string filename;
+        std::chrono::steady_clock::time_point changeTime;
+        std::future<TextureData> decodedTexture;
+        std::unique_ptr<UploadBatch> uploadBatch; // Set once decoded
+        vk::Image image;
+        MemoryAllocation imageMemory;
+        vk::ImageView imageView;
+        vk::DeviceSize imageSize{0};
+        uint64_t contentHash{0};
+        double stepMilliseconds{0.0};
+    };
+    std::vector<TextureReload> textureReloads;
+    // Replaced by a reload, destroyed once lastFrame is no longer in flight
+    struct RetiredResources
+    {
+        uint64_t lastFrame;
+        std::vector<VulkanMeshModel> meshModels;
+        std::vector<VulkanMesh> meshes; // Replaced static batches
+        vk::Image image;
+        MemoryAllocation imageMemory;
+        vk::ImageView imageView;
+        vk::DescriptorSet descriptorSet;
+        // Per frame buffers outgrown by a frame needing more
+        std::vector<vk::Buffer> buffers;
+        std::vector<MemoryAllocation> bufferMemories;
+    };
+    std::deque<RetiredResources> retiredResources;
+
+    // Workers for CPU-side asset processing
+    ThreadPool workerPool;
+    // Post processing applied on import, part of the mesh cache key
+    const unsigned int MESH_IMPORT_FLAGS =
+        aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices;
+    bool meshOptimizationEnabled{true};
+    bool nativeObjImportEnabled{true};
+    bool meshCacheCompressionEnabled{true};
+    size_t importMemoryCeiling{0};
+    VertexFormat meshVertexFormat{VertexFormat::Packed};
+    uint32_t meshLodCount{MeshSimplifier::DEFAULT_LOD_COUNT};
+    bool meshLodSelectionEnabled{true};
+    // Screen space error, in pixels, a level of detail may show
+    float lodPixelThreshold{1.0f};
+    size_t drawnTriangleCount{0};
+    size_t drawCallCount{0};
+    // The model meshes of a frame, gathered while recording then drawn by drawMeshes
+    struct MeshDraw
+    {
+        VulkanMesh *mesh;
+        const MeshLod *lod;
+        glm::mat4 matrix; // Model, node and translation of the mesh
+        float scale;      // Largest scale of matrix, for the meshlet spheres
+    };
+    std::vector<MeshDraw> meshDraws;
+    // Their model matrices, per swapchain image like the uniform buffers, grown when a frame needs more
+    std::vector<vk::Buffer> meshInstanceBuffers;
+    std::vector<MemoryAllocation> meshInstanceBufferMemories;
+    std::vector<size_t> meshInstanceCapacities;
+    double recordMilliseconds{0.0};
+    bool meshletBuildingEnabled{true};
+    bool meshletCullingEnabled{true};
+    MeshletCullingStats meshletCullingStats;
 
     vk::SampleCountFlagBits msaaSamples{vk::SampleCountFlagBits::e1};
     vk::Image colorImage;
-    vk::DeviceMemory colorImageMemory;
+    MemoryAllocation colorImageMemory;
     vk::ImageView colorImageView;
 
     // Instance
@@ -156,6 +645,20 @@ class VulkanRenderer
     void createGraphicsCommandPool();
     void createGraphicsCommandBuffers();
     void recordCommands(uint32_t currentImage);
+    // Pipeline and buffers bound while recording, consecutive meshes only bind what changes
+    struct MeshBindings
+    {
+        vk::Pipeline pipeline;
+        vk::Buffer vertexBuffer;
+        vk::Buffer indexBuffer;
+    };
+    // Pipeline, dequantization, buffers and descriptor sets to draw mesh, viewProjectionSet being set 0. The
+    // instanced pipelines read the model matrix from binding 1, bound by the caller.
+    void bindMesh(vk::CommandBuffer commandBuffer, VulkanMesh *mesh, vk::DescriptorSet viewProjectionSet,
+                  MeshBindings &bindings, bool isInstanced = false);
+    // The gathered meshDraws, occurrences of the same geometry, level and texture with a single instanced call
+    void drawMeshes(uint32_t currentImage, const glm::vec4 *frustumPlanes, const glm::vec3 &cameraPosition,
+                    MeshBindings &meshBindings);
 
     // Descriptor sets
     void createDescriptorSetLayout();
@@ -174,20 +677,107 @@ class VulkanRenderer
     void createDepthBufferImage();
     vk::Image createImage(uint32_t width, uint32_t height, uint32_t mipLevels, vk::SampleCountFlagBits numSamples,
                           vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags useFlags,
-                          vk::MemoryPropertyFlags propFlags, vk::DeviceMemory *imageMemory);
+                          vk::MemoryPropertyFlags propFlags, MemoryAllocation *imageMemory);
     vk::Format chooseSupportedFormat(const std::vector<vk::Format> &formats, vk::ImageTiling tiling,
                                      vk::FormatFeatureFlags featureFlags);
+    // Same for every depth attachment, so that the render passes stay compatible
+    vk::Format chooseDepthFormat();
 
     // Draw
     void createSynchronisation();
 
     // Textures
-    stbi_uc *loadTextureFile(const std::string &filename, int *width, int *height, vk::DeviceSize *imageSize);
-    int createTextureImage(const std::string &filename, uint32_t &mipLevels);
+    static stbi_uc *loadTextureFile(const std::string &filename, int *width, int *height, vk::DeviceSize *imageSize,
+                                    uint64_t *contentHash);
+    static bool isBlockCompressed(vk::Format format);
+    int createTextureImage(const TextureData &textureData, uint32_t &mipLevels, UploadBatch &uploadBatch);
     int createTexture(const std::string &filename);
+    // The image is usable once uploadBatch is submitted
+    int createTexture(const TextureData &textureData, UploadBatch &uploadBatch);
+    std::vector<int> createTextures(const std::vector<std::string> &filenames);
+    // Texture id for a freshly decoded file: shared with a cached texture of the same content, or created
+    int addDecodedTexture(const std::string &filename, const TextureData &textureData, UploadBatch &uploadBatch);
+    bool acquireCachedTexture(const std::string &filename, int *textureId);
+    void releaseTexture(int textureId);
+
+    // Meshes
+    // Mesh cache lookup, or Assimp import and processing then baking. CPU only, runs on a worker for asynchronous
+    // loads: the mesh settings must not change while loads are in flight.
+    ModelImport importMeshModel(const std::string &filename);
+    // Steps of importMeshModel: map the cache if up to date, else import the source file and process its meshes
+    uint32_t getMeshBakeFlags(const std::string &filename) const;
+    bool openMeshCache(const std::string &filename, ModelImport &modelImport);
+    void importSourceMeshes(const std::string &filename, ModelImport &modelImport);
+    // Assimp import of filename, setting the texture names and dependencies. The scene lives as long as importer.
+    const aiScene *readSourceScene(Assimp::Importer &importer, const std::string &filename, ModelImport &modelImport);
+    // With sourceMeshes, the index in meshes before processing of each processed mesh (large ones are split)
+    void processMeshes(std::vector<MeshData> &meshes, std::vector<uint32_t> *sourceMeshes = nullptr);
+    // createMeshModel under importMemoryCeiling
+    int createMeshModelBounded(const std::string &filename);
+    // Room for meshCount views from firstMesh in the shared geometry buffers, their vertices in vertexFormat, so that
+    // none of them is replaced in the middle of a batch. Duplicates take no room.
+    void reserveGeometry(const std::vector<MeshView> &meshViews, const std::vector<uint32_t> &duplicateOf,
+                         size_t firstMesh, size_t meshCount, VertexFormat vertexFormat);
+    // Device mesh for view meshIndex, a new occurrence of an earlier mesh of meshes when it is a duplicate, moved by
+    // the difference of their bounds
+    VulkanMesh createMesh(UploadBatch &uploadBatch, const std::vector<VulkanMesh> &meshes, const MeshView &meshView,
+                          uint32_t duplicateOf, size_t meshIndex, int texId);
+    VulkanMeshModel assembleMeshModel(const std::vector<VulkanMesh> &meshes,
+                                      const std::vector<std::string> &textureNames, const std::vector<int> &matToTex,
+                                      const SceneGraph &sceneGraph);
+    // Advance asynchronous loads by one frame's worth of uploads, called before recording each frame
+    void processModelLoads();
+    // Stage the next textures and meshes of load up to budget, returns true once everything is staged
+    bool stageModelLoad(ModelLoad &load, vk::DeviceSize budget);
+    // Give back what a load acquired so far, none of it has been drawn yet
+    void cancelModelLoad(ModelLoad &load);
+    // Swap the models of a finished reload in, the replaced ones are retired
+    void finishModelReload(ModelLoad &load, const VulkanMeshModel &meshModel);
+    // Move the changed static models in and out of their batches and rebuild those batches, before recording.
+    // Nothing is waited for: models are baked on the workers and batches uploaded without waiting, static models
+    // being drawn mesh by mesh until the batches they are in are on the device.
+    void updateStaticBatches();
+    // Worker side of updateStaticBatches: the meshes of a model read again from its mesh cache, moved to world space
+    // by their transforms and merged per texture. Throws std::runtime_error when the cache no longer matches them.
+    std::map<int, MeshData> bakeStaticModel(const std::string &filename, const std::vector<int> &texIds,
+                                            const std::vector<glm::mat4> &transforms);
+
+    // Impostors
+    void createImpostorResources();
+    // Render the atlas of meshModel and register it as a texture with one reference, returns its impostor index
+    int bakeImpostor(VulkanMeshModel &meshModel);
+    // Destroy the attachments of the complete bakes, of all of them waiting for them if wait is set
+    void releaseImpostorBakes(bool wait);
+
+    // Skinning
+    void createSkinningResources();
+    void destroySkinnedModelAsset(SkinnedModelAsset &asset);
+    // Palettes of every skinned copy, then the dispatches skinning them, before the render pass
+    void recordSkinning(uint32_t currentImage);
+    // The skinned vertices of the frame, in the render pass
+    void drawSkinnedModels(uint32_t currentImage, MeshBindings &bindings);
+
+    // Hot reload
+    // Start reloading the models and textures of the files changed since the last frame
+    void processFileChanges();
+    void processTextureReloads();
+    void destroyTextureReload(TextureReload &reload);
+    // Hand a grown per frame buffer over to retiredResources, buffer and memory are reset
+    void retireBuffer(vk::Buffer &buffer, MemoryAllocation &memory);
+    // Destroy the retired resources no frame in flight uses anymore, or all of them once the device is idle
+    void releaseRetiredResources(bool isDeviceIdle);
+    // Cache, overdraw and fetch reordering of freshly imported meshes on the workers, prints ACMR/ATVR
+    void optimizeMeshes(std::vector<MeshData> &meshes);
+    // Replace meshes too large for 16 bits indices by chunks that fit
+    void splitLargeMeshes(std::vector<MeshData> &meshes, std::vector<uint32_t> *sourceMeshes = nullptr);
+    // Simplified levels of detail for every mesh on the workers, prints the triangle count of each level
+    void generateMeshLods(std::vector<MeshData> &meshes);
+    // Meshlets of the full level of every mesh on the workers
+    void buildMeshlets(std::vector<MeshData> &meshes);
 
     // Sampler
     void createTextureSampler();
     int createTextureDescriptor(vk::ImageView textureImageView);
+    vk::DescriptorSet allocateTextureDescriptorSet(vk::ImageView textureImageView);
     void createColorBufferImage();
 };
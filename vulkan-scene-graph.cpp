@@ -0,0 +1,96 @@
+#include "vulkan-scene-graph.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+uint32_t SceneGraph::addNode(uint32_t parent, const glm::mat4 &localTransform, const std::string &name)
+{
+    uint32_t node = static_cast<uint32_t>(parents.size());
+    // The parent's subtree must end right here, or the new node would split another subtree's range
+    if (parent != NO_PARENT && (parent >= node || parent + subtreeSizes[parent] != node))
+    {
+        throw std::runtime_error("Scene graph nodes must be added in depth first order");
+    }
+
+    parents.push_back(parent);
+    subtreeSizes.push_back(1);
+    localTransforms.push_back(localTransform);
+    worldTransforms.push_back(parent == NO_PARENT ? localTransform : worldTransforms[parent] * localTransform);
+    names.push_back(name);
+    dirtyFlags.push_back(0);
+    for (uint32_t ancestor = parent; ancestor != NO_PARENT; ancestor = parents[ancestor])
+    {
+        subtreeSizes[ancestor]++;
+    }
+    return node;
+}
+
+void SceneGraph::reserve(size_t nodeCount)
+{
+    parents.reserve(nodeCount);
+    subtreeSizes.reserve(nodeCount);
+    localTransforms.reserve(nodeCount);
+    worldTransforms.reserve(nodeCount);
+    names.reserve(nodeCount);
+    dirtyFlags.reserve(nodeCount);
+}
+
+uint32_t SceneGraph::findNode(const std::string &name) const
+{
+    auto found = std::find(names.begin(), names.end(), name);
+    return found != names.end() ? static_cast<uint32_t>(found - names.begin()) : NO_PARENT;
+}
+
+void SceneGraph::setLocalTransform(uint32_t node, const glm::mat4 &localTransform)
+{
+    localTransforms[node] = localTransform;
+    if (!dirtyFlags[node])
+    {
+        dirtyFlags[node] = 1;
+        dirtyNodes.push_back(node);
+    }
+}
+
+size_t SceneGraph::updateWorldTransforms()
+{
+    if (dirtyNodes.empty())
+    {
+        return 0;
+    }
+
+    // In node order, a changed node inside a subtree already recomputed is skipped. Parents always come first, so
+    // the parent of every node of a range is either up to date before the range or recomputed earlier in it.
+    std::sort(dirtyNodes.begin(), dirtyNodes.end());
+    size_t updatedCount = 0;
+    uint32_t updatedEnd = 0;
+    for (uint32_t dirtyNode : dirtyNodes)
+    {
+        dirtyFlags[dirtyNode] = 0;
+        if (dirtyNode < updatedEnd)
+        {
+            continue;
+        }
+        updatedEnd = dirtyNode + subtreeSizes[dirtyNode];
+        for (uint32_t node = dirtyNode; node < updatedEnd; ++node)
+        {
+            uint32_t parent = parents[node];
+            worldTransforms[node] =
+                parent == NO_PARENT ? localTransforms[node] : worldTransforms[parent] * localTransforms[node];
+        }
+        updatedCount += subtreeSizes[dirtyNode];
+    }
+    dirtyNodes.clear();
+    return updatedCount;
+}
+
+void SceneGraph::updateAllWorldTransforms()
+{
+    for (uint32_t node = 0; node < parents.size(); ++node)
+    {
+        uint32_t parent = parents[node];
+        worldTransforms[node] =
+            parent == NO_PARENT ? localTransforms[node] : worldTransforms[parent] * localTransforms[node];
+        dirtyFlags[node] = 0;
+    }
+    dirtyNodes.clear();
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Transform hierarchy of a model, one node per aiNode, meshes pointing at the node they hang from.
+// Stored as flat arrays (structure of arrays) in depth first order: a node comes after its parent, and its subtree
+// is the contiguous range of subtreeSizes[node] nodes starting with it. Changing a local transform only flags the
+// node, updateWorldTransforms() then recomputes the flagged subtrees with one forward pass over each range.
+class SceneGraph
+{
+  public:
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+    // parent is NO_PARENT for a new root, otherwise the last node added or one of its ancestors, which keeps the
+    // depth first order. The world transform is computed right away.
+    uint32_t addNode(uint32_t parent, const glm::mat4 &localTransform, const std::string &name = "");
+    void reserve(size_t nodeCount);
+
+    size_t getNodeCount() const
+    {
+        return parents.size();
+    }
+    uint32_t getParent(uint32_t node) const
+    {
+        return parents[node];
+    }
+    const std::string &getName(uint32_t node) const
+    {
+        return names[node];
+    }
+    // First node with this name in depth first order, NO_PARENT if there is none
+    uint32_t findNode(const std::string &name) const;
+
+    const glm::mat4 &getLocalTransform(uint32_t node) const
+    {
+        return localTransforms[node];
+    }
+    void setLocalTransform(uint32_t node, const glm::mat4 &localTransform);
+    // Up to date once updateWorldTransforms() ran after the last change
+    const glm::mat4 &getWorldTransform(uint32_t node) const
+    {
+        return worldTransforms[node];
+    }
+
+    // Recompute the subtrees of the nodes changed since the last call, returns how many nodes were recomputed
+    size_t updateWorldTransforms();
+    // Every world transform from scratch, the cost the dirty flags save
+    void updateAllWorldTransforms();
+
+  private:
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> subtreeSizes;
+    std::vector<glm::mat4> localTransforms;
+    std::vector<glm::mat4> worldTransforms;
+    std::vector<std::string> names;
+    // A flag per node so that a node changed many times is listed once
+    std::vector<uint8_t> dirtyFlags;
+    std::vector<uint32_t> dirtyNodes;
+};
@@ -0,0 +1,175 @@
+#include "vulkan-skeletal-animation.h"
+
+#include <algorithm>
+#include <cmath>
+
+Skeleton::Skeleton(const SceneGraph &sceneGraph)
+{
+    size_t nodeCount = sceneGraph.getNodeCount();
+    parents.resize(nodeCount);
+    bindTransforms.resize(nodeCount);
+    bindTranslations.resize(nodeCount);
+    bindRotations.resize(nodeCount);
+    bindScales.resize(nodeCount);
+    for (uint32_t node = 0; node < nodeCount; ++node)
+    {
+        parents[node] = sceneGraph.getParent(node);
+        const glm::mat4 &transform = sceneGraph.getLocalTransform(node);
+        bindTransforms[node] = transform;
+
+        // Translation, then the column lengths as scale, the rotation being what is left once they are divided out
+        bindTranslations[node] = glm::vec3(transform[3]);
+        glm::mat3 rotation(transform);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            bindScales[node][axis] = glm::length(rotation[axis]);
+            if (bindScales[node][axis] > 0.0f)
+            {
+                rotation[axis] /= bindScales[node][axis];
+            }
+        }
+        bindRotations[node] = glm::normalize(glm::quat_cast(rotation));
+    }
+}
+
+// Key at or before time in range and the interpolation factor towards the next one, 0 outside of the keys
+static uint32_t findKey(const std::vector<float> &times, const KeyRange &range, float time, float *factor)
+{
+    const float *first = times.data() + range.first;
+    const float *last = first + range.count;
+    const float *next = std::upper_bound(first, last, time);
+    *factor = 0.0f;
+    if (next == first)
+    {
+        return range.first;
+    }
+    if (next == last)
+    {
+        return range.first + range.count - 1;
+    }
+    float previousTime = next[-1];
+    if (*next > previousTime)
+    {
+        *factor = (time - previousTime) / (*next - previousTime);
+    }
+    return range.first + static_cast<uint32_t>(next - first) - 1;
+}
+
+static glm::vec3 sampleVectorKeys(const std::vector<float> &times, const std::vector<glm::vec3> &values,
+                                  const KeyRange &range, float time)
+{
+    float factor;
+    uint32_t key = findKey(times, range, time, &factor);
+    return factor > 0.0f ? glm::mix(values[key], values[key + 1], factor) : values[key];
+}
+
+static glm::quat sampleRotationKeys(const AnimationClip &clip, const KeyRange &range, float time)
+{
+    float factor;
+    uint32_t key = findKey(clip.rotationTimes, range, time, &factor);
+    return factor > 0.0f ? glm::slerp(clip.rotations[key], clip.rotations[key + 1], factor) : clip.rotations[key];
+}
+
+void Skeleton::evaluate(const AnimationClip *clip, float time, glm::mat4 *nodeTransforms) const
+{
+    if (clip && clip->duration > 0.0f)
+    {
+        time = std::fmod(time, clip->duration);
+        time = time < 0.0f ? time + clip->duration : time;
+    }
+
+    // Parents come first, a single forward pass composes the whole hierarchy
+    for (uint32_t node = 0; node < parents.size(); ++node)
+    {
+        glm::mat4 localTransform;
+        const KeyRange *translationRange = clip ? &clip->translationRanges[node] : nullptr;
+        const KeyRange *rotationRange = clip ? &clip->rotationRanges[node] : nullptr;
+        const KeyRange *scaleRange = clip ? &clip->scaleRanges[node] : nullptr;
+        if (!clip || (translationRange->count == 0 && rotationRange->count == 0 && scaleRange->count == 0))
+        {
+            localTransform = bindTransforms[node];
+        }
+        else
+        {
+            glm::vec3 translation = translationRange->count > 0
+                                        ? sampleVectorKeys(clip->translationTimes, clip->translations,
+                                                           *translationRange, time)
+                                        : bindTranslations[node];
+            glm::quat rotation =
+                rotationRange->count > 0 ? sampleRotationKeys(*clip, *rotationRange, time) : bindRotations[node];
+            glm::vec3 scale = scaleRange->count > 0
+                                  ? sampleVectorKeys(clip->scaleTimes, clip->scales, *scaleRange, time)
+                                  : bindScales[node];
+
+            // Translation * rotation * scale, without the two matrix products
+            localTransform = glm::mat4_cast(rotation);
+            localTransform[0] *= scale.x;
+            localTransform[1] *= scale.y;
+            localTransform[2] *= scale.z;
+            localTransform[3] = glm::vec4(translation, 1.0f);
+        }
+        uint32_t parent = parents[node];
+        nodeTransforms[node] =
+            parent == SceneGraph::NO_PARENT ? localTransform : nodeTransforms[parent] * localTransform;
+    }
+}
+
+void Skeleton::computePalette(const Skin &skin, const glm::mat4 *nodeTransforms, glm::mat4 *palette)
+{
+    for (size_t joint = 0; joint < skin.jointNodes.size(); ++joint)
+    {
+        palette[joint] = nodeTransforms[skin.jointNodes[joint]] * skin.inverseBindMatrices[joint];
+    }
+}
+
+void Skeleton::skinVertices(const Vertex *vertices, const VertexSkin *skins, size_t vertexCount,
+                            const glm::mat4 *palette, Vertex *skinnedVertices)
+{
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        glm::vec4 position(vertices[i].pos, 1.0f);
+        glm::vec4 skinnedPosition(0.0f);
+        for (int influence = 0; influence < 4; ++influence)
+        {
+            if (skins[i].weights[influence] == 0)
+            {
+                continue;
+            }
+            skinnedPosition += palette[skins[i].joints[influence]] * position *
+                               (skins[i].weights[influence] * (1.0f / 65535.0f));
+        }
+        skinnedVertices[i].pos = glm::vec3(skinnedPosition);
+        skinnedVertices[i].col = vertices[i].col;
+        skinnedVertices[i].tex = vertices[i].tex;
+    }
+}
+
+VertexSkin Skeleton::packVertexSkin(std::vector<JointWeight> &influences)
+{
+    VertexSkin skin{};
+    size_t influenceCount = std::min<size_t>(influences.size(), 4);
+    std::partial_sort(influences.begin(), influences.begin() + influenceCount, influences.end(),
+                      [](const JointWeight &first, const JointWeight &second) { return first.weight > second.weight; });
+    float weightSum = 0.0f;
+    for (size_t i = 0; i < influenceCount; ++i)
+    {
+        weightSum += std::max(influences[i].weight, 0.0f);
+    }
+    if (weightSum <= 0.0f)
+    {
+        skin.weights[0] = 65535;
+        return skin;
+    }
+
+    // Rounding error goes to the largest weight, so that the vertex is never scaled
+    uint32_t quantizedSum = 0;
+    for (size_t i = 0; i < influenceCount; ++i)
+    {
+        skin.joints[i] = static_cast<uint16_t>(influences[i].joint);
+        skin.weights[i] =
+            static_cast<uint16_t>(std::lround(std::max(influences[i].weight, 0.0f) / weightSum * 65535.0f));
+        quantizedSum += skin.weights[i];
+    }
+    skin.weights[0] = static_cast<uint16_t>(skin.weights[0] + 65535 - static_cast<int32_t>(quantizedSum));
+    return skin;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "vulkan-scene-graph.h"
+#include "vulkan-utilities.h"
+
+// Up to four joints per vertex, indices into the palette of the vertex's mesh. Weights are unorm16 summing to 65535,
+// so the whole record is read as a single uvec4 by shaders/skinning.comp.
+struct VertexSkin
+{
+    uint16_t joints[4];
+    uint16_t weights[4];
+};
+
+// Influence of a joint on a vertex, as imported
+struct JointWeight
+{
+    uint32_t joint;
+    float weight;
+};
+
+// Joints of a mesh: palette matrix i is the model space transform of scene graph node jointNodes[i] times
+// inverseBindMatrices[i], which takes the vertices from mesh space (bind pose) to that joint's space.
+// A mesh without bones gets a single joint, its own node with an identity matrix, and moves rigidly with it.
+struct Skin
+{
+    std::vector<uint32_t> jointNodes;
+    std::vector<glm::mat4> inverseBindMatrices;
+};
+
+// Keys of one node for one kind of channel, a range of an AnimationClip key array. count 0: not animated.
+struct KeyRange
+{
+    uint32_t first{0};
+    uint32_t count{0};
+};
+
+// Keyframes of every animated node of a model, times in seconds. Stored as structure of arrays: the key times of
+// all the nodes one after the other, apart from their values, so that finding the keys around the current time
+// only walks a dense array of floats. Node ranges are indexed by scene graph node, for the whole graph.
+struct AnimationClip
+{
+    std::string name;
+    float duration{0.0f};
+    std::vector<KeyRange> translationRanges;
+    std::vector<KeyRange> rotationRanges;
+    std::vector<KeyRange> scaleRanges;
+    std::vector<float> translationTimes;
+    std::vector<glm::vec3> translations;
+    std::vector<float> rotationTimes;
+    std::vector<glm::quat> rotations;
+    std::vector<float> scaleTimes;
+    std::vector<glm::vec3> scales;
+};
+
+// Node hierarchy of a skinned model, evaluated from scratch every frame for each instance: unlike SceneGraph, there
+// are no dirty flags, an animation moving every joint anyway. The bind pose is kept as local matrices, and as
+// translation, rotation and scale arrays for the channels a clip leaves out.
+class Skeleton
+{
+  public:
+    Skeleton() = default;
+    // The hierarchy and the local transforms of sceneGraph as bind pose
+    explicit Skeleton(const SceneGraph &sceneGraph);
+
+    size_t getNodeCount() const
+    {
+        return parents.size();
+    }
+
+    // Model space transform of every node at time, looped over the clip duration, into nodeTransforms (node
+    // count matrices). A null clip gives the bind pose.
+    void evaluate(const AnimationClip *clip, float time, glm::mat4 *nodeTransforms) const;
+
+    // Joint matrices of skin from evaluated node transforms, into palette (joint count matrices)
+    static void computePalette(const Skin &skin, const glm::mat4 *nodeTransforms, glm::mat4 *palette);
+    // Reference CPU skinning of vertexCount vertices, the work the compute pass does on the GPU. Positions are
+    // transformed, colors and texture coordinates copied.
+    static void skinVertices(const Vertex *vertices, const VertexSkin *skins, size_t vertexCount,
+                             const glm::mat4 *palette, Vertex *skinnedVertices);
+    // The four largest influences, normalized and quantized so that the weights sum to exactly 65535.
+    // A vertex without influence is bound to joint 0.
+    static VertexSkin packVertexSkin(std::vector<JointWeight> &influences);
+
+  private:
+    std::vector<uint32_t> parents;
+    std::vector<glm::mat4> bindTransforms;
+    std::vector<glm::vec3> bindTranslations;
+    std::vector<glm::quat> bindRotations;
+    std::vector<glm::vec3> bindScales;
+};
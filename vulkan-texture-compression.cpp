@@ -0,0 +1,385 @@
+#include "vulkan-texture-compression.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static uint16_t packColor565(const float color[3])
+{
+    int r = std::min(std::max(static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f), 0), 31);
+    int g = std::min(std::max(static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f), 0), 63);
+    int b = std::min(std::max(static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f), 0), 31);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void unpackColor565(uint16_t packed, float color[3])
+{
+    // Same bit replication as the hardware decoder
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = static_cast<float>((r << 3) | (r >> 2));
+    color[1] = static_cast<float>((g << 2) | (g >> 4));
+    color[2] = static_cast<float>((b << 3) | (b >> 2));
+}
+
+// Choose for each of the 16 texels its closest entry in the 4 colors palette, returns the total squared error
+static float findColorIndices(const float channels[3][16], const float palette[4][3], uint32_t indices[16])
+{
+    float error = 0.0f;
+#if defined(__SSE2__)
+    // Four texels at a time, one register per channel
+    for (int group = 0; group < 16; group += 4)
+    {
+        __m128 red = _mm_loadu_ps(&channels[0][group]);
+        __m128 green = _mm_loadu_ps(&channels[1][group]);
+        __m128 blue = _mm_loadu_ps(&channels[2][group]);
+        __m128 bestDistance = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int entry = 0; entry < 4; ++entry)
+        {
+            __m128 deltaRed = _mm_sub_ps(red, _mm_set1_ps(palette[entry][0]));
+            __m128 deltaGreen = _mm_sub_ps(green, _mm_set1_ps(palette[entry][1]));
+            __m128 deltaBlue = _mm_sub_ps(blue, _mm_set1_ps(palette[entry][2]));
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(deltaRed, deltaRed), _mm_mul_ps(deltaGreen, deltaGreen)),
+                                         _mm_mul_ps(deltaBlue, deltaBlue));
+            // Select the entry where it is strictly closer than the best so far
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, bestDistance));
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(entry)), _mm_andnot_si128(closer, bestIndex));
+            bestDistance = _mm_min_ps(distance, bestDistance);
+        }
+        alignas(16) int32_t groupIndices[4];
+        alignas(16) float groupDistances[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(groupIndices), bestIndex);
+        _mm_store_ps(groupDistances, bestDistance);
+        for (int i = 0; i < 4; ++i)
+        {
+            indices[group + i] = static_cast<uint32_t>(groupIndices[i]);
+            error += groupDistances[i];
+        }
+    }
+#else
+    for (int i = 0; i < 16; ++i)
+    {
+        float bestDistance = FLT_MAX;
+        for (uint32_t entry = 0; entry < 4; ++entry)
+        {
+            float distance = 0.0f;
+            for (int channel = 0; channel < 3; ++channel)
+            {
+                float delta = channels[channel][i] - palette[entry][channel];
+                distance += delta * delta;
+            }
+            if (distance < bestDistance)
+            {
+                bestDistance = distance;
+                indices[i] = entry;
+            }
+        }
+        error += bestDistance;
+    }
+#endif
+    return error;
+}
+
+static float evaluateEndpoints(const float channels[3][16], uint16_t color0, uint16_t color1, uint32_t indices[16])
+{
+    // 4 colors mode palette: both endpoints and two interpolated colors
+    float palette[4][3];
+    unpackColor565(color0, palette[0]);
+    unpackColor565(color1, palette[1]);
+    for (int channel = 0; channel < 3; ++channel)
+    {
+        palette[2][channel] = std::floor((2.0f * palette[0][channel] + palette[1][channel]) / 3.0f);
+        palette[3][channel] = std::floor((palette[0][channel] + 2.0f * palette[1][channel]) / 3.0f);
+    }
+    return findColorIndices(channels, palette, indices);
+}
+
+static void encodeColorBlock(const unsigned char *texels, unsigned char *block)
+{
+    float channels[3][16];
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    float minimum[3] = {255.0f, 255.0f, 255.0f};
+    float maximum[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; ++i)
+    {
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            channels[channel][i] = texels[i * 4 + channel];
+            mean[channel] += channels[channel][i] / 16.0f;
+            minimum[channel] = std::min(minimum[channel], channels[channel][i]);
+            maximum[channel] = std::max(maximum[channel], channels[channel][i]);
+        }
+    }
+
+    // Principal axis of the colors (range fit): covariance matrix, then a few power iterations
+    float covariance[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; ++i)
+    {
+        float r = channels[0][i] - mean[0];
+        float g = channels[1][i] - mean[1];
+        float b = channels[2][i] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+    float axis[3] = {maximum[0] - minimum[0], maximum[1] - minimum[1], maximum[2] - minimum[2]};
+    for (int iteration = 0; iteration < 4; ++iteration)
+    {
+        float next[3] = {covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+                         covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+                         covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]};
+        float length = std::max(std::max(std::fabs(next[0]), std::fabs(next[1])), std::fabs(next[2]));
+        if (length < 1e-6f)
+        {
+            break;
+        }
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            axis[channel] = next[channel] / length;
+        }
+    }
+    float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    if (axisLength < 1e-6f)
+    {
+        // Flat block
+        axis[0] = axis[1] = axis[2] = 0.57735f;
+        axisLength = 1.0f;
+    }
+    for (int channel = 0; channel < 3; ++channel)
+    {
+        axis[channel] /= axisLength;
+    }
+
+    // Endpoints at the extremes of the projection of the colors on the axis
+    float minimumProjection = FLT_MAX;
+    float maximumProjection = -FLT_MAX;
+    for (int i = 0; i < 16; ++i)
+    {
+        float projection = (channels[0][i] - mean[0]) * axis[0] + (channels[1][i] - mean[1]) * axis[1] +
+                           (channels[2][i] - mean[2]) * axis[2];
+        minimumProjection = std::min(minimumProjection, projection);
+        maximumProjection = std::max(maximumProjection, projection);
+    }
+    float endpoint0[3];
+    float endpoint1[3];
+    for (int channel = 0; channel < 3; ++channel)
+    {
+        endpoint0[channel] = mean[channel] + axis[channel] * maximumProjection;
+        endpoint1[channel] = mean[channel] + axis[channel] * minimumProjection;
+    }
+    uint16_t color0 = packColor565(endpoint0);
+    uint16_t color1 = packColor565(endpoint1);
+    uint32_t indices[16];
+    float error = evaluateEndpoints(channels, color0, color1, indices);
+
+    // One least squares refinement of the endpoints with the chosen indices
+    const float weights0[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[3] = {0.0f, 0.0f, 0.0f};
+    float bx[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; ++i)
+    {
+        float alpha = weights0[indices[i]];
+        float beta = 1.0f - alpha;
+        aa += alpha * alpha;
+        ab += alpha * beta;
+        bb += beta * beta;
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            ax[channel] += alpha * channels[channel][i];
+            bx[channel] += beta * channels[channel][i];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) > 1e-6f)
+    {
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            endpoint0[channel] = std::min(std::max((ax[channel] * bb - bx[channel] * ab) / determinant, 0.0f), 255.0f);
+            endpoint1[channel] = std::min(std::max((bx[channel] * aa - ax[channel] * ab) / determinant, 0.0f), 255.0f);
+        }
+        uint16_t refinedColor0 = packColor565(endpoint0);
+        uint16_t refinedColor1 = packColor565(endpoint1);
+        uint32_t refinedIndices[16];
+        float refinedError = evaluateEndpoints(channels, refinedColor0, refinedColor1, refinedIndices);
+        if (refinedError < error)
+        {
+            color0 = refinedColor0;
+            color1 = refinedColor1;
+            memcpy(indices, refinedIndices, sizeof(indices));
+        }
+    }
+
+    // The decoder uses 4 colors mode only when color0 > color1: swap endpoints and their indices if needed
+    if (color0 < color1)
+    {
+        std::swap(color0, color1);
+        for (auto &index : indices)
+        {
+            index ^= 1;
+        }
+    }
+    else if (color0 == color1)
+    {
+        memset(indices, 0, sizeof(indices));
+    }
+
+    uint32_t packedIndices = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        packedIndices |= indices[i] << (2 * i);
+    }
+    block[0] = color0 & 0xff;
+    block[1] = color0 >> 8;
+    block[2] = color1 & 0xff;
+    block[3] = color1 >> 8;
+    for (int i = 0; i < 4; ++i)
+    {
+        block[4 + i] = (packedIndices >> (8 * i)) & 0xff;
+    }
+}
+
+static void encodeAlphaBlock(const unsigned char *texels, unsigned char *block)
+{
+    int minimum = 255;
+    int maximum = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        minimum = std::min(minimum, static_cast<int>(texels[i * 4 + 3]));
+        maximum = std::max(maximum, static_cast<int>(texels[i * 4 + 3]));
+    }
+
+    // 8 alphas mode (alpha0 > alpha1): both endpoints and 6 interpolated values
+    int palette[8];
+    palette[0] = maximum;
+    palette[1] = minimum;
+    for (int i = 1; i < 7; ++i)
+    {
+        palette[i + 1] = ((7 - i) * maximum + i * minimum) / 7;
+    }
+
+    uint64_t packedIndices = 0;
+    if (maximum > minimum)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            int alpha = texels[i * 4 + 3];
+            uint64_t bestIndex = 0;
+            int bestDistance = 256;
+            for (int entry = 0; entry < 8; ++entry)
+            {
+                int distance = std::abs(alpha - palette[entry]);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    bestIndex = entry;
+                }
+            }
+            packedIndices |= bestIndex << (3 * i);
+        }
+    }
+    // Otherwise constant alpha: every index 0 picks alpha0
+
+    block[0] = static_cast<unsigned char>(maximum);
+    block[1] = static_cast<unsigned char>(minimum);
+    for (int i = 0; i < 6; ++i)
+    {
+        block[2 + i] = (packedIndices >> (8 * i)) & 0xff;
+    }
+}
+
+void TextureCompression::encodeBC1Block(const unsigned char *texels, unsigned char *block)
+{
+    encodeColorBlock(texels, block);
+}
+
+void TextureCompression::encodeBC3Block(const unsigned char *texels, unsigned char *block)
+{
+    // Alpha block first, then a BC1 color block
+    encodeAlphaBlock(texels, block);
+    encodeColorBlock(texels, block + 8);
+}
+
+bool TextureCompression::hasAlpha(const unsigned char *pixels, uint32_t width, uint32_t height)
+{
+    size_t texelCount = static_cast<size_t>(width) * height;
+    for (size_t i = 0; i < texelCount; ++i)
+    {
+        if (pixels[i * 4 + 3] != 255)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<unsigned char> TextureCompression::compressMipChain(const unsigned char *mipChain, uint32_t width,
+                                                                uint32_t height, const std::vector<uint64_t> &levelOffsets,
+                                                                BlockFormat format, ThreadPool &threadPool,
+                                                                std::vector<uint64_t> &compressedLevelOffsets,
+                                                                std::vector<uint64_t> &compressedLevelSizes)
+{
+    size_t blockSize = getBlockSize(format);
+
+    // Lay out the compressed levels
+    compressedLevelOffsets.resize(levelOffsets.size());
+    compressedLevelSizes.resize(levelOffsets.size());
+    uint64_t offset = 0;
+    for (uint32_t level = 0; level < levelOffsets.size(); ++level)
+    {
+        compressedLevelOffsets[level] = offset;
+        compressedLevelSizes[level] =
+            getLevelSize(format, std::max(width >> level, 1u), std::max(height >> level, 1u));
+        offset = (offset + compressedLevelSizes[level] + 15) & ~uint64_t(15);
+    }
+    std::vector<unsigned char> compressed(offset, 0);
+
+    for (uint32_t level = 0; level < levelOffsets.size(); ++level)
+    {
+        const unsigned char *pixels = mipChain + levelOffsets[level];
+        unsigned char *blocks = compressed.data() + compressedLevelOffsets[level];
+        uint32_t levelWidth = std::max(width >> level, 1u);
+        uint32_t levelHeight = std::max(height >> level, 1u);
+        uint32_t blocksX = (levelWidth + 3) / 4;
+        uint32_t blocksY = (levelHeight + 3) / 4;
+
+        // One task per row of blocks
+        threadPool.parallelFor(blocksY, [&](size_t blockY) {
+            unsigned char texels[64];
+            for (uint32_t blockX = 0; blockX < blocksX; ++blockX)
+            {
+                // Gather the 4x4 texels, repeating the last row/column on partial blocks
+                for (uint32_t y = 0; y < 4; ++y)
+                {
+                    uint32_t pixelY = std::min(static_cast<uint32_t>(blockY) * 4 + y, levelHeight - 1);
+                    for (uint32_t x = 0; x < 4; ++x)
+                    {
+                        uint32_t pixelX = std::min(blockX * 4 + x, levelWidth - 1);
+                        memcpy(texels + (y * 4 + x) * 4, pixels + (static_cast<size_t>(pixelY) * levelWidth + pixelX) * 4,
+                               4);
+                    }
+                }
+                unsigned char *block = blocks + (blockY * blocksX + blockX) * blockSize;
+                if (format == BlockFormat::BC1)
+                {
+                    encodeBC1Block(texels, block);
+                }
+                else
+                {
+                    encodeBC3Block(texels, block);
+                }
+            }
+        });
+    }
+    return compressed;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "vulkan-thread-pool.h"
+
+// CPU block compression of RGBA8 mip chains, done once at import time and stored in the texture container.
+// BC1 (8 bytes per 4x4 block) is used for opaque images, BC3 (16 bytes per block) when alpha is needed.
+enum class BlockFormat
+{
+    BC1,
+    BC3
+};
+
+class TextureCompression
+{
+  public:
+    // Encode one 4x4 block of RGBA8 texels (row major, 64 bytes)
+    static void encodeBC1Block(const unsigned char *texels, unsigned char *block);
+    static void encodeBC3Block(const unsigned char *texels, unsigned char *block);
+
+    static size_t getBlockSize(BlockFormat format)
+    {
+        return format == BlockFormat::BC1 ? 8 : 16;
+    }
+    static uint64_t getLevelSize(BlockFormat format, uint32_t width, uint32_t height)
+    {
+        return uint64_t((width + 3) / 4) * ((height + 3) / 4) * getBlockSize(format);
+    }
+
+    // BC1 cannot store partial transparency, look for any texel that is not fully opaque
+    static bool hasAlpha(const unsigned char *pixels, uint32_t width, uint32_t height);
+
+    // Compress an RGBA8 mip chain as laid out by TextureContainer::buildMipChain.
+    // Block rows of every level are spread over threadPool. Output levels are packed on 16 bytes boundaries.
+    static std::vector<unsigned char> compressMipChain(const unsigned char *mipChain, uint32_t width, uint32_t height,
+                                                       const std::vector<uint64_t> &levelOffsets, BlockFormat format,
+                                                       ThreadPool &threadPool,
+                                                       std::vector<uint64_t> &compressedLevelOffsets,
+                                                       std::vector<uint64_t> &compressedLevelSizes);
+};
@@ -0,0 +1,235 @@
+#include "vulkan-texture-container.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "vulkan-utilities.h"
+
+static uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + 15) & ~uint64_t(15);
+}
+
+// Unique to the writer: textures are decoded on several workers, and by several loads at once
+static std::string getTemporaryPath(const std::string &path)
+{
+    static std::atomic<uint64_t> writerCount{0};
+    return path + "." + std::to_string(getpid()) + "." + std::to_string(writerCount++) + ".tmp";
+}
+
+TextureContainer::~TextureContainer()
+{
+    close();
+}
+
+std::string TextureContainer::getContainerPath(const std::string &sourcePath)
+{
+    return sourcePath + ".vktex";
+}
+
+bool TextureContainer::open(const std::string &sourcePath)
+{
+    close();
+
+    int fd = ::open(getContainerPath(sourcePath).c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat containerStat;
+    if (fstat(fd, &containerStat) != 0 || static_cast<size_t>(containerStat.st_size) < sizeof(TextureContainerHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    mappingSize = static_cast<size_t>(containerStat.st_size);
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        mapping = nullptr;
+        mappingSize = 0;
+        return false;
+    }
+    header = static_cast<const TextureContainerHeader *>(mapping);
+
+    // Unlike meshes, a touched texture is simply converted again: no need to hash megabytes of JPEG
+    uint64_t sourceSize;
+    int64_t sourceModifiedTime;
+    bool isOutdated = getFileStat(sourcePath, &sourceSize, &sourceModifiedTime) &&
+                      (sourceSize != header->sourceSize || sourceModifiedTime != header->sourceModifiedTime);
+    if (header->magic != MAGIC || header->version != VERSION || isOutdated ||
+        header->mipLevels == 0 || header->mipLevels > TextureContainerHeader::MAX_LEVELS ||
+        header->dataOffset > mappingSize || header->dataSize > mappingSize - header->dataOffset)
+    {
+        close();
+        return false;
+    }
+    // Every level inside the data, a truncated or corrupted file would otherwise be copied out of bounds
+    for (uint32_t level = 0; level < header->mipLevels; ++level)
+    {
+        if (header->levelSizes[level] == 0 || header->levelSizes[level] > header->dataSize ||
+            header->levelOffsets[level] > header->dataSize - header->levelSizes[level])
+        {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void TextureContainer::close()
+{
+    if (mapping)
+    {
+        munmap(mapping, mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    header = nullptr;
+}
+
+bool TextureContainer::write(const std::string &sourcePath, uint64_t sourceHash, uint32_t format, uint32_t width,
+                             uint32_t height, const std::vector<uint64_t> &levelOffsets,
+                             const std::vector<uint64_t> &levelSizes, const unsigned char *data, uint64_t dataSize)
+{
+    if (levelOffsets.size() > TextureContainerHeader::MAX_LEVELS)
+    {
+        return false;
+    }
+
+    TextureContainerHeader header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.format = format;
+    header.width = width;
+    header.height = height;
+    header.mipLevels = static_cast<uint32_t>(levelOffsets.size());
+    if (!getFileStat(sourcePath, &header.sourceSize, &header.sourceModifiedTime))
+    {
+        return false;
+    }
+    header.sourceHash = sourceHash;
+    header.dataOffset = alignOffset(sizeof(TextureContainerHeader));
+    header.dataSize = dataSize;
+    for (size_t level = 0; level < levelOffsets.size(); ++level)
+    {
+        header.levelOffsets[level] = levelOffsets[level];
+        header.levelSizes[level] = levelSizes[level];
+    }
+
+    // Written under a temporary name then renamed, a crash never leaves a truncated container. The name is unique
+    // to the writer: two runs or two loads converting the same texture each write their own file, the last rename
+    // wins.
+    std::string containerPath = getContainerPath(sourcePath);
+    std::string temporaryPath = getTemporaryPath(containerPath);
+    {
+        std::ofstream file{temporaryPath, std::ios::binary | std::ios::trunc};
+        if (!file.is_open())
+        {
+            return false;
+        }
+        std::vector<char> headerBytes(header.dataOffset, 0);
+        memcpy(headerBytes.data(), &header, sizeof(TextureContainerHeader));
+        file.write(headerBytes.data(), headerBytes.size());
+        file.write(reinterpret_cast<const char *>(data), dataSize);
+        file.close();
+        if (file.fail())
+        {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporaryPath.c_str(), containerPath.c_str()) != 0)
+    {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::vector<unsigned char> TextureContainer::buildMipChain(const unsigned char *pixels, uint32_t width,
+                                                           uint32_t height, std::vector<uint64_t> &levelOffsets,
+                                                           std::vector<uint64_t> &levelSizes)
+{
+    uint32_t mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+    mipLevels = std::min(mipLevels, TextureContainerHeader::MAX_LEVELS);
+
+    // Lay out every level first
+    levelOffsets.resize(mipLevels);
+    levelSizes.resize(mipLevels);
+    uint64_t offset = 0;
+    for (uint32_t level = 0; level < mipLevels; ++level)
+    {
+        uint64_t levelWidth = std::max(width >> level, 1u);
+        uint64_t levelHeight = std::max(height >> level, 1u);
+        levelOffsets[level] = offset;
+        levelSizes[level] = levelWidth * levelHeight * 4;
+        offset = alignOffset(offset + levelSizes[level]);
+    }
+    std::vector<unsigned char> data(offset, 0);
+    memcpy(data.data(), pixels, levelSizes[0]);
+
+    // Tent filter weights over the 4 source texels around each destination texel
+    const float weights[4] = {1.0f / 8.0f, 3.0f / 8.0f, 3.0f / 8.0f, 1.0f / 8.0f};
+    std::vector<float> rows;
+    for (uint32_t level = 1; level < mipLevels; ++level)
+    {
+        const unsigned char *src = data.data() + levelOffsets[level - 1];
+        unsigned char *dst = data.data() + levelOffsets[level];
+        int srcWidth = std::max(width >> (level - 1), 1u);
+        int srcHeight = std::max(height >> (level - 1), 1u);
+        int dstWidth = std::max(width >> level, 1u);
+        int dstHeight = std::max(height >> level, 1u);
+
+        // Horizontal pass into a float buffer (keeps precision between the two passes)
+        rows.assign(static_cast<size_t>(dstWidth) * srcHeight * 4, 0.0f);
+        for (int y = 0; y < srcHeight; ++y)
+        {
+            for (int x = 0; x < dstWidth; ++x)
+            {
+                float *out = &rows[(static_cast<size_t>(y) * dstWidth + x) * 4];
+                for (int tap = 0; tap < 4; ++tap)
+                {
+                    // A dimension already at 1 is only copied
+                    int srcX = srcWidth == 1 ? 0 : std::min(std::max(2 * x - 1 + tap, 0), srcWidth - 1);
+                    const unsigned char *texel = src + (static_cast<size_t>(y) * srcWidth + srcX) * 4;
+                    for (int channel = 0; channel < 4; ++channel)
+                    {
+                        out[channel] += weights[tap] * texel[channel];
+                    }
+                }
+            }
+        }
+        // Vertical pass, rounded back to 8 bits
+        for (int y = 0; y < dstHeight; ++y)
+        {
+            for (int x = 0; x < dstWidth; ++x)
+            {
+                float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                for (int tap = 0; tap < 4; ++tap)
+                {
+                    int srcY = srcHeight == 1 ? 0 : std::min(std::max(2 * y - 1 + tap, 0), srcHeight - 1);
+                    const float *row = &rows[(static_cast<size_t>(srcY) * dstWidth + x) * 4];
+                    for (int channel = 0; channel < 4; ++channel)
+                    {
+                        sum[channel] += weights[tap] * row[channel];
+                    }
+                }
+                unsigned char *texel = dst + (static_cast<size_t>(y) * dstWidth + x) * 4;
+                for (int channel = 0; channel < 4; ++channel)
+                {
+                    texel[channel] = static_cast<unsigned char>(std::min(sum[channel] + 0.5f, 255.0f));
+                }
+            }
+        }
+    }
+    return data;
+}
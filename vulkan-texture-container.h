@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Texture converted once with its whole mip chain pre-filtered on the CPU, stored as <texture>.vktex
+// next to the source image. Loading it is a memory map plus one buffer to image copy, no decoding
+// and no blit chain on the GPU.
+//
+// File layout:
+//   TextureContainerHeader
+//   Level data, each level starting on a 16 bytes boundary, largest level first
+struct TextureContainerHeader
+{
+    static constexpr uint32_t MAX_LEVELS = 16;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format; // VkFormat of the level data
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint64_t sourceSize;
+    int64_t sourceModifiedTime; // Nanoseconds since epoch
+    uint64_t sourceHash;        // Hash of the encoded source file, used by the texture cache
+    uint64_t dataOffset;        // Start of the level data from the start of the file
+    uint64_t dataSize;
+    uint64_t levelOffsets[MAX_LEVELS]; // From dataOffset
+    uint64_t levelSizes[MAX_LEVELS];
+};
+
+class TextureContainer
+{
+  public:
+    static constexpr uint32_t MAGIC = 0x58544b56; // "VKTX"
+    static constexpr uint32_t VERSION = 1;
+
+    TextureContainer() = default;
+    ~TextureContainer();
+    TextureContainer(const TextureContainer &) = delete;
+    TextureContainer &operator=(const TextureContainer &) = delete;
+
+    // Map the container of sourcePath, returns false if it is missing or older than the source
+    bool open(const std::string &sourcePath);
+    void close();
+
+    static bool write(const std::string &sourcePath, uint64_t sourceHash, uint32_t format, uint32_t width,
+                      uint32_t height, const std::vector<uint64_t> &levelOffsets, const std::vector<uint64_t> &levelSizes,
+                      const unsigned char *data, uint64_t dataSize);
+    static std::string getContainerPath(const std::string &sourcePath);
+
+    // Downsample an RGBA8 image into its full mip chain, levels packed one after the other on 16 bytes boundaries.
+    // Each level is filtered from the previous one with a [1 3 3 1] tent kernel, smoother than a 2x2 box.
+    static std::vector<unsigned char> buildMipChain(const unsigned char *pixels, uint32_t width, uint32_t height,
+                                                    std::vector<uint64_t> &levelOffsets,
+                                                    std::vector<uint64_t> &levelSizes);
+
+    const TextureContainerHeader &getHeader() const
+    {
+        return *header;
+    }
+    // Level data, valid while the container stays open
+    const unsigned char *getData() const
+    {
+        return static_cast<const unsigned char *>(mapping) + header->dataOffset;
+    }
+
+  private:
+    void *mapping{nullptr};
+    size_t mappingSize{0};
+    const TextureContainerHeader *header{nullptr};
+};
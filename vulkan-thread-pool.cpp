@@ -0,0 +1,114 @@
+#include "vulkan-thread-pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        // hardware_concurrency may return 0 when it cannot tell
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            // Finish the queue before stopping
+            if (tasks.empty())
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &task)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Shared between the caller and the helpers, helpers may outlive this call
+    // if they only get scheduled after every index was already taken
+    struct Shared
+    {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::exception_ptr exception;
+    };
+    auto shared = std::make_shared<Shared>();
+    size_t total = count;
+
+    auto work = [shared, total, &task]() {
+        size_t index;
+        while ((index = shared->next.fetch_add(1)) < total)
+        {
+            try
+            {
+                task(index);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(shared->mutex);
+                if (!shared->exception)
+                {
+                    shared->exception = std::current_exception();
+                }
+            }
+            if (shared->done.fetch_add(1) + 1 == total)
+            {
+                std::lock_guard<std::mutex> lock(shared->mutex);
+                shared->finished.notify_all();
+            }
+        }
+    };
+
+    // Helpers never touch task once every index is claimed, so the reference stays valid
+    size_t helperCount = std::min(workers.size(), count - 1);
+    for (size_t i = 0; i < helperCount; ++i)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(work);
+    }
+    condition.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->finished.wait(lock, [&shared, total]() { return shared->done.load() == total; });
+    if (shared->exception)
+    {
+        std::rethrow_exception(shared->exception);
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads consuming a FIFO of tasks.
+// Used for CPU-side asset work (mesh conversion, texture decoding...) so the GPU thread only uploads.
+class ThreadPool
+{
+  public:
+    explicit ThreadPool(size_t threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t getThreadCount() const
+    {
+        return workers.size();
+    }
+
+    // Queue a task, its result (or exception) is retrieved through the returned future
+    template <typename Task> auto submit(Task &&task) -> std::future<decltype(task())>
+    {
+        using Result = decltype(task());
+        auto packagedTask = std::make_shared<std::packaged_task<Result()>>(std::forward<Task>(task));
+        std::future<Result> future = packagedTask->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([packagedTask]() { (*packagedTask)(); });
+        }
+        condition.notify_one();
+        return future;
+    }
+
+    // Run task(i) for every i in [0, count) and return once all of them are done.
+    // The calling thread takes part in the work, so it is safe to call from inside a task.
+    void parallelFor(size_t count, const std::function<void(size_t)> &task);
+
+  private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping{false};
+
+    void workerLoop();
+};
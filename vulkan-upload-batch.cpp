@@ -0,0 +1,261 @@
+#include "vulkan-upload-batch.h"
+
+#include <algorithm>
+#include <limits>
+
+UploadBatch::UploadBatch(DeviceMemoryAllocator &memoryAllocatorP, vk::Queue transferQueueP,
+                         vk::CommandPool transferCommandPoolP)
+    : memoryAllocator(memoryAllocatorP), device(memoryAllocatorP.getDevice()), transferQueue(transferQueueP),
+      transferCommandPool(transferCommandPoolP)
+{
+}
+
+UploadBatch::~UploadBatch()
+{
+    if (inFlightFence)
+    {
+        device.waitForFences(inFlightFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        isComplete();
+    }
+    recycleStaging();
+    for (auto &page : freePages)
+    {
+        destroyPage(page);
+    }
+}
+
+size_t UploadBatch::allocateStaging(vk::DeviceSize size, vk::DeviceSize *offset)
+{
+    // Keep copies 16 bytes aligned in the staging pages, enough for any vertex or index format
+    if (!stagingPages.empty())
+    {
+        StagingPage &page = stagingPages.back();
+        vk::DeviceSize alignedUsed = (page.used + 15) & ~vk::DeviceSize(15);
+        if (alignedUsed + size <= page.size)
+        {
+            *offset = alignedUsed;
+            page.used = alignedUsed + size;
+            return stagingPages.size() - 1;
+        }
+    }
+
+    // Current page is full, take a recycled one or open a new one. It stays mapped until the batch is destroyed.
+    StagingPage page{};
+    if (size <= STAGING_PAGE_SIZE && !freePages.empty())
+    {
+        page = freePages.back();
+        freePages.pop_back();
+    }
+    else
+    {
+        page.size = std::max(size, STAGING_PAGE_SIZE);
+        createBuffer(memoryAllocator, page.size, vk::BufferUsageFlagBits::eTransferSrc,
+                     vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                     &page.buffer, &page.memory);
+    }
+    page.used = size;
+    stagingPages.push_back(page);
+
+    *offset = 0;
+    return stagingPages.size() - 1;
+}
+
+void UploadBatch::uploadBuffer(const void *data, vk::DeviceSize size, vk::Buffer dstBuffer, vk::DeviceSize dstOffset)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    memcpy(stageBuffer(size, dstBuffer, dstOffset), data, static_cast<size_t>(size));
+}
+
+void *UploadBatch::stageBuffer(vk::DeviceSize size, vk::Buffer dstBuffer, vk::DeviceSize dstOffset)
+{
+    if (size == 0)
+    {
+        return nullptr;
+    }
+    vk::DeviceSize stagingOffset;
+    size_t pageIndex = allocateStaging(size, &stagingOffset);
+
+    PendingBufferCopy copy{};
+    copy.pageIndex = pageIndex;
+    copy.dstBuffer = dstBuffer;
+    copy.region.srcOffset = stagingOffset;
+    copy.region.dstOffset = dstOffset;
+    copy.region.size = size;
+    pendingBufferCopies.push_back(copy);
+    stagedBytes += size;
+    return stagingPages[pageIndex].memory.mapped + stagingOffset;
+}
+
+void UploadBatch::uploadImage(const void *data, vk::DeviceSize size, vk::Image dstImage, uint32_t width,
+                              uint32_t height, const std::vector<vk::DeviceSize> &levelOffsets)
+{
+    memcpy(stageImage(size, dstImage, width, height, levelOffsets), data, static_cast<size_t>(size));
+}
+
+void *UploadBatch::stageImage(vk::DeviceSize size, vk::Image dstImage, uint32_t width, uint32_t height,
+                              const std::vector<vk::DeviceSize> &levelOffsets)
+{
+    vk::DeviceSize stagingOffset;
+    size_t pageIndex = allocateStaging(size, &stagingOffset);
+
+    // One region per mip level, each tightly packed at its offset, shifted by the place of the image in the staging
+    // page. 16 bytes alignment covers both texel and compressed block sizes.
+    PendingImageCopy copy{};
+    copy.pageIndex = pageIndex;
+    copy.dstImage = dstImage;
+    copy.regions.resize(levelOffsets.size());
+    for (uint32_t level = 0; level < copy.regions.size(); ++level)
+    {
+        vk::BufferImageCopy &region = copy.regions[level];
+        region.bufferOffset = stagingOffset + levelOffsets[level];
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = vk::Offset3D{0, 0, 0};
+        region.imageExtent = vk::Extent3D{std::max(width >> level, 1u), std::max(height >> level, 1u), 1};
+    }
+    pendingImageCopies.push_back(std::move(copy));
+    stagedBytes += size;
+    return stagingPages[pageIndex].memory.mapped + stagingOffset;
+}
+
+vk::CommandBuffer UploadBatch::recordCopies()
+{
+    // One command buffer for the whole batch
+    vk::CommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
+
+    // Images first go to the transfer destination layout, all with one barrier command
+    std::vector<vk::ImageMemoryBarrier> imageBarriers(pendingImageCopies.size());
+    for (size_t i = 0; i < pendingImageCopies.size(); ++i)
+    {
+        vk::ImageMemoryBarrier &barrier = imageBarriers[i];
+        barrier.oldLayout = vk::ImageLayout::eUndefined;
+        barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = pendingImageCopies[i].dstImage;
+        barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = static_cast<uint32_t>(pendingImageCopies[i].regions.size());
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = vk::AccessFlagBits::eNone;
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    }
+    if (!imageBarriers.empty())
+    {
+        transferCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                              vk::PipelineStageFlagBits::eTransfer, {}, 0, nullptr, 0, nullptr,
+                                              static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+
+    for (const auto &copy : pendingBufferCopies)
+    {
+        transferCommandBuffer.copyBuffer(stagingPages[copy.pageIndex].buffer, copy.dstBuffer, copy.region);
+    }
+    for (const auto &copy : pendingImageCopies)
+    {
+        transferCommandBuffer.copyBufferToImage(stagingPages[copy.pageIndex].buffer, copy.dstImage,
+                                                vk::ImageLayout::eTransferDstOptimal,
+                                                static_cast<uint32_t>(copy.regions.size()), copy.regions.data());
+    }
+
+    // Then they are made readable by the fragment shader, and the buffers by the vertex input and compute shaders
+    // (skinning) of any later submission on the queue, which makes drawing before the batch is known to be
+    // complete safe
+    for (auto &barrier : imageBarriers)
+    {
+        barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+        barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    }
+    vk::MemoryBarrier bufferBarrier{};
+    bufferBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    bufferBarrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+                                  vk::AccessFlagBits::eShaderRead;
+    transferCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                          vk::PipelineStageFlagBits::eVertexInput |
+                                              vk::PipelineStageFlagBits::eFragmentShader |
+                                              vk::PipelineStageFlagBits::eComputeShader,
+                                          {}, 1, &bufferBarrier, 0, nullptr,
+                                          static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+    pendingBufferCopies.clear();
+    pendingImageCopies.clear();
+    return transferCommandBuffer;
+}
+
+void UploadBatch::submit()
+{
+    if (!pendingBufferCopies.empty() || !pendingImageCopies.empty())
+    {
+        // Single submit and wait for every copy of the batch
+        endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, recordCopies());
+    }
+    recycleStaging();
+}
+
+void UploadBatch::submitAsync()
+{
+    if (pendingBufferCopies.empty() && pendingImageCopies.empty())
+    {
+        recycleStaging();
+        return;
+    }
+    inFlightCommandBuffer = recordCopies();
+    inFlightCommandBuffer.end();
+
+    vk::SubmitInfo submitInfo{};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &inFlightCommandBuffer;
+    inFlightFence = device.createFence(vk::FenceCreateInfo{});
+    transferQueue.submit(1, &submitInfo, inFlightFence);
+}
+
+bool UploadBatch::isComplete()
+{
+    if (!inFlightFence)
+    {
+        return true;
+    }
+    if (device.getFenceStatus(inFlightFence) != vk::Result::eSuccess)
+    {
+        return false;
+    }
+    device.destroyFence(inFlightFence, nullptr);
+    device.freeCommandBuffers(transferCommandPool, 1, &inFlightCommandBuffer);
+    inFlightFence = nullptr;
+    inFlightCommandBuffer = nullptr;
+    recycleStaging();
+    return true;
+}
+
+void UploadBatch::recycleStaging()
+{
+    for (auto &page : stagingPages)
+    {
+        if (page.size == STAGING_PAGE_SIZE)
+        {
+            freePages.push_back(page);
+        }
+        else
+        {
+            destroyPage(page);
+        }
+    }
+    stagingPages.clear();
+    stagedBytes = 0;
+}
+
+void UploadBatch::destroyPage(StagingPage &page)
+{
+    device.destroyBuffer(page.buffer, nullptr);
+    memoryAllocator.free(page.memory);
+}
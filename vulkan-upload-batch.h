@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+
+#include "vulkan-utilities.h"
+
+// Groups many host to device copies into a single command buffer and a single queue submission,
+// instead of one submit + waitIdle per buffer.
+// Data is copied right away into large host visible staging pages, the GPU copies are only
+// recorded and executed on submit(), or on submitAsync() which returns without waiting.
+// Pages stay mapped for the life of the batch and are recycled between submissions, so a batch reused
+// frame after frame (streaming) does not allocate staging memory again.
+class UploadBatch
+{
+  public:
+    // Staging pages are at least this big, bigger uploads get a page of their own
+    static constexpr vk::DeviceSize STAGING_PAGE_SIZE = 8 * 1024 * 1024;
+
+    UploadBatch(DeviceMemoryAllocator &memoryAllocatorP, vk::Queue transferQueueP,
+                vk::CommandPool transferCommandPoolP);
+    ~UploadBatch();
+    UploadBatch(const UploadBatch &) = delete;
+    UploadBatch &operator=(const UploadBatch &) = delete;
+
+    // Stage size bytes of data to be copied into dstBuffer at dstOffset
+    void uploadBuffer(const void *data, vk::DeviceSize size, vk::Buffer dstBuffer, vk::DeviceSize dstOffset = 0);
+    // Same without the source data: returns where to write the size bytes in mapped staging memory (16 bytes
+    // aligned, nullptr for 0 bytes), valid until the next submission. Data converted on the way, e.g. packed
+    // vertices, is written there directly instead of going through a temporary array. Only write to it: staging
+    // may be write-combined memory, very slow to read.
+    void *stageBuffer(vk::DeviceSize size, vk::Buffer dstBuffer, vk::DeviceSize dstOffset = 0);
+    // Stage every mip level of a freshly created image, tightly packed at levelOffsets in data. The image goes
+    // from undefined to transfer destination layout, then to shader read only once copied.
+    void uploadImage(const void *data, vk::DeviceSize size, vk::Image dstImage, uint32_t width, uint32_t height,
+                     const std::vector<vk::DeviceSize> &levelOffsets);
+    void *stageImage(vk::DeviceSize size, vk::Image dstImage, uint32_t width, uint32_t height,
+                     const std::vector<vk::DeviceSize> &levelOffsets);
+
+    // Record every pending copy, submit them at once and wait for completion, then recycle staging memory
+    void submit();
+    // Same, but return right after the submission: staging memory is recycled once isComplete() sees the fence
+    // signaled, or by the destructor which waits for it. The batch can be reused once complete.
+    void submitAsync();
+    bool isComplete();
+
+    vk::DeviceSize getStagedBytes() const
+    {
+        return stagedBytes;
+    }
+
+  private:
+    struct StagingPage
+    {
+        vk::Buffer buffer;
+        MemoryAllocation memory; // Mapped
+        vk::DeviceSize size;
+        vk::DeviceSize used;
+    };
+
+    struct PendingBufferCopy
+    {
+        size_t pageIndex;
+        vk::Buffer dstBuffer;
+        vk::BufferCopy region;
+    };
+
+    struct PendingImageCopy
+    {
+        size_t pageIndex;
+        vk::Image dstImage;
+        std::vector<vk::BufferImageCopy> regions; // One per mip level
+    };
+
+    DeviceMemoryAllocator &memoryAllocator;
+    vk::Device device;
+    vk::Queue transferQueue;
+    vk::CommandPool transferCommandPool;
+
+    std::vector<StagingPage> stagingPages;
+    // Standard size pages of earlier submissions, still mapped and ready to be filled again
+    std::vector<StagingPage> freePages;
+    std::vector<PendingBufferCopy> pendingBufferCopies;
+    std::vector<PendingImageCopy> pendingImageCopies;
+    vk::DeviceSize stagedBytes{0};
+    // Submission in flight, from submitAsync()
+    vk::CommandBuffer inFlightCommandBuffer;
+    vk::Fence inFlightFence;
+
+    // Find room for size bytes in the staging pages, returns the page index and offset in it
+    size_t allocateStaging(vk::DeviceSize size, vk::DeviceSize *offset);
+    vk::CommandBuffer recordCopies();
+    // Staging is no longer read by the GPU: standard pages go back to freePages, bigger ones are freed
+    void recycleStaging();
+    void destroyPage(StagingPage &page);
+};